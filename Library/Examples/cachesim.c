@@ -0,0 +1,180 @@
+/*
+**	@(#) $Id$
+**
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Trace driven simulation of the persistent cache. Reads an access log
+**	and replays it through HTCache in a scratch cache directory: a request
+**	for a URL which is in the cache counts as a hit, any other request
+**	stores the document with the size from the log through the cache
+**	writer so that the cache gc's as it would in a real client. At the
+**	end it reports the hit ratio and the byte hit ratio. With -restart
+**	the cache is closed and opened again every so many requests so that
+**	the entries which only are in the cache index are used as well. The
+**	log can either be in common log format (only 200 responses are used)
+**	or have a URL and a size on each line. The cache directory is flushed
+**	before and after the run.
+**
+**	Usage: cachesim [-size <Mbytes>] [-root <dir>] [-restart <requests>] [logfile]
+*/
+
+#include "WWWLib.h"
+#include "WWWCache.h"
+#include "WWWInit.h"
+
+#define DEFAULT_ROOT	"/tmp/cachesim/"
+#define DEFAULT_HOST	"http://cachesim/"
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+};
+
+PRIVATE long Requests = 0;
+PRIVATE long Hits = 0;
+PRIVATE double Bytes = 0;
+PRIVATE double ByteHits = 0;
+PRIVATE char Data[8192];
+
+/* ----------------------------------------------------------------- */
+
+/*
+**  Store a document of the given size through the cache writer
+*/
+PRIVATE void cache_store (HTParentAnchor * anchor, long size)
+{
+    HTRequest * request = HTRequest_new();
+    HTStream * target;
+    HTRequest_setAnchor(request, (HTAnchor *) anchor);
+    HTRequest_setResponse(request, HTResponse_new());
+    HTRequest_setDate(request, time(NULL));
+    HTAnchor_setDate(anchor, time(NULL));
+    HTAnchor_setLength(anchor, size);
+    target = HTCacheWriter(request, NULL, WWW_SOURCE, WWW_SOURCE, NULL);
+    if (target) {
+	while (size > 0) {
+	    int l = size > (long) sizeof(Data) ? (int) sizeof(Data) : (int) size;
+	    (*target->isa->put_block)(target, Data, l);
+	    size -= l;
+	}
+	(*target->isa->_free)(target);
+    }
+    HTRequest_delete(request);
+}
+
+PRIVATE void cache_access (const char * address, long size)
+{
+    char * url = HTParse(address, DEFAULT_HOST, PARSE_ALL);
+    HTParentAnchor * anchor = HTAnchor_parent(HTAnchor_findAddress(url));
+    HTCache * cache = HTCache_find(anchor, NULL);
+    Requests++;
+    Bytes += size;
+    if (cache) {
+	Hits++;
+	ByteHits += size;
+	HTCache_addHit(cache);
+    } else
+	cache_store(anchor, size);
+    HT_FREE(url);
+}
+
+/*
+**  Find the URL and the size in a log line. Returns NO if the line
+**  should be skipped.
+*/
+PRIVATE BOOL parse_line (char * line, char ** url, long * size)
+{
+    char * request = strchr(line, '"');
+    if (request) {
+	char * method, * status, * bytes;
+	char * ptr = request+1;
+	char * end = strchr(ptr, '"');
+	if (!end) return NO;
+	*end++ = '\0';
+	method = HTNextField(&ptr);
+	*url = HTNextField(&ptr);
+	status = HTNextField(&end);
+	bytes = HTNextField(&end);
+	if (!method || !*url || !status || !bytes) return NO;
+	if (strcmp(method, "GET") || strcmp(status, "200")) return NO;
+	*size = atol(bytes);
+    } else {
+	char * ptr = line;
+	char * bytes;
+	*url = HTNextField(&ptr);
+	bytes = HTNextField(&ptr);
+	if (!*url || !bytes) return NO;
+	*size = atol(bytes);
+    }
+    return YES;
+}
+
+int main (int argc, char ** argv)
+{
+    FILE * fp = stdin;
+    const char * root = DEFAULT_ROOT;
+    int size = 20;
+    long restart = 0;
+    char line[4096];
+    ms_t start;
+    int arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-size") && arg+1 < argc) {
+	    size = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-root") && arg+1 < argc) {
+	    root = argv[++arg];
+	} else if (!strcmp(argv[arg], "-restart") && arg+1 < argc) {
+	    restart = atol(argv[++arg]);
+	} else if (*argv[arg] == '-') {
+	    HTPrint("Usage: %s [-size <Mbytes>] [-root <dir>] [-restart <requests>] [logfile]\n",
+		    argv[0]);
+	    return 1;
+	} else if ((fp = fopen(argv[arg], "r")) == NULL) {
+	    HTPrint("Can't open `%s\'\n", argv[arg]);
+	    return 1;
+	}
+    }
+
+    HTProfile_newNoCacheClient("cachesim", "1.0");
+    HTAlert_deleteAll();
+    memset(Data, 'x', sizeof(Data));
+    if (!HTCacheInit(root, size)) {
+	HTPrint("Can't initialize the cache in `%s\'\n", root);
+	return 1;
+    }
+    HTCache_flushAll();
+
+    start = HTGetTimeInMillis();
+    while (fgets(line, sizeof(line), fp)) {
+	char * url = NULL;
+	long bytes = 0;
+	if (parse_line(line, &url, &bytes)) {
+	    cache_access(url, bytes);
+	    if (restart > 0 && Requests % restart == 0) {
+		HTCacheTerminate();
+		HTCacheInit(root, size);
+	    }
+	}
+    }
+    if (fp != stdin) fclose(fp);
+
+    HTPrint("Cache size %d Mbytes, %ld ms\n", HTCacheMode_maxSize(),
+	    (long) (HTGetTimeInMillis() - start));
+    HTPrint("requests %ld hit ratio %.2f%% byte hit ratio %.2f%%\n",
+	    Requests, Requests ? 100.0 * Hits / Requests : 0.0,
+	    Bytes > 0 ? 100.0 * ByteHits / Bytes : 0.0);
+    HTCache_flushAll();
+    HTCacheTerminate();
+    HTProfile_delete();
+    return 0;
+}
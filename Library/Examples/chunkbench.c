@@ -0,0 +1,118 @@
+/*
+**	@(#) $Id$
+**	
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**	
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Benchmark for chunks. The "mime" test creates a pair of chunks for
+**	each response and collects header names and values in them with
+**	HTChunk_putb and HTChunk_putc like the MIME parser does. The "load"
+**	test appends a document of -size Mbytes in blocks of -block bytes to
+**	a chunk like HTLoadToChunk does, both without and with a size hint from
+**	the Content-Length. The "small" test does the same with a chunk that
+**	was created with a small allocation unit.
+**
+**	Usage: chunkbench [-n <responses>] [-size <Mbytes>] [-block <bytes>]
+*/
+
+#include "WWWLib.h"
+
+#define MEGA	0x100000L
+
+PRIVATE const char * Headers[] = {
+    "HTTP/1.1 200 OK",
+    "Date: Sun, 18 Oct 2026 10:12:31 GMT",
+    "Server: Apache/2.4.62 (Unix)",
+    "Last-Modified: Tue, 06 Oct 2026 08:44:10 GMT",
+    "ETag: \"2b6f-5f1c2a3e4b5d0\"",
+    "Accept-Ranges: bytes",
+    "Content-Length: 11119",
+    "Cache-Control: max-age=3600",
+    "Vary: Accept-Encoding",
+    "Content-Type: text/html; charset=iso-8859-1",
+    NULL
+};
+
+PRIVATE long mime_test (int responses)
+{
+    ms_t start = HTGetTimeInMillis();
+    int cnt;
+    for (cnt=0; cnt<responses; cnt++) {
+	HTChunk * token = HTChunk_new(256);
+	HTChunk * value = HTChunk_new(256);
+	const char ** line;
+	for (line = Headers; *line; line++) {
+	    const char * colon = strchr(*line, ':');
+	    const char * ptr;
+	    if (!colon) continue;
+	    HTChunk_putb(token, *line, colon - *line);
+	    HTChunk_putc(token, '\0');
+	    for (ptr = colon+2; *ptr; ptr++) HTChunk_putc(value, *ptr);
+	    HTChunk_putc(value, '\0');
+	    HTChunk_truncate(token, 0);
+	    HTChunk_truncate(value, 0);
+	}
+	HTChunk_delete(token);
+	HTChunk_delete(value);
+    }
+    return HTGetTimeInMillis() - start;
+}
+
+PRIVATE long load_test (int grow, long size, int block, BOOL hint)
+{
+    ms_t start = HTGetTimeInMillis();
+    HTChunk * chunk = HTChunk_new(grow);
+    char * buf;
+    long done;
+    if ((buf = (char *) HT_MALLOC(block)) == NULL)
+	HT_OUTOFMEM("load_test");
+    memset(buf, 'a', block);
+    if (hint) HTChunk_ensure(chunk, size);
+    for (done = 0; done < size; done += block)
+	HTChunk_putb(chunk, buf, HTMIN(block, size - done));
+    if (HTChunk_size(chunk) != size)
+	HTPrint("Wrong size %d\n", HTChunk_size(chunk));
+    HTChunk_delete(chunk);
+    HT_FREE(buf);
+    return HTGetTimeInMillis() - start;
+}
+
+int main (int argc, char ** argv)
+{
+    int responses = 100000;
+    long size = 16;
+    int block = 8192;
+    int arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    responses = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-size") && arg+1 < argc) {
+	    size = atol(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-block") && arg+1 < argc) {
+	    block = atoi(argv[++arg]);
+	} else {
+	    HTPrint("Usage: %s [-n <responses>] [-size <Mbytes>] [-block <bytes>]\n",
+		    argv[0]);
+	    return 1;
+	}
+    }
+    if (block <= 0) block = 8192;
+
+    HTPrint("mime   %d responses in %ld ms\n", responses, mime_test(responses));
+    HTPrint("load   %ld Mbytes in %ld ms, with hint %ld ms\n", size,
+	    load_test(0x4000, size * MEGA, block, NO),
+	    load_test(0x4000, size * MEGA, block, YES));
+    HTPrint("small  %ld Mbytes in %ld ms\n", size,
+	    load_test(128, size * MEGA, block, NO));
+    return 0;
+}
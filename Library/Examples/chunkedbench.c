@@ -0,0 +1,185 @@
+/*
+**	@(#) $Id$
+**
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Throughput benchmark for the chunked transfer decoder. A body of
+**	-size Mbytes is encoded in memory with chunks of 100 bytes and with
+**	chunks of 64 Kbytes, every chunk header carrying an extension and the
+**	last chunk followed by two trailer fields. The body is then pushed
+**	through the decoder in blocks of -block bytes, the same way the socket
+**	reader does it, a number of times. The target counts the payload and
+**	with -check it also keeps a checksum of it to see that the payload
+**	comes out unchanged.
+**
+**	Usage: chunkedbench [-size <Mbytes>] [-block <bytes>] [-repeat <n>]
+**			    [-check]
+*/
+
+#include "WWWLib.h"
+#include "HTTChunk.h"
+
+#define MEGA	0x100000L
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    long			bytes;
+    unsigned long		checksum;
+};
+
+PRIVATE BOOL Check = NO;
+
+PRIVATE int bench_flush (HTStream * me) { return HT_OK; }
+PRIVATE int bench_free (HTStream * me) { return HT_OK; }
+PRIVATE int bench_abort (HTStream * me, HTList * e) { return HT_ERROR; }
+
+PRIVATE int bench_put_block (HTStream * me, const char * s, int l)
+{
+    me->bytes += l;
+    if (Check) {
+	while (l-- > 0)
+	    me->checksum = me->checksum * 31 + (unsigned char) *s++;
+    }
+    return HT_OK;
+}
+
+PRIVATE int bench_put_character (HTStream * me, char c)
+{
+    return bench_put_block(me, &c, 1);
+}
+
+PRIVATE int bench_put_string (HTStream * me, const char * s)
+{
+    return bench_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass BenchClass = {
+    "ChunkedBench",
+    bench_flush,
+    bench_free,
+    bench_abort,
+    bench_put_character,
+    bench_put_string,
+    bench_put_block
+};
+
+/*
+**	Encode size bytes of payload with chunks of the given size
+*/
+PRIVATE HTChunk * encode (long size, int chunksize, unsigned long * checksum)
+{
+    HTChunk * body = HTChunk_new(0x4000);
+    char * data;
+    char line[64];
+    long done;
+    int i;
+    if ((data = (char *) HT_MALLOC(chunksize)) == NULL)
+	HT_OUTOFMEM("encode");
+    for (i = 0; i < chunksize; i++) data[i] = 'a' + i % 26;
+    HTChunk_ensure(body, size + (size / chunksize + 1) * 32);
+    *checksum = 0;
+    for (done = 0; done < size; done += chunksize) {
+	int l = (int) HTMIN(chunksize, size - done);
+	sprintf(line, "%x;ext=%d\r\n", l, l);
+	HTChunk_puts(body, line);
+	HTChunk_putb(body, data, l);
+	HTChunk_puts(body, "\r\n");
+	if (Check) {
+	    for (i = 0; i < l; i++)
+		*checksum = *checksum * 31 + (unsigned char) data[i];
+	}
+    }
+    HTChunk_puts(body, "0\r\nContent-MD5: none\r\nX-Bench: done\r\n\r\n");
+    HT_FREE(data);
+    return body;
+}
+
+PRIVATE void decode_test (HTRequest * request, long size, int chunksize,
+			  int block, int repeat)
+{
+    unsigned long checksum;
+    HTChunk * body = encode(size, chunksize, &checksum);
+    struct _HTStream target;
+    BOOL ok = YES;
+    clock_t start;
+    double secs;
+    int r;
+    memset(&target, 0, sizeof(target));
+    target.isa = &BenchClass;
+    start = clock();
+    for (r = 0; r < repeat; r++) {
+	HTStream * decoder = HTChunkedDecoder(request, NULL,
+					      WWW_CODING_CHUNKED, &target);
+	const char * data = HTChunk_data(body);
+	int left = HTChunk_size(body);
+	int status = HT_OK;
+	target.bytes = 0;
+	target.checksum = 0;
+	while (left > 0 && status == HT_OK) {
+	    int l = left < block ? left : block;
+	    status = (*decoder->isa->put_block)(decoder, data, l);
+	    data += l;
+	    left -= l;
+	}
+	(*decoder->isa->_free)(decoder);
+	if (status != HT_LOADED || left || target.bytes != size ||
+	    target.checksum != checksum)
+	    ok = NO;
+    }
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    HTPrint("chunks of %5d bytes: %ld Mbytes in %.3f s: %.1f Mbytes/s%s\n",
+	    chunksize, size * repeat / MEGA, secs,
+	    secs > 0 ? (double) size * repeat / MEGA / secs : 0.0,
+	    ok ? "" : " (WRONG OUTPUT)");
+    HTChunk_delete(body);
+}
+
+int main (int argc, char ** argv)
+{
+    HTRequest * request;
+    long size = 16;
+    int block = 32*1024;
+    int repeat = 16;
+    int arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-size") && arg+1 < argc) {
+	    size = atol(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-block") && arg+1 < argc) {
+	    block = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-repeat") && arg+1 < argc) {
+	    repeat = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-check")) {
+	    Check = YES;
+	} else {
+	    HTPrint("Usage: %s [-size <Mbytes>] [-block <bytes>] [-repeat <n>] [-check]\n",
+		    argv[0]);
+	    return 1;
+	}
+    }
+    if (block <= 0) block = 32*1024;
+    if (size <= 0) size = 16;
+    if (repeat <= 0) repeat = 1;
+
+    request = HTRequest_new();
+    HTRequest_setAnchor(request, HTAnchor_findAddress("http://bench.example/"));
+    decode_test(request, size * MEGA, 100, block, repeat);
+    decode_test(request, size * MEGA, 64*1024, block, repeat);
+    {
+	HTAssocList * trailer = HTResponse_trailer(HTRequest_response(request));
+	HTPrint("trailer: %s\n",
+		HTAssocList_findObject(trailer, "x-bench") ? "found" : "not found");
+    }
+    HTRequest_delete(request);
+    return 0;
+}
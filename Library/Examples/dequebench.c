@@ -0,0 +1,94 @@
+/*
+**	@(#) $Id$
+**
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Benchmark for FIFO queues. For each queue size up to -n it fills a
+**	queue with that many objects, asks for the size as many times like
+**	the host and robot queues do before each launch, and then takes the
+**	objects out again from the front. It does this with a deque and with
+**	a list, where objects are either appended at the end and removed from
+**	the front, or added at the front and removed from the end. A list has
+**	to walk to the other end for one of the two and to count the objects.
+**
+**	Usage: dequebench [-n <max objects>]
+*/
+
+#include "WWWLib.h"
+
+PRIVATE long Sum = 0;			  /* So that nothing is optimized away */
+
+PRIVATE void deque_test (int objects)
+{
+    HTDeque * deque = HTDeque_new();
+    ms_t start = HTGetTimeInMillis();
+    ms_t filled, counted;
+    long cnt;
+    for (cnt=1; cnt<=objects; cnt++) HTDeque_append(deque, (void *) cnt);
+    filled = HTGetTimeInMillis();
+    for (cnt=0; cnt<objects; cnt++) Sum += HTDeque_count(deque);
+    counted = HTGetTimeInMillis();
+    while (!HTDeque_isEmpty(deque)) Sum += (long) HTDeque_removeFirst(deque);
+    HTPrint("deque        %7d: fill %5ld ms, count %5ld ms, remove %5ld ms\n",
+	    objects, (long) (filled - start), (long) (counted - filled),
+	    (long) (HTGetTimeInMillis() - counted));
+    HTDeque_delete(deque);
+}
+
+PRIVATE void list_test (int objects, BOOL append)
+{
+    HTList * list = HTList_new();
+    ms_t start = HTGetTimeInMillis();
+    ms_t filled, counted;
+    long cnt;
+    for (cnt=1; cnt<=objects; cnt++) {
+	if (append)
+	    HTList_appendObject(list, (void *) cnt);
+	else
+	    HTList_addObject(list, (void *) cnt);
+    }
+    filled = HTGetTimeInMillis();
+    for (cnt=0; cnt<objects; cnt++) Sum += HTList_count(list);
+    counted = HTGetTimeInMillis();
+    while (!HTList_isEmpty(list))
+	Sum += (long) (append ? HTList_removeLastObject(list) :
+		       HTList_removeFirstObject(list));
+    HTPrint("%s %7d: fill %5ld ms, count %5ld ms, remove %5ld ms\n",
+	    append ? "list append " : "list add    ", objects,
+	    (long) (filled - start), (long) (counted - filled),
+	    (long) (HTGetTimeInMillis() - counted));
+    HTList_delete(list);
+}
+
+int main (int argc, char ** argv)
+{
+    int max = 16000;
+    int objects;
+    int arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    max = atoi(argv[++arg]);
+	} else {
+	    HTPrint("Usage: %s [-n <max objects>]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    for (objects = 1000; objects <= max; objects *= 4) {
+	deque_test(objects);
+	list_test(objects, YES);
+	list_test(objects, NO);
+    }
+    return Sum == 0;
+}
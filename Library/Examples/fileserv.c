@@ -0,0 +1,136 @@
+/*
+**	@(#) $Id$
+**	
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**	
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Serves local files over HTTP for one connection and then reports the
+**	CPU time it used. Files which don't need any conversion are sent
+**	directly from the file to the socket; with -copy they go through the
+**	stream stack instead. The client can be any HTTP client, for example
+**
+**		fileserv -port 8080 &
+**		pipebench -seq -n 100 http://localhost:8080/tmp/file.bin
+**
+**	With -zip text files are compressed with gzip or deflate if the
+**	client asks for it in an Accept-Encoding header.
+**
+**	As the path in the request URI is a local file name, the server
+**	should only be run for testing.
+**
+**	Usage: fileserv [-port <port>] [-copy] [-zip]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTTP.h"
+#include "WWWFile.h"
+#include "HTTPServ.h"
+
+#define DEFAULT_PORT		8080
+
+/*
+**  Generate the response line from the errors on the request
+*/
+PRIVATE BOOL reply_message (HTRequest * request, HTAlertOpcode op,
+			    int msgnum, const char * dfault, void * input,
+			    HTAlertPar * reply)
+{
+    HTList * cur = (HTList *) input;
+    const char * line = "HTTP/1.1 200 OK\r\n";
+    HTError * pres;
+    while ((pres = (HTError *) HTList_nextObject(cur))) {
+	if (HTError_severity(pres) == ERR_INFO) continue;
+	line = (HTError_index(pres) == HTERR_NOT_FOUND) ?
+	    "HTTP/1.1 404 Not Found\r\n" :
+	    "HTTP/1.1 500 Internal Server Error\r\n";
+	break;
+    }
+    HTAlert_setReplyMessage(reply, line);
+    return YES;
+}
+
+PRIVATE int terminate_handler (HTRequest * request, HTResponse * response,
+			       void * param, int status)
+{
+    ms_t * start = (ms_t *) param;
+    HTPrint("Connection closed after %ld ms using %ld ms CPU time\n",
+	    (long) (HTGetTimeInMillis() - *start),
+	    (long) (clock() * 1000.0 / CLOCKS_PER_SEC));
+    HTEventList_stopLoop();
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    HTRequest * request;
+    HTList * converters = HTList_new();
+    HTList * encodings = NULL;
+    int port = DEFAULT_PORT;
+    char url[64];
+    ms_t start;
+    int arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-port") && arg+1 < argc) {
+	    port = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-copy")) {
+	    HTTPServ_setSendFile(NO);
+	} else if (!strcmp(argv[arg], "-zip")) {
+	    encodings = HTList_new();
+	} else {
+	    HTPrint("Usage: %s [-port <port>] [-copy] [-zip]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    HTLibInit("libwww-fileserv", "1.0");
+    HTEventInit();
+    HTAlert_add(reply_message, HT_A_MESSAGE);
+
+    /* We serve http and read local files */
+    HTTransport_add("buffered_tcp", HT_TP_SINGLE, HTReader_new, HTBufferWriter_new);
+    HTTransport_add("local", HT_TP_SINGLE, HTReader_new, HTWriter_new);
+    HTProtocol_add("http", "buffered_tcp", port, NO, HTLoadHTTP, HTServHTTP);
+    HTProtocol_add("file", "local", 0, NO, HTLoadFile, NULL);
+    HTConverterInit(converters);
+    HTFormat_setConversion(converters);
+    HTFileInit();
+
+    /*
+    **  Parse Accept-Encoding and register the coders we compress with. The
+    **  compressed replies are chunked so we need that encoder as well.
+    */
+    if (encodings) {
+	HTList * transfer = HTList_new();
+	HTMIMEInit();
+	HTContentEncoderInit(encodings);
+	HTFormat_setContentCoding(encodings);
+	HTTransferEncoderInit(transfer);
+	HTFormat_setTransferCoding(transfer);
+    }
+
+    request = HTRequest_new();
+    HTRequest_addAfter(request, terminate_handler, NULL, &start, HT_ALL,
+		       HT_FILTER_LAST, NO);
+    sprintf(url, "http://localhost:%d/", port);
+    start = HTGetTimeInMillis();
+    if (HTServeAbsolute(url, request) != YES) {
+	HTPrint("Can't listen on port %d\n", port);
+	return 1;
+    }
+    HTEventList_newLoop();
+
+    HTRequest_delete(request);
+    HTLibTerminate();
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+**	@(#) $Id$
+**	
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**	
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Sends a burst of requests to the same server and reports how long it
+**	took. The requests are GET requests which are pipelined on the same
+**	connection, or with -post they POST a document of the given size from
+**	memory. Normally the requests are flushed at the end of each pass
+**	through the event loop; with -delay they are flushed by a timer after
+**	the given number of milliseconds instead. With -seq each request is
+**	only sent when the previous one is done, so they are neither pipelined
+**	nor spread over several connections. With -arena the responses and
+**	errors are taken from an arena in each request and the arena usage is
+**	printed at the end. With -zip the posted document is compressed on the
+**	fly with the given content coding, for example gzip.
+**
+**	Usage: pipebench [-n <requests>] [-post <bytes>] [-delay <ms>] [-seq]
+**			 [-arena] [-zip <coding>] url
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTTP.h"
+
+PRIVATE int Requests = 100;
+PRIVATE int Sent = 0;
+PRIVATE int Done = 0;
+PRIVATE int Failed = 0;
+PRIVATE double Bytes = 0;
+PRIVATE BOOL Sequential = NO;
+
+PRIVATE char * Url = NULL;
+PRIVATE char * Document = NULL;
+PRIVATE long Post = 0;
+PRIVATE HTEncoding Coding = NULL;
+
+PRIVATE void send_request (void)
+{
+    HTRequest * request = HTRequest_new();
+    HTAnchor * anchor = HTAnchor_findAddress(Url);
+    HTRequest_setOutputFormat(request, WWW_SOURCE);
+    HTRequest_setOutputStream(request, HTBlackHole());
+    Sent++;
+    if (Document) {
+	HTParentAnchor * src = HTTmpAnchor(NULL);
+	HTAnchor_setDocument(src, Document);
+	HTAnchor_setFormat(src, HTAtom_for("application/octet-stream"));
+	HTAnchor_setLength(src, Post);
+	if (Coding) HTRequest_setEntityCoding(request, Coding);
+	HTPostAnchor(src, anchor, request);
+    } else
+	HTLoadAnchor(anchor, request);
+}
+
+PRIVATE int terminate_handler (HTRequest * request, HTResponse * response,
+			       void * param, int status)
+{
+    if (status != HT_LOADED)
+	Failed++;
+    else if (response && HTResponse_length(response) > 0)
+	Bytes += HTResponse_length(response);
+    HTRequest_delete(request);
+    if (++Done >= Requests)
+	HTEventList_stopLoop();
+    else if (Sequential && Sent < Requests)
+	send_request();
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    ms_t start;
+    ms_t msecs;
+    int arg, i;
+
+    HTProfile_newNoCacheClient("libwww-pipebench", "1.0");
+    HTAlert_setInteractive(NO);
+    HTNet_addAfter(terminate_handler, NULL, NULL, HT_ALL, HT_FILTER_LAST);
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    Requests = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-post") && arg+1 < argc) {
+	    Post = atol(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-delay") && arg+1 < argc) {
+	    HTHost_setDefaultWriteBatch(NO);
+	    HTHost_setDefaultWriteDelay(atol(argv[++arg]));
+	} else if (!strcmp(argv[arg], "-seq")) {
+	    Sequential = YES;
+	} else if (!strcmp(argv[arg], "-arena")) {
+	    HTRequest_setDefaultArena(YES);
+	} else if (!strcmp(argv[arg], "-zip") && arg+1 < argc) {
+	    Coding = HTAtom_for(argv[++arg]);
+	} else {
+	    Url = argv[arg];
+	}
+    }
+    if (!Url || Requests <= 0) {
+	HTPrint("Usage: %s [-n <requests>] [-post <bytes>] [-delay <ms>] [-seq] [-arena] [-zip <coding>] url\n",
+		argv[0]);
+	return 1;
+    }
+
+    /*
+    **  The document we post is the same for all requests. Don't wait
+    **  long for a 100 Continue before sending it.
+    */
+    if (Post > 0) {
+	HTTP_setBodyWriteDelay(21, 21);
+	if ((Document = (char *) HT_MALLOC(Post + 1)) == NULL)
+	    HT_OUTOFMEM("main");
+	for (i = 0; i < Post; i++) Document[i] = 'a' + i % 26;
+	Document[Post] = '\0';
+    }
+
+    start = HTGetTimeInMillis();
+    for (i = 0; i < (Sequential ? 1 : Requests); i++) send_request();
+    HTEventList_loop(NULL);
+    msecs = HTGetTimeInMillis() - start;
+
+    HTPrint("%d requests (%d failed) in %ld ms: %.0f requests/s\n",
+	    Requests, Failed, (long) msecs,
+	    msecs ? Requests * 1000.0 / msecs : 0.0);
+    if (Post > 0 && msecs)
+	HTPrint("%.1f Mbytes posted: %.1f Mbytes/s\n", (double) Post * Requests / 0x100000L,
+		(double) Post * Requests / 0x100000L * 1000.0 / msecs);
+    else if (Bytes > 0 && msecs)
+	HTPrint("%.1f Mbytes received: %.1f Mbytes/s\n", Bytes / 0x100000L,
+		Bytes / 0x100000L * 1000.0 / msecs);
+    if (HTRequest_defaultArena()) {
+	HTArenaStats stats;
+	HTArena_stats(NULL, &stats);
+	HTPrint("%lu arenas: %lu objects (%lu bytes) in %lu blocks, largest %lu bytes\n",
+		stats.arenas, stats.objects, stats.used, stats.blocks, stats.peak);
+    }
+    HT_FREE(Document);
+    HTProfile_delete();
+    return 0;
+}
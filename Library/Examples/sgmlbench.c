@@ -0,0 +1,229 @@
+/*
+**	@(#) $Id$
+**	
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**	
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Throughput benchmark for the SGML parser. The files given on the
+**	command line (for example a directory of saved pages) are read into
+**	memory and pushed through the HTML parser a number of times in blocks
+**	of a given size. The target counts elements, links and text. With
+**	-check it also keeps a checksum of everything it gets so that the
+**	output of different versions of the parser can be compared. With
+**	-tags it parses a generated document which is nothing but <n> start
+**	tags with attributes, which shows the cost of looking up names.
+**
+**	Usage: sgmlbench [-block <bytes>] [-repeat <n>] [-check]
+**			 [-tags <n>] file...
+*/
+
+#include "WWWLib.h"
+#include "WWWHTML.h"
+
+#define MEGA	0x100000L
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+};
+
+struct _HTStructured {
+    const HTStructuredClass *	isa;
+    long			elements;
+    long			links;
+    long			text;
+    unsigned long		checksum;
+};
+
+PRIVATE BOOL Check = NO;
+
+PRIVATE void sum (HTStructured * me, const char * s, int l)
+{
+    if (!Check) return;
+    while (l-- > 0) {
+	me->checksum ^= (unsigned char) *s++;
+	me->checksum *= 16777619UL;
+    }
+}
+
+PRIVATE int bench_flush (HTStructured * me) { return HT_OK; }
+PRIVATE int bench_free (HTStructured * me) { return HT_OK; }
+PRIVATE int bench_abort (HTStructured * me, HTList * e) { return HT_ERROR; }
+
+PRIVATE int bench_put_block (HTStructured * me, const char * s, int l)
+{
+    me->text += l;
+    sum(me, s, l);
+    return HT_OK;
+}
+
+PRIVATE int bench_put_character (HTStructured * me, char c)
+{
+    return bench_put_block(me, &c, 1);
+}
+
+PRIVATE int bench_put_string (HTStructured * me, const char * s)
+{
+    return bench_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE void bench_start_element (HTStructured * me, int element,
+				  const BOOL * present, const char ** value)
+{
+    SGML_dtd * dtd = HTML_dtd();
+    HTTag * tag = SGML_findTag(dtd, element);
+    int i;
+    me->elements++;
+    if (element == HTML_A && present[HTML_A_HREF] && value[HTML_A_HREF])
+	me->links++;
+    sum(me, "<", 1);
+    sum(me, tag->name, (int) strlen(tag->name));
+    for (i = 0; i < tag->number_of_attributes; i++) {
+	if (present[i]) {
+	    sum(me, tag->attributes[i].name, (int) strlen(tag->attributes[i].name));
+	    if (value[i]) sum(me, value[i], (int) strlen(value[i]));
+	}
+    }
+}
+
+PRIVATE void bench_end_element (HTStructured * me, int element)
+{
+    sum(me, "</", 2);
+    sum(me, (char *) &element, sizeof(int));
+}
+
+PRIVATE void bench_put_entity (HTStructured * me, int entity)
+{
+    sum(me, "&", 1);
+    sum(me, (char *) &entity, sizeof(int));
+}
+
+PRIVATE int bench_unparsed (HTStructured * me, const char * s, int l)
+{
+    sum(me, "?", 1);
+    sum(me, s, l);
+    return HT_OK;
+}
+
+PRIVATE const HTStructuredClass BenchClass = {
+    "SGMLBench",
+    bench_flush,
+    bench_free,
+    bench_abort,
+    bench_put_character,
+    bench_put_string,
+    bench_put_block,
+    bench_start_element,
+    bench_end_element,
+    bench_put_entity,
+    bench_unparsed,
+    bench_unparsed,
+    bench_unparsed
+};
+
+/*
+**  Generate a document with n start tags, each with an attribute known
+**  to the element and one which isn't. Every other name is in lower case.
+*/
+PRIVATE HTChunk * tag_document (int n)
+{
+    SGML_dtd * dtd = HTML_dtd();
+    HTChunk * chunk = HTChunk_new(0x4000);
+    int i;
+    for (i = 0; i < n; i++) {
+	HTTag * tag = SGML_findTag(dtd, i % dtd->number_of_tags);
+	char name[64];
+	char * p;
+	HTChunk_putc(chunk, '<');
+	strcpy(name, tag->name);
+	if (i & 1) for (p = name; *p; p++) *p = TOLOWER(*p);
+	HTChunk_puts(chunk, name);
+	if (tag->number_of_attributes > 0) {
+	    HTChunk_putc(chunk, ' ');
+	    HTChunk_puts(chunk, tag->attributes[i % tag->number_of_attributes].name);
+	    HTChunk_puts(chunk, "=x");
+	}
+	HTChunk_puts(chunk, " unknown=y>\n");
+    }
+    return chunk;
+}
+
+int main (int argc, char ** argv)
+{
+    HTStructured target;
+    HTChunk ** files;
+    int nfiles = 0;
+    int block = 4096;
+    int repeat = 10;
+    double bytes = 0;
+    clock_t start;
+    double secs;
+    int arg, i, r;
+
+    if ((files = (HTChunk **) HT_CALLOC(argc, sizeof(HTChunk *))) == NULL)
+	HT_OUTOFMEM("main");
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-block") && arg+1 < argc) {
+	    block = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-repeat") && arg+1 < argc) {
+	    repeat = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-check")) {
+	    Check = YES;
+	} else if (!strcmp(argv[arg], "-tags") && arg+1 < argc) {
+	    files[nfiles++] = tag_document(atoi(argv[++arg]));
+	} else {
+	    FILE * fp = fopen(argv[arg], "rb");
+	    if (fp) {
+		HTChunk * chunk = HTChunk_new(0x4000);
+		char buf[0x4000];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		    HTChunk_putb(chunk, buf, (int) n);
+		fclose(fp);
+		files[nfiles++] = chunk;
+	    } else
+		HTPrint("Can't open `%s'\n", argv[arg]);
+	}
+    }
+    if (!nfiles || block <= 0) {
+	HTPrint("Usage: %s [-block <bytes>] [-repeat <n>] [-check] [-tags <n>] file...\n",
+		argv[0]);
+	return 1;
+    }
+
+    memset(&target, 0, sizeof(target));
+    target.isa = &BenchClass;
+    start = clock();
+    for (r = 0; r < repeat; r++) {
+	for (i = 0; i < nfiles; i++) {
+	    HTStream * parser = SGML_new(HTML_dtd(), &target);
+	    const char * data = HTChunk_data(files[i]);
+	    int left = HTChunk_size(files[i]);
+	    bytes += left;
+	    while (left > 0) {
+		int l = left < block ? left : block;
+		(*parser->isa->put_block)(parser, data, l);
+		data += l;
+		left -= l;
+	    }
+	    (*parser->isa->_free)(parser);
+	}
+    }
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    HTPrint("%d files, %.1f Mbytes in %.3f s: %.1f Mbytes/s\n", nfiles,
+	    bytes / MEGA, secs, secs > 0 ? bytes / MEGA / secs : 0.0);
+    HTPrint("%ld elements, %ld links, %ld bytes of text, checksum %08lx\n",
+	    target.elements / repeat, target.links / repeat,
+	    target.text / repeat, target.checksum & 0xFFFFFFFFUL);
+    if (target.elements > 0)
+	HTPrint("%.1f ns per element\n", secs * 1e9 / target.elements);
+    return 0;
+}
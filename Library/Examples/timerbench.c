@@ -0,0 +1,103 @@
+/*
+**	@(#) $Id$
+**
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Benchmark for timers. It creates -n repetitive timers with timeouts
+**	spread over a minute or two like the timeouts of that many open
+**	connections, refreshes all of them -refresh times in a random order
+**	like when data arrives on the connections and finally expires them
+**	all. The "flush" test dispatches -flush deferred timers by hand while
+**	the other timers are active, which is what a buffered writer does
+**	when it flushes before its timer has gone off.
+**
+**	Usage: timerbench [-n <timers>] [-refresh <rounds>] [-flush <count>]
+*/
+
+#include "WWWLib.h"
+
+PRIVATE long Expired = 0;
+PRIVATE unsigned long Seed = 1;
+
+PRIVATE int next_random (int max)
+{
+    Seed = Seed * 1103515245UL + 12345UL;
+    return (int) ((Seed >> 8) % (unsigned long) max);
+}
+
+PRIVATE int timeout_cbf (HTTimer * timer, void * param, HTEventType type)
+{
+    Expired++;
+    HTTimer_delete(timer);
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    int timers = 100000;
+    int rounds = 10;
+    int flushes = 100000;
+    HTTimer ** list;
+    ms_t start;
+    int arg;
+    int cnt;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    timers = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-refresh") && arg+1 < argc) {
+	    rounds = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-flush") && arg+1 < argc) {
+	    flushes = atoi(argv[++arg]);
+	} else {
+	    HTPrint("Usage: %s [-n <timers>] [-refresh <rounds>] [-flush <count>]\n",
+		    argv[0]);
+	    return 1;
+	}
+    }
+    if (timers <= 0) timers = 100000;
+    if ((list = (HTTimer **) HT_CALLOC(timers, sizeof(HTTimer *))) == NULL)
+	HT_OUTOFMEM("timerbench");
+
+    start = HTGetTimeInMillis();
+    for (cnt=0; cnt<timers; cnt++)
+	list[cnt] = HTTimer_new(NULL, timeout_cbf, NULL,
+				60000 + next_random(60000), YES, YES);
+    HTPrint("create  %d timers in %ld ms\n", timers,
+	    (long) (HTGetTimeInMillis() - start));
+
+    start = HTGetTimeInMillis();
+    for (arg=0; arg<rounds; arg++) {
+	for (cnt=0; cnt<timers; cnt++)
+	    HTTimer_refresh(list[next_random(timers)], 0);
+    }
+    HTPrint("refresh %ld times in %ld ms\n", (long) rounds * timers,
+	    (long) (HTGetTimeInMillis() - start));
+
+    start = HTGetTimeInMillis();
+    for (cnt=0; cnt<flushes; cnt++) {
+	HTTimer * timer = HTTimer_defer(timeout_cbf, NULL);
+	if (HTTimer_hasTimerExpired(timer)) HTTimer_dispatch(timer);
+    }
+    HTPrint("flush   %d times in %ld ms\n", flushes,
+	    (long) (HTGetTimeInMillis() - start));
+
+    Expired = 0;
+    start = HTGetTimeInMillis();
+    HTTimer_expireAll();
+    HTPrint("expire  %ld timers in %ld ms\n", Expired,
+	    (long) (HTGetTimeInMillis() - start));
+
+    HT_FREE(list);
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+**	@(#) $Id$
+**
+**	More libwww samples can be found at "http://www.w3.org/Library/Examples/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Benchmark for the deflate encoder. The files given on the command
+**	line (or a generated HTML document if there are none) are pushed
+**	through the gzip encoder in blocks of -block bytes at each compression
+**	level from 1 to 9. For every level it reports the CPU time, the
+**	throughput and the bytes saved. The output is inflated again to check
+**	that it comes back unchanged.
+**
+**	Usage: zipbench [-block <bytes>] [-repeat <n>] [-deflate] file...
+*/
+
+#include "WWWLib.h"
+#include "WWWZip.h"
+
+#define MEGA	0x100000L
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    long			bytes;
+    HTChunk *			data;		     /* Output if we keep it */
+};
+
+PRIVATE int bench_flush (HTStream * me) { return HT_OK; }
+PRIVATE int bench_free (HTStream * me) { return HT_OK; }
+PRIVATE int bench_abort (HTStream * me, HTList * e) { return HT_ERROR; }
+
+PRIVATE int bench_put_block (HTStream * me, const char * s, int l)
+{
+    me->bytes += l;
+    if (me->data) HTChunk_putb(me->data, s, l);
+    return HT_OK;
+}
+
+PRIVATE int bench_put_character (HTStream * me, char c)
+{
+    return bench_put_block(me, &c, 1);
+}
+
+PRIVATE int bench_put_string (HTStream * me, const char * s)
+{
+    return bench_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass BenchClass = {
+    "ZipBench",
+    bench_flush,
+    bench_free,
+    bench_abort,
+    bench_put_character,
+    bench_put_string,
+    bench_put_block
+};
+
+#ifdef HT_ZLIB
+
+/*
+**	A document that looks a bit like a real page
+*/
+PRIVATE HTChunk * html_document (void)
+{
+    HTChunk * chunk = HTChunk_new(0x4000);
+    char line[256];
+    int i;
+    HTChunk_puts(chunk, "<html><head><title>Generated page</title></head><body>\n");
+    for (i = 0; i < 20000; i++) {
+	sprintf(line, "<p class=\"item\">Item %d of the list with <a href=\"/doc/%d/page%d.html\">a link</a> and some %s text.</p>\n",
+		i, i * 7919 % 1000, i % 37, (i % 3) ? "plain" : "<em>emphasized</em>");
+	HTChunk_puts(chunk, line);
+    }
+    HTChunk_puts(chunk, "</body></html>\n");
+    return chunk;
+}
+
+PRIVATE void push (HTStream * stream, HTChunk * data, int block)
+{
+    const char * ptr = HTChunk_data(data);
+    int left = HTChunk_size(data);
+    while (left > 0) {
+	int l = left < block ? left : block;
+	(*stream->isa->put_block)(stream, ptr, l);
+	ptr += l;
+	left -= l;
+    }
+    (*stream->isa->put_block)(stream, "", 0);
+    (*stream->isa->_free)(stream);
+}
+
+int main (int argc, char ** argv)
+{
+    HTRequest * request;
+    HTEncoding coding = WWW_CODING_GZIP;
+    HTList * files = HTList_new();
+    HTChunk * data = HTChunk_new(0x4000);
+    int block = 8192;
+    int repeat = 4;
+    int level, arg;
+
+    for (arg=1; arg<argc; arg++) {
+	if (!strcmp(argv[arg], "-block") && arg+1 < argc) {
+	    block = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-repeat") && arg+1 < argc) {
+	    repeat = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-deflate")) {
+	    coding = WWW_CODING_DEFLATE;
+	} else if (*argv[arg] == '-') {
+	    HTPrint("Usage: %s [-block <bytes>] [-repeat <n>] [-deflate] file...\n",
+		    argv[0]);
+	    return 1;
+	} else {
+	    FILE * fp = fopen(argv[arg], "rb");
+	    if (fp) {
+		char buf[0x4000];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		    HTChunk_putb(data, buf, (int) n);
+		fclose(fp);
+		HTList_addObject(files, argv[arg]);
+	    } else
+		HTPrint("Can't open `%s'\n", argv[arg]);
+	}
+    }
+    if (block <= 0) block = 8192;
+    if (repeat <= 0) repeat = 1;
+    if (HTList_isEmpty(files)) {
+	HTChunk_delete(data);
+	data = html_document();
+    }
+    HTList_delete(files);
+
+    request = HTRequest_new();
+    HTPrint("%d bytes of input encoded with %s\n", HTChunk_size(data),
+	    HTAtom_name(coding));
+    HTPrint("level      bytes  saved      ms   Mbytes/s\n");
+    for (level = 1; level <= 9; level++) {
+	struct _HTStream target;
+	struct _HTStream check;
+	clock_t start;
+	double secs;
+	int r;
+	memset(&target, 0, sizeof(target));
+	target.isa = &BenchClass;
+	HTZLib_setCompressionLevel(level);
+	start = clock();
+	for (r = 0; r < repeat; r++) {
+	    target.bytes = 0;
+	    push(HTZLib_deflate(request, NULL, coding, &target), data, block);
+	}
+	secs = (double) (clock() - start) / CLOCKS_PER_SEC / repeat;
+
+	/* Inflate the output again to see that it is right */
+	memset(&check, 0, sizeof(check));
+	check.isa = &BenchClass;
+	check.data = HTChunk_new(0x4000);
+	target.data = HTChunk_new(0x4000);
+	target.bytes = 0;
+	push(HTZLib_deflate(request, NULL, coding, &target), data, block);
+	push(HTZLib_inflate(request, NULL, coding, &check), target.data, block);
+
+	HTPrint("%5d %10ld %5.1f%% %7.1f %10.1f%s\n", level, target.bytes,
+		100.0 - 100.0 * target.bytes / HTChunk_size(data),
+		secs * 1000.0,
+		secs > 0 ? HTChunk_size(data) / (double) MEGA / secs : 0.0,
+		(HTChunk_size(check.data) == HTChunk_size(data) &&
+		 !memcmp(HTChunk_data(check.data), HTChunk_data(data),
+			 HTChunk_size(data))) ? "" : " (WRONG OUTPUT)");
+	HTChunk_delete(check.data);
+	HTChunk_delete(target.data);
+    }
+    HTRequest_delete(request);
+    HTChunk_delete(data);
+    return 0;
+}
+
+#else
+
+int main (int argc, char ** argv)
+{
+    HTPrint("%s: libwww was built without zlib\n", argv[0]);
+    return 1;
+}
+
+#endif /* HT_ZLIB */
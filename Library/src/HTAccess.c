@@ -591,6 +591,12 @@ PRIVATE int HTEntity_callback (HTRequest * request, HTStream * target)
 	    return HT_ERROR;
 	}
 
+	/*
+	** If the entity is encoded on the fly then it is sent using the
+	** chunked transfer coding and we must end it when we are done
+	*/
+	if (HTRequest_entityCoding(request)) chunking = YES;
+
 	/*
 	** If the length is unknown (-1) then see if the document is a text
 	** type and in that case take the strlen. If not then we don't know
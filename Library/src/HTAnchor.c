@@ -25,10 +25,36 @@
 #include "HTWWWStr.h"
 #include "HTAncMan.h"					 /* Implemented here */
 
-#define PARENT_HASH_SIZE	HT_XL_HASH_SIZE
 #define CHILD_HASH_SIZE		HT_L_HASH_SIZE
 
-PRIVATE HTList **adult_table=0;  /* Point to table of lists of all parents */
+/*
+**  The parent anchors are kept in an open addressed hash table with linear
+**  probing. When it gets too full, a new table is allocated and the
+**  anchors are moved over a few slots at a time on each lookup, so no
+**  single lookup pays for rehashing the whole table. Until then we look in
+**  both tables.
+*/
+typedef struct _HTAnchorSlot {
+    unsigned int	hash;
+    HTParentAnchor *	anchor;			 /* NULL if free, or DELETED */
+} HTAnchorSlot;
+
+typedef struct _HTAnchorTable {
+    HTAnchorSlot *	slots;
+    unsigned int	size;			      /* Always a power of 2 */
+    unsigned int	used;		  /* Slots which are not free */
+    unsigned int	count;					 /* Anchors */
+} HTAnchorTable;
+
+#define PARENT_TABLE_SIZE	1024			     /* Initial size */
+#define PARENT_MOVE_STEP	16	   /* Slots moved on each lookup */
+
+PRIVATE HTAnchorTable	Adults;		     /* Where new anchors are added */
+PRIVATE HTAnchorTable	OldAdults;		 /* Being moved to Adults */
+PRIVATE unsigned int	OldPos;		  /* Next slot to move in OldAdults */
+
+PRIVATE char		deleted;
+#define DELETED		((HTParentAnchor *) &deleted)
 
 /* ------------------------------------------------------------------------- */
 /*				Creation Methods			     */
@@ -127,6 +153,150 @@ PUBLIC HTChildAnchor * HTAnchor_findChild (HTParentAnchor *	parent,
 }
 
 
+/* ------------------------------------------------------------------------- */
+/*				Parent Anchor Table			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	FNV-1a with a final mix so that the low bits are good enough
+**	for indexing a table with a power of two size
+*/
+PRIVATE unsigned int anchor_hash (const char * address)
+{
+    unsigned int hash = 2166136261U;
+    while (*address) {
+	hash ^= *(unsigned char *) address++;
+	hash *= 16777619U;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+PRIVATE HTAnchorSlot * table_find (HTAnchorTable * table,
+				   const char * address, unsigned int hash)
+{
+    if (table->slots) {
+	unsigned int mask = table->size - 1;
+	unsigned int pos = hash & mask;
+	HTAnchorSlot * slot;
+	while ((slot = table->slots + pos)->anchor) {
+	    if (slot->hash == hash && slot->anchor != DELETED &&
+		!strcmp(slot->anchor->address, address))
+		return slot;
+	    pos = (pos + 1) & mask;
+	}
+    }
+    return NULL;
+}
+
+/*
+**	Add an anchor which we know isn't in the table already. The
+**	table must have at least one free slot.
+*/
+PRIVATE void table_add (HTAnchorTable * table, HTParentAnchor * anchor)
+{
+    unsigned int mask = table->size - 1;
+    unsigned int pos = anchor->hash & mask;
+    HTAnchorSlot * slot;
+    while ((slot = table->slots + pos)->anchor && slot->anchor != DELETED)
+	pos = (pos + 1) & mask;
+    if (!slot->anchor) table->used++;
+    slot->hash = anchor->hash;
+    slot->anchor = anchor;
+    table->count++;
+}
+
+/*
+**	Move some anchors from the old table to the new one. Moved slots
+**	are marked as deleted so that we can still search the old table.
+*/
+PRIVATE void move_anchors (unsigned int max)
+{
+    while (OldAdults.slots && max-- > 0) {
+	HTAnchorSlot * slot = OldAdults.slots + OldPos;
+	if (slot->anchor && slot->anchor != DELETED) {
+	    table_add(&Adults, slot->anchor);
+	    slot->anchor = DELETED;
+	    OldAdults.count--;
+	}
+	if (++OldPos >= OldAdults.size) {
+	    HTTRACE(ANCH_TRACE, "Anchor Table Done moving %u slots\n" _ OldAdults.size);
+	    HT_FREE(OldAdults.slots);
+	    memset(&OldAdults, 0, sizeof(HTAnchorTable));
+	    OldPos = 0;
+	}
+    }
+}
+
+/*
+**	Start a new table when the current one is 3/4 full, counting the
+**	anchors which are still to be moved. Deleted slots count as full as
+**	they make the probe sequences longer, but if that is why we are full
+**	then the new table has the same size.
+*/
+PRIVATE void table_grow (void)
+{
+    unsigned int size = PARENT_TABLE_SIZE;
+    if (Adults.slots &&
+	(Adults.used + OldAdults.count + 1) * 4 <= Adults.size * 3) return;
+    move_anchors(OldAdults.size);		      /* Finish the last one */
+    if (Adults.slots && (Adults.used + 1) * 4 <= Adults.size * 3) return;
+    if (Adults.slots) {
+	size = Adults.size;
+	if (Adults.count * 2 >= Adults.size) size *= 2;
+	OldAdults = Adults;
+	OldPos = 0;
+    }
+    HTTRACE(ANCH_TRACE, "Anchor Table New table with %u slots for %u anchors\n" _ size _ Adults.count);
+    if ((Adults.slots = (HTAnchorSlot *)
+	 HT_CALLOC(size, sizeof(HTAnchorSlot))) == NULL)
+	HT_OUTOFMEM("table_grow");
+    Adults.size = size;
+    Adults.used = 0;
+    Adults.count = 0;
+}
+
+PRIVATE HTParentAnchor * find_parent (const char * address, unsigned int hash)
+{
+    HTAnchorSlot * slot;
+    move_anchors(PARENT_MOVE_STEP);
+    if ((slot = table_find(&Adults, address, hash)) ||
+	(slot = table_find(&OldAdults, address, hash)))
+	return slot->anchor;
+    return NULL;
+}
+
+PRIVATE void remove_parent (HTParentAnchor * me)
+{
+    HTAnchorSlot * slot;
+    if ((slot = table_find(&Adults, me->address, me->hash)) != NULL)
+	Adults.count--;
+    else if ((slot = table_find(&OldAdults, me->address, me->hash)) != NULL)
+	OldAdults.count--;
+    if (slot) slot->anchor = DELETED;
+}
+
+/*
+**	Call a function for all parent anchors. The function must not add
+**	or remove anchors.
+*/
+PRIVATE void walk_parents (void (*func) (HTParentAnchor *, void *), void * param)
+{
+    HTAnchorTable * tables[2];
+    int cnt;
+    tables[0] = &OldAdults;
+    tables[1] = &Adults;
+    for (cnt=0; cnt<2; cnt++) {
+	unsigned int pos;
+	for (pos=0; tables[cnt]->slots && pos<tables[cnt]->size; pos++) {
+	    HTParentAnchor * pres = tables[cnt]->slots[pos].anchor;
+	    if (pres && pres != DELETED) (*func)(pres, param);
+	}
+    }
+}
+
 /*	Create new or find old named anchor
 **	-----------------------------------
 **
@@ -137,57 +307,55 @@ PUBLIC HTChildAnchor * HTAnchor_findChild (HTParentAnchor *	parent,
 */
 PUBLIC HTAnchor * HTAnchor_findAddress (const char * address)
 {
-    char *tag = HTParse (address, "", PARSE_VIEW);	        /* Any tags? */
-    
+    HTParentAnchor * foundAnchor;
+    char * newaddr = NULL;
+    unsigned int hash;
+
     /* If the address represents a sub-anchor, we recursively load its parent,
        then we create a child anchor within that document. */
-    if (*tag) {
-	char *addr = HTParse(address, "", PARSE_ACCESS | PARSE_HOST |
-			     PARSE_PATH | PARSE_PUNCTUATION);
-	HTParentAnchor * parent = (HTParentAnchor*) HTAnchor_findAddress(addr);
-	HTChildAnchor * child = HTAnchor_findChild(parent, tag);
-	HT_FREE(addr);
+    if (strchr(address, '#')) {
+	char *tag = HTParse (address, "", PARSE_VIEW);	        /* Any tags? */
+	if (*tag) {
+	    char *addr = HTParse(address, "", PARSE_ACCESS | PARSE_HOST |
+				 PARSE_PATH | PARSE_PUNCTUATION);
+	    HTParentAnchor * parent = (HTParentAnchor*) HTAnchor_findAddress(addr);
+	    HTChildAnchor * child = HTAnchor_findChild(parent, tag);
+	    HT_FREE(addr);
+	    HT_FREE(tag);
+	    return (HTAnchor *) child;
+	}
 	HT_FREE(tag);
-	return (HTAnchor *) child;
-    } else {		       	     /* Else check whether we have this node */
-	int hash;
-	const char *p;
-	HTList * adults;
-	HTList *grownups;
-	HTParentAnchor * foundAnchor;
-	char *newaddr = NULL;
+    }
+
+    /*
+    **  Else check whether we have this node. The addresses in the table
+    **  are simplified so if we find the address as it is then we don't
+    **  have to simplify it first.
+    */
+    hash = anchor_hash(address);
+    if ((foundAnchor = find_parent(address, hash)) == NULL) {
 	StrAllocCopy(newaddr, address);		         /* Get our own copy */
-	HT_FREE(tag);
 	newaddr = HTSimplify(&newaddr);
-
-	/* Select list from hash table */
-	for(p=newaddr, hash=0; *p; p++)
-	    hash = (int) ((hash * 3 + (*(unsigned char*)p)) % PARENT_HASH_SIZE);
-	if (!adult_table) {
-	    if ((adult_table = (HTList* *) HT_CALLOC(PARENT_HASH_SIZE, sizeof(HTList*))) == NULL)
-	        HT_OUTOFMEM("HTAnchor_findAddress");
-	}
-	if (!adult_table[hash]) adult_table[hash] = HTList_new();
-	adults = adult_table[hash];
-
-	/* Search list for anchor */
-	grownups = adults;
-	while ((foundAnchor = (HTParentAnchor *) HTList_nextObject(grownups))){
-	    if (!strcmp(foundAnchor->address, newaddr)) {
-		HTTRACE(ANCH_TRACE, "Find Parent. %p with address `%s' already exists.\n" _ 
-			    (void*) foundAnchor _ newaddr);
-		HT_FREE(newaddr);		       /* We already have it */
-		return (HTAnchor *) foundAnchor;
-	    }
+	if (strcmp(newaddr, address)) {
+	    hash = anchor_hash(newaddr);
+	    foundAnchor = find_parent(newaddr, hash);
 	}
-	
-	/* Node not found : create new anchor. */
-	foundAnchor = HTParentAnchor_new();
-	foundAnchor->address = newaddr;			/* Remember our copy */
-	HTList_addObject (adults, foundAnchor);
-	HTTRACE(ANCH_TRACE, "Find Parent. %p with hash %d and address `%s' created\n" _ (void*)foundAnchor _ hash _ newaddr);
+    }
+    if (foundAnchor) {
+	HTTRACE(ANCH_TRACE, "Find Parent. %p with address `%s' already exists.\n" _ 
+		    (void*) foundAnchor _ foundAnchor->address);
+	HT_FREE(newaddr);			       /* We already have it */
 	return (HTAnchor *) foundAnchor;
     }
+
+    /* Node not found : create new anchor. */
+    foundAnchor = HTParentAnchor_new();
+    foundAnchor->address = newaddr;			/* Remember our copy */
+    foundAnchor->hash = hash;
+    table_grow();
+    table_add(&Adults, foundAnchor);
+    HTTRACE(ANCH_TRACE, "Find Parent. %p with hash %08x and address `%s' created\n" _ (void*)foundAnchor _ hash _ newaddr);
+    return (HTAnchor *) foundAnchor;
 }
 
 /*	Create or find a child anchor with a possible link
@@ -298,7 +466,8 @@ PUBLIC HTLink * HTAnchor_findLinkType (HTAnchor * me, HTLinkType type)
 **	The anchor is only deleted if the corresponding document is not loaded.
 **	All outgoing links from parent and children are deleted, and this
 **	anchor is removed from the sources list of all its targets.
-**	We also try to delete the targets whose documents are not loaded.
+**	We also delete the targets that nothing else refers to and whose
+**	documents are not loaded.
 **	If this anchor's source list is empty, we delete it and its children.
 */
 
@@ -387,23 +556,22 @@ PRIVATE void * delete_family (HTAnchor * me)
 **	If NULL then no hyperdocs are returned
 **	Return YES if OK, else NO
 */
+PRIVATE void delete_one (HTParentAnchor * pres, void * documents)
+{
+    void * doc = delete_family((HTAnchor *) pres);
+    if (doc && documents) HTList_addObject((HTList *) documents, doc);
+}
+
 PUBLIC BOOL HTAnchor_deleteAll (HTList * documents)
 {
-    int cnt;
-    HTList *cur;
-    if (!adult_table)
+    if (!Adults.slots)
 	return NO;
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor *pres;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur)) != NULL){
-		void * doc = delete_family((HTAnchor *) pres);
-		if (doc && documents) HTList_addObject(documents, doc);
-	    }
-	}
-	HTList_delete(adult_table[cnt]);
-    }
-    HT_FREE(adult_table);
+    walk_parents(delete_one, documents);
+    HT_FREE(OldAdults.slots);
+    HT_FREE(Adults.slots);
+    memset(&OldAdults, 0, sizeof(HTAnchorTable));
+    memset(&Adults, 0, sizeof(HTAnchorTable));
+    OldPos = 0;
     return YES;
 }
 
@@ -413,52 +581,97 @@ PUBLIC BOOL HTAnchor_deleteAll (HTList * documents)
 **	than deleting the complete anchor structure as this represents the
 **	complete Web the application has been in touch with
 */
+PRIVATE void clear_one (HTParentAnchor * pres, void * documents)
+{
+    /* Then remove entity header information */
+    HTAnchor_clearHeader(pres);
+
+    /* Delete the physical address */
+    HT_FREE(pres->physical);
+
+    /* Register if we have a document on this anchor */
+    if (documents && pres->document)
+	HTList_addObject((HTList *) documents, pres->document);
+}
+
 PUBLIC BOOL HTAnchor_clearAll (HTList * documents)
 {
-    int cnt;
-    HTList * cur;
-    if (!adult_table) return NO;
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor * pres;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur))) {
-
-		/* Then remove entity header information */
-		HTAnchor_clearHeader(pres);
-
-		/* Delete the physical address */
-		HT_FREE(pres->physical);
-
-		/* Register if we have a document on this anchor */
-		if (documents && pres->document)
-		    HTList_addObject(documents, pres->document);
-	    }
-	}
-    }
+    if (!Adults.slots) return NO;
+    walk_parents(clear_one, documents);
     return YES;
 }
 
+/*
+**	An anchor that nothing refers to and that has no links or children of
+**	its own can go. These are typically documents that we have seen a link
+**	to but never loaded.
+*/
+PRIVATE BOOL is_orphan (HTParentAnchor * me)
+{
+    return (!me->document && HTList_isEmpty(me->sources) && !me->children &&
+	    !me->mainLink.dest && HTList_isEmpty(me->links));
+}
+
+PRIVATE void delete_orphan (HTParentAnchor * me)
+{
+    if (is_orphan(me)) {
+	HTTRACE(ANCH_TRACE, "AnchorDelete Orphan %p\n" _ me);
+	remove_parent(me);
+	delete_parent(me);
+    }
+}
+
+/*
+**	Delete the outgoing links from a parent or child anchor and remove it
+**	from the sources list of the targets. Targets that become orphans are
+**	deleted as well but we don't go any further than that so we never
+**	come back to an anchor that is being deleted.
+*/
 PRIVATE void delete_links (HTAnchor * me)
 {
-  if (! me)
-    return;
-
-  /* Recursively try to delete target anchors */
-  if (me->mainLink.dest) {
-    HTParentAnchor *parent = me->mainLink.dest->parent;
-    HTList_removeObject (parent->sources, me);
-    if (! parent->document)  /* Test here to avoid calling overhead */
-      HTAnchor_delete (parent);
-  }
-  if (me->links) {  /* Extra destinations */
-    HTLink *target;
-    while ((target = (HTLink *) HTList_removeLastObject (me->links))) {
-      HTParentAnchor *parent = target->dest->parent;
-      HTList_removeObject (parent->sources, me);
-      if (! parent->document)  /* Test here to avoid calling overhead */
-	HTAnchor_delete (parent);
+    HTParentAnchor * parent;
+    if (!me) return;
+    if (me->mainLink.dest) {
+	parent = me->mainLink.dest->parent;
+	me->mainLink.dest = NULL;
+	HTList_removeObject(parent->sources, me);
+	if (parent != me->parent) delete_orphan(parent);
+    }
+    if (me->links) {
+	HTLink * target;
+	while ((target = (HTLink *) HTList_removeLastObject(me->links))) {
+	    parent = target->dest->parent;
+	    HTLink_delete(target);
+	    HTList_removeObject(parent->sources, me);
+	    if (parent != me->parent) delete_orphan(parent);
+	}
+    }
+}
+
+/*
+**	Delete the links from other anchors to this anchor or its children
+*/
+PRIVATE void delete_sources (HTParentAnchor * me)
+{
+    HTAnchor * source;
+    while ((source = (HTAnchor *) HTList_removeLastObject(me->sources))) {
+	if (source->mainLink.dest && source->mainLink.dest->parent == me) {
+	    source->mainLink.dest = NULL;
+	    source->mainLink.type = NULL;
+	    source->mainLink.method = METHOD_INVALID;
+	    source->mainLink.result = HT_LINK_INVALID;
+	} else if (source->links) {
+	    HTList * cur = source->links;
+	    HTLink * pres;
+	    while ((pres = (HTLink *) HTList_nextObject(cur))) {
+		if (pres->dest->parent == me) {
+		    HTList_removeObject(source->links, pres);
+		    HTLink_delete(pres);
+		    break;
+		}
+	    }
+	}
     }
-  }
 }
 
 PUBLIC BOOL HTAnchor_delete (HTParentAnchor * me)
@@ -469,98 +682,43 @@ PUBLIC BOOL HTAnchor_delete (HTParentAnchor * me)
 	return NO;
     }
 
-    /* Recursively try to delete target anchors */
-    delete_links ((HTAnchor *) me);
-
-    if (!HTList_isEmpty(me->sources)) {    /* There are still incoming links */
-
-	/*
-	** Delete all outgoing links from children, if any
-	*/
-	if (me->children) {
-	    int cnt = 0;
-	    for (; cnt<CHILD_HASH_SIZE; cnt++) {
-		HTList * kids = me->children[cnt];
-		if (kids) {
-		    HTChildAnchor * child;
-		    while ((child = (HTChildAnchor *) HTList_nextObject(kids)))
-			delete_links((HTAnchor *) child);
-		    return NO;	/* Parent not deleted */
-		}
-	    }
-	}
-
-	/*
-	** No more incoming links : kill everything
-	** First, recursively delete children
-	*/
-	if (me->children) {
-	    int cnt = 0;
-	    for (; cnt<CHILD_HASH_SIZE; cnt++) {
-		HTList * kids = me->children[cnt];
-		if (kids) {
-		    HTChildAnchor * child;
-		    while ((child=(HTChildAnchor *) HTList_removeLastObject(kids)))
-			delete_links((HTAnchor *) child);
-		    HT_FREE(child->tag);
-		    HT_FREE(child);
-		}
-	    }
+    /* Delete all outgoing links from the parent and the children */
+    delete_links((HTAnchor *) me);
+    if (me->children) {
+	int cnt = 0;
+	for (; cnt<CHILD_HASH_SIZE; cnt++) {
+	    HTList * cur = me->children[cnt];
+	    HTChildAnchor * child;
+	    while ((child = (HTChildAnchor *) HTList_nextObject(cur)))
+		delete_links((HTAnchor *) child);
 	}
     }
 
+    /* There are still incoming links so we keep the anchor itself */
+    if (!HTList_isEmpty(me->sources)) return NO;
+
     /* 2001/03/06: Bug fix by Serge Adda <sAdda@infovista.com>
        HTAnchor_delete wasn't removing the reference to the deleted
        anchor. This caused a bug whenever requesting another anchor
        for the same URL.
     */
-    if (adult_table) {
-      int hash;
-      const char *p;
-      HTList * adults;
-      HTList * grownups;
-      HTList * last;
-      HTParentAnchor * foundAnchor;
-
-      /* Select list from hash table */
-      for(p=me->address, hash=0; *p; p++)
-	hash = (int) ((hash * 3 + (*(unsigned char*)p)) %
-		      PARENT_HASH_SIZE);
-      adults = adult_table[hash];
-
-      /* Search list for anchor */
-      grownups = adults;
-      last = grownups;
-      while ((foundAnchor = (HTParentAnchor *)
-	      HTList_nextObject(grownups))){
-	if (!strcmp(foundAnchor->address, me->address)) {
-	  HTList_quickRemoveElement (grownups, last);
-	  break;
-	}
-	last = grownups;
-      }
-    }
+    remove_parent(me);
 
-    /* Now kill myself */
-    delete_parent(me);
+    /* Now kill myself and my children */
+    delete_family((HTAnchor *) me);
     return YES;  /* Parent deleted */
-#if 0
-  if (! HTList_isEmpty (me->sources)) {  /* There are still incoming links */
-    /* Delete all outgoing links from children, if any */
-    HTList *kids = me->children;
-    while ((child = (HTChildAnchor *) HTList_nextObject (kids)))
-      delete_links ((HTAnchor *) child);
-    return NO;  /* Parent not deleted */
-  }
-
-  /* No more incoming links : kill everything */
-  /* First, recursively delete children */
-  while ((child = (HTChildAnchor *) HTList_removeLastObject (me->children))) {
-    delete_links ((HTAnchor *) child);
-    HT_FREE(child->tag);
-    HT_FREE(child);
-  }
-#endif
+}
+
+/*	Release an anchor
+**	-----------------
+**	Like HTAnchor_delete but any links pointing to the anchor or its
+**	children are removed first so that the anchor always goes.
+*/
+PUBLIC BOOL HTAnchor_release (HTParentAnchor * me)
+{
+    if (!me || me->document) return NO;
+    delete_sources(me);
+    return HTAnchor_delete(me);
 }
 
 /*	FLATTEN ALL ANCHORS
@@ -575,30 +733,24 @@ PUBLIC BOOL HTAnchor_delete (HTParentAnchor * me)
 **	Return an array that must be freed by the caller or
 **      NULL if no anchors.
 */
+PRIVATE void add_one (HTParentAnchor * pres, void * array)
+{
+    if (HTArray_addObject((HTArray *) array, pres) == NO)
+	HTTRACE(ANCH_TRACE, "Anchor...... Can't add object %p to array %p\n" _ 
+		    pres _ array);
+}
+
 PUBLIC HTArray * HTAnchor_getArray (int growby)
 {
-    int cnt;
     HTArray * array = NULL;
-    HTList * cur = NULL;
-    if (!adult_table) return NULL;
+    if (!Adults.slots) return NULL;
 
     /* Allocate an array for the anchors */
-    if (growby <= 0) growby = PARENT_HASH_SIZE;
+    if (growby <= 0) growby = Adults.count + OldAdults.count + 1;
     array = HTArray_new(growby);
 
     /* Traverse anchor structure */
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor * pres = NULL;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur)) != NULL) {
-                if (HTArray_addObject(array, pres) == NO) {
-                    HTTRACE(ANCH_TRACE, "Anchor...... Can't add object %p to array %p\n" _ 
-				pres _ array);
-                    break;
-                }
-	    }
-	}
-    }
+    walk_parents(add_one, array);
     return array;
 }
 
@@ -0,0 +1,161 @@
+/*								      HTArena.c
+**	ARENA ALLOCATOR
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	An arena hands out memory from a list of blocks. The first block in
+**	the list is the one we take memory from. Large objects get a block of
+**	their own which is put after the first one so that we can continue
+**	using the rest of the first block.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "HTUtils.h"
+#include "HTArena.h"					 /* Implemented here */
+
+#define ARENA_BLOCK_SIZE	1024		      /* Default block size */
+#define ARENA_ALIGN		(2 * sizeof(void *))
+
+#define ALIGN(size)		(((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct _HTArenaBlock HTArenaBlock;
+struct _HTArenaBlock {
+    HTArenaBlock *	next;
+    size_t		size;			      /* Usable size of block */
+    size_t		used;
+};
+
+struct _HTArena {
+    HTArenaBlock *	blocks;
+    size_t		block_size;
+    HTArenaStats	stats;
+};
+
+#define BLOCK_DATA(b)	((char *) (b) + ALIGN(sizeof(HTArenaBlock)))
+
+PRIVATE HTArenaStats Totals;
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTArena * HTArena_new (size_t block)
+{
+    HTArena * me;
+    if ((me = (HTArena *) HT_CALLOC(1, sizeof(HTArena))) == NULL)
+	HT_OUTOFMEM("HTArena_new");
+    me->block_size = block > 0 ? ALIGN(block) : ARENA_BLOCK_SIZE;
+    me->stats.arenas = 1;
+    Totals.arenas++;
+    HTTRACE(MEM_TRACE, "Arena....... Created %p with blocks of %d bytes\n" _
+		me _ (int) me->block_size);
+    return me;
+}
+
+PUBLIC BOOL HTArena_clear (HTArena * me)
+{
+    if (me) {
+	HTArenaBlock * block = me->blocks;
+	HTTRACE(MEM_TRACE, "Arena....... Clear %p with %lu objects in %lu bytes\n" _
+		    me _ me->stats.objects _ me->stats.size);
+	while (block) {
+	    HTArenaBlock * next = block->next;
+	    HT_FREE(block);
+	    block = next;
+	}
+	me->blocks = NULL;
+	me->stats.blocks = 0;
+	me->stats.objects = 0;
+	me->stats.used = 0;
+	me->stats.size = 0;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTArena_delete (HTArena * me)
+{
+    if (me) {
+	HTArena_clear(me);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE HTArenaBlock * new_block (HTArena * me, size_t size)
+{
+    HTArenaBlock * block;
+    size_t total = ALIGN(sizeof(HTArenaBlock)) + size;
+    if ((block = (HTArenaBlock *) HT_MALLOC(total)) == NULL)
+	HT_OUTOFMEM("HTArena");
+    block->size = size;
+    block->used = 0;
+    me->stats.blocks++;
+    me->stats.size += total;
+    if (me->stats.size > me->stats.peak) me->stats.peak = me->stats.size;
+    Totals.blocks++;
+    Totals.size += total;
+    if (me->stats.size > Totals.peak) Totals.peak = me->stats.size;
+    return block;
+}
+
+PUBLIC void * HTArena_malloc (HTArena * me, size_t size)
+{
+    HTArenaBlock * block;
+    void * ptr;
+    if (!me) return NULL;
+    size = ALIGN(size ? size : 1);
+    block = me->blocks;
+    if (size > me->block_size / 4) {
+	block = new_block(me, size);
+	if (me->blocks) {
+	    block->next = me->blocks->next;
+	    me->blocks->next = block;
+	} else {
+	    block->next = NULL;
+	    me->blocks = block;
+	}
+    } else if (!block || block->used + size > block->size) {
+	block = new_block(me, me->block_size);
+	block->next = me->blocks;
+	me->blocks = block;
+    }
+    ptr = BLOCK_DATA(block) + block->used;
+    block->used += size;
+    me->stats.objects++;
+    me->stats.used += size;
+    Totals.objects++;
+    Totals.used += size;
+    return ptr;
+}
+
+PUBLIC void * HTArena_calloc (HTArena * me, size_t count, size_t size)
+{
+    void * ptr = HTArena_malloc(me, count * size);
+    if (ptr) memset(ptr, '\0', count * size);
+    return ptr;
+}
+
+PUBLIC char * HTArena_strdup (HTArena * me, const char * str)
+{
+    if (me && str) {
+	size_t length = strlen(str) + 1;
+	char * ptr = (char *) HTArena_malloc(me, length);
+	memcpy(ptr, str, length);
+	return ptr;
+    }
+    return NULL;
+}
+
+PUBLIC BOOL HTArena_stats (HTArena * me, HTArenaStats * stats)
+{
+    if (stats) {
+	*stats = me ? me->stats : Totals;
+	return YES;
+    }
+    return NO;
+}
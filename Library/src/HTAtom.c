@@ -9,7 +9,10 @@
 **	so that they can be stored more efficiently, and comparisons
 **	for equality done more efficiently.
 **
-**	Atoms are kept in a hash table consisting of an array of linked lists.
+**	Atoms are kept in a hash table consisting of an array of linked
+**	lists. The array is doubled when there are more atoms than lists.
+**	Each atom and its name is a single piece of memory taken from large
+**	blocks which are only freed by HTAtom_deleteAll.
 **
 ** Authors:
 **	TBL	Tim Berners-Lee, WorldWideWeb project, CERN
@@ -23,56 +26,254 @@
 #include "HTList.h"
 #include "HTAtom.h"
 
-PRIVATE HTAtom * hash_table[HT_XL_HASH_SIZE];
-PRIVATE BOOL initialised = NO;
+#define ATOM_TABLE_SIZE		1024		     /* Initial number of lists */
+#define ATOM_BLOCK_SIZE		8192		  /* Memory blocks for atoms */
 
 /*
-**	Finds an atom representation for a string. The atom doesn't have to be
-**	a new one but can be an already existing atom.
+**	The names of the well known atoms must be in the same order as
+**	HTAtomKnown. They are not string constants as some matching functions
+**	write to atom names while they compare them.
 */
-PUBLIC HTAtom * HTAtom_for (const char * string)
+PRIVATE char known_names[HT_ATOM_MAX][34] = {
+    "www/*",
+    "www/void",
+    "*/*",
+    "www/present",
+    "www/debug",
+    "www/unknown",
+    "www/cache",
+    "www/cache-append",
+    "text/html",
+    "text/plain",
+    "application/x-www-form-urlencoded",
+    "message/rfc822",
+    "message/x-rfc822-head",
+    "message/x-rfc822-foot",
+    "message/x-rfc822-partial",
+    "message/x-rfc822-cont",
+    "message/x-rfc822-upgrade",
+    "www/x-rfc822-headers",
+    "audio/basic",
+    "video/mpeg",
+    "image/gif",
+    "image/jpeg",
+    "image/tiff",
+    "image/png",
+    "application/octet-stream",
+    "application/postscript",
+    "application/rtf",
+    "text/x-gopher",
+    "text/x-cso",
+    "text/x-ftp-lnst",
+    "text/x-ftp-list",
+    "text/x-nntp-list",
+    "text/x-nntp-over",
+    "text/x-nntp-head",
+    "text/x-http",
+    "application/x-www-rules",
+    "7bit",
+    "8bit",
+    "binary",
+    "identity",
+    "base64",
+    "macbinhex",
+    "chunked",
+    "compress",
+    "gzip",
+    "deflate"
+};
+
+PUBLIC HTAtom HTAtom_wellKnown[HT_ATOM_MAX] = {
+    {NULL, known_names[HT_ATOM_INTERNAL]},
+    {NULL, known_names[HT_ATOM_RAW]},
+    {NULL, known_names[HT_ATOM_SOURCE]},
+    {NULL, known_names[HT_ATOM_PRESENT]},
+    {NULL, known_names[HT_ATOM_DEBUG]},
+    {NULL, known_names[HT_ATOM_UNKNOWN]},
+    {NULL, known_names[HT_ATOM_CACHE]},
+    {NULL, known_names[HT_ATOM_CACHE_APPEND]},
+    {NULL, known_names[HT_ATOM_HTML]},
+    {NULL, known_names[HT_ATOM_PLAINTEXT]},
+    {NULL, known_names[HT_ATOM_FORM]},
+    {NULL, known_names[HT_ATOM_MIME]},
+    {NULL, known_names[HT_ATOM_MIME_HEAD]},
+    {NULL, known_names[HT_ATOM_MIME_FOOT]},
+    {NULL, known_names[HT_ATOM_MIME_PART]},
+    {NULL, known_names[HT_ATOM_MIME_CONT]},
+    {NULL, known_names[HT_ATOM_MIME_UPGRADE]},
+    {NULL, known_names[HT_ATOM_MIME_COPYHEADERS]},
+    {NULL, known_names[HT_ATOM_AUDIO]},
+    {NULL, known_names[HT_ATOM_VIDEO]},
+    {NULL, known_names[HT_ATOM_GIF]},
+    {NULL, known_names[HT_ATOM_JPEG]},
+    {NULL, known_names[HT_ATOM_TIFF]},
+    {NULL, known_names[HT_ATOM_PNG]},
+    {NULL, known_names[HT_ATOM_BINARY]},
+    {NULL, known_names[HT_ATOM_POSTSCRIPT]},
+    {NULL, known_names[HT_ATOM_RICHTEXT]},
+    {NULL, known_names[HT_ATOM_GOPHER_MENU]},
+    {NULL, known_names[HT_ATOM_CSO_SEARCH]},
+    {NULL, known_names[HT_ATOM_FTP_LNST]},
+    {NULL, known_names[HT_ATOM_FTP_LIST]},
+    {NULL, known_names[HT_ATOM_NNTP_LIST]},
+    {NULL, known_names[HT_ATOM_NNTP_OVER]},
+    {NULL, known_names[HT_ATOM_NNTP_HEAD]},
+    {NULL, known_names[HT_ATOM_HTTP]},
+    {NULL, known_names[HT_ATOM_RULES]},
+    {NULL, known_names[HT_ATOM_CODING_7BIT]},
+    {NULL, known_names[HT_ATOM_CODING_8BIT]},
+    {NULL, known_names[HT_ATOM_CODING_BINARY]},
+    {NULL, known_names[HT_ATOM_CODING_IDENTITY]},
+    {NULL, known_names[HT_ATOM_CODING_BASE64]},
+    {NULL, known_names[HT_ATOM_CODING_MACBINHEX]},
+    {NULL, known_names[HT_ATOM_CODING_CHUNKED]},
+    {NULL, known_names[HT_ATOM_CODING_COMPRESS]},
+    {NULL, known_names[HT_ATOM_CODING_GZIP]},
+    {NULL, known_names[HT_ATOM_CODING_DEFLATE]}
+};
+
+typedef struct _HTAtomBlock HTAtomBlock;
+struct _HTAtomBlock {
+    HTAtomBlock *	next;
+    size_t		used;
+    size_t		size;
+};
+
+#define BLOCK_HEAD	((sizeof(HTAtomBlock) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+PRIVATE HTAtom **	hash_table = NULL;
+PRIVATE unsigned int	table_size = 0;			  /* Always a power of 2 */
+PRIVATE unsigned int	atoms = 0;
+PRIVATE HTAtomBlock *	blocks = NULL;
+
+/*
+**	FNV-1a of the lower case string so that HTAtom_for and
+**	HTAtom_caseFor find the same atoms. Also returns the length.
+*/
+PRIVATE unsigned int atom_hash (const char * string, unsigned int * length)
 {
-    int hash;
     const unsigned char * p;
-    HTAtom * a;
+    unsigned int hash = 2166136261U;
+    for (p = (const unsigned char *) string; *p; p++) {
+	hash ^= TOLOWER(*p);
+	hash *= 16777619U;
+    }
+    *length = p - (const unsigned char *) string;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    return hash;
+}
 
-    if (!string) return NULL;			/* prevent core dumps */
-    
-    /*		First time around, clear hash table
-    */
-    if (!initialised) {
-        memset((void *) hash_table, '\0', sizeof(HTAtom *) * HT_XL_HASH_SIZE);
-	initialised = YES;
+PRIVATE void atom_add (HTAtom * a)
+{
+    unsigned int pos = a->hash & (table_size - 1);
+    a->next = hash_table[pos];
+    hash_table[pos] = a;
+    atoms++;
+}
+
+/*
+**	Double the number of lists when we have more atoms than lists
+*/
+PRIVATE void atom_grow (void)
+{
+    HTAtom ** old = hash_table;
+    unsigned int old_size = table_size;
+    unsigned int cnt;
+    table_size = old_size ? old_size * 2 : ATOM_TABLE_SIZE;
+    if ((hash_table = (HTAtom **) HT_CALLOC(table_size, sizeof(HTAtom *))) == NULL)
+	HT_OUTOFMEM("atom_grow");
+    atoms = 0;
+    for (cnt=0; cnt<old_size; cnt++) {
+	HTAtom * a = old[cnt];
+	while (a) {
+	    HTAtom * next = a->next;
+	    atom_add(a);
+	    a = next;
+	}
     }
-    
-    /*		Generate hash function
-    */
-    for (p=string, hash=0; *p; p++) {
-        hash = (hash * 3 + TOLOWER(*p)) % HT_XL_HASH_SIZE;
+    HT_FREE(old);
+}
+
+/*
+**	The first time around we create the table and add the well
+**	known atoms
+*/
+PRIVATE void atom_init (void)
+{
+    int cnt;
+    atom_grow();
+    for (cnt=0; cnt<HT_ATOM_MAX; cnt++) {
+	HTAtom * a = &HTAtom_wellKnown[cnt];
+	a->hash = atom_hash(a->name, &a->length);
+	atom_add(a);
+    }
+}
+
+/*
+**	Get memory for an atom and its name from the current block
+*/
+PRIVATE HTAtom * atom_new (const char * string, unsigned int length,
+			   unsigned int hash)
+{
+    size_t size = (sizeof(HTAtom) + length + 1 + sizeof(void *) - 1) &
+	~(sizeof(void *) - 1);
+    HTAtom * a;
+    if (!blocks || blocks->used + size > blocks->size) {
+	size_t block_size = BLOCK_HEAD + size > ATOM_BLOCK_SIZE ?
+	    BLOCK_HEAD + size : ATOM_BLOCK_SIZE;
+	HTAtomBlock * block;
+	if ((block = (HTAtomBlock *) HT_MALLOC(block_size)) == NULL)
+	    HT_OUTOFMEM("atom_new");
+	block->used = BLOCK_HEAD;
+	block->size = block_size;
+	block->next = blocks;
+	blocks = block;
     }
-    
+    a = (HTAtom *) ((char *) blocks + blocks->used);
+    blocks->used += size;
+    a->name = (char *) (a + 1);
+    memcpy(a->name, string, length + 1);
+    a->hash = hash;
+    a->length = length;
+    if (atoms >= table_size) atom_grow();
+    atom_add(a);
+    return a;
+}
+
+PRIVATE HTAtom * atom_for (const char * string, BOOL caseless)
+{
+    unsigned int length;
+    unsigned int hash;
+    HTAtom * a;
+
+    if (!string) return NULL;			/* prevent core dumps */
+    if (!hash_table) atom_init();
+    hash = atom_hash(string, &length);
+
     /*		Search for the string in the list
     */
-    for (a=hash_table[hash]; a; a=a->next) {
-	if (0==strcmp(a->name, string)) {
-    	    /* HTTRACE(UTIL_TRACE, "HTAtom: Old atom %p for `%s'\n" _ a _ string); */
+    for (a=hash_table[hash & (table_size - 1)]; a; a=a->next) {
+	if (a->hash == hash && a->length == length &&
+	    (caseless ? !strncasecomp(a->name, string, length) :
+	     !memcmp(a->name, string, length)))
 	    return a;				/* Found: return it */
-	}
     }
-    
+
     /*		Generate a new entry
     */
-    if ((a = (HTAtom  *) HT_MALLOC(sizeof(*a))) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    if ((a->name = (char  *) HT_MALLOC(strlen(string)+1)) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    strcpy(a->name, string);
-    a->next = hash_table[hash];		/* Put onto the head of list */
-    hash_table[hash] = a;
-/*    HTTRACE(UTIL_TRACE, "HTAtom: New atom %p for `%s'\n" _ a _ string); */
-    return a;
+    return atom_new(string, length, hash);
 }
 
+/*
+**	Finds an atom representation for a string. The atom doesn't have to be
+**	a new one but can be an already existing atom.
+*/
+PUBLIC HTAtom * HTAtom_for (const char * string)
+{
+    return atom_for(string, NO);
+}
 
 /*
 **	CASE INSENSITIVE VERSION OF HTAtom_for()
@@ -81,43 +282,7 @@ PUBLIC HTAtom * HTAtom_for (const char * string)
 */
 PUBLIC HTAtom * HTAtom_caseFor (const char * string)
 {
-    int hash;
-    const unsigned char * p;
-    HTAtom * a;
-
-    if (!string) return NULL;			/* prevent core dumps */
-    
-    /*		First time around, clear hash table
-    */
-    if (!initialised) {
-        memset((void *) hash_table, '\0', sizeof(HTAtom *) * HT_XL_HASH_SIZE);
-	initialised = YES;
-    }
-    
-    /*		Generate hash function
-    */
-    for(p=string, hash=0; *p; p++) {
-        hash = (hash * 3 + TOLOWER(*p)) % HT_XL_HASH_SIZE;
-    }
-    
-    /*		Search for the string in the list
-    */
-    for (a=hash_table[hash]; a; a=a->next) {
-	if (!strcasecomp(a->name, string)) {
-	    return a;					/* Found: return it */
-	}
-    }
-    
-    /*		Generate a new entry
-    */
-    if ((a = (HTAtom  *) HT_MALLOC(sizeof(*a))) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    if ((a->name = (char  *) HT_MALLOC(strlen(string)+1)) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    strcpy(a->name, string);
-    a->next = hash_table[hash];		/* Put onto the head of list */
-    hash_table[hash] = a;
-    return a;
+    return atom_for(string, YES);
 }
 
 
@@ -127,22 +292,14 @@ PUBLIC HTAtom * HTAtom_caseFor (const char * string)
 */
 PUBLIC void HTAtom_deleteAll (void)
 {
-    int i;
-    HTAtom *cur;
-    HTAtom *next;
-    
-    for (i=0; i<HT_XL_HASH_SIZE; i++) {
-	if (hash_table[i]) {
-	    cur = hash_table[i];
-	    while (cur) {
-		next = cur->next;
-		HT_FREE(cur->name);
-		HT_FREE(cur);
-		cur = next;	
-	    }	
-	}
+    while (blocks) {
+	HTAtomBlock * next = blocks->next;
+	HT_FREE(blocks);
+	blocks = next;
     }
-    initialised = NO;
+    HT_FREE(hash_table);
+    table_size = 0;
+    atoms = 0;
 }
 
 
@@ -175,11 +332,11 @@ PUBLIC HTList *HTAtom_templateMatches (const char * templ)
 {
     HTList *matches = HTList_new();
 
-    if (initialised && templ) {
-	int i;
+    if (hash_table && templ) {
+	unsigned int i;
 	HTAtom *cur;
 
-	for (i=0; i<HT_XL_HASH_SIZE; i++) {
+	for (i=0; i<table_size; i++) {
 	    for (cur = hash_table[i];  cur;  cur=cur->next) {
 		if (mime_match(cur->name, templ))
 		    HTList_addObject(matches, (void*)cur);
@@ -9,6 +9,12 @@
 **	stream without causing a write every time.  The data is first written
 **	into a buffer. Data is written to the actual stream only when the
 **	buffer is full, or when the stream is flushed.
+**
+**	When the target is a socket writer, large blocks are not copied
+**	into the buffer but written together with it in one writev call.
+**	Data which can't be written right away is kept in a queue of
+**	segments in front of the buffer. A segment can also be part of a
+**	file which is sent directly from the file to the socket.
 */
 
 /* Library include files */
@@ -20,10 +26,25 @@
 #include "HTTimer.h"
 #include "HTBufWrt.h"					 /* Implemented here */
 
+typedef struct _HTSegment {
+    HTIOVec			vec;		    /* What is left to write */
+    int				fd;		   /* File segment if not -1 */
+    long			offset;		   /* What is left to send */
+    long			length;
+    BOOL			copy;	     /* Read it - sendfile failed */
+    HTSegmentRelease *		release;
+    void *			context;
+} HTSegment;
+
 struct _HTOutputStream {
     const HTOutputStreamClass *	isa;
     HTOutputStream *		target;		 /* Target for outgoing data */
     HTHost *			host;
+    BOOL			vector;	     /* Target is a socket writer */
+
+    HTSegment *			segments;     /* Queued in front of 'data' */
+    int				nsegments;
+    int				maxsegments;
 
     int				allocated;  	    /* Allocated Buffer size */
     int                         growby;
@@ -38,8 +59,250 @@ struct _HTOutputStream {
 
 #define PUTBLOCK(b,l) (*me->target->isa->put_block)(me->target,(b),(l))
 
+#define VECTOR_MAX	16			/* Segments per writev call */
+#define MAP_MAX		0x40000000L	     /* Largest file segment to map */
+
 /* ------------------------------------------------------------------------- */
 
+PRIVATE void free_data (void * context)
+{
+    HT_FREE(context);
+}
+
+PRIVATE void segment_add (HTOutputStream * me, const char * buf, int len,
+			  HTSegmentRelease * release, void * context)
+{
+    HTSegment * seg;
+    if (me->nsegments >= me->maxsegments) {
+	me->maxsegments = me->maxsegments ? 2 * me->maxsegments : 8;
+	if ((me->segments = (HTSegment *) HT_REALLOC(me->segments,
+			    me->maxsegments * sizeof(HTSegment))) == NULL)
+	    HT_OUTOFMEM("segment_add");
+    }
+    seg = me->segments + me->nsegments++;
+    seg->vec.base = buf;
+    seg->vec.len = len;
+    seg->fd = -1;
+    seg->copy = NO;
+    seg->release = release;
+    seg->context = context;
+}
+
+/*
+**  Remove the first n segments from the queue and release them
+*/
+PRIVATE void segment_release (HTOutputStream * me, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+	HTSegment * seg = me->segments + i;
+	if (seg->release) (*seg->release)(seg->context);
+    }
+    me->nsegments -= n;
+    if (me->nsegments > 0)
+	memmove(me->segments, me->segments + n, me->nsegments * sizeof(HTSegment));
+}
+
+/*
+**  Put what is in the buffer at the end of the segment queue and start
+**  a new buffer. The first `skip' bytes have already been written.
+*/
+PRIVATE void buffer_queue (HTOutputStream * me, int skip)
+{
+    int size = me->read - me->data;
+    if (size > skip) {
+	segment_add(me, me->data + skip, size - skip, free_data, me->data);
+	if ((me->data = (char *) HT_MALLOC(me->allocated)) == NULL)
+	    HT_OUTOFMEM("buffer_queue");
+    }
+    me->read = me->data;
+}
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+typedef struct _HTMapping {
+    void *			addr;
+    size_t			size;
+    HTSegmentRelease *		release;
+    void *			context;
+} HTMapping;
+
+PRIVATE void unmap_file (void * context)
+{
+    HTMapping * map = (HTMapping *) context;
+    munmap(map->addr, map->size);
+    if (map->release) (*map->release)(map->context);
+    HT_FREE(map);
+}
+#endif
+
+/*
+**  If we can't send the file segment at the front of the queue directly
+**  then we try to map the rest of it into memory so that it becomes a
+**  normal segment.
+*/
+PRIVATE BOOL segment_map (HTOutputStream * me)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    HTSegment * seg = me->segments;
+    if (seg->length <= MAP_MAX) {
+	long page = sysconf(_SC_PAGESIZE);
+	long skip = page > 0 ? seg->offset % page : 0;
+	void * addr = mmap(NULL, skip + seg->length, PROT_READ, MAP_SHARED,
+			   seg->fd, seg->offset - skip);
+	if (addr != MAP_FAILED) {
+	    HTMapping * map;
+	    if ((map = (HTMapping *) HT_MALLOC(sizeof(HTMapping))) == NULL)
+		HT_OUTOFMEM("segment_map");
+	    map->addr = addr;
+	    map->size = skip + seg->length;
+	    map->release = seg->release;
+	    map->context = seg->context;
+	    seg->vec.base = (char *) addr + skip;
+	    seg->vec.len = (int) seg->length;
+	    seg->fd = -1;
+	    seg->release = unmap_file;
+	    seg->context = map;
+	    return YES;
+	}
+	HTTRACE(STREAM_TRACE, "Buffer...... Can't map file %d\n" _ seg->fd);
+    }
+#endif
+    return NO;
+}
+
+/*
+**  Otherwise we read the next part of the file into a segment in front
+**  of what is left of it.
+*/
+PRIVATE int segment_read (HTOutputStream * me)
+{
+    HTSegment * seg = me->segments;
+    int size = seg->length > me->allocated ? me->allocated : (int) seg->length;
+    char * copy;
+    if ((copy = (char *) HT_MALLOC(size)) == NULL)
+	HT_OUTOFMEM("segment_read");
+    if (lseek(seg->fd, seg->offset, SEEK_SET) < 0 ||
+	(size = read(seg->fd, copy, size)) <= 0) {
+	HTTRACE(STREAM_TRACE, "Buffer...... Can't read file %d\n" _ seg->fd);
+	HT_FREE(copy);
+	return HT_ERROR;
+    }
+    seg->offset += size;
+    seg->length -= size;
+    segment_add(me, copy, size, free_data, copy);
+    {
+	HTSegment last = me->segments[me->nsegments-1];
+	memmove(me->segments + 1, me->segments,
+		(me->nsegments-1) * sizeof(HTSegment));
+	me->segments[0] = last;
+    }
+    return HT_OK;
+}
+
+/*
+**  Send what is left of the file segment at the front of the queue
+*/
+PRIVATE int segment_sendfile (HTOutputStream * me)
+{
+    HTSegment * seg = me->segments;
+    long done = 0;
+    int status = HT_OK;
+    if (seg->length > 0 && !seg->copy) {
+	status = HTWriter_sendfile(me->target, seg->fd, seg->offset,
+				   seg->length, &done);
+	seg->offset += done;
+	seg->length -= done;
+	if (status == HT_UNSUPPORTED) {
+	    seg->copy = YES;
+	    if (seg->length > 0 && segment_map(me)) return HT_OK;
+	}
+    }
+    if (seg->length > 0 && seg->copy) return segment_read(me);
+    if (status == HT_OK) segment_release(me, 1);
+    return status;
+}
+
+/*
+**  Write the segment queue, the buffer, and then the block passed by the
+**  caller (if any) in as few system calls as possible. If we would block
+**  then the rest of the caller's block is copied so that the caller can
+**  reuse it. Returns HT_WOULD_BLOCK if we have data left.
+*/
+PRIVATE int HTBufferWriter_send (HTOutputStream * me, const char * block, int len)
+{
+    while (1) {
+	HTIOVec vec[VECTOR_MAX];
+	int size = me->read - me->data;
+	int count = 0;
+	int done = 0;
+	int status;
+	BOOL last;
+	int i;
+
+	/* File segments are sent on their own */
+	if (me->nsegments > 0 && me->segments->fd >= 0) {
+	    me->lastFlushTime = HTGetTimeInMillis();
+	    status = segment_sendfile(me);
+	    last = NO;
+	} else {
+	    for (i = 0; i < me->nsegments && me->segments[i].fd < 0 &&
+		     count < VECTOR_MAX-2; i++)
+		vec[count++] = me->segments[i].vec;
+	    if ((last = (i == me->nsegments))) {
+		if (size > 0) {
+		    vec[count].base = me->data;
+		    vec[count++].len = size;
+		}
+		if (len > 0) {
+		    vec[count].base = block;
+		    vec[count++].len = len;
+		}
+	    }
+	    if (!count) return HT_OK;
+	    me->lastFlushTime = HTGetTimeInMillis();
+	    status = HTWriter_writev(me->target, vec, count, &done);
+
+	    /* Drop the segments that are done */
+	    for (i = 0; i < me->nsegments && me->segments[i].fd < 0 &&
+		     done >= me->segments[i].vec.len; i++)
+		done -= me->segments[i].vec.len;
+	    segment_release(me, i);
+	    if (me->nsegments > 0 && me->segments->fd < 0) {
+		me->segments->vec.base += done;
+		me->segments->vec.len -= done;
+		done = 0;
+	    }
+	}
+
+	if (status == HT_OK) {
+	    if (last) {
+		me->read = me->data;
+		return HT_OK;
+	    }
+	    continue;
+	}
+	HTTRACE(STREAM_TRACE, "Buffer...... Writev returned %d\n" _ status);
+	if (status != HT_WOULD_BLOCK) return status;
+
+	/* Keep what is left in the queue */
+	if (last) {
+	    int skip = done < size ? done : size;
+	    buffer_queue(me, skip);
+	    block += done - skip;
+	    len -= done - skip;
+	} else
+	    buffer_queue(me, 0);
+	if (len > 0) {
+	    char * copy;
+	    if ((copy = (char *) HT_MALLOC(len)) == NULL)
+		HT_OUTOFMEM("HTBufferWriter_send");
+	    memcpy(copy, block, len);
+	    segment_add(me, copy, len, free_data, copy);
+	}
+	return HT_WOULD_BLOCK;
+    }
+}
+
 /*
 **  This function is only called from either FlushEvent or HTBufferWriter_lazyFlush
 **  which means that only the host object or timeout can cause a flush
@@ -47,6 +310,7 @@ struct _HTOutputStream {
 PRIVATE int HTBufferWriter_flush (HTOutputStream * me)
 {
     int status = HT_OK;
+    if (me && me->vector) return HTBufferWriter_send(me, NULL, 0);
     if (me && me->read > me->data) {
 	me->lastFlushTime = HTGetTimeInMillis();
         if ((status = PUTBLOCK(me->data, me->read - me->data))==HT_WOULD_BLOCK)
@@ -79,17 +343,28 @@ PRIVATE int FlushEvent (HTTimer * timer, void * param, HTEventType type)
 PRIVATE int HTBufferWriter_lazyFlush (HTOutputStream * me)
 {
     HTNet * net;
+    BOOL batch;
     int delay;
 
-    if (me->read <= me->data) {
+    if (me->read <= me->data && !me->nsegments) {
 	return HT_OK;			/* nothing to flush */
     }
     /*
     **  If we are allowed to delay the flush then set a timer with the
     **  delay descibed by our delay variable. If we can't delay then flush 
-    **  right away.
+    **  right away. When batching, the timer is deferred to the next pass
+    **  through the event loop so everything written while handling the
+    **  current events is flushed together. Preemptive requests don't go
+    **  through the event loop so they are flushed right away.
     */
-    delay = HTHost_findWriteDelay(me->host, me->lastFlushTime, me->read - me->data);
+    delay = me->nsegments ? 0 :
+	HTHost_findWriteDelay(me->host, me->lastFlushTime, me->read - me->data);
+    net = HTHost_getWriteNet(me->host);
+    batch = delay && HTHost_writeBatch(me->host);
+    if (batch && net && HTNet_preemptive(net)) {
+	batch = NO;
+	delay = 0;
+    }
 
     /*
     **	Flush immediately
@@ -112,11 +387,11 @@ PRIVATE int HTBufferWriter_lazyFlush (HTOutputStream * me)
     **  can't parse the data fast enough.
     */
     if (!me->timer) {
-	net = HTHost_getWriteNet(me->host);
-	me->timer = HTTimer_new(NULL, FlushEvent, me, delay, YES, NO);
+	me->timer = batch ? HTTimer_defer(FlushEvent, me) :
+	    HTTimer_new(NULL, FlushEvent, me, delay, YES, NO);
 	HTHost_unregister(me->host, net, HTEvent_WRITE);
-	HTTRACE(STREAM_TRACE, "Buffer...... Waiting %dms on %p\n" _ delay _ me);
-    } else {
+	HTTRACE(STREAM_TRACE, "Buffer...... Waiting %dms on %p\n" _ batch ? 0 : delay _ me);
+    } else if (!batch) {
 	if (HTTimer_hasTimerExpired(me->timer)) {
 	    HTTRACE(STREAM_TRACE, "Buffer...... Dispatching old timer %p\n" _ me->timer);
 	    HTTimer_dispatch(me->timer);
@@ -161,6 +436,8 @@ PRIVATE int HTBufferWriter_abort (HTOutputStream * me, HTList * e)
 	HTTimer_delete(me->timer);
 	me->timer = NULL;
     }
+    segment_release(me, me->nsegments);
+    me->read = me->data;
     if (me->target) (*me->target->isa->abort)(me->target, e);
     return HT_ERROR;
 }
@@ -168,6 +445,21 @@ PRIVATE int HTBufferWriter_abort (HTOutputStream * me, HTList * e)
 PRIVATE int HTBufferWriter_write (HTOutputStream * me, const char * buf, int len)
 {
     int status;
+
+    /*
+    **  If the block doesn't fit then write it together with what we have
+    **  instead of copying it into the buffer first.
+    */
+    if (me->vector) {
+	if (len <= me->data + me->allocated - me->read) {
+	    memcpy(me->read, buf, len);
+	    me->read += len;
+	    return HT_OK;
+	}
+	status = HTBufferWriter_send(me, buf, len);
+	return (status == HT_WOULD_BLOCK) ? HT_OK : status;
+    }
+
     while (1) {
 	int available = me->data + me->allocated - me->read;
 
@@ -242,6 +534,8 @@ PRIVATE int HTBufferWriter_close (HTOutputStream * me)
 	    me->timer = NULL;
 	}
 	if (me->target) (*me->target->isa->close)(me->target);
+	segment_release(me, me->nsegments);
+	HT_FREE(me->segments);
 	HT_FREE(me->data);
 	HT_FREE(me);
     }
@@ -260,13 +554,65 @@ PRIVATE const HTOutputStreamClass HTBufferWriter =
     HTBufferWriter_close
 }; 
 
+/*	Queue a Segment
+**	---------------
+**	The segment is written without being copied. The release function
+**	is called when it has been written or the stream is aborted. Once
+**	it is queued we return HT_OK as the caller doesn't own it anymore.
+*/
+PUBLIC int HTBufferWriter_putSegment (HTOutputStream * me,
+				      const char * buf, int len,
+				      HTSegmentRelease * release,
+				      void * context)
+{
+    int status;
+    if (!me || me->isa != &HTBufferWriter || !me->vector || len < 0)
+	return HT_ERROR;
+    buffer_queue(me, 0);
+    segment_add(me, buf, len, release, context);
+    if ((status = HTBufferWriter_lazyFlush(me)) != HT_OK &&
+	status != HT_WOULD_BLOCK)
+	HTTRACE(STREAM_TRACE, "Buffer...... Flush of segment returned %d\n" _ status);
+    return HT_OK;
+}
+
+/*	Queue Part of a File
+**	--------------------
+**	Where we have sendfile, the data goes directly from the file to the
+**	socket. Otherwise, or if sendfile fails on this file, we map the file
+**	into memory or read it and write it as a normal segment with writev.
+*/
+PUBLIC int HTBufferWriter_putFile (HTOutputStream * me, int fd,
+				   long offset, long length,
+				   HTSegmentRelease * release, void * context)
+{
+    int status;
+    if (!me || me->isa != &HTBufferWriter || !me->vector ||
+	fd < 0 || offset < 0 || length < 0)
+	return HT_ERROR;
+    buffer_queue(me, 0);
+    segment_add(me, NULL, 0, release, context);
+    me->segments[me->nsegments-1].fd = fd;
+    me->segments[me->nsegments-1].offset = offset;
+    me->segments[me->nsegments-1].length = length;
+
+    /*
+    **  The segment owns the file now and releases it whatever happens to
+    **  the connection, so the caller must not fall back to reading the
+    **  file. A broken connection is reported by the writer as usual.
+    */
+    if ((status = HTBufferWriter_lazyFlush(me)) != HT_OK &&
+	status != HT_WOULD_BLOCK)
+	HTTRACE(STREAM_TRACE, "Buffer...... Flush of file %d returned %d\n" _ fd _ status);
+    return HT_OK;
+}
+
 PRIVATE HTOutputStream * buffer_new (HTHost * host, HTChannel * ch,
 				     void * param, int bufsize)
 {
     if (host && ch) {
 	HTOutputStream * me = HTChannel_output(ch);
 	if (!me) {
-	    HTOutputStream * me;
 	    int tcpbufsize = 0;
 
 #if defined(HAVE_GETSOCKOPT) && defined(SO_SNDBUF)
@@ -295,8 +641,8 @@ PRIVATE HTOutputStream * buffer_new (HTHost * host, HTChannel * ch,
             me->growby = bufsize;
 	    me->expo = 1;
 	    me->host = host;
-           return me;
 	}
+	return me;
     }
     return NULL;
 }
@@ -307,11 +653,13 @@ PUBLIC HTOutputStream * HTBufferWriter_new (HTHost *	       	host,
 					    int 		bufsize)
 {
     HTOutputStream * me = buffer_new(host, ch, param, bufsize);
-    if (me) {
+    if (me && me->isa == &HTBufferWriter && !me->target) {
 	me->target = HTWriter_new(host, ch, param, 0);
-	return me;
+#ifndef NOT_ASCII
+	me->vector = YES;
+#endif
     }
-    return NULL;
+    return me;
 }
 
 PUBLIC HTOutputStream * HTBufferConverter_new (HTHost * 	host,
@@ -322,10 +670,9 @@ PUBLIC HTOutputStream * HTBufferConverter_new (HTHost * 	host,
 {
     if (target) {
 	HTOutputStream * me = buffer_new(host, ch, param, bufsize);
-	if (me) {
+	if (me && me->isa == &HTBufferWriter && !me->target)
 	    me->target = target;
-	    return me;
-	}
+	return me;
     }
     return NULL;
 }
@@ -25,7 +25,10 @@
 /* This is the default cache directory: */
 #define HT_CACHE_LOC	"/tmp/"
 #define HT_CACHE_ROOT	"w3c-cache/"
-#define HT_CACHE_INDEX	".index"
+#define HT_CACHE_INDEX	".index"			/* Old text index */
+#define HT_CACHE_BINDEX	".index.bin"
+#define HT_CACHE_JOURNAL	".index.jnl"
+#define HT_CACHE_NEWINDEX	".index.new"
 #define HT_CACHE_LOCK	".lock"
 #define HT_CACHE_META	".meta"
 #define HT_CACHE_EMPTY_ETAG	"@w3c@"
@@ -44,7 +47,11 @@
 
 #define WARN_HEURISTICS		24*3600		  /* When to issue a warning */
 
-#define DUMP_FREQUENCY	10			 /* Dump index every x loads */
+#define JOURNAL_MAX	500	       /* Fold journal after x entries */
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define HT_CACHE_MMAP
+#endif
 
 #define MEGA			0x100000L
 #define HT_CACHE_TOTAL_SIZE	20		/* Default cache size is 20M */
@@ -52,6 +59,8 @@
 #define HT_CACHE_GC_PCT		10        /* 10% of cache size free after GC */
 #define HT_MIN_CACHE_TOTAL_SIZE	 5			/* 5M Min cache size */
 #define HT_MAX_CACHE_ENTRY_SIZE	 3     /* 3M Max sixe of single cached entry */
+#define HT_CACHE_PROTECTED_PCT	80	  /* Max size of protected LRU segment */
+#define HT_CACHE_GC_WINDOW	64	/* Entries we look at for stale ones */
 
 /* Final states have negative value */
 typedef enum _CacheState {
@@ -91,6 +100,7 @@ struct _HTCache {
     time_t		response_time;
     time_t		corrected_initial_age;
     HTRequest *		lock;
+    HTDequeLink		lru;		  /* Our place in the LRU segments */
 };
 
 struct _HTStream {
@@ -123,6 +133,11 @@ PRIVATE int DefaultExpiration = NO_LM_EXPIRATION;
 /* List of cache entries */
 PRIVATE HTList ** 	CacheTable = NULL;
 
+/* Segmented LRU lists for eviction */
+PRIVATE HTDeque *	Probation = NULL;
+PRIVATE HTDeque *	Protected = NULL;
+PRIVATE long		ProtectedSize = 0L;
+
 /* Cache size variables */
 PRIVATE long		HTCacheTotalSize = HT_CACHE_TOTAL_SIZE*MEGA;
 PRIVATE long		HTCacheFolderSize = (HT_CACHE_TOTAL_SIZE*MEGA)/HT_CACHE_FOLDER_PCT;
@@ -130,12 +145,14 @@ PRIVATE long		HTCacheGCBuffer = (HT_CACHE_TOTAL_SIZE*MEGA)/HT_CACHE_GC_PCT;
 PRIVATE long		HTCacheContentSize = 0L;
 PRIVATE long		HTCacheMaxEntrySize = HT_MAX_CACHE_ENTRY_SIZE*MEGA;
 
-PRIVATE int		new_entries = 0;	   /* Number of new entries */
-
 PRIVATE HTNetBefore	HTCacheFilter;
 PRIVATE HTNetAfter	HTCacheUpdateFilter;
 PRIVATE HTNetAfter	HTCacheCheckFilter;
 
+PRIVATE BOOL delete_object (HTList * list, HTCache * me);
+PRIVATE BOOL index_isOpen (void);
+PRIVATE void index_evict (BOOL expendable);
+
 /* ------------------------------------------------------------------------- */
 /*  			     CACHE GARBAGE COLLECTOR			     */
 /* ------------------------------------------------------------------------- */
@@ -150,15 +167,122 @@ PRIVATE BOOL startGC (void)
     return (HTCacheContentSize + HTCacheFolderSize > HTCacheTotalSize);
 }
 
+/*
+**  The cache entries are kept in a segmented LRU list. New entries go
+**  into the probation segment and are moved to the protected segment
+**  when they get a cache hit. The protected segment can take up to
+**  HT_CACHE_PROTECTED_PCT of the cache size - when it grows beyond that
+**  then the least recently used entries are moved back to probation. We
+**  evict from the cold end of probation first and then from the cold end
+**  of protected so that an entry which is only used once can't push out
+**  the entries that are used again and again. Keeping the lists up to
+**  date is constant time for every hit and eviction never has to walk
+**  the whole cache. Entries that are stale or bigger than the max entry
+**  size go first and entries that are too big are never protected.
+*/
+PRIVATE long protected_max (void)
+{
+    return (HTCacheTotalSize - HTCacheFolderSize) / 100 * HT_CACHE_PROTECTED_PCT;
+}
+
+/*
+**  Add a new entry to the probation segment. Entries that we know have
+**  not been used in a long time (for example when loaded from the index
+**  on disk) are added at the cold end.
+*/
+PRIVATE void lru_insert (HTCache * cache, BOOL used)
+{
+    if (!Probation) Probation = HTDeque_new();
+    if (used)
+	HTDeque_appendLink(Probation, &cache->lru, cache);
+    else
+	HTDeque_prependLink(Probation, &cache->lru, cache);
+}
+
+PRIVATE void lru_unlink (HTCache * cache)
+{
+    if (HTDeque_isLinkedTo(&cache->lru, Protected))
+	ProtectedSize -= cache->size;
+    HTDeque_unlink(&cache->lru);
+}
+
+/*
+**  Move an entry to the hot end of the protected segment and demote the
+**  least recently used protected entries if the segment is too big.
+*/
+PRIVATE void lru_hit (HTCache * cache)
+{
+    if (cache->size > HTCacheMaxEntrySize) {
+	lru_unlink(cache);
+	lru_insert(cache, NO);
+	return;
+    }
+    if (!Protected) Protected = HTDeque_new();
+    if (!HTDeque_isLinkedTo(&cache->lru, Protected))
+	ProtectedSize += cache->size;
+    HTDeque_appendLink(Protected, &cache->lru, cache);
+    while (ProtectedSize > protected_max() && HTDeque_count(Protected) > 1) {
+	HTCache * cold = (HTCache *) HTDeque_first(Protected);
+	lru_unlink(cold);
+	lru_insert(cold, YES);
+    }
+}
+
+/*
+**  All changes to the size of an entry goes through here so that we know
+**  how much is in the protected segment.
+*/
+PRIVATE void lru_setSize (HTCache * cache, long size)
+{
+    if (HTDeque_isLinkedTo(&cache->lru, Protected))
+	ProtectedSize += size - cache->size;
+    cache->size = size;
+    if (size > HTCacheMaxEntrySize) {
+	lru_unlink(cache);
+	lru_insert(cache, NO);
+    }
+}
+
+/*
+**  An entry which is stale or bigger than what we would cache now is the
+**  first to go when we gc.
+*/
+PRIVATE BOOL gc_expendable (long size, time_t freshness_lifetime,
+			    time_t response_time, time_t corrected_initial_age)
+{
+    time_t current_age = corrected_initial_age + (time(NULL) - response_time);
+    return (size > HTCacheMaxEntrySize || freshness_lifetime < current_age);
+}
+
+/*
+**  Remove entries from the cold end of a segment until we are below the
+**  gc threshold. Locked entries are skipped. If `expendable' then we only
+**  look at the HT_CACHE_GC_WINDOW coldest entries and only take those
+**  that are stale or too big.
+*/
+PRIVATE void lru_evict (HTDeque * segment, BOOL expendable)
+{
+    HTDequeLink * link = segment ? segment->head : NULL;
+    int cnt = 0;
+    while (link && !stopGC() && (!expendable || cnt++ < HT_CACHE_GC_WINDOW)) {
+	HTDequeLink * next = link->next;
+	HTCache * cache = (HTCache *) link->object;
+	if (!expendable ||
+	    gc_expendable(cache->size, cache->freshness_lifetime,
+			  cache->response_time, cache->corrected_initial_age)) {
+	    HTTRACE(CACHE_TRACE, "Cache....... Evicting %p with %d hits\n" _
+		    cache _ cache->hits);
+	    HTCache_remove(cache);
+	}
+	link = next;
+    }
+}
+
 PRIVATE BOOL HTCacheGarbage (void)
 {
     long old_size = HTCacheContentSize;
     HTTRACE(CACHE_TRACE, "Cache....... Garbage collecting\n");
-    if (CacheTable) {
-	time_t cur_time = time(NULL);
-	HTList * cur;
-	int cnt;
-	int hits;
+    if (CacheTable || index_isOpen()) {
 
 	/*
 	**  Tell the user that we're gc'ing.
@@ -168,79 +292,22 @@ PRIVATE BOOL HTCacheGarbage (void)
 	    if (cbf) (*cbf)(NULL, HT_PROG_OTHER, HT_MSG_NULL,NULL, NULL, NULL);
 	}
 
-	/*
-	**  Walk through and delete all the expired entries. If this is not
-	**  sufficient then take the fresh ones which have the lowest cache
-	**  hit count. This algorithm could be made a lot fancier by including
-	**  the size and also the pain it took to get the document in the first
-	**  case. It could also include max_stale.
-	*/
-	HTTRACE(CACHE_TRACE, "Cache....... Collecting Stale entries\n");
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = CacheTable[cnt])) { 
-		HTList * old_cur = cur;
-		HTCache * pres;
-		while ((pres = (HTCache *) HTList_nextObject(cur)) != NULL) {
-		    time_t resident_time = cur_time - pres->response_time;
-		    time_t current_age = pres->corrected_initial_age +
-			resident_time;
-		    /* 2000-08-08 Jens Meggers: HTCache_remove doesn't
-		       remove a cache entry if it's locked. To avoid
-		       an endless loop, we check the return value of 
-		       HTCache_remove before skipping the entry. */
-		    if ((pres->freshness_lifetime < current_age)
-			&& HTCache_remove(pres)) {
-			cur = old_cur;
-		    } else {
-			old_cur = cur;
-		    }
-		    if (stopGC()) break;
-		}
-	    }
-	}
-
 	/*
 	**  We must at least free the min buffer size so that we don't
-	**  dead lock ourselves. We start from the bottom up by taking
-	**  all the documents with 0 hits, 1 hits, 2 hits, etc.
+	**  dead lock ourselves. First we take stale and too big entries near
+	**  the cold ends. Then the entries that haven't been looked up since
+	**  the index was opened as they are colder than anything in memory.
+	**  They are removed directly from the index without loading them.
+	**  Deletions are written to the journal as we go.
 	*/
-	HTTRACE(CACHE_TRACE, "Cache....... Collecting least used entries\n");
-	hits = 0;
-	while (startGC()) {
-	    BOOL removed = NO;
-	    HTTRACE(CACHE_TRACE, "Cache....... Collecting entries with %d hits\n" _ hits);
-	    for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-		if ((cur = CacheTable[cnt])) { 
-		    HTList * old_cur = cur;
-		    HTCache * pres;
-		    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-			/* 2000-08-08 Jens Meggers: HTCache_remove doesn't
-			   remove a cache entry if it's locked. To avoid
-			   going into an endless loop, we check the return
-			   value of  HTCache_remove before marking the
-			   object as removed. */
-			if ((pres->size > HTCacheMaxEntrySize 
-			     || pres->hits <= hits) 
-			    && HTCache_remove(pres)) {
-			    cur = old_cur;
-			    removed = YES;
-			} else {
-			    old_cur = cur;
-			}
-			if (stopGC()) break;
-		    }
-		}
-	    }
-	    if (!removed) break;
-	    hits++;
-	}
+	lru_evict(Probation, YES);
+	lru_evict(Protected, YES);
+	index_evict(YES);
+	index_evict(NO);
+	lru_evict(Probation, NO);
+	lru_evict(Protected, NO);
 	HTTRACE(CACHE_TRACE, "Cache....... Size reduced from %ld to %ld\n" _ 
 		    old_size _ HTCacheContentSize);
-	/*
-	**  Dump the new content to the index file
-	*/
-	HTCacheIndex_write(HTCacheRoot);
-	new_entries = 0;
 	return YES;
     }
     return NO;
@@ -250,99 +317,1018 @@ PRIVATE BOOL HTCacheGarbage (void)
 /*  			      CACHE INDEX				     */
 /* ------------------------------------------------------------------------- */
 
-PRIVATE char * cache_index_name (const char * cache_root)
+PRIVATE char * cache_file_name (const char * cache_root, const char * suffix)
 {
     if (cache_root) {
 	char * location = NULL;
 	if ((location = (char *)
-	     HT_MALLOC(strlen(cache_root) + strlen(HT_CACHE_INDEX) + 1)) == NULL)
-	    HT_OUTOFMEM("cache_index_name");
+	     HT_MALLOC(strlen(cache_root) + strlen(suffix) + 1)) == NULL)
+	    HT_OUTOFMEM("cache_file_name");
 	strcpy(location, cache_root);
-	strcat(location, HT_CACHE_INDEX);
+	strcat(location, suffix);
 	return location;
     }
     return NULL;
 }
 
 /*
-**  Remove the cache index file
+**  The hash used for the cache directories (and the in-memory table)
 */
-PUBLIC BOOL HTCacheIndex_delete (const char * cache_root)
+PRIVATE int cache_hash (const char * url)
 {
-    if (cache_root) {
-	char * index = cache_index_name(cache_root);
-	REMOVE(index);
-	HT_FREE(index);
-	return YES;
+    int hash = 0;
+    const char * ptr;
+    for (ptr=url; *ptr; ptr++)
+	hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_XL_HASH_SIZE);
+    return hash;
+}
+
+PRIVATE HTList * cache_list (int hash)
+{
+    if (!CacheTable) {
+	if ((CacheTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE,
+						sizeof(HTList *))) == NULL)
+	    HT_OUTOFMEM("cache_list");
     }
-    return NO;
+    if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
+    return CacheTable[hash];
 }
 
 /*
-**	Walk through the list of cached objects and save them to disk.
-**	We override any existing version but that is normally OK as we have
-**	already read its contents.
+**  Fill in the expire information we have in the index for this entry
 */
-PUBLIC BOOL HTCacheIndex_write (const char * cache_root)
+PRIVATE void cache_anchor (HTCache * cache)
+{
+    HTAnchor * anchor = HTAnchor_findAddress(cache->url);
+    HTParentAnchor * parent = HTAnchor_parent(anchor);
+    HTAnchor_setExpires(parent, cache->expires);
+    HTAnchor_setLastModified(parent, cache->lm);
+    if (cache->etag) HTAnchor_setEtag(parent, cache->etag);
+}
+
+/*
+**  The binary index is a header followed by an open addressed hash table
+**  of fixed size records keyed by a hash of the URL and then a string area
+**  containing the URLs, file names and etags. The file is mapped into
+**  memory (or read in one go if we can't map it) and records are only
+**  turned into HTCache objects the first time they are looked up. That way
+**  opening the index doesn't depend on the number of entries. Changes are
+**  appended to a journal which is folded into the index file in place once
+**  in a while: the records in the journal are written into their slots and
+**  new strings are appended to the string area. Deleted records stay in the
+**  table marked as deleted so that we don't break the probe sequence of
+**  other records. The header is written last. The table is only rebuilt
+**  when it gets half full or when most of the string area is garbage.
+*/
+#define HT_INDEX_MAGIC		0x57334349			   /* "W3CI" */
+#define HT_JOURNAL_MAGIC	0x5733434A			   /* "W3CJ" */
+#define HT_INDEX_VERSION	2
+#define HT_INDEX_MIN_SLOTS	64
+
+#define INDEX_RANGE		0x1
+#define INDEX_REVALIDATE	0x2
+#define INDEX_DELETED		0x4
+
+#define JOURNAL_PUT		1
+#define JOURNAL_DELETE		2
+
+typedef struct _HTIndexHeader {
+    unsigned int	magic;			/* Also detects byte order */
+    unsigned int	version;
+    unsigned int	record_size;		 /* Also detects word sizes */
+    unsigned int	slots;			 /* Always a power of two */
+    unsigned int	entries;			     /* Live records */
+    unsigned int	used;			 /* Live and deleted records */
+    unsigned int	strings;		  /* Size of string area */
+    unsigned int	garbage;	    /* Strings no record points to */
+    long		content_size;
+} HTIndexHeader;
+
+typedef struct _HTIndexRecord {
+    unsigned int	key;			/* URL hash - 0 is free */
+    unsigned int	flags;
+    int			hash;
+    int			hits;
+    long		size;
+    time_t		lm;
+    time_t		expires;
+    time_t		freshness_lifetime;
+    time_t		response_time;
+    time_t		corrected_initial_age;
+    unsigned int	url;		    /* Offsets into string area */
+    unsigned int	cachename;
+    unsigned int	etag;				  /* 0 is no etag */
+} HTIndexRecord;
+
+typedef struct _HTJournalFile {
+    unsigned int	magic;
+    unsigned int	version;		  /* Same as for the index */
+    unsigned int	record_size;
+} HTJournalFile;
+
+typedef struct _HTJournalHeader {
+    unsigned int	op;
+    unsigned int	length;		  /* Size of strings after record */
+} HTJournalHeader;
+
+PRIVATE char *		IndexBase = NULL;		  /* The whole file */
+PRIVATE long		IndexLength = 0;
+PRIVATE BOOL		IndexMapped = NO;
+PRIVATE HTIndexRecord *	IndexRecords = NULL;
+PRIVATE unsigned int	IndexSlots = 0;
+PRIVATE const char *	IndexStrings = NULL;
+PRIVATE unsigned int	IndexStringSize = 0;
+PRIVATE unsigned char *	IndexTaken = NULL;    /* Slots loaded or deleted */
+PRIVATE unsigned int	IndexCold = 0;	   /* Live records not taken (max) */
+PRIVATE unsigned int	IndexCursor = 0;	/* Where the gc left off */
+
+PRIVATE FILE *		JournalFp = NULL;
+PRIVATE int		journal_entries = 0;
+
+PRIVATE unsigned int index_key (const char * url)
+{
+    unsigned int key = 2166136261U;
+    while (*url) {
+	key ^= *(unsigned char *) url++;
+	key *= 16777619U;
+    }
+    return key ? key : 1;
+}
+
+PRIVATE long index_size (HTIndexHeader * header)
 {
-    if (cache_root && CacheTable) {
-	char * index = cache_index_name(cache_root);
-	FILE * fp = NULL;
-	HTTRACE(CACHE_TRACE, "Cache Index. Writing index `%s\'\n" _ index);
+    return (long) sizeof(HTIndexHeader) + (long) header->slots *
+	(long) sizeof(HTIndexRecord) + (long) header->strings;
+}
 
-	/*
-	**  Open the file for writing. Note - we don't take a backup!
-	**  This should probably be fixed!
-	*/
-	if (!index) return NO;
-	if ((fp = fopen(index, "wb")) == NULL) {
-	    HTTRACE(CACHE_TRACE, "Cache Index. Can't open `%s\' for writing\n" _ index);
-	    HT_FREE(index);
+PRIVATE BOOL index_valid (HTIndexHeader * header, long length)
+{
+    return (header->magic == HT_INDEX_MAGIC &&
+	    header->version == HT_INDEX_VERSION &&
+	    header->record_size == sizeof(HTIndexRecord) &&
+	    header->slots && !(header->slots & (header->slots-1)) &&
+	    header->entries <= header->used && header->used < header->slots &&
+	    header->strings && index_size(header) <= length);
+}
+
+/*
+**  Unmapping the index keeps track of which slots are taken. As long as
+**  the table isn't rebuilt the records stay in their slots.
+*/
+PRIVATE void index_unmap (void)
+{
+    if (IndexBase) {
+#ifdef HT_CACHE_MMAP
+	if (IndexMapped)
+	    munmap(IndexBase, (size_t) IndexLength);
+	else
+#endif
+	    HT_FREE(IndexBase);
+	IndexBase = NULL;
+    }
+    IndexLength = 0;
+    IndexMapped = NO;
+    IndexRecords = NULL;
+    IndexStrings = NULL;
+    IndexStringSize = 0;
+}
+
+PRIVATE void index_close (void)
+{
+    index_unmap();
+    HT_FREE(IndexTaken);
+    IndexSlots = 0;
+    IndexCold = 0;
+    IndexCursor = 0;
+}
+
+PRIVATE BOOL index_isOpen (void)
+{
+    return IndexRecords != NULL;
+}
+
+/*
+**  Map the binary index into memory. The mapping is read only - which
+**  records we have loaded or deleted since is kept on the side. The file
+**  may be longer than what the header says if we crashed while folding.
+*/
+PRIVATE BOOL index_open (const char * cache_root)
+{
+    char * name = cache_file_name(cache_root, HT_CACHE_BINDEX);
+    struct stat stat_info;
+    HTIndexHeader * header;
+    if (!name) return NO;
+    if (HT_STAT(name, &stat_info) == -1 ||
+	(long) stat_info.st_size < (long) sizeof(HTIndexHeader)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. No binary index `%s\'\n" _ name);
+	HT_FREE(name);
+	return NO;
+    }
+    IndexLength = (long) stat_info.st_size;
+#ifdef HT_CACHE_MMAP
+    {
+	int fd = open(name, O_RDONLY);
+	if (fd >= 0) {
+	    void * base = mmap(NULL, (size_t) IndexLength, PROT_READ,
+			       MAP_SHARED, fd, 0);
+	    if (base != MAP_FAILED) {
+		IndexBase = (char *) base;
+		IndexMapped = YES;
+	    }
+	    close(fd);
+	}
+    }
+#endif
+    if (!IndexBase) {
+	FILE * fp;
+	if ((IndexBase = (char *) HT_MALLOC(IndexLength)) == NULL)
+	    HT_OUTOFMEM("index_open");
+	if ((fp = fopen(name, "rb")) == NULL ||
+	    fread(IndexBase, 1, IndexLength, fp) != (size_t) IndexLength) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Can't read `%s\'\n" _ name);
+	    if (fp) fclose(fp);
+	    index_close();
+	    HT_FREE(name);
 	    return NO;
 	}
+	fclose(fp);
+    }
 
-	/*
-	**  Walk through the list and write it out. The format is really
-	**  simple as we keep it all in ASCII.
-	*/
-	{
-	    HTList * cur;
-	    int cnt;
-	    for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-		if ((cur = CacheTable[cnt])) { 
-		    HTCache * pres;
-		    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-			if (fprintf(fp, "%s %s %s %ld %ld %ld %c %d %d %ld %ld %ld %c\r\n",
-				    pres->url,
-				    pres->cachename,
-				    pres->etag ? pres->etag : HT_CACHE_EMPTY_ETAG,
-				    (long) (pres->lm),
-				    (long) (pres->expires),
-				    pres->size,
-				    pres->range+0x30,
-				    pres->hash,
-				    pres->hits,
-				    (long) (pres->freshness_lifetime),
-				    (long) (pres->response_time),
-				    (long) (pres->corrected_initial_age),
-				    pres->must_revalidate+0x30) < 0) {
-			    HTTRACE(CACHE_TRACE, "Cache Index. Error writing cache index\n");
-			    return NO;
-			}
-		    }
-		}
+    /*
+    **  Check that this is an index we can use. If not then we start with
+    **  an empty cache and the index will be overwritten next time it is
+    **  written.
+    */
+    header = (HTIndexHeader *) IndexBase;
+    if (!index_valid(header, IndexLength) ||
+	IndexBase[index_size(header)-1] != '\0') {
+	HTTRACE(CACHE_TRACE, "Cache Index. Bad binary index `%s\'\n" _ name);
+	index_close();
+	HT_FREE(name);
+	return NO;
+    }
+    IndexRecords = (HTIndexRecord *) (IndexBase + sizeof(HTIndexHeader));
+    if (IndexSlots != header->slots) {
+	HT_FREE(IndexTaken);
+	IndexSlots = header->slots;
+	IndexCold = header->entries;
+	IndexCursor = 0;
+    }
+    IndexStrings = (const char *) (IndexRecords + IndexSlots);
+    IndexStringSize = header->strings;
+    HTTRACE(CACHE_TRACE, "Cache Index. Opened `%s\' with %u entries\n" _
+	    name _ header->entries);
+    HT_FREE(name);
+    return YES;
+}
+
+PRIVATE BOOL index_taken (unsigned int slot)
+{
+    return (IndexTaken && (IndexTaken[slot >> 3] & (1 << (slot & 7))));
+}
+
+PRIVATE void index_mark (unsigned int slot)
+{
+    if (!IndexTaken &&
+	(IndexTaken = (unsigned char *) HT_CALLOC(IndexSlots/8 + 1, 1)) == NULL)
+	HT_OUTOFMEM("index_mark");
+    IndexTaken[slot >> 3] |= 1 << (slot & 7);
+}
+
+/*
+**  Take a live record that we are going to load or delete
+*/
+PRIVATE void index_take (unsigned int slot)
+{
+    if (!index_taken(slot)) {
+	index_mark(slot);
+	if (IndexCold > 0) IndexCold--;
+    }
+}
+
+/*
+**  Create a cache object from a record in the binary index and add it
+**  to the cache table. The size is already included in the total size.
+*/
+PRIVATE HTCache * index_load (unsigned int slot, BOOL used)
+{
+    HTIndexRecord * record = IndexRecords + slot;
+    HTCache * cache;
+    index_take(slot);
+    if (record->url >= IndexStringSize ||
+	record->cachename >= IndexStringSize ||
+	record->etag >= IndexStringSize ||
+	record->hash < 0 || record->hash >= HT_XL_HASH_SIZE) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Bad record %p\n" _ record);
+	HTCacheContentSize -= record->size;
+	return NULL;
+    }
+    if ((cache = (HTCache *) HT_CALLOC(1, sizeof(HTCache))) == NULL)
+	HT_OUTOFMEM("index_load");
+    StrAllocCopy(cache->url, IndexStrings + record->url);
+    StrAllocCopy(cache->cachename, IndexStrings + record->cachename);
+    if (record->etag) StrAllocCopy(cache->etag, IndexStrings + record->etag);
+    cache->hash = record->hash;
+    cache->hits = record->hits;
+    cache->size = record->size;
+    cache->range = (record->flags & INDEX_RANGE) ? YES : NO;
+    cache->must_revalidate = (record->flags & INDEX_REVALIDATE) ? YES : NO;
+    cache->lm = record->lm;
+    cache->expires = record->expires;
+    cache->freshness_lifetime = record->freshness_lifetime;
+    cache->response_time = record->response_time;
+    cache->corrected_initial_age = record->corrected_initial_age;
+    cache_anchor(cache);
+    HTList_addObject(cache_list(cache->hash), (void *) cache);
+    lru_insert(cache, used);
+    return cache;
+}
+
+/*
+**  Find the slot of a URL in the binary index which hasn't been loaded or
+**  deleted yet. Returns IndexSlots if not found.
+*/
+PRIVATE unsigned int index_find (const char * url)
+{
+    unsigned int key = index_key(url);
+    unsigned int mask = IndexSlots - 1;
+    unsigned int slot = key & mask;
+    unsigned int probes;
+    if (!IndexRecords) return IndexSlots;
+    for (probes = 0; probes < IndexSlots; probes++) {
+	HTIndexRecord * record = IndexRecords + slot;
+	if (!record->key) break;
+	if (record->key == key && !(record->flags & INDEX_DELETED) &&
+	    !index_taken(slot) && record->url < IndexStringSize &&
+	    !strcmp(IndexStrings + record->url, url))
+	    return slot;
+	slot = (slot + 1) & mask;
+    }
+    return IndexSlots;
+}
+
+PRIVATE HTCache * index_lookup (const char * url)
+{
+    unsigned int slot = index_find(url);
+    return slot < IndexSlots ? index_load(slot, YES) : NULL;
+}
+
+/*
+**  An entry has been deleted but the index doesn't know until the journal
+**  is folded into it. Make sure that we don't load it again meanwhile.
+*/
+PRIVATE void index_forget (const char * url)
+{
+    unsigned int slot = index_find(url);
+    if (slot < IndexSlots) index_take(slot);
+}
+
+/*
+**  Once the journal has been folded into the index, the records of the
+**  entries that we already have in memory are not taken anymore. This
+**  checks whether we have one in memory.
+*/
+PRIVATE BOOL index_resident (HTIndexRecord * record)
+{
+    if (CacheTable && record->url < IndexStringSize &&
+	record->hash >= 0 && record->hash < HT_XL_HASH_SIZE) {
+	HTList * cur = CacheTable[record->hash];
+	HTCache * pres;
+	while ((pres = (HTCache *) HTList_nextObject(cur)))
+	    if (!strcmp(pres->url, IndexStrings + record->url)) return YES;
+    }
+    return NO;
+}
+
+/*
+**  Remove the cached files of a record which isn't loaded
+*/
+PRIVATE void index_flush (HTIndexRecord * record)
+{
+    if (record->cachename && record->cachename < IndexStringSize) {
+	const char * name = IndexStrings + record->cachename;
+	char * meta = NULL;
+	StrAllocMCopy(&meta, name, HT_CACHE_META, NULL);
+	REMOVE(name);
+	REMOVE(meta);
+	HT_FREE(meta);
+    }
+}
+
+/*
+**  Find a cache object in memory or in the binary index
+*/
+PRIVATE HTCache * find_object (const char * url, int hash)
+{
+    HTList * cur = CacheTable ? CacheTable[hash] : NULL;
+    HTCache * pres;
+    while ((pres = (HTCache *) HTList_nextObject(cur)))
+	if (!strcmp(pres->url, url)) return pres;
+    return index_lookup(url);
+}
+
+PRIVATE unsigned int put_string (HTChunk * strings, const char * str)
+{
+    unsigned int offset = (unsigned int) HTChunk_size(strings);
+    HTChunk_putb(strings, str, (int) strlen(str) + 1);
+    return offset;
+}
+
+/*
+**  Fill in a record and add the strings to the string area which must
+**  start with a '\0' so that offset 0 can be used for "no etag".
+*/
+PRIVATE void cache_record (HTCache * cache, HTIndexRecord * record,
+			   HTChunk * strings)
+{
+    record->key = index_key(cache->url);
+    record->flags = (cache->range ? INDEX_RANGE : 0) |
+	(cache->must_revalidate ? INDEX_REVALIDATE : 0);
+    record->hash = cache->hash;
+    record->hits = cache->hits;
+    record->size = cache->size;
+    record->lm = cache->lm;
+    record->expires = cache->expires;
+    record->freshness_lifetime = cache->freshness_lifetime;
+    record->response_time = cache->response_time;
+    record->corrected_initial_age = cache->corrected_initial_age;
+    record->url = put_string(strings, cache->url);
+    record->cachename = put_string(strings, cache->cachename ? cache->cachename : "");
+    record->etag = cache->etag ? put_string(strings, cache->etag) : 0;
+}
+
+/*
+**  Open the journal for appending. A new journal starts with a header so
+**  that we don't replay a file that isn't ours.
+*/
+PRIVATE BOOL journal_open (const char * cache_root)
+{
+    if (!JournalFp && cache_root) {
+	char * name = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+	JournalFp = fopen(name, "ab");
+	HT_FREE(name);
+	if (!JournalFp) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Can't open journal\n");
+	    return NO;
+	}
+	if (fseek(JournalFp, 0, SEEK_END) == 0 && ftell(JournalFp) == 0) {
+	    HTJournalFile file;
+	    file.magic = HT_JOURNAL_MAGIC;
+	    file.version = HT_INDEX_VERSION;
+	    file.record_size = sizeof(HTIndexRecord);
+	    if (fwrite(&file, sizeof(HTJournalFile), 1, JournalFp) != 1) {
+		HTTRACE(CACHE_TRACE, "Cache Index. Error writing journal\n");
+		fclose(JournalFp);
+		JournalFp = NULL;
+		return NO;
 	    }
 	}
+    }
+    return JournalFp != NULL;
+}
 
-	/* Done writing */
+/*
+**  Append an update to the journal. The journal is flushed for every
+**  entry so that we don't loose more than the last one if we crash.
+*/
+PRIVATE BOOL journal_append (int op, HTIndexRecord * record, HTChunk * strings)
+{
+    if (journal_open(HTCacheRoot)) {
+	HTJournalHeader header;
+	BOOL status = YES;
+	header.op = op;
+	header.length = HTChunk_size(strings);
+	if (fwrite(&header, sizeof(HTJournalHeader), 1, JournalFp) != 1 ||
+	    fwrite(record, sizeof(HTIndexRecord), 1, JournalFp) != 1 ||
+	    fwrite(HTChunk_data(strings), 1, header.length, JournalFp) != header.length ||
+	    fflush(JournalFp) == EOF) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Error writing journal\n");
+	    status = NO;
+	}
+	journal_entries++;
+	return status;
+    }
+    return NO;
+}
+
+PRIVATE BOOL journal_write (int op, HTCache * cache)
+{
+    if (cache) {
+	HTIndexRecord record;
+	HTChunk * strings = HTChunk_new(256);
+	BOOL status;
+	HTChunk_putc(strings, '\0');
+	memset(&record, 0, sizeof(HTIndexRecord));
+	cache_record(cache, &record, strings);
+	status = journal_append(op, &record, strings);
+	HTChunk_delete(strings);
+	return status;
+    }
+    return NO;
+}
+
+PRIVATE void journal_close (void)
+{
+    if (JournalFp) {
+	fclose(JournalFp);
+	JournalFp = NULL;
+    }
+    journal_entries = 0;
+}
+
+/*
+**  Remove an entry that is only in the index from disk and from the index
+*/
+PRIVATE void index_remove (unsigned int slot)
+{
+    HTIndexRecord * record = IndexRecords + slot;
+    HTTRACE(CACHE_TRACE, "Cache Index. Evicting record %u\n" _ slot);
+    index_take(slot);
+    if (record->url < IndexStringSize && record->cachename < IndexStringSize &&
+	record->hash >= 0 && record->hash < HT_XL_HASH_SIZE) {
+	HTIndexRecord entry = *record;
+	HTChunk * strings = HTChunk_new(256);
+	HTChunk_putc(strings, '\0');
+	entry.url = put_string(strings, IndexStrings + record->url);
+	entry.cachename = put_string(strings, IndexStrings + record->cachename);
+	entry.etag = 0;
+	journal_append(JOURNAL_DELETE, &entry, strings);
+	HTChunk_delete(strings);
+	index_flush(record);
+    }
+    HTCacheContentSize -= record->size;
+}
+
+/*
+**  Remove entries that are only in the index directly from the index and
+**  from disk. They haven't been looked up since the index was opened so
+**  they are colder than anything we have in memory. We go on from where
+**  we stopped last time and stop when there are no such entries left so
+**  that the gc doesn't walk the index again and again. If `expendable'
+**  then we only look at the next HT_CACHE_GC_WINDOW of them and only take
+**  those that are stale or too big.
+*/
+PRIVATE void index_evict (BOOL expendable)
+{
+    unsigned int slot = IndexCursor;
+    unsigned int probes;
+    int cnt = 0;
+    if (!IndexRecords) return;
+    for (probes = 0; probes < IndexSlots && IndexCold > 0 && !stopGC(); probes++) {
+	HTIndexRecord * record = IndexRecords + slot;
+	if (record->key && !(record->flags & INDEX_DELETED) && !index_taken(slot)) {
+	    if (index_resident(record))
+		index_take(slot);
+	    else if (!expendable ||
+		     gc_expendable(record->size, record->freshness_lifetime,
+				   record->response_time,
+				   record->corrected_initial_age))
+		index_remove(slot);
+	    if (expendable && ++cnt >= HT_CACHE_GC_WINDOW) break;
+	}
+	slot = (slot + 1) & (IndexSlots - 1);
+	if (!expendable) IndexCursor = slot;
+    }
+    if (!expendable && probes == IndexSlots) IndexCold = 0;
+}
+
+/*
+**  Read the journal into memory. A journal without a valid header is
+**  removed instead of replayed.
+*/
+PRIVATE char * journal_load (const char * name, long * length)
+{
+    struct stat stat_info;
+    HTJournalFile file;
+    char * data = NULL;
+    FILE * fp;
+    if (HT_STAT(name, &stat_info) == -1 || (fp = fopen(name, "rb")) == NULL)
+	return NULL;
+    *length = (long) stat_info.st_size;
+    if (*length > 0) {
+	if ((data = (char *) HT_MALLOC(*length)) == NULL)
+	    HT_OUTOFMEM("journal_load");
+	*length = (long) fread(data, 1, *length, fp);
+    }
+    fclose(fp);
+    if (data && *length >= (long) sizeof(HTJournalFile))
+	memcpy(&file, data, sizeof(HTJournalFile));
+    if (!data || *length < (long) sizeof(HTJournalFile) ||
+	file.magic != HT_JOURNAL_MAGIC || file.version != HT_INDEX_VERSION ||
+	file.record_size != sizeof(HTIndexRecord)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Ignoring bad journal `%s\'\n" _ name);
+	HT_FREE(data);
+	REMOVE(name);
+	return NULL;
+    }
+    return data;
+}
+
+/*
+**  Get the next entry from the journal. A truncated entry at the end (if
+**  we crashed while writing it) ends the journal.
+*/
+PRIVATE BOOL journal_next (const char * data, long length, long * pos,
+			   HTJournalHeader * header, HTIndexRecord * record,
+			   const char ** strings)
+{
+    if (*pos + (long) (sizeof(HTJournalHeader) + sizeof(HTIndexRecord)) > length)
+	return NO;
+    memcpy(header, data + *pos, sizeof(HTJournalHeader));
+    memcpy(record, data + *pos + sizeof(HTJournalHeader), sizeof(HTIndexRecord));
+    *strings = data + *pos + sizeof(HTJournalHeader) + sizeof(HTIndexRecord);
+    if (header->length == 0 ||
+	(long) header->length > length - (*strings - data) ||
+	(*strings)[header->length-1] != '\0' ||
+	record->url >= header->length || record->cachename >= header->length ||
+	record->etag >= header->length ||
+	record->hash < 0 || record->hash >= HT_XL_HASH_SIZE ||
+	(header->op != JOURNAL_PUT && header->op != JOURNAL_DELETE)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Journal truncated at %ld\n" _ *pos);
+	return NO;
+    }
+    *pos += sizeof(HTJournalHeader) + sizeof(HTIndexRecord) + header->length;
+    return YES;
+}
+
+/*
+**  Random access to the index file while we fold the journal into it
+*/
+PRIVATE BOOL file_read (FILE * fp, long pos, void * data, size_t length)
+{
+    return (fseek(fp, pos, SEEK_SET) == 0 &&
+	    fread(data, 1, length, fp) == length);
+}
+
+PRIVATE BOOL file_write (FILE * fp, long pos, const void * data, size_t length)
+{
+    return (fseek(fp, pos, SEEK_SET) == 0 &&
+	    fwrite(data, 1, length, fp) == length);
+}
+
+PRIVATE long record_pos (unsigned int slot)
+{
+    return (long) sizeof(HTIndexHeader) + (long) slot * (long) sizeof(HTIndexRecord);
+}
+
+PRIVATE long string_pos (HTIndexHeader * header, unsigned int offset)
+{
+    return record_pos(header->slots) + (long) offset;
+}
+
+PRIVATE BOOL file_string_is (FILE * fp, HTIndexHeader * header,
+			     unsigned int offset, const char * str)
+{
+    BOOL match = NO;
+    if (offset < header->strings) {
+	size_t length = strlen(str) + 1;
+	char * data;
+	if ((data = (char *) HT_MALLOC(length)) == NULL)
+	    HT_OUTOFMEM("file_string_is");
+	match = (file_read(fp, string_pos(header, offset), data, length) &&
+		 !memcmp(data, str, length));
+	HT_FREE(data);
+    }
+    return match;
+}
+
+/*
+**  Append a string to the string area. Returns 0 on error
+*/
+PRIVATE unsigned int file_put_string (FILE * fp, HTIndexHeader * header,
+				      const char * str)
+{
+    unsigned int offset = header->strings;
+    size_t length = strlen(str) + 1;
+    if (!file_write(fp, string_pos(header, offset), str, length)) return 0;
+    header->strings += length;
+    return offset;
+}
+
+/*
+**  Open the index file for updating. If we don't have a usable one then
+**  we start a new empty one.
+*/
+PRIVATE FILE * index_file (const char * name, HTIndexHeader * header)
+{
+    FILE * fp = fopen(name, "r+b");
+    if (fp) {
+	long length = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+	char last = '\1';
+	if (file_read(fp, 0, header, sizeof(HTIndexHeader)) &&
+	    index_valid(header, length) &&
+	    file_read(fp, index_size(header)-1, &last, 1) && !last)
+	    return fp;
+	HTTRACE(CACHE_TRACE, "Cache Index. Replacing bad index `%s\'\n" _ name);
 	fclose(fp);
+    }
+    if ((fp = fopen(name, "w+b")) != NULL) {
+	HTIndexRecord record;
+	unsigned int slot;
+	memset(header, 0, sizeof(HTIndexHeader));
+	header->magic = HT_INDEX_MAGIC;
+	header->version = HT_INDEX_VERSION;
+	header->record_size = sizeof(HTIndexRecord);
+	header->slots = HT_INDEX_MIN_SLOTS;
+	header->strings = 1;
+	memset(&record, 0, sizeof(HTIndexRecord));
+	if (fwrite(header, sizeof(HTIndexHeader), 1, fp) == 1) {
+	    for (slot = 0; slot < header->slots; slot++)
+		if (fwrite(&record, sizeof(HTIndexRecord), 1, fp) != 1) break;
+	    if (slot == header->slots && fputc('\0', fp) != EOF) return fp;
+	}
+	HTTRACE(CACHE_TRACE, "Cache Index. Can't create `%s\'\n" _ name);
+	fclose(fp);
+    }
+    return NULL;
+}
+
+/*
+**  Write a new index with room for four times as many entries as we need
+**  now. Deleted records and strings that nobody points to are left
+**  behind. This takes time proportional to the size of the index but we
+**  only get here when the table is half full or when most of the string
+**  area is garbage so it is amortized over many updates.
+*/
+PRIVATE BOOL index_rebuild (const char * cache_root, FILE * fp,
+			    HTIndexHeader * header, unsigned int needed)
+{
+    char * index = cache_file_name(cache_root, HT_CACHE_BINDEX);
+    char * tmp = cache_file_name(cache_root, HT_CACHE_NEWINDEX);
+    long length = index_size(header) - (long) sizeof(HTIndexHeader);
+    HTIndexHeader new_header;
+    HTIndexRecord * records;
+    HTIndexRecord * old;
+    const char * old_strings;
+    HTChunk * strings;
+    unsigned int slots = HT_INDEX_MIN_SLOTS;
+    unsigned int slot;
+    BOOL status = YES;
+    HTTRACE(CACHE_TRACE, "Cache Index. Rebuilding `%s\' for %u entries\n" _
+	    index _ needed);
+    if ((old = (HTIndexRecord *) HT_MALLOC(length)) == NULL)
+	HT_OUTOFMEM("index_rebuild");
+    if (!file_read(fp, (long) sizeof(HTIndexHeader), old, (size_t) length)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Can't read `%s\'\n" _ index);
+	status = NO;
+    }
+    fclose(fp);
+    old_strings = (const char *) (old + header->slots);
+
+    while (slots < needed * 4) slots <<= 1;
+    if ((records = (HTIndexRecord *) HT_CALLOC(slots, sizeof(HTIndexRecord))) == NULL)
+	HT_OUTOFMEM("index_rebuild");
+    strings = HTChunk_new(4096);
+    HTChunk_putc(strings, '\0');
+    memset(&new_header, 0, sizeof(HTIndexHeader));
+    for (slot = 0; status == YES && slot < header->slots; slot++) {
+	HTIndexRecord * record = old + slot;
+	if (record->key && !(record->flags & INDEX_DELETED) &&
+	    record->url < header->strings &&
+	    record->cachename < header->strings &&
+	    record->etag < header->strings) {
+	    unsigned int pos = record->key & (slots-1);
+	    while (records[pos].key) pos = (pos + 1) & (slots-1);
+	    records[pos] = *record;
+	    records[pos].url = put_string(strings, old_strings + record->url);
+	    records[pos].cachename = put_string(strings, old_strings + record->cachename);
+	    records[pos].etag = record->etag ?
+		put_string(strings, old_strings + record->etag) : 0;
+	    new_header.entries++;
+	    new_header.content_size += record->size;
+	}
+    }
+    new_header.magic = HT_INDEX_MAGIC;
+    new_header.version = HT_INDEX_VERSION;
+    new_header.record_size = sizeof(HTIndexRecord);
+    new_header.slots = slots;
+    new_header.used = new_header.entries;
+    new_header.strings = HTChunk_size(strings);
+
+    if (status == YES) {
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Can't open `%s\' for writing\n" _ tmp);
+	    status = NO;
+	} else {
+	    if (fwrite(&new_header, sizeof(HTIndexHeader), 1, fp) != 1 ||
+		fwrite(records, sizeof(HTIndexRecord), slots, fp) != slots ||
+		fwrite(HTChunk_data(strings), 1, new_header.strings, fp) != new_header.strings) {
+		HTTRACE(CACHE_TRACE, "Cache Index. Error writing cache index\n");
+		status = NO;
+	    }
+	    if (fclose(fp) == EOF) status = NO;
+	    if (status == YES && rename(tmp, index) < 0) {
+		REMOVE(index);				  /* Needed on Windows */
+		if (rename(tmp, index) < 0) status = NO;
+	    }
+	    if (status == NO) REMOVE(tmp);
+	}
+    }
+    HT_FREE(old);
+    HT_FREE(records);
+    HTChunk_delete(strings);
+    HT_FREE(tmp);
+    HT_FREE(index);
+    return status;
+}
+
+/*
+**  Fold one journal entry into the index file. Strings that haven't
+**  changed are shared with the record already in the index.
+*/
+PRIVATE BOOL index_apply (FILE * fp, HTIndexHeader * header,
+			  HTJournalHeader * entry, HTIndexRecord * record,
+			  const char * strings, unsigned int * where)
+{
+    const char * url = strings + record->url;
+    const char * cachename = strings + record->cachename;
+    const char * etag = record->etag ? strings + record->etag : NULL;
+    unsigned int mask = header->slots - 1;
+    unsigned int slot;
+    unsigned int deleted = header->slots;
+    unsigned int probes;
+    HTIndexRecord old;
+    BOOL found = NO;
+    record->key = index_key(url);
+    slot = record->key & mask;
+    memset(&old, 0, sizeof(HTIndexRecord));
+    for (probes = 0; probes < header->slots; probes++) {
+	if (!file_read(fp, record_pos(slot), &old, sizeof(HTIndexRecord)))
+	    return NO;
+	if (!old.key) break;
+	if (old.flags & INDEX_DELETED) {
+	    if (deleted == header->slots) deleted = slot;
+	} else if (old.key == record->key &&
+		   file_string_is(fp, header, old.url, url)) {
+	    found = YES;
+	    break;
+	}
+	slot = (slot + 1) & mask;
+    }
+
+    if (entry->op == JOURNAL_DELETE) {
+	if (!found) return YES;
+	old.flags |= INDEX_DELETED;
+	header->entries--;
+	header->garbage += entry->length - 1;
+	header->content_size -= old.size;
+	return file_write(fp, record_pos(slot), &old, sizeof(HTIndexRecord));
+    }
+
+    if (found) {
+	header->content_size -= old.size;
+	record->url = old.url;
+	if (file_string_is(fp, header, old.cachename, cachename))
+	    record->cachename = old.cachename;
+	else {
+	    header->garbage += strlen(cachename) + 1;
+	    record->cachename = file_put_string(fp, header, cachename);
+	}
+	if (etag && old.etag && file_string_is(fp, header, old.etag, etag))
+	    record->etag = old.etag;
+	else {
+	    if (old.etag) header->garbage += etag ? strlen(etag) + 1 : 1;
+	    record->etag = etag ? file_put_string(fp, header, etag) : 0;
+	}
+    } else {
+	if (deleted < header->slots)
+	    slot = deleted;
+	else if (!old.key)
+	    header->used++;
+	else {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Index is full\n");
+	    return NO;
+	}
+	header->entries++;
+	record->url = file_put_string(fp, header, url);
+	record->cachename = file_put_string(fp, header, cachename);
+	record->etag = etag ? file_put_string(fp, header, etag) : 0;
+    }
+    if (!record->url || !record->cachename || (etag && !record->etag))
+	return NO;
+    record->flags &= INDEX_RANGE | INDEX_REVALIDATE;
+    header->content_size += record->size;
+    *where = slot;
+    return file_write(fp, record_pos(slot), record, sizeof(HTIndexRecord));
+}
+
+/*
+**  Fold the journal into the binary index and remove it. Only the records
+**  of the entries in the journal are touched. If the journal is going to
+**  fill the table more than half then we first rebuild it bigger. Entries
+**  that we have in memory are marked as taken in the new index.
+*/
+PRIVATE BOOL index_fold (const char * cache_root)
+{
+    char * index = cache_file_name(cache_root, HT_CACHE_BINDEX);
+    char * journal = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+    HTJournalHeader entry;
+    HTIndexRecord record;
+    HTIndexHeader header;
+    const char * strings;
+    unsigned int entries = 0;
+    unsigned int slot = 0;
+    BOOL rebuilt = NO;
+    long length = 0;
+    long pos;
+    BOOL status = YES;
+    char * data;
+    FILE * fp;
+
+    journal_close();
+    if ((data = journal_load(journal, &length)) == NULL) {
+	HT_FREE(journal);
+	HT_FREE(index);
+	return YES;
+    }
+    pos = sizeof(HTJournalFile);
+    while (journal_next(data, length, &pos, &entry, &record, &strings))
+	entries++;
+
+    if ((fp = index_file(index, &header)) != NULL &&
+	(header.used + entries >= header.slots / 2 ||
+	 header.garbage > header.strings / 2)) {
+	status = index_rebuild(cache_root, fp, &header, header.entries + entries);
+	fp = status ? index_file(index, &header) : NULL;
+	rebuilt = YES;
+    }
+    if (fp && (rebuilt || IndexSlots != header.slots)) {
+	HT_FREE(IndexTaken);
+	IndexSlots = header.slots;
+	IndexCold = header.entries + entries;
+	IndexCursor = 0;
+    }
+    if (fp) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Folding %u journal entries into `%s\'\n" _
+		entries _ index);
+	pos = sizeof(HTJournalFile);
+	while (status == YES &&
+	       journal_next(data, length, &pos, &entry, &record, &strings)) {
+	    status = index_apply(fp, &header, &entry, &record, strings, &slot);
+	    if (status == YES && entry.op == JOURNAL_PUT && CacheTable)
+		index_mark(slot);
+	}
+
+	/* The header goes last so that it only points to what is there */
+	if (status == YES &&
+	    (fflush(fp) == EOF ||
+	     !file_write(fp, 0, &header, sizeof(HTIndexHeader)))) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Error writing cache index\n");
+	    status = NO;
+	}
+	if (fclose(fp) == EOF) status = NO;
+    } else
+	status = NO;
+
+    /* If we didn't make it then the journal is replayed next time */
+    if (status == YES) REMOVE(journal);
+    HT_FREE(data);
+    HT_FREE(journal);
+    HT_FREE(index);
+    return status;
+}
+
+/*
+**  Remove the cache index files
+*/
+PUBLIC BOOL HTCacheIndex_delete (const char * cache_root)
+{
+    if (cache_root) {
+	char * index = cache_file_name(cache_root, HT_CACHE_INDEX);
+	REMOVE(index);
 	HT_FREE(index);
+	index = cache_file_name(cache_root, HT_CACHE_BINDEX);
+	REMOVE(index);
+	HT_FREE(index);
+	journal_close();
+	index = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+	REMOVE(index);
+	HT_FREE(index);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	Fold the journal into the binary index on disk. This only writes the
+**	entries that have changed since the last time and so doesn't depend
+**	on the number of entries in the cache. The index is mapped again
+**	afterwards.
+*/
+PUBLIC BOOL HTCacheIndex_write (const char * cache_root)
+{
+    if (cache_root) {
+	BOOL status;
+	index_unmap();
+	status = index_fold(cache_root);
+	if (!index_open(cache_root)) index_close();
+	return status;
     }
     return NO;
 }
 
 /*
-**	Load one line of index file
+**	Load one line of the old text index file
 **	Returns YES if line OK, else NO
 */
 PRIVATE BOOL HTCacheIndex_parseLine (char * line)
@@ -396,27 +1382,15 @@ PRIVATE BOOL HTCacheIndex_parseLine (char * line)
 	**  Create the new anchor and fill in the expire information we have read
 	**  in the index.
 	*/
-	if (cache) {
-	    HTAnchor * anchor = HTAnchor_findAddress(cache->url);
-	    HTParentAnchor * parent = HTAnchor_parent(anchor);
-	    HTAnchor_setExpires(parent, cache->expires);	    
-	    HTAnchor_setLastModified(parent, cache->lm);
-	    if (cache->etag) HTAnchor_setEtag(parent, cache->etag);
-	}
+	cache_anchor(cache);
 
 	/*
-	**  Create the cache table if not already existent and add the new
-	**  entry. Also check that the hash is still within bounds
+	**  Add the new entry to the cache table. Also check that the hash is
+	**  still within bounds
 	*/
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE,
-						    sizeof(HTList *))) == NULL)
-		HT_OUTOFMEM("HTCache_parseLine");
-	}
 	if (cache->hash >= 0 && cache->hash < HT_XL_HASH_SIZE) {
-	    int hash = cache->hash;
-	    if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	    HTList_addObject(CacheTable[hash], (void *) cache);
+	    HTList_addObject(cache_list(cache->hash), (void *) cache);
+	    lru_insert(cache, NO);
 	}
 
 	/* Update the total cache size */
@@ -544,40 +1518,86 @@ PRIVATE HTStream * HTCacheIndexReader (HTRequest *	request)
     return me;
 }
 
+/*
+**	Read the old text index through the cache index stream
+*/
+PRIVATE BOOL text_index_read (const char * cache_root)
+{
+    BOOL status = NO;
+    BOOL wasInteractive;
+    char * file = cache_file_name(cache_root, HT_CACHE_INDEX);
+    char * index = HTLocalToWWW(file, "cache:");
+    HTAnchor * anchor = HTAnchor_findAddress(index);	
+    HTRequest * request = HTRequest_new();
+    HTRequest_setPreemptive(request, YES);
+    HTRequest_setOutputFormat(request, WWW_SOURCE);
+
+    /* Make sure we don't use any filters */
+    HTRequest_addBefore(request, NULL, NULL, NULL, 0, YES);
+    HTRequest_addAfter(request, NULL, NULL, NULL, HT_ALL, 0, YES);
+
+    /* Set the output */    
+    HTRequest_setOutputStream(request, HTCacheIndexReader(request));
+    HTRequest_setAnchor(request, anchor);
+    HTAnchor_setFormat((HTParentAnchor *) anchor, HTAtom_for("www/cache-index"));
+    wasInteractive = HTAlert_interactive();
+    HTAlert_setInteractive(NO);
+    status = HTLoad(request, NO);
+    HTAlert_setInteractive(wasInteractive);
+    HTRequest_delete(request);
+    HT_FREE(file);
+    HT_FREE(index);
+    return status;
+}
+
+/*
+**	Convert an old text index to the binary format. Like reading the
+**	index, this can only be done when there are no entries in memory. All
+**	the entries go through the journal into a new index.
+*/
+PUBLIC BOOL HTCacheIndex_convert (const char * cache_root)
+{
+    if (cache_root && CacheTable == NULL && IndexBase == NULL) {
+	text_index_read(cache_root);
+	if (CacheTable && journal_open(cache_root)) {
+	    int cnt;
+	    HTTRACE(CACHE_TRACE, "Cache Index. Converting text index to binary\n");
+	    for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
+		HTList * cur = CacheTable[cnt];
+		HTCache * pres;
+		while ((pres = (HTCache *) HTList_nextObject(cur)))
+		    journal_write(JOURNAL_PUT, pres);
+	    }
+	    if (HTCacheIndex_write(cache_root)) {
+		char * index = cache_file_name(cache_root, HT_CACHE_INDEX);
+		REMOVE(index);
+		HT_FREE(index);
+		return YES;
+	    }
+	}
+    }
+    return NO;
+}
+
 /*
 **	Read the saved set of cached entries from disk. we only allow the index
 **	ro be read when there is no entries in memory. That way we can ensure
-**	consistancy.
+**	consistancy. A journal left over from last time is folded into the
+**	index first. If we only find an old text index then it is converted.
 */
 PUBLIC BOOL HTCacheIndex_read (const char * cache_root)
 {
-    BOOL status = NO;
-    if (cache_root && CacheTable == NULL) {
-	BOOL wasInteractive;
-	char * file = cache_index_name(cache_root);
-	char * index = HTLocalToWWW(file, "cache:");
-	HTAnchor * anchor = HTAnchor_findAddress(index);	
-	HTRequest * request = HTRequest_new();
-	HTRequest_setPreemptive(request, YES);
-	HTRequest_setOutputFormat(request, WWW_SOURCE);
-
-	/* Make sure we don't use any filters */
-	HTRequest_addBefore(request, NULL, NULL, NULL, 0, YES);
-	HTRequest_addAfter(request, NULL, NULL, NULL, HT_ALL, 0, YES);
-
-	/* Set the output */    
-	HTRequest_setOutputStream(request, HTCacheIndexReader(request));
-	HTRequest_setAnchor(request, anchor);
-	HTAnchor_setFormat((HTParentAnchor *) anchor, HTAtom_for("www/cache-index"));
-	wasInteractive = HTAlert_interactive();
-	HTAlert_setInteractive(NO);
-	status = HTLoad(request, NO);
-	HTAlert_setInteractive(wasInteractive);
-	HTRequest_delete(request);
-	HT_FREE(file);
-	HT_FREE(index);
+    if (cache_root && CacheTable == NULL && IndexBase == NULL) {
+	index_fold(cache_root);
+	if (index_open(cache_root)) {
+	    HTIndexHeader * header = (HTIndexHeader *) IndexBase;
+	    HTCacheContentSize += header->content_size;
+	    IndexCold = header->entries;
+	    return YES;
+	}
+	return HTCacheIndex_convert(cache_root);
     }
-    return status;
+    return NO;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -796,7 +1816,7 @@ PUBLIC BOOL HTCacheTerminate (void)
     if (HTCacheInitialized) {
 
 	/*
-	**  Write the index to file
+	**  Fold the journal into the index on file
 	*/
 	HTCacheIndex_write(HTCacheRoot);
 
@@ -958,6 +1978,7 @@ PUBLIC int HTCacheMode_DefaultExpiration (void)
 
 PRIVATE BOOL free_object (HTCache * me)
 {
+    lru_unlink(me);
     HT_FREE(me->url);
     HT_FREE(me->cachename);
     HT_FREE(me->etag);
@@ -1105,26 +2126,13 @@ PRIVATE HTCache * HTCache_new (HTRequest * request, HTResponse * response,
     
     /* Find a hash for this anchor */
     if ((url = HTAnchor_address((HTAnchor *) anchor))) {
-	char * ptr;
-	for (ptr=url; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_XL_HASH_SIZE);
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE,
-						   sizeof(HTList *))) == NULL)
-	        HT_OUTOFMEM("HTCache_new");
-	}
-	if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	list = CacheTable[hash];
+	hash = cache_hash(url);
+	list = cache_list(hash);
     } else
 	return NULL;
 
     /* Search the cache */
-    {
-	HTList * cur = list;
-	while ((pres = (HTCache *) HTList_nextObject(cur))) {
-	    if (!strcmp(pres->url, url)) break;
-	}
-    }
+    pres = find_object(url, hash);
 
     /* If not found then create new cache object, else use existing one */
     if (!pres) {
@@ -1135,9 +2143,11 @@ PRIVATE HTCache * HTCache_new (HTRequest * request, HTResponse * response,
 	pres->range = NO;
 	HTCache_createLocation(pres);
 	HTList_addObject(list, (void *) pres);
-	new_entries++;
-    } else
+	lru_insert(pres, YES);
+    } else {
 	HT_FREE(url);
+	lru_hit(pres);
+    }
 
     if (HTCache_hasLock(pres)) {
 	if (HTCache_breakLock(pres, request) == NO) {
@@ -1181,8 +2191,9 @@ PUBLIC HTCache * HTCache_touch (HTRequest * request, HTResponse * response,
 
     /* We don't have any of the data in cache - only meta information */
     if (cache) {
-	cache->size = 0;
+	lru_setSize(cache, 0);
 	cache->range = YES;
+	journal_write(JOURNAL_PUT, cache);
     }
 
     return cache;
@@ -1401,7 +2412,7 @@ PRIVATE int HTCacheCheckFilter (HTRequest * request, HTResponse * response,
 		*/
 		if (status == 204) {
 		    HTCache_updateMeta(cache, request, response);
-		    cache->size = 0;
+		    lru_setSize(cache, 0);
 		    cache->range = YES;
 		    /* @@ JK: update the cache meta data on disk */
 		    HTCache_writeMeta (cache, request, response);
@@ -1433,7 +2444,7 @@ PRIVATE BOOL HTCache_setSize (HTCache * cache, long written, BOOL append)
 	**  (in case the download was interrupted)
 	*/
 	if (cache->size > 0 && !append) HTCacheContentSize -= cache->size;
-	cache->size = written;
+	lru_setSize(cache, written);
 	HTCacheContentSize += written;
 
 	/*
@@ -1457,39 +2468,21 @@ PRIVATE BOOL HTCache_setSize (HTCache * cache, long written, BOOL append)
 */
 PUBLIC HTCache * HTCache_find (HTParentAnchor * anchor, char * default_name)
 {
-    HTList * list = NULL;
     HTCache * pres = NULL;
 
     /* Find a hash entry for this URL */
-    if (HTCacheMode_enabled() && anchor && CacheTable) {
+    if (HTCacheMode_enabled() && anchor && (CacheTable || IndexRecords)) {
 	char * url = NULL;
-	int hash = 0;
-	char * ptr;
 
 	if (default_name)
 	    StrAllocCopy (url, default_name);
 	  else
 	    url = HTAnchor_address((HTAnchor *) anchor);
-	ptr = url;
-
-	for (; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_XL_HASH_SIZE);
-	if (!CacheTable[hash]) {
-	    HT_FREE(url);
-	    return NULL;
-	}
-	list = CacheTable[hash];
 
 	/* Search the cache */
-	{
-	    HTList * cur = list;
-	    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-		if (!strcmp(pres->url, url)) {
-		    HTTRACE(CACHE_TRACE, "Cache....... Found %p hits %d\n" _ 
-					     pres _ pres->hits);
-		    break;
-		}
-	    }
+	if ((pres = find_object(url, cache_hash(url)))) {
+	    HTTRACE(CACHE_TRACE, "Cache....... Found %p hits %d\n" _ 
+				     pres _ pres->hits);
 	}
 	HT_FREE(url);
     }
@@ -1504,6 +2497,10 @@ PRIVATE BOOL HTCache_delete (HTCache * cache)
 {
     if (cache && CacheTable) {
 	HTList * cur = CacheTable[cache->hash];
+	if (cur) {
+	    journal_write(JOURNAL_DELETE, cache);
+	    index_forget(cache->url);
+	}
 	return cur && delete_object(cur, cache);
     }
     return NO;
@@ -1516,6 +2513,10 @@ PRIVATE BOOL HTCache_delete (HTCache * cache)
 */
 PUBLIC BOOL HTCache_deleteAll (void)
 {
+    /* Entries not loaded from the binary index are only on disk */
+    index_close();
+    journal_close();
+
     if (CacheTable) {
 	HTList * cur;
 	int cnt;
@@ -1530,9 +2531,14 @@ PUBLIC BOOL HTCache_deleteAll (void)
 	    HTList_delete(CacheTable[cnt]);
 	}
 	HT_FREE(CacheTable);
+	HTDeque_delete(Probation);
+	HTDeque_delete(Protected);
+	Probation = Protected = NULL;
+	ProtectedSize = 0L;
 	HTCacheContentSize = 0L;
 	return YES;
     }
+    HTCacheContentSize = 0L;
     return NO;
 }
 
@@ -1753,6 +2759,7 @@ PUBLIC BOOL HTCache_updateMeta (HTCache * cache, HTRequest * request,
     if (cache && request && response) {
 	HTParentAnchor * anchor = HTRequest_anchor(request);
 	cache->hits++;
+	lru_hit(cache);
 
 	/* Calculate the various times */
 	calculate_time(cache, request, response);
@@ -1767,6 +2774,7 @@ PUBLIC BOOL HTCache_updateMeta (HTCache * cache, HTRequest * request,
 	/* Must we revalidate this every time? */
 	cache->must_revalidate = HTResponse_mustRevalidate(response);
 
+	journal_write(JOURNAL_PUT, cache);
 	return YES;
     }
     return NO;
@@ -1778,7 +2786,7 @@ PUBLIC BOOL HTCache_resetMeta (HTCache * cache, HTRequest * request,
   /* what a problem... we update the cache with the wrong data
      from the response... after the redirection */
   HTCache_updateMeta (cache, request, response);
-  cache->size = 0;
+  lru_setSize(cache, 0);
   cache->range = YES;
   /* @@ JK: update the cache meta data on disk */
   HTCache_writeMeta (cache, request, response);
@@ -1813,6 +2821,20 @@ PRIVATE BOOL flush_object (HTCache * cache)
 */
 PUBLIC BOOL HTCache_flushAll (void)
 {
+    BOOL status = NO;
+
+    /* Entries that are only in the index are removed directly */
+    if (IndexRecords) {
+	unsigned int slot;
+	for (slot = 0; slot < IndexSlots; slot++) {
+	    HTIndexRecord * record = IndexRecords + slot;
+	    if (record->key && !(record->flags & INDEX_DELETED) &&
+		!index_taken(slot) && !index_resident(record))
+		index_flush(record);
+	}
+	index_close();
+	status = YES;
+    }
     if (CacheTable) {
 	HTList * cur;
 	int cnt;
@@ -1829,13 +2851,15 @@ PUBLIC BOOL HTCache_flushAll (void)
 	    HTList_delete(CacheTable[cnt]);
 	    CacheTable[cnt] = NULL;
 	}
+	status = YES;
+    }
 
-	/* Write the new empty index to disk */
-	HTCacheIndex_write(HTCacheRoot);
+    /* The next journal entry starts a new index */
+    if (status == YES) {
+	HTCacheIndex_delete(HTCacheRoot);
 	HTCacheContentSize = 0L;
-	return YES;
     }
-    return NO;
+    return status;
 }
 
 /*
@@ -2005,6 +3029,7 @@ PUBLIC BOOL HTCache_addHit (HTCache * cache)
 {
     if (cache) {
 	cache->hits++;
+	lru_hit(cache);
 	HTTRACE(CACHE_TRACE, "Cache....... Hits for %p is %d\n" _ 
 				 cache _ cache->hits);
 	return YES;
@@ -2031,12 +3056,12 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 
 	/*
 	**  We are done storing the object body and can update the cache entry.
-	**  Also update the meta information entry on disk as well. When we
-	**  are done we don't need the lock anymore.
+	**  Also update the meta information entry on disk as well. We keep
+	**  the lock until the entry is in the journal so that the gc can't
+	**  remove it under our feet.
 	*/
 	if (cache) {
 	    HTCache_writeMeta(cache, me->request, me->response);
-	    HTCache_releaseLock(cache);
 
 	    /*
 	    **  Remember if this is the full entity body or only a subpart
@@ -2054,13 +3079,14 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 	}
 
 	/*
-	**  In order not to loose information, we dump the current cache index
-	**  every time we have created DUMP_FREQUENCY new entries
+	**  In order not to loose information, we add the entry to the journal
+	**  and fold the journal into the index every JOURNAL_MAX entries
 	*/
-	if (new_entries > DUMP_FREQUENCY) {
-	    HTCacheIndex_write(HTCacheRoot);
-	    new_entries = 0;
+	if (cache) {
+	    journal_write(JOURNAL_PUT, cache);
+	    HTCache_releaseLock(cache);
 	}
+	if (journal_entries > JOURNAL_MAX) HTCacheIndex_write(HTCacheRoot);
 	HT_FREE(me);
 	return YES;
     }
@@ -10,6 +10,10 @@
 **			HTChunk_terminate not needed any more, but never mind.
 **		EGP	15 Mar 96, Added CString conversions.
 **
+**	Chunks grow by half their size but at least by the allocation unit
+**	so that appending to a large chunk doesn't copy it over and over.
+**	Short strings are kept in a small buffer in the chunk itself, and
+**	buffers of deleted chunks are kept for reuse by the next chunks.
 */
 
 /* Library include files */
@@ -17,13 +21,97 @@
 #include "HTUtils.h"
 #include "HTChunk.h"				         /* Implemented here */
 
+#define CHUNK_INLINE		48	     /* Strings kept in the chunk */
+#define CHUNK_POOL_MAX		4096	   /* Largest buffer we keep */
+#define CHUNK_POOL_COUNT	32	     /* Number of buffers we keep */
+
 struct _HTChunk {
     int		size;		/* In bytes			*/
     int		growby;		/* Allocation unit in bytes	*/
     int		allocated;	/* Current size of *data	*/
     char *	data;		/* Pointer to malloced area or 0 */
+    char	buffer[CHUNK_INLINE];		 /* Used for short data */
 };	
 
+/*
+**	Free buffers are zero filled except for this header
+*/
+typedef struct _HTChunkFree HTChunkFree;
+struct _HTChunkFree {
+    HTChunkFree *	next;
+    int			allocated;
+};
+
+PRIVATE HTChunkFree *	FreeBuffers = NULL;
+PRIVATE int		FreeCount = 0;
+
+/* --------------------------------------------------------------------------*/
+
+/*
+**	Get a zero filled buffer of at least the given size, preferably one
+**	that was used before. The actual size is returned in size.
+*/
+PRIVATE char * buffer_new (int * size)
+{
+    HTChunkFree ** ptr;
+    char * data;
+    if (*size <= CHUNK_POOL_MAX) {
+	for (ptr = &FreeBuffers; *ptr; ptr = &(*ptr)->next) {
+	    HTChunkFree * found = *ptr;
+	    if (found->allocated >= *size) {
+		*ptr = found->next;
+		FreeCount--;
+		*size = found->allocated;
+		memset((void *) found, '\0', sizeof(HTChunkFree));
+		return (char *) found;
+	    }
+	}
+    }
+    if ((data = (char *) HT_CALLOC(1, *size)) == NULL)
+	HT_OUTOFMEM("HTChunk");
+    return data;
+}
+
+PRIVATE void buffer_free (HTChunk * ch)
+{
+    if (ch->data == ch->buffer) return;
+    if (ch->allocated >= (int) sizeof(HTChunkFree) &&
+	ch->allocated <= CHUNK_POOL_MAX && FreeCount < CHUNK_POOL_COUNT) {
+	HTChunkFree * pres = (HTChunkFree *) ch->data;
+	memset((void *) ch->data, '\0', ch->allocated);
+	pres->allocated = ch->allocated;
+	pres->next = FreeBuffers;
+	FreeBuffers = pres;
+	FreeCount++;
+	ch->data = NULL;
+    } else
+	HT_FREE(ch->data);
+}
+
+/*
+**	Make room for at least needed bytes plus the terminating zero. The
+**	new part of the buffer is zero filled.
+*/
+PRIVATE void chunk_grow (HTChunk * ch, int needed)
+{
+    int size = ch->allocated + HTMAX(ch->growby, ch->allocated/2);
+    if (size <= needed) size = needed + 1;
+    if (!ch->data && needed < CHUNK_INLINE) {
+	ch->data = ch->buffer;
+	ch->allocated = CHUNK_INLINE;
+    } else if (!ch->data || ch->data == ch->buffer) {
+	char * data = buffer_new(&size);
+	if (ch->data) memcpy((void *) data, ch->data, ch->allocated);
+	ch->data = data;
+	ch->allocated = size;
+    } else {
+	if ((ch->data = (char *) HT_REALLOC(ch->data, size)) == NULL)
+	    HT_OUTOFMEM("HTChunk");
+	memset((void *) (ch->data + ch->allocated), '\0', size - ch->allocated);
+	ch->allocated = size;
+    }
+}
+
 /* --------------------------------------------------------------------------*/
 
 /*	Create a chunk with a certain allocation unit
@@ -34,7 +122,7 @@ PUBLIC HTChunk * HTChunk_new (int grow)
     HTChunk * ch;
     if ((ch = (HTChunk  *) HT_CALLOC(1, sizeof(HTChunk))) == NULL)
         HT_OUTOFMEM("HTChunk_new");
-    ch->growby = grow;
+    ch->growby = grow > 0 ? grow : 1;
     return ch;
 }
 
@@ -59,7 +147,7 @@ PUBLIC void HTChunk_clear (HTChunk * ch)
 PUBLIC void HTChunk_delete (HTChunk * ch)
 {
     if (ch) {
-	HT_FREE(ch->data);
+	if (ch->data) buffer_free(ch);
     	HT_FREE(ch);
     }
 }
@@ -140,7 +228,12 @@ PUBLIC char * HTChunk_toCString (HTChunk * ch)
 {
     char * ret = 0;
     if (ch) {
-	ret = ch->data;
+	if (ch->data == ch->buffer) {
+	    if ((ret = (char *) HT_MALLOC(ch->allocated)) == NULL)
+		HT_OUTOFMEM("HTChunk_toCString");
+	    memcpy(ret, ch->data, ch->allocated);
+	} else
+	    ret = ch->data;
     	HT_FREE(ch);
     }
     return ret;
@@ -152,17 +245,8 @@ PUBLIC char * HTChunk_toCString (HTChunk * ch)
 PUBLIC void HTChunk_putc (HTChunk * ch, char c)
 {
     if (ch) {	
-	if (!ch->data || ch->size >= ch->allocated-1) { /* [SIC] bobr */
-	    if (ch->data) {
-		if ((ch->data = (char  *) HT_REALLOC(ch->data,ch->allocated+ch->growby)) == NULL)
-		    HT_OUTOFMEM("HTChunk_putc");
-		memset((void *) (ch->data + ch->allocated), '\0', ch->growby);
-	    } else {
-		if ((ch->data = (char  *) HT_CALLOC(1, ch->allocated+ch->growby)) == NULL)
-		    HT_OUTOFMEM("HTChunk_putc");
-	    }
-	    ch->allocated += ch->growby;
-	}
+	if (!ch->data || ch->size >= ch->allocated-1) /* [SIC] bobr */
+	    chunk_grow(ch, ch->size+1);
 	*(ch->data+ch->size++) = c;
     }
 }
@@ -183,17 +267,7 @@ PUBLIC void HTChunk_putb (HTChunk * ch, const char * block, int len)
 {
     if (ch && block && len) {
 	int needed = ch->size+len;
-	if (needed >= ch->allocated) {
-	    ch->allocated = needed - needed%ch->growby + ch->growby;
-	    if (ch->data) {
-		if ((ch->data = (char *) HT_REALLOC(ch->data, ch->allocated)) == NULL)
-		    HT_OUTOFMEM("HTChunk_putb");
-	        memset((void *) (ch->data + needed), '\0', ch->allocated-needed);
-	    } else {
-		if ((ch->data = (char *) HT_CALLOC(1, ch->allocated)) == NULL)
-		    HT_OUTOFMEM("HTChunk_putb");
-	    }
-	}
+	if (needed >= ch->allocated) chunk_grow(ch, needed);
 	memcpy((void *) (ch->data+ch->size), block, len);
 	ch->size = needed;
     }
@@ -211,17 +285,7 @@ PUBLIC void HTChunk_ensure (HTChunk * ch, int len)
 {
     if (ch && len > 0) {
 	int needed = ch->size+len;
-	if (needed >= ch->allocated) {
-	    ch->allocated = needed - needed%ch->growby + ch->growby;
-	    if (ch->data) {
-		if ((ch->data = (char  *) HT_REALLOC(ch->data, ch->allocated)) == NULL)
-		    HT_OUTOFMEM("HTChunk_ensure");
-	        memset((void *) (ch->data + ch->size), '\0', ch->allocated-ch->size);
-	    } else {
-		if ((ch->data = (char  *) HT_CALLOC(1, ch->allocated)) == NULL)
-		    HT_OUTOFMEM("HTChunk_ensure");
-	    }
-	}
+	if (needed >= ch->allocated) chunk_grow(ch, needed);
     }
 #if 0
     if (needed <= ch->allocated) return;
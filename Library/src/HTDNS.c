@@ -12,6 +12,13 @@
 **
 **	13 Sep 95  HFN	Spawned from HTTCP.c and rewritten
 **      23 Feb 03  MJD  Started working on IDN implementation
+**
+**	Lookups for non-preemptive requests are done asynchronously by a
+**	small pool of resolver threads calling getaddrinfo(). When a lookup
+**	is done, the thread writes a byte on a pipe which is registered with
+**	the event manager so that the result is put into the cache and the
+**	waiting Net objects are called again from the event loop. Failed
+**	lookups are cached as entries with no homes for a short time.
 */
 
 /* Library include files */
@@ -21,7 +28,9 @@
 #include "HTAlert.h"
 #include "HTError.h"
 #include "HTTrans.h"
+#include "HTEvent.h"
 #include "HTHstMan.h"
+#include "HTNetMan.h"
 #include "HTDNS.h"					 /* Implemented here */
 
 #ifdef LIBWWW_USEIDN
@@ -29,6 +38,13 @@
 #endif
 
 #define DNS_TIMEOUT		1800L	     /* Default DNS timeout is 30 mn */
+#define DNS_NEGATIVE_TIMEOUT	60L	   /* Remember unknown hosts for 1 mn */
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_GETADDRINFO) && !defined(_WINSOCKAPI_)
+#define HT_ASYNC_DNS
+#define DNS_MAX_THREADS		4		/* Max number of resolvers */
+#define DNS_MAX_HOMES		32	    /* Max addresses kept per host */
+#endif
 
 /* Type definitions and global variables etc. local to this module */
 struct _HTdns {
@@ -42,6 +58,44 @@ struct _HTdns {
 
 PRIVATE HTList	**CacheTable = NULL;
 PRIVATE time_t	DNSTimeout = DNS_TIMEOUT;	   /* Timeout on DNS entries */
+PRIVATE time_t	DNSNegativeTimeout = DNS_NEGATIVE_TIMEOUT;
+
+#ifdef HT_ASYNC_DNS
+typedef enum _HTLookupState {
+    DNS_QUEUED = 0,
+    DNS_RUNNING,
+    DNS_DONE
+} HTLookupState;
+
+/*
+**  The hostname and the list of waiters are only touched by the event loop.
+**  The rest is shared with the resolver threads and protected by DNSMutex.
+*/
+typedef struct _HTLookup {
+    char *		hostname;		   /* ACE name being resolved */
+    int			hash;			  /* Where it goes in the cache */
+    HTDeque *		waiters;	     /* Net objects waiting for result */
+    HTLookupState	state;
+    BOOL		cancelled;	   /* Nobody wants the result anymore */
+    int			error;			  /* Result of getaddrinfo() */
+    struct addrinfo *	result;
+    struct _HTLookup *	next;			    /* In job or done queue */
+} HTLookup;
+
+PRIVATE BOOL		AsyncDNS = YES;
+PRIVATE HTList *	Lookups = NULL;		  /* Outstanding lookups */
+PRIVATE HTEvent *	PipeEvent = NULL;
+PRIVATE int		DNSPipe[2] = {-1, -1};   /* Resolvers wake up the loop */
+
+PRIVATE pthread_mutex_t	DNSMutex = PTHREAD_MUTEX_INITIALIZER;
+PRIVATE pthread_cond_t	DNSCond = PTHREAD_COND_INITIALIZER;
+PRIVATE HTLookup *	JobHead = NULL;			/* Queued lookups */
+PRIVATE HTLookup *	JobTail = NULL;
+PRIVATE HTLookup *	DoneHead = NULL;		      /* Done lookups */
+PRIVATE int		Resolvers = 0;		   /* Number of threads */
+PRIVATE int		IdleResolvers = 0;
+PRIVATE BOOL		Terminating = NO;
+#endif /* HT_ASYNC_DNS */
 
 /* ------------------------------------------------------------------------- */
 
@@ -65,6 +119,42 @@ PRIVATE BOOL delete_object (HTList * list, HTdns * me)
     return YES;
 }
 
+PRIVATE int dns_hash (const char * host)
+{
+    int hash = 0;
+    const char * ptr;
+    for (ptr=host; *ptr; ptr++)
+	hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_M_HASH_SIZE);
+    return hash;
+}
+
+PRIVATE HTList * cache_list (int hash)
+{
+    if (!CacheTable) {
+	if ((CacheTable = (HTList* *) HT_CALLOC(HT_M_HASH_SIZE, sizeof(HTList *))) == NULL)
+	    HT_OUTOFMEM("HTDNS_init");
+    }
+    if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
+    return CacheTable[hash];
+}
+
+/*
+**	Remember that a host name could not be resolved. The entry has no
+**	homes and expires after the negative timeout.
+*/
+PRIVATE HTdns * add_negative (HTList * list, char * host)
+{
+    HTdns * me;
+    if ((me = (HTdns *) HT_CALLOC(1, sizeof(HTdns))) == NULL ||
+	(me->addrlist = (char **) HT_CALLOC(1, sizeof(char *))) == NULL)
+	HT_OUTOFMEM("add_negative");
+    StrAllocCopy(me->hostname, host);
+    me->ntime = time(NULL);
+    HTTRACE(PROT_TRACE, "DNS Add..... `%s\' as unknown host to %p\n" _ host _ list);
+    HTList_addObject(list, (void *) me);
+    return me;
+}
+
 /*	HTDNS_setTimeout
 **	----------------
 **	Set the cache timeout for DNS entries. Default is DNS_TIMEOUT
@@ -83,6 +173,21 @@ PUBLIC time_t HTDNS_timeout (time_t timeout)
     return DNSTimeout;
 }
 
+/*	HTDNS_setNegativeTimeout
+**	------------------------
+**	Set how long a failed lookup is remembered. Default is
+**	DNS_NEGATIVE_TIMEOUT
+*/
+PUBLIC void HTDNS_setNegativeTimeout (time_t timeout)
+{
+    DNSNegativeTimeout = timeout;
+}
+
+PUBLIC time_t HTDNS_negativeTimeout (void)
+{
+    return DNSNegativeTimeout;
+}
+
 /*	HTDNS_add
 **	---------
 **	Add an element to the cache of visited hosts. Note that this function
@@ -172,11 +277,9 @@ PUBLIC BOOL HTDNS_updateWeigths(HTdns *dns, int current, ms_t deltatime)
 PUBLIC BOOL HTDNS_delete (const char * host)
 {
     HTList *list;
-    int hash = 0;
-    const char *ptr;
+    int hash;
     if (!host || !CacheTable) return NO;
-    for(ptr=host; *ptr; ptr++)
-	hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_M_HASH_SIZE);
+    hash = dns_hash(host);
     if ((list = CacheTable[hash])) {	 /* We have the list, find the entry */
 	HTdns *pres;
 	while ((pres = (HTdns *) HTList_nextObject(list))) {
@@ -279,13 +382,273 @@ PUBLIC int HTACEfromUTF8 (char *hostUTF8, char *punycode, size_t punyLength)
 }
 #endif
 
+/* ------------------------------------------------------------------------- */
+/*			     ASYNCHRONOUS LOOKUPS			     */
+/* ------------------------------------------------------------------------- */
+
+/*	HTDNS_setAsync
+**	--------------
+**	Turn asynchronous lookups on or off. Preemptive requests always
+**	resolve host names synchronously.
+*/
+PUBLIC BOOL HTDNS_setAsync (BOOL mode)
+{
+#ifdef HT_ASYNC_DNS
+    AsyncDNS = mode;
+    return YES;
+#else
+    return mode ? NO : YES;
+#endif
+}
+
+PUBLIC BOOL HTDNS_isAsync (void)
+{
+#ifdef HT_ASYNC_DNS
+    return AsyncDNS;
+#else
+    return NO;
+#endif
+}
+
+#ifdef HT_ASYNC_DNS
+PRIVATE void free_lookup (HTLookup * me)
+{
+    if (me) {
+	if (me->result) freeaddrinfo(me->result);
+	HT_FREE(me->hostname);
+	HT_FREE(me);
+    }
+}
+
+/*
+**	The resolver threads pick up queued lookups, call getaddrinfo() and
+**	hand the result back to the event loop via the done queue and the
+**	pipe. A lookup that has been cancelled while running is freed here.
+*/
+PRIVATE void * DNSResolver (void * param)
+{
+    pthread_mutex_lock(&DNSMutex);
+    while (1) {
+	HTLookup * job;
+	struct addrinfo hints;
+	struct addrinfo * result = NULL;
+	int error;
+	while (!JobHead && !Terminating) {
+	    IdleResolvers++;
+	    pthread_cond_wait(&DNSCond, &DNSMutex);
+	    IdleResolvers--;
+	}
+	if ((job = JobHead) == NULL) break;
+	if ((JobHead = job->next) == NULL) JobTail = NULL;
+	job->next = NULL;
+	job->state = DNS_RUNNING;
+	pthread_mutex_unlock(&DNSMutex);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;		    /* SockA is sockaddr_in */
+	hints.ai_socktype = SOCK_STREAM;
+	error = getaddrinfo(job->hostname, NULL, &hints, &result);
+
+	pthread_mutex_lock(&DNSMutex);
+	job->error = error;
+	job->result = result;
+	job->state = DNS_DONE;
+	if (job->cancelled) {
+	    free_lookup(job);
+	} else {
+	    job->next = DoneHead;
+	    DoneHead = job;
+	    if (DNSPipe[1] >= 0) write(DNSPipe[1], "", 1);
+	}
+    }
+    Resolvers--;
+    pthread_mutex_unlock(&DNSMutex);
+    return NULL;
+}
+
+/*
+**	Put the result of a lookup into the cache. Only AF_INET addresses
+**	are kept as that is what the rest of the Library connects to.
+*/
+PRIVATE void lookup_cache (HTLookup * me)
+{
+    HTList * list = cache_list(me->hash);
+    char * addrs[DNS_MAX_HOMES+1];
+    int cnt = 0;
+    if (!me->error) {
+	struct addrinfo * ai;
+	for (ai = me->result; ai && cnt < DNS_MAX_HOMES; ai = ai->ai_next) {
+	    if (ai->ai_family == AF_INET)
+		addrs[cnt++] = (char *) &((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+	}
+    }
+    addrs[cnt] = NULL;
+
+    /* Replace any entry added by a synchronous lookup in the meantime */
+    HTDNS_delete(me->hostname);
+    if (cnt) {
+	struct hostent element;
+	int homes;
+	memset(&element, 0, sizeof(element));
+	element.h_addrtype = AF_INET;
+	element.h_length = sizeof(struct in_addr);
+	element.h_addr_list = addrs;
+	HTDNS_add(list, &element, me->hostname, &homes);
+    } else {
+	HTTRACE(PROT_TRACE, "HostByName.. Can't resolve `%s\': %s\n" _ me->hostname _
+		me->error ? gai_strerror(me->error) : "no IPv4 address");
+	add_negative(list, me->hostname);
+    }
+}
+
+/*
+**	Called by the event manager when the resolvers have written on the
+**	pipe. Each done lookup is cached and its waiters are called again
+**	with a WRITE event so that they pick up the result from the cache.
+*/
+PRIVATE int DNSEvent (SOCKET soc, void * param, HTEventType type)
+{
+    HTLookup * done;
+    char buf[64];
+    while (read(DNSPipe[0], buf, sizeof(buf)) > 0);
+    pthread_mutex_lock(&DNSMutex);
+    done = DoneHead;
+    DoneHead = NULL;
+    pthread_mutex_unlock(&DNSMutex);
+    while (done) {
+	HTLookup * next = done->next;
+	HTNet * net;
+	HTList_removeObject(Lookups, done);
+	lookup_cache(done);
+	while ((net = (HTNet *) HTDeque_removeFirst(done->waiters)) != NULL) {
+	    HTTRACE(PROT_TRACE, "HostByName.. `%s\' resolved, calling Net %p\n" _
+		    done->hostname _ net);
+	    HTNet_execute(net, HTEvent_WRITE);
+	}
+	HTDeque_delete(done->waiters);
+	free_lookup(done);
+	done = next;
+    }
+    if (HTList_isEmpty(Lookups)) HTEvent_unregister(DNSPipe[0], HTEvent_READ);
+    return HT_OK;
+}
+
+/*
+**	Start a lookup or join one already going on for the same host.
+**	Returns YES if the Net object will be called when the lookup is done.
+*/
+PRIVATE BOOL lookup_start (HTNet * net, char * hostname, int hash)
+{
+    HTLookup * me = NULL;
+    HTList * cur = Lookups;
+    while ((me = (HTLookup *) HTList_nextObject(cur))) {
+	if (!strcmp(me->hostname, hostname)) break;
+    }
+    if (me) {
+	HTTRACE(PROT_TRACE, "HostByName.. Joining lookup of `%s\'\n" _ hostname);
+	HTDeque_appendLink(me->waiters, &net->dnsLink, net);
+	return YES;
+    }
+
+    /* Create the pipe back into the event loop */
+    if (DNSPipe[0] < 0) {
+	if (pipe(DNSPipe) < 0) {
+	    HTTRACE(PROT_TRACE, "HostByName.. Can't create pipe - resolving synchronously\n");
+	    return NO;
+	}
+	fcntl(DNSPipe[0], F_SETFL, O_NONBLOCK);
+	if (!PipeEvent) PipeEvent = HTEvent_new(DNSEvent, NULL, HT_PRIORITY_MAX, -1);
+    }
+
+    if ((me = (HTLookup *) HT_CALLOC(1, sizeof(HTLookup))) == NULL)
+	HT_OUTOFMEM("lookup_start");
+    StrAllocCopy(me->hostname, hostname);
+    me->hash = hash;
+    me->waiters = HTDeque_new();
+
+    pthread_mutex_lock(&DNSMutex);
+    Terminating = NO;
+    if (!IdleResolvers && Resolvers < DNS_MAX_THREADS) {
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, DNSResolver, NULL) == 0)
+	    Resolvers++;
+	pthread_attr_destroy(&attr);
+    }
+    if (!Resolvers) {
+	pthread_mutex_unlock(&DNSMutex);
+	HTTRACE(PROT_TRACE, "HostByName.. No resolver threads - resolving synchronously\n");
+	HTDeque_delete(me->waiters);
+	free_lookup(me);
+	return NO;
+    }
+    if (JobTail)
+	JobTail->next = me;
+    else
+	JobHead = me;
+    JobTail = me;
+    pthread_cond_signal(&DNSCond);
+    pthread_mutex_unlock(&DNSMutex);
+
+    HTTRACE(PROT_TRACE, "HostByName.. Looking up `%s\' asynchronously\n" _ hostname);
+    if (!Lookups) Lookups = HTList_new();
+    if (HTList_isEmpty(Lookups)) HTEvent_register(DNSPipe[0], HTEvent_READ, PipeEvent);
+    HTList_addObject(Lookups, me);
+    HTDeque_appendLink(me->waiters, &net->dnsLink, net);
+    return YES;
+}
+#endif /* HT_ASYNC_DNS */
+
+/*	HTDNS_killAll
+**	-------------
+**	Cancel all outstanding lookups and let the resolver threads exit.
+**	Net objects still waiting for a lookup are not called again.
+*/
+PUBLIC BOOL HTDNS_killAll (void)
+{
+#ifdef HT_ASYNC_DNS
+    HTLookup * me;
+    if (DNSPipe[0] < 0) return NO;
+    HTEvent_unregister(DNSPipe[0], HTEvent_READ);
+    pthread_mutex_lock(&DNSMutex);
+    while ((me = (HTLookup *) HTList_removeLastObject(Lookups)) != NULL) {
+	HTDeque_delete(me->waiters);
+	me->waiters = NULL;
+	if (me->state == DNS_RUNNING)
+	    me->cancelled = YES;		 /* The resolver frees it */
+	else
+	    free_lookup(me);
+    }
+    HTList_delete(Lookups);
+    Lookups = NULL;
+    JobHead = JobTail = DoneHead = NULL;
+    Terminating = YES;
+    pthread_cond_broadcast(&DNSCond);
+    close(DNSPipe[0]);
+    close(DNSPipe[1]);
+    DNSPipe[0] = DNSPipe[1] = -1;
+    pthread_mutex_unlock(&DNSMutex);
+    HTEvent_delete(PipeEvent);
+    PipeEvent = NULL;
+    return YES;
+#else
+    return NO;
+#endif
+}
+
 /*	HTGetHostByName
 **	---------------
 **	Resolve the host name using internal DNS cache. As we want to refer   
 **	a specific host when timing the connection the weight function must
 **	use the 'current' value as returned.
+**	If the name is not in the cache and the request is not preemptive
+**	then the lookup is done asynchronously and the Net object is called
+**	again when the result is in the cache.
 **      Returns:
 **	       	>0	Number of homes
+**		 0	Lookup in progress
 **		-1	Error
 */
 PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
@@ -294,6 +657,7 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
     int homes = -1;
     HTList *list;				    /* Current list in cache */
     HTdns *pres = NULL;
+    int hash;
     char hostace[256]; /* check lengths!!! */
 
     if (!host || !hostname) {
@@ -308,25 +672,16 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
     HTHost_setHome(host, 0); 
 
     /* Find a hash for this host */
-    {
-	int hash = 0;
-	char *ptr;
-	for(ptr=hostace; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_M_HASH_SIZE);
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList* *) HT_CALLOC(HT_M_HASH_SIZE, sizeof(HTList *))) == NULL)
-	        HT_OUTOFMEM("HTDNS_init");
-	}
-	if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	list = CacheTable[hash];
-    }
+    hash = dns_hash(hostace);
+    list = cache_list(hash);
 
     /* Search the cache */
     {
 	HTList *cur = list;
 	while ((pres = (HTdns *) HTList_nextObject(cur))) {
 	    if (!strcmp(pres->hostname, hostace)) {
-		if (time(NULL) > pres->ntime + DNSTimeout) {
+		time_t ttl = pres->homes ? DNSTimeout : DNSNegativeTimeout;
+		if (time(NULL) > pres->ntime + ttl) {
 		    HTTRACE(PROT_TRACE, "HostByName.. Refreshing cache\n");
 		    delete_object(list, pres);
 		    pres = NULL;
@@ -335,7 +690,10 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 	    }
 	}
     }
-    if (pres) {
+    if (pres && !pres->homes) {
+	HTTRACE(PROT_TRACE, "HostByName.. `%s\' is cached as unknown\n" _ hostace);
+	return -1;
+    } else if (pres) {
 	/*
 	** Find the best home. We still want to do this as we use it as a
 	** fall back for persistent connections
@@ -368,6 +726,14 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 #endif
 
 	if (cbf) (*cbf)(request, HT_PROG_DNS, HT_MSG_NULL,NULL,hostace,NULL);
+#ifdef HT_ASYNC_DNS
+	{
+	    HTNet * net = HTRequest_net(request);
+	    if (AsyncDNS && net && !HTNet_preemptive(net) &&
+		lookup_start(net, hostace, hash))
+		return 0;
+	}
+#endif
 #ifdef HAVE_GETHOSTBYNAME_R_5
 	hostelement = gethostbyname_r(hostace, &result, buffer,
 				      HOSTENT_MAX, &thd_errno);
@@ -389,6 +755,7 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 	if (!hostelement) {
             HTRequest_addSystemError(request, ERR_FATAL, socerrno, NO,
    			             "gethostbyname");
+	    add_negative(list, hostace);
 	    return -1;
 	}	
 	host->dns = HTDNS_add(list, hostelement, hostace, &homes);
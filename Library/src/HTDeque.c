@@ -0,0 +1,181 @@
+/*								      HTDeque.c
+**	DOUBLE ENDED QUEUES
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	A deque is a doubly linked list of HTDequeLink elements with a
+**	pointer to each end and a count. Links are either allocated by
+**	the deque or embedded in the objects themselves (intrusive).
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "HTUtils.h"
+#include "HTDeque.h"					 /* Implemented here */
+
+PUBLIC HTDeque * HTDeque_new (void)
+{
+    HTDeque * me;
+    if ((me = (HTDeque *) HT_CALLOC(1, sizeof(HTDeque))) == NULL)
+        HT_OUTOFMEM("HTDeque_new");
+    return me;
+}
+
+PUBLIC BOOL HTDeque_delete (HTDeque * me)
+{
+    if (me) {
+	HTDequeLink * link = me->head;
+	while (link) {
+	    HTDequeLink * next = link->next;
+	    if (link->allocated) {
+		HT_FREE(link);
+	    } else {
+		link->prev = link->next = NULL;
+		link->deque = NULL;
+	    }
+	    link = next;
+	}
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC BOOL HTDeque_unlink (HTDequeLink * link)
+{
+    HTDeque * me;
+    if (!link || (me = link->deque) == NULL) return NO;
+    if (link->prev)
+	link->prev->next = link->next;
+    else
+	me->head = link->next;
+    if (link->next)
+	link->next->prev = link->prev;
+    else
+	me->tail = link->prev;
+    me->count--;
+    if (link->allocated) {
+	HT_FREE(link);
+    } else {
+	link->prev = link->next = NULL;
+	link->deque = NULL;
+    }
+    return YES;
+}
+
+PUBLIC BOOL HTDeque_appendLink (HTDeque * me, HTDequeLink * link, void * object)
+{
+    if (me && link) {
+	if (link->deque) HTDeque_unlink(link);
+	link->object = object;
+	link->deque = me;
+	link->next = NULL;
+	link->prev = me->tail;
+	if (me->tail)
+	    me->tail->next = link;
+	else
+	    me->head = link;
+	me->tail = link;
+	me->count++;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTDeque_prependLink (HTDeque * me, HTDequeLink * link, void * object)
+{
+    if (me && link) {
+	if (link->deque) HTDeque_unlink(link);
+	link->object = object;
+	link->deque = me;
+	link->prev = NULL;
+	link->next = me->head;
+	if (me->head)
+	    me->head->prev = link;
+	else
+	    me->tail = link;
+	me->head = link;
+	me->count++;
+	return YES;
+    }
+    return NO;
+}
+
+PRIVATE HTDequeLink * new_link (void)
+{
+    HTDequeLink * link;
+    if ((link = (HTDequeLink *) HT_CALLOC(1, sizeof(HTDequeLink))) == NULL)
+        HT_OUTOFMEM("HTDeque_append");
+    link->allocated = YES;
+    return link;
+}
+
+PUBLIC BOOL HTDeque_append (HTDeque * me, void * object)
+{
+    if (me) return HTDeque_appendLink(me, new_link(), object);
+    HTTRACE(CORE_TRACE, "HTDeque..... Can not add object %p to nonexisting deque\n" _
+	    object);
+    return NO;
+}
+
+PUBLIC BOOL HTDeque_prepend (HTDeque * me, void * object)
+{
+    if (me) return HTDeque_prependLink(me, new_link(), object);
+    HTTRACE(CORE_TRACE, "HTDeque..... Can not add object %p to nonexisting deque\n" _
+	    object);
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC void * HTDeque_removeFirst (HTDeque * me)
+{
+    if (me && me->head) {
+	void * object = me->head->object;
+	HTDeque_unlink(me->head);
+	return object;
+    }
+    return NULL;
+}
+
+PUBLIC void * HTDeque_removeLast (HTDeque * me)
+{
+    if (me && me->tail) {
+	void * object = me->tail->object;
+	HTDeque_unlink(me->tail);
+	return object;
+    }
+    return NULL;
+}
+
+PUBLIC BOOL HTDeque_removeObject (HTDeque * me, void * object)
+{
+    BOOL found = NO;
+    if (me) {
+	HTDequeLink * link = me->head;
+	while (link) {
+	    HTDequeLink * next = link->next;
+	    if (link->object == object) {
+		HTDeque_unlink(link);
+		found = YES;
+	    }
+	    link = next;
+	}
+    }
+    return found;
+}
+
+PUBLIC int HTDeque_indexOf (HTDeque * me, void * object)
+{
+    if (me) {
+	HTDequeLink * link;
+	int position = 0;
+	for (link = me->head; link; link = link->next, position++)
+	    if (link->object == object) return position;
+    }
+    return -1;
+}
@@ -28,6 +28,7 @@ struct _HTError {
     void *  		par;          	/* Explanation, e.g. filename  */
     int 		length;   	/* For copying by generic routine */
     char *       	where;          /* Which function */
+    BOOL		arena;		/* Taken from an arena */
 };
 
 PRIVATE HTErrorShow HTShowMask = HT_ERR_SHOW_DEFAULT;
@@ -51,17 +52,35 @@ PUBLIC BOOL HTError_add (HTList * 	list,
 			 void *		par,
 			 unsigned int	length,
 			 char *		where)
+{
+    return HTError_addFromArena(NULL, list, severity, ignore, element,
+				par, length, where);
+}
+
+PUBLIC BOOL HTError_addFromArena (HTArena *	arena,
+				  HTList * 	list,
+				  HTSeverity	severity,
+				  BOOL		ignore,
+				  int		element,
+				  void *	par,
+				  unsigned int	length,
+				  char *	where)
 {
     HTError *newError;
     if (!list) return NO;
-    if ((newError = (HTError *) HT_CALLOC(1, sizeof(HTError))) == NULL)
+    if (arena)
+	newError = (HTError *) HTArena_calloc(arena, 1, sizeof(HTError));
+    else if ((newError = (HTError *) HT_CALLOC(1, sizeof(HTError))) == NULL)
         HT_OUTOFMEM("HTError_add");
     newError->element = (HTErrorElement) element;
     newError->severity = severity;
     newError->ignore = ignore;
+    newError->arena = arena ? YES : NO;
     if (par) {
 	if (!length) length = (int) strlen((char *) par);
-	if ((newError->par = HT_MALLOC(length+1)) == NULL)
+	if (arena)
+	    newError->par = HTArena_malloc(arena, length+1);
+	else if ((newError->par = HT_MALLOC(length+1)) == NULL)
 	    HT_OUTOFMEM("HTErrorError");
 	memcpy(newError->par, par, length);
 	*(((char *) newError->par)+length) = '\0';
@@ -90,13 +109,25 @@ PUBLIC BOOL HTError_addSystem (HTList *		list,
 			       int		errornumber,
 			       BOOL		ignore,
 			       char *		syscall)
+{
+    return HTError_addSystemFromArena(NULL, list, severity, errornumber,
+				      ignore, syscall);
+}
+
+PUBLIC BOOL HTError_addSystemFromArena (HTArena *	arena,
+					HTList *	list,
+					HTSeverity	severity,
+					int		errornumber,
+					BOOL		ignore,
+					char *		syscall)
 {
     BOOL status = NO;
     if (list) {
 	char * errsysmsg = HTErrnoString(errornumber);
-	status = HTError_add(list, severity, ignore, HTERR_SYSTEM,
-			     errsysmsg, errsysmsg ? (int) strlen(errsysmsg) : 0,
-			     syscall ? syscall : "unknown");
+	status = HTError_addFromArena(arena, list, severity, ignore,
+				      HTERR_SYSTEM, errsysmsg,
+				      errsysmsg ? (int) strlen(errsysmsg) : 0,
+				      syscall ? syscall : "unknown");
 	HT_FREE(errsysmsg);
     }
     return status;
@@ -112,8 +143,10 @@ PUBLIC BOOL HTError_deleteAll (HTList * list)
 	HTList *cur = list;
 	HTError *pres;
 	while ((pres = (HTError *) HTList_nextObject(cur))) {
-	    HT_FREE(pres->par);
-	    HT_FREE(pres);
+	    if (!pres->arena) {
+		HT_FREE(pres->par);
+		HT_FREE(pres);
+	    }
 	}
 	HTList_delete(list);
 	return YES;
@@ -132,8 +165,10 @@ PUBLIC BOOL HTError_deleteLast (HTList * list)
 	HTError * old = (HTError *) HTList_removeLastObject(list);
 	if (old) {
 	    HTTRACE(CORE_TRACE, "Error....... Delete %p\n" _ old);
-	    HT_FREE(old->par);
-	    HT_FREE(old);
+	    if (!old->arena) {
+		HT_FREE(old->par);
+		HT_FREE(old);
+	    }
 	    return YES;
 	}
     }
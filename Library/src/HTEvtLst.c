@@ -43,6 +43,11 @@
 
 #define HT_FS_BYTES(a)		((((a)/16)+1) * 4)
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE) && !defined(WWW_WIN_ASYNC)
+#define HT_EPOLL
+#define EPOLL_MAX_READY		256  /* how many ready sockets to get per wait */
+#endif
+
 typedef struct {
     SOCKET 	s ;	 		/* our socket */
     HTEvent * 	events[HTEvent_TYPES];	/* event parameters for read, write, oob */
@@ -77,6 +82,11 @@ PRIVATE fd_set FdArray[HTEvent_TYPES];
 PRIVATE SOCKET MaxSock = 0;			  /* max socket value in use */
 #endif /* !WWW_WIN_ASYNC */
 
+PRIVATE HTEventBackend EventBackend = HT_EVENT_SELECT;
+#ifdef HT_EPOLL
+PRIVATE int EpollFd = -1;			/* Kernel interest set */
+#endif /* HT_EPOLL */
+
 /* ------------------------------------------------------------------------- */
 /* 				DEBUG FUNCTIONS	    		             */
 /* ------------------------------------------------------------------------- */
@@ -390,6 +400,48 @@ PRIVATE int EventList_remaining (SockEvents * pres)
     return ret;
 }
 
+#ifdef HT_EPOLL
+/*
+**  Bring the kernel interest set for a socket in line with the set of
+**  events registered in our own tables. The sets are bit masks as
+**  returned by EventList_remaining(). An empty new set removes the
+**  socket from the interest set.
+*/
+PRIVATE int Epoll_update (SOCKET s, int oldset, int newset)
+{
+    struct epoll_event ev;
+    int op;
+    if (oldset == newset) return HT_OK;
+    op = !oldset ? EPOLL_CTL_ADD : newset ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    memset(&ev, 0, sizeof(ev));
+    if (newset & (1<<HTEvent_INDEX(HTEvent_READ))) ev.events |= EPOLLIN;
+    if (newset & (1<<HTEvent_INDEX(HTEvent_WRITE))) ev.events |= EPOLLOUT;
+    if (newset & (1<<HTEvent_INDEX(HTEvent_OOB))) ev.events |= EPOLLPRI;
+    ev.data.fd = s;
+    if (epoll_ctl(EpollFd, op, s, &ev) < 0) {
+
+	/*
+	**  The kernel drops a descriptor from the interest set by itself
+	**  when it is closed, so a recycled socket number may be out of
+	**  sync with what we think is registered. Fix it up and try again.
+	*/
+	if (op == EPOLL_CTL_DEL) return HT_OK;
+	if (op == EPOLL_CTL_MOD && errno == ENOENT)
+	    op = EPOLL_CTL_ADD;
+	else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+	    op = EPOLL_CTL_MOD;
+	else
+	    op = -1;
+	if (op < 0 || epoll_ctl(EpollFd, op, s, &ev) < 0) {
+	    HTTRACE(THD_TRACE, "Event....... epoll_ctl failed for socket %d: `%s'\n" _
+		    s _ HTErrnoString(errno));
+	    return HT_ERROR;
+	}
+    }
+    return HT_OK;
+}
+#endif /* HT_EPOLL */
+
 /*
 **  For a given socket, reqister a request structure, a set of operations, 
 **  a HTEventCallback function, and a priority. For this implementation, 
@@ -399,6 +451,8 @@ PRIVATE int EventList_remaining (SockEvents * pres)
 PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
 {
     int newset = 0;
+    int oldset = 0;
+    HTEvent * oldevent;
     SockEvents * sockp;
     HTTRACE(THD_TRACE, "Event....... Register socket %d, request %p handler %p type %s at priority %d\n" _ 
 		s _ (void *) event->request _ 
@@ -414,6 +468,8 @@ PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
     HTTRACE(THD_TRACE, "Event....... Registering socket for %s\n" _ HTEvent_type2str(type));
     sockp = SockEvents_get(s, SockEvents_mayCreate);
     sockp->s = s;
+    oldset = EventList_remaining(sockp);
+    oldevent = sockp->events[HTEvent_INDEX(type)];
     sockp->events[HTEvent_INDEX(type)] = event;
     newset = EventList_remaining(sockp);
 #ifdef WWW_WIN_ASYNC
@@ -422,13 +478,30 @@ PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
 	return HT_ERROR;
     }
 #else /* WWW_WIN_ASYNC */
-    FD_SET(s, FdArray+HTEvent_INDEX(type));
+#ifdef HT_EPOLL
+    if (EventBackend == HT_EVENT_EPOLL) {
+	if (Epoll_update(s, oldset, newset) != HT_OK) {
+	    sockp->events[HTEvent_INDEX(type)] = oldevent;
+	    return HT_ERROR;
+	}
+    } else
+#endif /* HT_EPOLL */
+    {
+	/* select() can't watch sockets beyond the size of an fd_set */
+	if (s >= FD_SETSIZE) {
+	    HTTRACE(THD_TRACE, "Event....... Socket %d is beyond FD_SETSIZE (%d)\n" _
+		    s _ FD_SETSIZE);
+	    sockp->events[HTEvent_INDEX(type)] = oldevent;
+	    return HT_ERROR;
+	}
+	FD_SET(s, FdArray+HTEvent_INDEX(type));
 
-    HTTRACEDATA((char *) FdArray+HTEvent_INDEX(type), 8, "HTEventList_register: (s:%d)" _ s);
+	HTTRACEDATA((char *) FdArray+HTEvent_INDEX(type), 8, "HTEventList_register: (s:%d)" _ s);
 
-    if (s > MaxSock) {
-	MaxSock = s ;
-	HTTRACE(THD_TRACE, "Event....... New value for MaxSock is %d\n" _ MaxSock);
+	if (s > MaxSock) {
+	    MaxSock = s ;
+	    HTTRACE(THD_TRACE, "Event....... New value for MaxSock is %d\n" _ MaxSock);
+	}
     }
 #endif /* !WWW_WIN_ASYNC */
 
@@ -491,6 +564,7 @@ PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type)
     while (cur && (pres = (SockEvents *) HTList_nextObject(cur))) {
         if (pres->s == s) {
 	    int	remaining = 0;
+	    int registered = EventList_remaining(pres);
 
 	    /*
 	    **  Unregister the event from this action
@@ -512,10 +586,16 @@ PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type)
 	    if (WSAAsyncSelect(s, HTSocketWin, HTwinMsg, remaining) < 0)
 		ret = HT_ERROR;
 #else /* WWW_WIN_ASYNC */
-	    FD_CLR(s, FdArray+HTEvent_INDEX(type));
-
-	    HTTRACEDATA((char*)FdArray+HTEvent_INDEX(type), 8, "HTEventList_unregister: (s:%d)" _ s);
-
+#ifdef HT_EPOLL
+	    if (EventBackend == HT_EVENT_EPOLL)
+		Epoll_update(s, registered, remaining);
+	    else
+#endif /* HT_EPOLL */
+	    if (s < FD_SETSIZE) {
+		FD_CLR(s, FdArray+HTEvent_INDEX(type));
+
+		HTTRACEDATA((char*)FdArray+HTEvent_INDEX(type), 8, "HTEventList_unregister: (s:%d)" _ s);
+	    }
 #endif /* !WWW_WIN_ASYNC */
 
 	    /*
@@ -528,7 +608,8 @@ PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type)
 
 #ifndef WWW_WIN_ASYNC
 		/* Check to see if we have to update MaxSock */
-		if (pres->s >= MaxSock) __ResetMaxSock();
+		if (EventBackend == HT_EVENT_SELECT && pres->s >= MaxSock)
+		    __ResetMaxSock();
 #endif /* !WWW_WIN_ASYNC */
 
 		HT_FREE(pres);
@@ -569,6 +650,10 @@ PUBLIC int HTEventList_unregisterAll (void)
 #ifdef WWW_WIN_ASYNC
 	    WSAAsyncSelect(pres->s, HTSocketWin, HTwinMsg, 0);
 #endif /* WWW_WIN_ASYNC */
+#ifdef HT_EPOLL
+	    if (EventBackend == HT_EVENT_EPOLL)
+		Epoll_update(pres->s, EventList_remaining(pres), 0);
+#endif /* HT_EPOLL */
 	    HT_FREE(pres);
 	}
 	HTList_delete(HashTable[i]);
@@ -643,6 +728,65 @@ PUBLIC void HTEventList_stopLoop (void)
     HTEndLoop = 1;
 }
 
+#ifdef HT_EPOLL
+/*
+**  Wait for readiness on the kernel interest set and queue the ready
+**  events. Unlike select() we only ever look at the sockets that are
+**  actually ready so the cost is independent of the number of sockets
+**  registered. A timeout of 0 means that we wait forever.
+*/
+PRIVATE int EventList_epollWait (ms_t timeout)
+{
+    struct epoll_event ready[EPOLL_MAX_READY];
+    int wait = timeout == 0 ? -1 : timeout > INT_MAX ? INT_MAX : (int) timeout;
+    int active_sockets;
+    int status;
+    int cnt;
+    ms_t now;
+
+    HTTRACE(THD_TRACE, "Event Loop.. calling epoll_wait: timeout is %d\n" _ wait);
+    active_sockets = epoll_wait(EpollFd, ready, EPOLL_MAX_READY, wait);
+    now = HTGetTimeInMillis();
+    HTTRACE(THD_TRACE, "Event Loop.. epoll_wait returns %d\n" _ active_sockets);
+
+    if (active_sockets == -1) {
+	if (errno == EINTR) {
+	    HTTRACE(THD_TRACE, "Event Loop.. epoll_wait was interruted - try again\n");
+	    return HT_OK;
+	}
+	HTTRACE(THD_TRACE, "Event Loop.. epoll_wait returned error %d\n" _ errno);
+#ifdef HTDEBUG
+	EventList_dump();
+#endif /* HTDEBUG */
+	return HT_ERROR;
+    }
+    if (active_sockets == 0) return HT_OK;
+
+    for (cnt = 0; cnt < active_sockets; cnt++) {
+	SOCKET s = ready[cnt].data.fd;
+	unsigned int what = ready[cnt].events;
+	SockEvents * sockp = SockEvents_get(s, SockEvents_find);
+	if (!sockp) continue;
+
+	/*
+	**  Errors and hangups are reported to all registered events,
+	**  just like select() marks the socket as readable and writable
+	*/
+	if (what & (EPOLLERR | EPOLLHUP)) what |= EPOLLIN | EPOLLOUT;
+	if ((what & EPOLLPRI) && sockp->events[HTEvent_INDEX(HTEvent_OOB)])
+	    if ((status = EventOrder_add(s, HTEvent_OOB, now)) != HT_OK)
+		return status;
+	if ((what & EPOLLOUT) && sockp->events[HTEvent_INDEX(HTEvent_WRITE)])
+	    if ((status = EventOrder_add(s, HTEvent_WRITE, now)) != HT_OK)
+		return status;
+	if ((what & EPOLLIN) && sockp->events[HTEvent_INDEX(HTEvent_READ)])
+	    if ((status = EventOrder_add(s, HTEvent_READ, now)) != HT_OK)
+		return status;
+    }
+    return EventOrder_executeAndDelete();
+}
+#endif /* HT_EPOLL */
+
 /*
 **  There are now two versions of the event loop. The first is if you want
 **  to use async I/O on windows, and the other is if you want to use normal
@@ -714,6 +858,14 @@ PUBLIC int HTEventList_loop (HTRequest * theRequest)
 	*/
 	if (HTEndLoop) break;
 
+#ifdef HT_EPOLL
+	if (EventBackend == HT_EVENT_EPOLL) {
+	    if ((status = EventList_epollWait(timeout)) != HT_OK)
+		break;
+	    continue;
+	}
+#endif /* HT_EPOLL */
+
 	/*
 	**  Now we copy the current active file descriptors to pass them to select.
 	*/
@@ -887,6 +1039,80 @@ PUBLIC HWND HTEventList_getWinHandle (unsigned long * pMessage)
 }
 #endif /* WWW_WIN_ASYNC */
 
+/*	HTEventList_setBackend
+**	----------------------
+**	Select the mechanism used by the eventloop for waiting on sockets.
+**	Sockets that are already registered are moved to the new backend.
+**	If the backend isn't available then we keep using select(). We
+**	can't go back to select() while a socket is registered which is too
+**	big for an fd_set as it would never be polled again.
+*/
+PUBLIC BOOL HTEventList_setBackend (HTEventBackend backend)
+{
+#ifdef HT_EPOLL
+    int v;
+    if (backend == EventBackend) return YES;
+    if (HTInLoop) {
+	HTTRACE(THD_TRACE, "Event....... Can't change backend while in the eventloop\n");
+	return NO;
+    }
+    if (backend == HT_EVENT_SELECT) {
+	for (v = 0; v < HT_M_HASH_SIZE; v++) {
+	    HTList * cur = HashTable[v];
+	    SockEvents * pres;
+	    while ((pres = (SockEvents *) HTList_nextObject(cur))) {
+		if (pres->s >= FD_SETSIZE && EventList_remaining(pres)) {
+		    HTTRACE(THD_TRACE, "Event....... Can't use select with socket %d registered\n" _ pres->s);
+		    return NO;
+		}
+	    }
+	}
+    }
+    if (backend == HT_EVENT_EPOLL && EpollFd < 0) {
+	if ((EpollFd = epoll_create(EPOLL_MAX_READY)) < 0) {
+	    HTTRACE(THD_TRACE, "Event....... Can't create epoll set: `%s'\n" _
+		    HTErrnoString(errno));
+	    return NO;
+	}
+    }
+
+    /* Move all registered sockets over to the new backend */
+    for (v = 0; v < HT_M_HASH_SIZE; v++) {
+	HTList * cur = HashTable[v];
+	SockEvents * pres;
+	while ((pres = (SockEvents *) HTList_nextObject(cur))) {
+	    int set = EventList_remaining(pres);
+	    int i;
+	    for (i = 0; i < HTEvent_TYPES; i++) {
+		if (pres->s >= FD_SETSIZE || !(set & (1<<i))) continue;
+		if (backend == HT_EVENT_EPOLL)
+		    FD_CLR(pres->s, FdArray+i);
+		else
+		    FD_SET(pres->s, FdArray+i);
+	    }
+	    if (backend == HT_EVENT_EPOLL)
+		Epoll_update(pres->s, 0, set);
+	}
+    }
+    if (backend == HT_EVENT_SELECT) {
+	close(EpollFd);
+	EpollFd = -1;
+    }
+    EventBackend = backend;
+    __ResetMaxSock();
+    HTTRACE(THD_TRACE, "Event....... Using %s backend\n" _
+	    backend == HT_EVENT_EPOLL ? "epoll" : "select");
+    return YES;
+#else
+    return (backend == HT_EVENT_SELECT);
+#endif /* HT_EPOLL */
+}
+
+PUBLIC HTEventBackend HTEventList_backend (void)
+{
+    return EventBackend;
+}
+
 PUBLIC BOOL HTEventInit (void)
 {
 #ifdef WWW_WIN_ASYNC
@@ -974,6 +1200,14 @@ PUBLIC BOOL HTEventInit (void)
 
 PUBLIC BOOL HTEventTerminate (void)
 {
+    if (!HTEventList_setBackend(HT_EVENT_SELECT)) {
+#ifdef HT_EPOLL
+	close(EpollFd);
+	EpollFd = -1;
+	EventBackend = HT_EVENT_SELECT;
+#endif /* HT_EPOLL */
+    }
+
 #ifdef _WINSOCKAPI_
     WSACleanup();
 #endif /* _WINSOCKAPI_ */
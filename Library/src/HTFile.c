@@ -335,6 +335,40 @@ PRIVATE int FileCleanup (HTRequest *req, int status)
 }
 
 
+/*	HTFile_sendDirect
+**	-----------------
+**	If the application has registered a file callback and the output
+**	doesn't need any conversion then we hand it the open file instead
+**	of reading the file through the stream stack.
+**	Returns HT_OK if the callback has taken over the file, HT_ERROR if
+**	we should read the file as usual and anything else if the callback
+**	has taken over the file but couldn't send it.
+*/
+PRIVATE int HTFile_sendDirect (HTRequest * request, file_info * file)
+{
+#ifndef NO_UNIX_IO
+    HTFileCallback * cbf = HTRequest_fileCallback(request);
+    HTFormat format = HTRequest_outputFormat(request);
+    int status;
+    int fd;
+    if (!cbf || (format != WWW_SOURCE &&
+		 format != HTAnchor_format(HTRequest_anchor(request))))
+	return HT_ERROR;
+    if ((fd = open(file->local, HT_FB_RDONLY)) < 0) return HT_ERROR;
+    status = (*cbf)(request, HTRequest_fileParam(request), fd,
+		    file->stat_info.st_size);
+    if (status == HT_ERROR) {
+	close(fd);
+	return HT_ERROR;
+    }
+    HTTRACE(PROT_TRACE, "Load File... Sending `%s' directly returned %d\n" _
+	    file->local _ status);
+    return status;
+#else
+    return HT_ERROR;
+#endif /* NO_UNIX_IO */
+}
+
 /*	Load a document
 **	---------------
 **
@@ -552,6 +586,15 @@ PRIVATE int FileEvent (SOCKET soc, void * pVoid, HTEventType type)
 	    break;
 
 	  case FS_NEED_OPEN_FILE:
+	    if ((status = HTFile_sendDirect(request, file)) == HT_OK) {
+		HTRequest_addError(request, ERR_INFO, NO, HTERR_OK, NULL, 0,
+				   "HTLoadFile");
+		file->state = FS_GOT_DATA;
+		break;
+	    } else if (status != HT_ERROR) {
+		file->state = FS_ERROR;
+		break;
+	    }
 	    status = HTFileOpen(net, file->local, HT_FB_RDONLY);
 	    if (status == HT_OK) {
 		/* 
@@ -31,6 +31,7 @@ PRIVATE HTList * HTContentCoders = NULL;		   /* Content coders */
 PRIVATE HTList * HTTransferCoders = NULL;	  /* Content transfer coders */
 PRIVATE HTList * HTCharsets = NULL;
 PRIVATE HTList * HTLanguages = NULL;
+PRIVATE int HTGeneration = 0;		 /* Bumped when a global list changes */
 
 PRIVATE double HTMaxSecs = 1e10;		/* No effective limit */
 
@@ -49,6 +50,17 @@ struct _HTCoding {
 
 PRIVATE HTStream	HTBaseConverterStreamInstance;
 
+/*
+**  Note that a list has changed. Only the global lists count as they
+**  are the ones that the protocol modules can cache information about.
+*/
+PRIVATE void changed (HTList * list)
+{
+    if (list == HTConversions || list == HTContentCoders ||
+	list == HTTransferCoders || list == HTCharsets || list == HTLanguages)
+	HTGeneration++;
+}
+
 /* ------------------------------------------------------------------------- */
 /*				BASIC CONVERTERS			     */
 /* ------------------------------------------------------------------------- */
@@ -200,6 +212,7 @@ PUBLIC void HTPresentation_add (HTList *	conversions,
 	HTTRACE(CORE_TRACE, "Presentation Adding `%s\' with quality %.2f\n" _ 
 		    command _ quality);
 	HTList_addObject(conversions, pres);
+	changed(conversions);
     }
 }
 
@@ -208,6 +221,7 @@ PUBLIC void HTPresentation_deleteAll (HTList * list)
     if (list) {
 	HTList *cur = list;
 	HTPresentation *pres;
+	changed(list);
 	while ((pres = (HTPresentation*) HTList_nextObject(cur))) {
 	    HT_FREE(pres->command);
 	    HT_FREE(pres);
@@ -241,6 +255,7 @@ PUBLIC void HTConversion_add (HTList *		conversions,
     HTTRACE(CORE_TRACE, "Conversions. Adding %p with quality %.2f\n" _ 
 		converter _ quality);
     HTList_addObject(conversions, pres);
+    changed(conversions);
 }
 
 PUBLIC void HTConversion_deleteAll (HTList * list)
@@ -268,6 +283,7 @@ PUBLIC BOOL HTCoding_add (HTList * 	list,
 	me->quality = quality;
 	HTTRACE(CORE_TRACE, "Codings..... Adding %s with quality %.2f\n" _ 
 		    encoding _ quality);
+	changed(list);
 	return HTList_addObject(list, (void *) me);
     }
     HTTRACE(CORE_TRACE, "Codings..... Bad argument\n");
@@ -279,6 +295,7 @@ PUBLIC void HTCoding_deleteAll (HTList * list)
     if (list) {
 	HTList * cur = list;
 	HTCoding * pres;
+	changed(list);
 	while ((pres = (HTCoding *) HTList_nextObject(cur)))
 	    HT_FREE(pres);
 	HTList_delete(list);
@@ -314,6 +331,7 @@ PUBLIC void HTLanguage_add (HTList *		list,
     HTList_addObject(list, (void*)node);
     node->atom = HTAtom_for(lang);
     node->quality = quality;
+    changed(list);
 }
 
 PUBLIC void HTLanguage_deleteAll (HTList * list)
@@ -321,6 +339,7 @@ PUBLIC void HTLanguage_deleteAll (HTList * list)
     if (list) {
 	HTList *cur = list;
 	HTAcceptNode *pres;
+	changed(list);
 	while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
 	    HT_FREE(pres);
 	}
@@ -347,6 +366,7 @@ PUBLIC void HTCharset_add (HTList *		list,
     HTList_addObject(list, (void*)node);
     node->atom = HTAtom_for(charset);
     node->quality = quality;
+    changed(list);
 }
 
 PUBLIC void HTCharset_deleteAll (HTList * list)
@@ -354,6 +374,7 @@ PUBLIC void HTCharset_deleteAll (HTList * list)
     if (list) {
 	HTList *cur = list;
 	HTAcceptNode *pres;
+	changed(list);
 	while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
 	    HT_FREE(pres);
 	}
@@ -372,6 +393,7 @@ PUBLIC void HTCharset_deleteAll (HTList * list)
 PUBLIC void HTFormat_setConversion (HTList * list)
 {
     HTConversions = list;
+    HTGeneration++;
 }
 
 PUBLIC HTList * HTFormat_conversion (void)
@@ -398,6 +420,7 @@ PUBLIC void HTFormat_addConversion (const char *	input_format,
 PUBLIC void HTFormat_setContentCoding (HTList *list)
 {
     HTContentCoders = list;
+    HTGeneration++;
 }
 
 PUBLIC HTList * HTFormat_contentCoding (void)
@@ -421,6 +444,7 @@ PUBLIC BOOL HTFormat_addCoding ( char *		encoding,
 PUBLIC void HTFormat_setTransferCoding (HTList *list)
 {
     HTTransferCoders = list;
+    HTGeneration++;
 }
 
 PUBLIC HTList * HTFormat_transferCoding (void)
@@ -444,6 +468,7 @@ PUBLIC BOOL HTFormat_addTransferCoding ( char *		encoding,
 PUBLIC void HTFormat_setLanguage (HTList *list)
 {
     HTLanguages = list;
+    HTGeneration++;
 }
 
 PUBLIC HTList * HTFormat_language (void)
@@ -458,6 +483,7 @@ PUBLIC HTList * HTFormat_language (void)
 PUBLIC void HTFormat_setCharset (HTList *list)
 {
     HTCharsets = list;
+    HTGeneration++;
 }
 
 PUBLIC HTList * HTFormat_charset (void)
@@ -465,6 +491,11 @@ PUBLIC HTList * HTFormat_charset (void)
     return HTCharsets;
 }
 
+PUBLIC int HTFormat_generation (void)
+{
+    return HTGeneration;
+}
+
 /*
 **	Convenience function to clean up
 */
@@ -641,28 +672,17 @@ PUBLIC double HTStackValue (HTList *	theseConversions,
     return NO_VALUE_FOUND;		/* Really bad */
 }
 
-/*	Create a new coder and insert it into stream chain
-**	--------------------------------------------------
-**	Creating the content decoding stack is not based on quality factors as
-**	we don't have the freedom as with content types. Specify whether you
-**	you want encoding or decoding using the BOOL "encode" flag.
+/*
+**  Find the best content coder for this encoding, either in the request
+**  or in the global list.
 */
-PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
-					HTStream *	target,
-					HTRequest *	request,
-					void *		param,
-					BOOL		encode)
+PRIVATE HTCoding * HTContentCoding_find (HTEncoding encoding, HTRequest * request)
 {
     HTList * coders[2];
-    HTStream * top = target;
     HTCoding * pres = NULL;
     HTCoding * best_match = NULL;
     double best_quality = -1e30;		/* Pretty bad! */
     int cnt;
-    if (!encoding || !request) {
-	HTTRACE(CORE_TRACE, "Codings... Nothing applied...\n");
-	return target ? target : HTErrorStream();
-    }
     coders[0] = HTRequest_encoding(request);
     coders[1] = HTContentCoders;
     HTTRACE(CORE_TRACE, "C-E......... Looking for `%s\'\n" _ HTAtom_name(encoding));
@@ -676,6 +696,36 @@ PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
 	    }
 	}
     }
+    return best_match;
+}
+
+PUBLIC BOOL HTFormat_canEncode (HTEncoding encoding, HTRequest * request)
+{
+    HTCoding * coding;
+    if (!encoding || HTFormat_isUnityContent(encoding)) return NO;
+    coding = HTContentCoding_find(encoding, request);
+    return (coding && coding->encoder) ? YES : NO;
+}
+
+/*	Create a new coder and insert it into stream chain
+**	--------------------------------------------------
+**	Creating the content decoding stack is not based on quality factors as
+**	we don't have the freedom as with content types. Specify whether you
+**	you want encoding or decoding using the BOOL "encode" flag.
+*/
+PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
+					HTStream *	target,
+					HTRequest *	request,
+					void *		param,
+					BOOL		encode)
+{
+    HTStream * top = target;
+    HTCoding * best_match = NULL;
+    if (!encoding || !request) {
+	HTTRACE(CORE_TRACE, "Codings... Nothing applied...\n");
+	return target ? target : HTErrorStream();
+    }
+    best_match = HTContentCoding_find(encoding, request);
 
     if (best_match) {
 	HTTRACE(CORE_TRACE, "C-E......... Found `%s\'\n" _ HTAtom_name(best_match->encoding));
@@ -31,6 +31,7 @@
 #define TCP_IDLE_ACTIVE     60000L /* Active TTL in ms on an idle connection */
 
 #define MAX_PIPES		50   /* maximum number of pipelined requests */
+#define MAX_HOST_CONNECTIONS	1	 /* Parallel connections per origin */
 #define MAX_HOST_RECOVER	1	      /* Max number of auto recovery */
 #define DEFAULT_DELAY		30	  /* Default write flush delay in ms */
 
@@ -46,7 +47,8 @@ PRIVATE time_t	HTPassiveTimeout = TCP_IDLE_PASSIVE; /* Passive timeout in s */
 PRIVATE ms_t	HTActiveTimeout = TCP_IDLE_ACTIVE;   /* Active timeout in ms */
 
 PRIVATE HTList	** HostTable = NULL;
-PRIVATE HTList * PendHost = NULL;	    /* List of pending host elements */
+PRIVATE HTDeque * PendHost = NULL;	   /* Queue of pending host elements */
+PRIVATE HTDeque * IdleHost = NULL;   /* Idle persistent connections, LRU */
 
 /* JK: New functions for interruption the automatic pending request 
    activation */
@@ -58,15 +60,62 @@ PRIVATE BOOL DoPendingReqLaunch = YES; /* controls automatic activation
 PRIVATE int EventTimeout = -1;		        /* Global Host event timeout */
 
 PRIVATE ms_t WriteDelay = DEFAULT_DELAY;		      /* Delay in ms */
+PRIVATE BOOL WriteBatch = YES;		 /* Flush once per loop iteration */
 
 PRIVATE int MaxPipelinedRequests = MAX_PIPES;
+PRIVATE int MaxHostConnections = MAX_HOST_CONNECTIONS;
+
+PRIVATE HTList * OriginLimits = NULL;	     /* Per origin connection limits */
+
+PRIVATE unsigned long ReusedConnections = 0;
+PRIVATE unsigned long EvictedConnections = 0;
+
+typedef struct _HTOriginLimit {
+    char *		hostname;
+    u_short		u_port;
+    int			max;
+} HTOriginLimit;
+
+/*
+**  What we learn about the server, like its version and the methods it
+**  allows, is kept in the first Host object for the origin and shared by
+**  the other connections to it.
+*/
+#define ORIGIN(me)	((me)->primary ? (me)->primary : (me))
 
 /* ------------------------------------------------------------------------- */
 
+/*
+**  Before a primary Host object is deleted, the next connection to the
+**  same origin takes over what we know about the server
+*/
+PRIVATE void handoverOrigin (HTHost * me)
+{
+    HTList * cur = HostTable ? HostTable[me->hash] : NULL;
+    HTHost * heir = NULL;
+    HTHost * pres;
+    while ((pres = (HTHost *) HTList_nextObject(cur))) {
+	if (pres->primary != me) continue;
+	if (!heir) {
+	    heir = pres;
+	    heir->primary = NULL;
+	    heir->type = me->type;
+	    heir->version = me->version;
+	    heir->methods = me->methods;
+	    heir->server = me->server;
+	    heir->user_agent = me->user_agent;
+	    heir->range_units = me->range_units;
+	    me->type = me->server = me->user_agent = me->range_units = NULL;
+	} else
+	    pres->primary = heir;
+    }
+}
+
 PRIVATE void free_object (HTHost * me)
 {
     if (me) {
 	int i;
+	if (!me->primary) handoverOrigin(me);
 	HT_FREE(me->hostname);
 	HT_FREE(me->type);
 	HT_FREE(me->server);
@@ -85,10 +134,13 @@ PRIVATE void free_object (HTHost * me)
 
 	/* Delete the timer (if any) */
 	if (me->timer) HTTimer_delete(me->timer);
+	if (me->readTimer) HTTimer_delete(me->readTimer);
 
 	/* Delete the queues */
-	HTList_delete(me->pipeline);
-	HTList_delete(me->pending);
+	HTDeque_unlink(&me->pendLink);
+	HTDeque_unlink(&me->idleLink);
+	HTDeque_delete(me->pipeline);
+	HTDeque_delete(me->pending);
 	HT_FREE(me);
     }
 }
@@ -103,21 +155,21 @@ PRIVATE BOOL delete_object (HTList * list, HTHost * me)
 
 PRIVATE BOOL isLastInPipe (HTHost * host, HTNet * net)
 {
-    return HTList_lastObject(host->pipeline) == net;
+    return HTDeque_last(host->pipeline) == net;
 }
 
 PRIVATE BOOL killPipeline (HTHost * host, HTEventType type)
 {
     if (host) {
-	int piped = HTList_count(host->pipeline);
-	int pending = HTList_count(host->pending);
+	int piped = HTDeque_count(host->pipeline);
+	int pending = HTDeque_count(host->pending);
 	int cnt;
 
 	HTTRACE(CORE_TRACE, "Host kill... Pipeline due to %s event\n" _ HTEvent_type2str(type));
 
 	/* Terminate all net objects in pending queue */
 	for (cnt=0; cnt<pending; cnt++) {
-	    HTNet * net = HTList_removeLastObject(host->pending);
+	    HTNet * net = HTDeque_removeLast(host->pending);
 	    if (net) {
 		HTTRACE(CORE_TRACE, "Host kill... Terminating net object %p from pending queue\n" _ net);
 		net->registeredFor = 0;
@@ -133,7 +185,7 @@ PRIVATE BOOL killPipeline (HTHost * host, HTEventType type)
 	    **  Terminte all net objects in the pipeline
 	    */
 	    for (cnt=0; cnt<piped; cnt++) {
-		HTNet * net = HTList_firstObject(host->pipeline);
+		HTNet * net = HTDeque_first(host->pipeline);
 		if (net) {
 		    HTTRACE(CORE_TRACE, "Host kill... Terminating net object %p from pipe line\n" _ net);
 		    net->registeredFor = 0;
@@ -162,10 +214,52 @@ PRIVATE int IdleTimeoutEvent (HTTimer * timer, void * param, HTEventType type)
 
     HTTimer_delete(timer);
     host->timer = NULL;
+    HTDeque_unlink(&host->idleLink);
 
     return HostEvent (sockfd, host, HTEvent_CLOSE);
 }
 
+/*
+**  Data for the next request in the pipe was read while the previous
+**  request was handled outside HostEvent, for example when a pipelined
+**  request is launched from the write side. Pass it on as if we had
+**  received a READ event; the socket itself may never become readable
+**  again.
+*/
+PRIVATE int ReadEvent (HTTimer * timer, void * param, HTEventType type)
+{
+    HTHost * host = (HTHost *) param;
+
+    HTTimer_delete(timer);
+    host->readTimer = NULL;
+    if (host->channel && host->remainingRead > 0 &&
+	!HTDeque_isEmpty(host->pipeline))
+	return HostEvent(HTChannel_socket(host->channel), host, HTEvent_READ);
+    return HT_OK;
+}
+
+/*
+**  When we are out of sockets then close the idle persistent connection
+**  that has been idle the longest in order to make room for a new one.
+*/
+PRIVATE BOOL evictIdleHost (void)
+{
+    HTHost * host = (HTHost *) HTDeque_first(IdleHost);
+    if (host) {
+	HTTRACE(CORE_TRACE, "Host info... Evicting idle connection to `%s' on host %p\n" _
+		host->hostname _ host);
+	EvictedConnections++;
+	if (host->timer)
+	    IdleTimeoutEvent(host->timer, host, HTEvent_TIMEOUT);
+	else {
+	    HTDeque_unlink(&host->idleLink);
+	    HTHost_clearChannel(host, HT_OK);
+	}
+	return YES;
+    }
+    return NO;
+}
+
 /*
 **	HostEvent - host event manager - recieves events from the event 
 **	manager and dispatches them to the client net objects by calling the 
@@ -180,6 +274,7 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 	HTNet * targetNet;
 
 	/* call the first net object */
+	host->inRead = YES;
 	do {
 	    int ret;
 
@@ -191,16 +286,19 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 		HTTRACE(CORE_TRACE, "Host Event.. wild socket %d type = %s real socket is %d\n" _ soc _ 
 			type == HTEvent_CLOSE ? "Event_Close" : "Event_Read" _ 
 			HTChannel_socket(host->channel));
+		host->inRead = NO;
 		return HT_OK;
 	    }
 
-	    targetNet = (HTNet *)HTList_firstObject(host->pipeline);
+	    targetNet = (HTNet *)HTDeque_first(host->pipeline);
 	    if (targetNet) {
 		HTTRACE(CORE_TRACE, "Host Event.. READ passed to `%s\'\n" _ 
 			    HTAnchor_physical(HTRequest_anchor(HTNet_request(targetNet))));
 		if ((ret = (*targetNet->event.cbf)(HTChannel_socket(host->channel), 
-						  targetNet->event.param, type)) != HT_OK)
+						  targetNet->event.param, type)) != HT_OK) {
+		    host->inRead = NO;
 		    return ret;
+		}
 	    }
 	    if (targetNet == NULL && host->remainingRead > 0) {
 		HTTRACE(CORE_TRACE, "HostEvent... Error: %d bytes left to read and nowhere to put them\n" _ 
@@ -212,6 +310,7 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 	    }
 	/* call pipelined net object to eat all the data in the channel */
 	} while (host->remainingRead > 0);
+	host->inRead = NO;
 
 	/* last target net should have set remainingRead to 0 */
 	if (targetNet)
@@ -238,7 +337,7 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 	return HT_OK; 	     /* extra garbage does not constitute an application error */
 	
     } else if (type == HTEvent_WRITE || type == HTEvent_CONNECT) {
-	HTNet * targetNet = (HTNet *)HTList_lastObject(host->pipeline);
+	HTNet * targetNet = (HTNet *)HTDeque_last(host->pipeline);
 	if (targetNet) {
 	    HTTRACE(CORE_TRACE, "Host Event.. WRITE passed to `%s\'\n" _ 
 			HTAnchor_physical(HTRequest_anchor(HTNet_request(targetNet))));
@@ -249,8 +348,8 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 		    host ? host->hostname : "<null>" _ 
 		    HTEvent_type2str(type) _ 
 		    host ? host->reqsMade : -1 _ 
-		    HTList_count(host->pipeline) _ 
-		    HTList_count(host->pending));
+		    HTDeque_count(host->pipeline) _ 
+		    HTDeque_count(host->pending));
 #if 0
 	HTDEBUGBREAK("Host Event.. Host %p (`%s\') dispatched with event %d\n" _ 
 		     host _ host ? host->hostname : "<null>" _ type);
@@ -267,6 +366,45 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
     return HT_OK;
 }
 
+/*
+**	Find the connection to an origin with the fewest outstanding and
+**	pending Net objects, preferring one with an open channel, and
+**	collect Host objects that haven't been used for a long time on the
+**	way. A negative port matches any port. The number of connections to
+**	the origin is returned in pConnections.
+*/
+PRIVATE HTHost * leastLoaded (HTList * list, const char * host, int port,
+			      int * pConnections)
+{
+    HTList * cur = list;
+    HTHost * least = NULL;
+    HTHost * pres;
+    int least_load = 0;
+    int connections = 0;
+    while ((pres = (HTHost *) HTList_nextObject(cur))) {
+	if (!strcmp(pres->hostname, host) && (port < 0 || port == pres->u_port)) {
+	    int load;
+	    if (HTHost_isIdle(pres) && time(NULL) > pres->ntime + HostTimeout) {
+		HTTRACE(CORE_TRACE, "Host info... Collecting host info %p\n" _ pres);
+		delete_object(list, pres);
+		cur = list;				      /* Start over */
+		least = NULL;
+		connections = 0;
+		continue;
+	    }
+	    connections++;
+	    load = 2 * (HTDeque_count(pres->pipeline) + HTDeque_count(pres->pending)) +
+		(pres->channel ? 0 : 1);
+	    if (!least || load < least_load) {
+		least = pres;
+		least_load = load;
+	    }
+	}
+    }
+    if (pConnections) *pConnections = connections;
+    return least;
+}
+
 /*
 **	Search the host info cache for a host object or create a new one
 **	and add it. Examples of host names are
@@ -282,6 +420,7 @@ PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 {
     HTList * list = NULL;			    /* Current list in cache */
     HTHost * pres = NULL;
+    HTHost * sibling = NULL;	       /* Another connection to same origin */
     int hash = 0;
     if (!host) {
 	HTTRACE(CORE_TRACE, "Host info... Bad argument\n");
@@ -302,18 +441,20 @@ PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 	list = HostTable[hash];
     }
 
-    /* Search the cache */
+    /*
+    **  Search the cache. We may have more than one Host object for the
+    **  same origin, each with its own connection. Use an unused or idle
+    **  connection if there is one, else open a new connection if we are
+    **  below the limit for the origin, else use the least loaded connection.
+    */
     {
-	HTList * cur = list;
-	while ((pres = (HTHost *) HTList_nextObject(cur))) {
-	    if (!strcmp(pres->hostname, host) && u_port == pres->u_port) {
-		if (HTHost_isIdle(pres) && time(NULL)>pres->ntime+HostTimeout){
-		    HTTRACE(CORE_TRACE, "Host info... Collecting host info %p\n" _ pres);
-		    delete_object(list, pres);
-		    pres = NULL;
-		}
-		break;
-	    }
+	int connections = 0;
+	if ((pres = leastLoaded(list, host, u_port, &connections)) != NULL &&
+	    HTHost_numberOfOutstandingNetObjects(pres) +
+	    HTHost_numberOfPendingNetObjects(pres) > 0 && u_port &&
+	    connections < HTHost_maxOriginConnections(host, u_port)) {
+	    sibling = pres;
+	    pres = NULL;
 	}
     }
 
@@ -333,6 +474,7 @@ PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 		    HTHost_clearChannel(pres, HT_OK);
                 } else {
                     pres->expires = t + HTPassiveTimeout;
+		    if (HTHost_isIdle(pres)) ReusedConnections++;
                     HTTRACE(CORE_TRACE, "Host info... REUSING CHANNEL %p\n" _ pres->channel);
                 }
             }
@@ -348,7 +490,12 @@ PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 	pres->ntime = time(NULL);
 	pres->mode = HT_TP_SINGLE;
 	pres->delay = WriteDelay;
+	pres->batch = WriteBatch;
 	pres->inFlush = NO;
+	if (sibling) {
+	    HTTRACE(CORE_TRACE, "Host info... Opening another connection to `%s'\n" _ host);
+	    pres->primary = ORIGIN(sibling);
+	}
 	{
 	    int i;
 	    for (i = 0; i < HTEvent_TYPES; i++)
@@ -438,21 +585,9 @@ PUBLIC HTHost * HTHost_find (char * host)
 	list = HostTable[hash];
 
 	/* Search the cache */
-	{
-	    HTList * cur = list;
-	    while ((pres = (HTHost *) HTList_nextObject(cur))) {
-		if (!strcmp(pres->hostname, host)) {
-		    if (time(NULL) > pres->ntime + HostTimeout) {
-			HTTRACE(CORE_TRACE, "Host info... Collecting host %p\n" _ pres);
-			delete_object(list, pres);
-			pres = NULL;
-  		    } else {
-			HTTRACE(CORE_TRACE, "Host info... Found `%s\'\n" _ host);
-		    }
-		    return pres;
-		}
-	    }
-	}
+	if ((pres = leastLoaded(list, host, -1, NULL)) != NULL)
+	    HTTRACE(CORE_TRACE, "Host info... Found `%s\'\n" _ host);
+	return pres;
     }
     return NULL;
 }
@@ -466,6 +601,16 @@ PUBLIC void HTHost_deleteAll (void)
     HTHost * host;
     int i;
 
+    if (OriginLimits) {
+	HTOriginLimit * limit;
+	while ((limit = (HTOriginLimit *) HTList_removeLastObject(OriginLimits))) {
+	    HT_FREE(limit->hostname);
+	    HT_FREE(limit);
+	}
+	HTList_delete(OriginLimits);
+	OriginLimits = NULL;
+    }
+
     if (!HostTable)
 	return;
 
@@ -473,7 +618,7 @@ PUBLIC void HTHost_deleteAll (void)
 	list = HostTable[i];
 	if (!list) continue;
 
-	while ((host = (HTHost *) HTList_removeFirstObject(list)) != NULL)
+	while ((host = (HTHost *) HTList_removeLastObject(list)) != NULL)
 	    free_object(host);
 
 	HTList_delete(list);
@@ -481,6 +626,10 @@ PUBLIC void HTHost_deleteAll (void)
 
     HT_FREE(HostTable);
     HostTable = NULL;
+    HTDeque_delete(PendHost);
+    PendHost = NULL;
+    HTDeque_delete(IdleHost);
+    IdleHost = NULL;
 }
 
 /*
@@ -496,12 +645,12 @@ PUBLIC char * HTHost_name (HTHost * host)
 */
 PUBLIC char * HTHost_class (HTHost * host)
 {
-     return host ? host->type : NULL;
+     return host ? ORIGIN(host)->type : NULL;
 }
 
 PUBLIC void HTHost_setClass (HTHost * host, char * s_class)
 {
-    if (host && s_class) StrAllocCopy(host->type, s_class);
+    if (host && s_class) StrAllocCopy(ORIGIN(host)->type, s_class);
 }
 
 /*
@@ -509,12 +658,12 @@ PUBLIC void HTHost_setClass (HTHost * host, char * s_class)
 */
 PUBLIC int HTHost_version (HTHost *host)
 {
-     return host ? host->version : 0;
+     return host ? ORIGIN(host)->version : 0;
 }
 
 PUBLIC void HTHost_setVersion (HTHost * host, int version)
 {
-    if (host) host->version = version;
+    if (host) ORIGIN(host)->version = version;
 }
 
 /*
@@ -590,17 +739,17 @@ PUBLIC int HTHost_reqsMade (HTHost * host)
 */
 PUBLIC HTMethod HTHost_publicMethods (HTHost * me)
 {
-    return me ? me->methods : METHOD_INVALID;
+    return me ? ORIGIN(me)->methods : METHOD_INVALID;
 }
 
 PUBLIC void HTHost_setPublicMethods (HTHost * me, HTMethod methodset)
 {
-    if (me) me->methods = methodset;
+    if (me) ORIGIN(me)->methods = methodset;
 }
 
 PUBLIC void HTHost_appendPublicMethods (HTHost * me, HTMethod methodset)
 {
-    if (me) me->methods |= methodset;
+    if (me) ORIGIN(me)->methods |= methodset;
 }
 
 /*
@@ -608,13 +757,13 @@ PUBLIC void HTHost_appendPublicMethods (HTHost * me, HTMethod methodset)
 */
 PUBLIC char * HTHost_server (HTHost * host)
 {
-     return host ? host->server : NULL;
+     return host ? ORIGIN(host)->server : NULL;
 }
 
 PUBLIC BOOL HTHost_setServer (HTHost * host, const char * server)
 {
     if (host && server) {
-	StrAllocCopy(host->server, server);
+	StrAllocCopy(ORIGIN(host)->server, server);
 	return YES;
     }
     return NO;
@@ -625,13 +774,13 @@ PUBLIC BOOL HTHost_setServer (HTHost * host, const char * server)
 */
 PUBLIC char * HTHost_userAgent (HTHost * host)
 {
-     return host ? host->user_agent : NULL;
+     return host ? ORIGIN(host)->user_agent : NULL;
 }
 
 PUBLIC BOOL HTHost_setUserAgent (HTHost * host, const char * userAgent)
 {
     if (host && userAgent) {
-	StrAllocCopy(host->user_agent, userAgent);
+	StrAllocCopy(ORIGIN(host)->user_agent, userAgent);
 	return YES;
     }
     return NO;
@@ -642,13 +791,13 @@ PUBLIC BOOL HTHost_setUserAgent (HTHost * host, const char * userAgent)
 */
 PUBLIC char * HTHost_rangeUnits (HTHost * host)
 {
-     return host ? host->range_units : NULL;
+     return host ? ORIGIN(host)->range_units : NULL;
 }
 
 PUBLIC BOOL HTHost_setRangeUnits (HTHost * host, const char * units)
 {
     if (host && units) {
-	StrAllocCopy(host->range_units, units);
+	StrAllocCopy(ORIGIN(host)->range_units, units);
 	return YES;
     }
     return NO;
@@ -790,6 +939,7 @@ PUBLIC BOOL HTHost_clearChannel (HTHost * host, int status)
 	host->expires = 0;	
 	host->channel = NULL;
 	host->tcpstate = TCP_BEGIN;
+	HTDeque_unlink(&host->idleLink);
 	host->reqsMade = 0;
 	if (HTHost_isPersistent(host)) {
 	    HTNet_decreasePersistentSocket();
@@ -803,8 +953,8 @@ PUBLIC BOOL HTHost_clearChannel (HTHost * host, int status)
 
 	HTTRACE(CORE_TRACE, "Host info... removed host %p as persistent\n" _ host);
 
-	if (!HTList_isEmpty(host->pending)) {
-	    HTTRACE(CORE_TRACE, "Host has %d object(s) pending - attempting launch\n" _ HTList_count(host->pending));
+	if (!HTDeque_isEmpty(host->pending)) {
+	    HTTRACE(CORE_TRACE, "Host has %d object(s) pending - attempting launch\n" _ HTDeque_count(host->pending));
 	    HTHost_launchPending(host);
 	}
 	return YES;
@@ -824,7 +974,7 @@ PUBLIC BOOL HTHost_doRecover (HTHost * host)
 PUBLIC BOOL HTHost_recoverPipe (HTHost * host)
 {
     if (host) {
-	int piped = HTList_count(host->pipeline);
+	int piped = HTDeque_count(host->pipeline);
 
 	/*
 	**  First check that we haven't already recovered more than we want
@@ -858,13 +1008,13 @@ PUBLIC BOOL HTHost_recoverPipe (HTHost * host)
 	    /*
 	    **  Move all net objects from the net object to the pending queue.
 	    */
-	    if (!host->pending) host->pending = HTList_new();
+	    if (!host->pending) host->pending = HTDeque_new();
 	    for (cnt=0; cnt<piped; cnt++) {
-		HTNet * net = HTList_removeLastObject(host->pipeline);
+		HTNet * net = HTDeque_removeLast(host->pipeline);
 		HTTRACE(CORE_TRACE, "Host recover Resetting net object %p\n" _ net);
 		net->registeredFor = 0;
 		(*net->event.cbf)(HTChannel_socket(host->channel), net->event.param, HTEvent_RESET);
-		HTList_appendObject(host->pending, net);
+		HTDeque_prependLink(host->pending, &net->hostLink, net);
 		host->lock = net;
 	    }
 
@@ -908,16 +1058,16 @@ PUBLIC BOOL HTHost_setMode (HTHost * host, HTTransportMode mode)
 	**  Check the new mode and see if we must adjust the queues.
 	*/
 	if (mode == HT_TP_SINGLE && host->mode > mode) {
-	    int piped = HTList_count(host->pipeline);
+	    int piped = HTDeque_count(host->pipeline);
 	    if (piped > 0) {
 		int cnt;
 		HTTRACE(CORE_TRACE, "Host info... Moving %d Net objects from pipe line to pending queue\n" _ piped);
-		if (!host->pending) host->pending = HTList_new();
+		if (!host->pending) host->pending = HTDeque_new();
 		for (cnt=0; cnt<piped; cnt++) {
-		    HTNet * net = HTList_removeLastObject(host->pipeline);
+		    HTNet * net = HTDeque_removeLast(host->pipeline);
 		    HTTRACE(CORE_TRACE, "Host info... Resetting net object %p\n" _ net);
 		    (*net->event.cbf)(HTChannel_socket(host->channel), net->event.param, HTEvent_RESET);
-		    HTList_appendObject(host->pending, net);
+		    HTDeque_prependLink(host->pending, &net->hostLink, net);
 		}
 		HTChannel_setSemaphore(host->channel, 0);
 		HTHost_clearChannel(host, HT_INTERRUPTED);
@@ -948,7 +1098,7 @@ PUBLIC BOOL HTHost_setMode (HTHost * host, HTTransportMode mode)
 */
 PUBLIC BOOL HTHost_isIdle (HTHost * host)
 {
-    return (host && HTList_isEmpty(host->pipeline));
+    return (host && HTDeque_isEmpty(host->pipeline));
 }
 
 PRIVATE BOOL _roomInPipe (HTHost * host)
@@ -958,7 +1108,7 @@ PRIVATE BOOL _roomInPipe (HTHost * host)
 	(host->reqsPerConnection && host->reqsMade >= host->reqsPerConnection) ||
 	HTHost_closeNotification(host) || host->broken_pipe)
 	return NO;
-    count = HTList_count(host->pipeline);
+    count = HTDeque_count(host->pipeline);
     switch (host->mode) {
     case HT_TP_SINGLE:
 	return count <= 0;
@@ -985,30 +1135,33 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 
 	/*
 	**  If we don't have a socket already then check to see if we can get
-	**  one. Otherwise we put the host object into our pending queue.
+	**  one, if necessary by closing the connection that has been idle the
+	**  longest. Otherwise we put the host object into our pending queue.
 	*/
-	if (!host->channel && HTNet_availableSockets() <= 0) {
+	if (!host->channel && HTNet_availableSockets() <= 0 &&
+	    (!evictIdleHost() || HTNet_availableSockets() <= 0)) {
 
 	    /* Create list for pending Host objects */
-	    if (!PendHost) PendHost = HTList_new();
+	    if (!PendHost) PendHost = HTDeque_new();
 
 	    /* Add the host object ad pending if not already */
-	    if (HTList_indexOf(PendHost, host) < 0) HTList_addObject(PendHost, host);
+	    if (!HTDeque_isLinkedTo(&host->pendLink, PendHost))
+		HTDeque_appendLink(PendHost, &host->pendLink, host);
 
 	    /* 
 	    ** Add the Net object to the Host object. If it is the current Net
 	    ** obejct holding the lock then add it to the beginning of the list.
 	    ** Otherwise add it to the end
 	    */
-	    if (!host->pending) host->pending = HTList_new();
+	    if (!host->pending) host->pending = HTDeque_new();
 	    if (host->lock == net)
-		HTList_appendObject(host->pending, net);
+		HTDeque_prependLink(host->pending, &net->hostLink, net);
 	    else
-		HTList_addObject(host->pending, net);
+		HTDeque_appendLink(host->pending, &net->hostLink, net);
 
  	    HTTRACE(CORE_TRACE, "Host info... Added Net %p (request %p) as pending on pending Host %p, %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ host _ host->reqsMade _ 
-			HTList_count(host->pipeline) _ HTList_count(host->pending));
+			HTDeque_count(host->pipeline) _ HTDeque_count(host->pending));
 	    return HT_PENDING;
 	}
 
@@ -1018,23 +1171,23 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 	** Do NOT add extra copies of the HTNet object to
 	** the pipeline or pending list (if it's already on the list).
 	*/
-	if (HTList_indexOf(host->pipeline, net) >= 0) {
+	if (HTDeque_indexOf(host->pipeline, net) >= 0) {
 	    HTTRACE(CORE_TRACE, "Host info... The Net %p (request %p) is already in pipe,"
 			" %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ host->reqsMade _ 
-			HTList_count(host->pipeline) _ 
-			HTList_count(host->pending));
+			HTDeque_count(host->pipeline) _ 
+			HTDeque_count(host->pending));
 	    HTDEBUGBREAK("Net object %p registered multiple times in pipeline\n" _ 
 			 net);
 	    return HT_OK;
 	}
 
-	if (HTList_indexOf(host->pending,  net) >= 0) {
+	if (HTDeque_indexOf(host->pending,  net) >= 0) {
 	    HTTRACE(CORE_TRACE, "Host info... The Net %p (request %p) already pending,"
 			" %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ host->reqsMade _ 
-			HTList_count(host->pipeline) _ 
-			HTList_count(host->pending));
+			HTDeque_count(host->pipeline) _ 
+			HTDeque_count(host->pending));
 	    HTDEBUGBREAK("Net object %p registered multiple times in pending queue\n" _ 
 			 net);
 
@@ -1045,14 +1198,14 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 	/*
 	**  Add net object to either active or pending queue.
 	*/
-	if (_roomInPipe(host) && (HTList_isEmpty(host->pending) || doit)) {
+	if (_roomInPipe(host) && (HTDeque_isEmpty(host->pending) || doit)) {
 	    if (doit) host->doit = NULL;
-	    if (!host->pipeline) host->pipeline = HTList_new();
-	    HTList_addObject(host->pipeline, net);
+	    if (!host->pipeline) host->pipeline = HTDeque_new();
+	    HTDeque_appendLink(host->pipeline, &net->hostLink, net);
 	    host->reqsMade++;
             HTTRACE(CORE_TRACE, "Host info... Added Net %p (request %p) to pipe on Host %p, %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ host _ host->reqsMade _ 
-			HTList_count(host->pipeline) _ HTList_count(host->pending));
+			HTDeque_count(host->pipeline) _ HTDeque_count(host->pending));
 
 	    /*
 	    **  If we have been idle then make sure we delete the timer
@@ -1061,6 +1214,7 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 		HTTimer_delete(host->timer);
 		host->timer = NULL;
 	    }
+	    HTDeque_unlink(&host->idleLink);
            
             /*JK: New CBF function
 	    ** Call any user-defined callback to say the request will
@@ -1069,12 +1223,12 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
             HTHost_ActivateRequest (net);
 
 	} else {
-	    if (!host->pending) host->pending = HTList_new();
-	    HTList_addObject(host->pending, net);	    
+	    if (!host->pending) host->pending = HTDeque_new();
+	    HTDeque_appendLink(host->pending, &net->hostLink, net);
 	    HTTRACE(CORE_TRACE, "Host info... Added Net %p (request %p) as pending on Host %p, %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ 
 			host _ host->reqsMade _ 
-			HTList_count(host->pipeline) _ HTList_count(host->pending));
+			HTDeque_count(host->pipeline) _ HTDeque_count(host->pending));
 	    status = HT_PENDING;
 	}
 	return status;
@@ -1088,7 +1242,7 @@ PRIVATE BOOL HTHost_free (HTHost * host, int status)
 
 	/* Check if we should keep the socket open */
         if (HTHost_isPersistent(host)) {
-	    int piped = HTList_count(host->pipeline);
+	    int piped = HTDeque_count(host->pipeline);
             if (HTHost_closeNotification(host)) {
 		HTTRACE(CORE_TRACE, "Host Object. got close notifiation on socket %d\n" _ 
 			    HTChannel_socket(host->channel));
@@ -1134,9 +1288,11 @@ PRIVATE BOOL HTHost_free (HTHost * host, int status)
                 **  If connection is idle then set a timer so that we close the 
                 **  connection if idle too long
                 */
-                if (piped<=1 && HTList_isEmpty(host->pending) && !host->timer) {
+                if (piped<=1 && HTDeque_isEmpty(host->pending) && !host->timer) {
                     host->timer = HTTimer_new(NULL, IdleTimeoutEvent,
 					      host, HTActiveTimeout, YES, NO);
+		    if (!IdleHost) IdleHost = HTDeque_new();
+		    HTDeque_appendLink(IdleHost, &host->idleLink, host);
                     HTTRACE(PROT_TRACE, "Host........ Object %p going idle...\n" _ host);
                 }
             }
@@ -1156,13 +1312,26 @@ PUBLIC BOOL HTHost_deleteNet (HTHost * host, HTNet * net, int status)
         HTTRACE(CORE_TRACE, "Host info... Remove %p from pipe\n" _ net);
 
 	/* If the Net object is in the pipeline then also update the channel */
-	if (host->pipeline && HTList_indexOf(host->pipeline, net) >= 0) {
+	if (HTDeque_isLinkedTo(&net->hostLink, host->pipeline)) {
 	    HTHost_free(host, status);
-	    HTList_removeObjectAll(host->pipeline, net);
+	    HTDeque_unlink(&net->hostLink);
+
+	    /*
+	    **  If there is data left for the next request and nobody is
+	    **  going to hand it over then do it from the event loop
+	    */
+	    if (host->remainingRead > 0 && !host->inRead && !host->readTimer &&
+		!HTDeque_isEmpty(host->pipeline)) {
+		HTTRACE(CORE_TRACE, "Host info... %d bytes left for next in pipe on host %p\n" _
+			host->remainingRead _ host);
+		host->readTimer = HTTimer_defer(ReadEvent, host);
+	    }
 	}
 
-	HTList_removeObjectAll(host->pending, net); /* just to make sure */
-	host->lock = HTList_firstObject(host->pending);
+	/* just to make sure */
+	if (HTDeque_isLinkedTo(&net->hostLink, host->pending))
+	    HTDeque_unlink(&net->hostLink);
+	host->lock = HTDeque_first(host->pending);
 	return YES;
     }
     return NO;
@@ -1189,7 +1358,7 @@ PUBLIC HTNet * HTHost_nextPendingNet (HTHost * host)
 	/*JK 23/Sep/96 Bug correction. Associated the following lines to the
 	**above if. There was a missing pair of brackets. 
 	*/
-	if ((net = (HTNet *) HTList_removeFirstObject(host->pending)) != NULL) {
+	if ((net = (HTNet *) HTDeque_removeFirst(host->pending)) != NULL) {
 	    HTTRACE(CORE_TRACE, "Host info... Popping %p from pending net queue on host %p\n" _ 
 			net _ host);
 #if 0
@@ -1212,7 +1381,7 @@ PUBLIC HTHost * HTHost_nextPendingHost (void)
 {
     HTHost * host = NULL;
     if (PendHost) {
-	if ((host = (HTHost *) HTList_removeFirstObject(PendHost)) != NULL)
+	if ((host = (HTHost *) HTDeque_removeFirst(PendHost)) != NULL)
 	    HTTRACE(PROT_TRACE, "Host info... Popping %p from pending host queue\n" _ 
 			host);
     }
@@ -1238,7 +1407,7 @@ PUBLIC BOOL HTHost_launchPending (HTHost * host)
     **  registered for write
     */
     if (host->mode == HT_TP_PIPELINE) {
-	net = (HTNet *) HTList_lastObject(host->pipeline);
+	net = (HTNet *) HTDeque_last(host->pipeline);
 	if (net && net->registeredFor == HTEvent_WRITE)
 	    return NO;
     }
@@ -1250,7 +1419,7 @@ PUBLIC BOOL HTHost_launchPending (HTHost * host)
 	   (net = HTHost_nextPendingNet(host))) {
 	HTHost_ActivateRequest(net);
 	HTTRACE(CORE_TRACE, "Launch pending net object %p with %d reqs in pipe (%d reqs made)\n" _ 
-		    net _ HTList_count(host->pipeline) _ host->reqsMade);
+		    net _ HTDeque_count(host->pipeline) _ host->reqsMade);
 	return HTNet_execute(net, HTEvent_WRITE);
     }
 
@@ -1260,11 +1429,11 @@ PUBLIC BOOL HTHost_launchPending (HTHost * host)
     if (DoPendingReqLaunch && HTNet_availableSockets() > 0) {
 	HTHost * pending = HTHost_nextPendingHost();
 	if (pending && (net = HTHost_nextPendingNet(pending))) {
-	    if (!pending->pipeline) pending->pipeline = HTList_new();
-	    HTList_addObject(pending->pipeline, net);
+	    if (!pending->pipeline) pending->pipeline = HTDeque_new();
+	    HTDeque_appendLink(pending->pipeline, &net->hostLink, net);
 	    host->reqsMade++;
 	    HTTRACE(CORE_TRACE, "Launch pending host object %p, net %p with %d reqs in pipe (%d reqs made)\n" _ 
-			pending _ net _ HTList_count(pending->pipeline) _ pending->reqsMade);
+			pending _ net _ HTDeque_count(pending->pipeline) _ pending->reqsMade);
 	    HTHost_ActivateRequest(net);
 	    return HTNet_execute(net, HTEvent_WRITE);
 	}
@@ -1274,17 +1443,17 @@ PUBLIC BOOL HTHost_launchPending (HTHost * host)
 
 PUBLIC HTNet * HTHost_firstNet (HTHost * host)
 {
-    return (HTNet *) HTList_firstObject(host->pipeline);
+    return (HTNet *) HTDeque_first(host->pipeline);
 }
 
 PUBLIC int HTHost_numberOfOutstandingNetObjects (HTHost * host)
 {
-    return host ? HTList_count(host->pipeline) : -1;
+    return host ? HTDeque_count(host->pipeline) : -1;
 }
 
 PUBLIC int HTHost_numberOfPendingNetObjects (HTHost * host)
 {
-    return host ? HTList_count(host->pending) : -1;
+    return host ? HTDeque_count(host->pending) : -1;
 }
 
 /*
@@ -1305,12 +1474,13 @@ PUBLIC int HTHost_connect (HTHost * host, HTNet * net, char * url)
 	/*
 	** If not already locked and without a channel
 	** then lock the darn thing with the first Net object
-	** pending.
+	** pending. Don't delay the first write on the new channel
+	** unless we flush at the end of the event loop pass anyway.
 	*/
 	if (!host->lock && !host->channel) {
 	    HTNet * next_pending = NULL;
-	    host->forceWriteFlush = YES;
-	    host->lock = (next_pending = HTList_firstObject(host->pending)) ?
+	    host->forceWriteFlush = !host->batch;
+	    host->lock = (next_pending = HTDeque_first(host->pending)) ?
 		next_pending : net;
 	    HTTRACE(CORE_TRACE, "Host connect Grabbing lock on Host %p with %p\n" _ host _ host->lock);
 	}
@@ -1331,7 +1501,7 @@ PUBLIC int HTHost_connect (HTHost * host, HTNet * net, char * url)
 	    **  take over the current lock
 	    */
 	    HTNet * next_pending = NULL;
-	    if ((next_pending = HTList_firstObject(host->pending))) {
+	    if ((next_pending = HTDeque_first(host->pending))) {
 		HTTRACE(CORE_TRACE, "Host connect Changing lock on Host %p to %p\n" _ 
 			host _ next_pending);
 		host->lock = next_pending;	    
@@ -1365,7 +1535,7 @@ PUBLIC int HTHost_listen (HTHost * host, HTNet * net, char * url)
 	** pending.
 	*/
 	if (!host->lock && !host->channel) {
-	    host->forceWriteFlush = YES;
+	    host->forceWriteFlush = !host->batch;
 	    host->lock = net;
 	}
 	HTNet_setHost(net, host);
@@ -1410,7 +1580,7 @@ PUBLIC int HTHost_accept (HTHost * host, HTNet * net, char * url)
 	    **  take over the current lock
 	    */
 	    HTNet * next_pending = NULL;
-	    if ((next_pending = HTList_firstObject(host->pending))) {
+	    if ((next_pending = HTDeque_first(host->pending))) {
 		HTTRACE(CORE_TRACE, "Host connect Changing lock on Host %p to %p\n" _ 
 			host _ next_pending);
 		host->lock = next_pending;	    
@@ -1583,12 +1753,12 @@ PUBLIC BOOL HTHost_setChannel (HTHost * host, HTChannel * channel)
 
 PUBLIC HTNet * HTHost_getReadNet(HTHost * host)
 {
-    return host ? (HTNet *) HTList_firstObject(host->pipeline) : NULL;
+    return host ? (HTNet *) HTDeque_first(host->pipeline) : NULL;
 }
 
 PUBLIC HTNet * HTHost_getWriteNet(HTHost * host)
 {
-    return host ? (HTNet *) HTList_lastObject(host->pipeline) : NULL;
+    return host ? (HTNet *) HTDeque_last(host->pipeline) : NULL;
 }
 
 /*
@@ -1708,9 +1878,35 @@ PUBLIC ms_t HTHost_defaultWriteDelay (void)
     return WriteDelay;
 }
 
+PUBLIC BOOL HTHost_setWriteBatch (HTHost * host, BOOL mode)
+{
+    if (host) {
+	host->batch = mode;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTHost_writeBatch (HTHost * host)
+{
+    return host ? host->batch : NO;
+}
+
+PUBLIC void HTHost_setDefaultWriteBatch (BOOL mode)
+{
+    WriteBatch = mode;
+    HTTRACE(CORE_TRACE, "Host........ Default write batching is %s\n" _
+	    mode ? "on" : "off");
+}
+
+PUBLIC BOOL HTHost_defaultWriteBatch (void)
+{
+    return WriteBatch;
+}
+
 PUBLIC int HTHost_forceFlush(HTHost * host)
 {
-    HTNet * targetNet = (HTNet *) HTList_lastObject(host->pipeline);
+    HTNet * targetNet = (HTNet *) HTDeque_last(host->pipeline);
     int ret;
     if (targetNet == NULL) return HT_ERROR;
     /* 2000/28/07 JK: The following test was proposed by Heiner Kallweit, as there's a problem
@@ -1771,6 +1967,96 @@ PUBLIC int HTHost_maxPipelinedRequests (void)
     return MaxPipelinedRequests;
 }
 
+PUBLIC BOOL HTHost_setMaxConnections (int max)
+{
+    if (max > 0) {
+	MaxHostConnections = max;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC int HTHost_maxConnections (void)
+{
+    return MaxHostConnections;
+}
+
+PRIVATE HTOriginLimit * findOriginLimit (const char * host, u_short u_port)
+{
+    HTList * cur = OriginLimits;
+    HTOriginLimit * pres;
+    while ((pres = (HTOriginLimit *) HTList_nextObject(cur)))
+	if (pres->u_port == u_port && !strcmp(pres->hostname, host)) return pres;
+    return NULL;
+}
+
+/*
+**	Set the number of connections for a single origin. A max of 0 or
+**	less removes the limit so that the global one is used again.
+*/
+PUBLIC BOOL HTHost_setMaxOriginConnections (const char * host, u_short u_port,
+					    int max)
+{
+    HTOriginLimit * limit;
+    if (!host) return NO;
+    if ((limit = findOriginLimit(host, u_port)) != NULL) {
+	if (max > 0) {
+	    limit->max = max;
+	} else {
+	    HTList_removeObject(OriginLimits, limit);
+	    HT_FREE(limit->hostname);
+	    HT_FREE(limit);
+	}
+    } else if (max > 0) {
+	if ((limit = (HTOriginLimit *) HT_CALLOC(1, sizeof(HTOriginLimit))) == NULL)
+	    HT_OUTOFMEM("HTHost_setMaxOriginConnections");
+	StrAllocCopy(limit->hostname, host);
+	limit->u_port = u_port;
+	limit->max = max;
+	if (!OriginLimits) OriginLimits = HTList_new();
+	HTList_addObject(OriginLimits, limit);
+    }
+    return YES;
+}
+
+PUBLIC int HTHost_maxOriginConnections (const char * host, u_short u_port)
+{
+    HTOriginLimit * limit = host ? findOriginLimit(host, u_port) : NULL;
+    return limit ? limit->max : MaxHostConnections;
+}
+
+/*
+**	Collect statistics about the connections we have. If hostname is
+**	not NULL then only the connections to that origin are counted.
+*/
+PUBLIC BOOL HTHost_poolStatistics (const char * hostname, u_short u_port,
+				   HTHostStatistics * stats)
+{
+    int cnt;
+    if (!stats) return NO;
+    memset(stats, 0, sizeof(HTHostStatistics));
+    stats->reused = ReusedConnections;
+    stats->evicted = EvictedConnections;
+    if (!HostTable) return YES;
+    for (cnt=0; cnt<HOST_HASH_SIZE; cnt++) {
+	HTList * cur = HostTable[cnt];
+	HTHost * pres;
+	while ((pres = (HTHost *) HTList_nextObject(cur))) {
+	    if (hostname &&
+		(strcmp(pres->hostname, hostname) || pres->u_port != u_port))
+		continue;
+	    stats->hosts++;
+	    if (pres->channel) {
+		stats->connections++;
+		if (HTDeque_isLinked(&pres->idleLink)) stats->idle++;
+	    }
+	    stats->outstanding += HTDeque_count(pres->pipeline);
+	    stats->pending += HTDeque_count(pres->pending);
+	}
+    }
+    return YES;
+}
+
 PUBLIC void HTHost_setActivateRequestCallback (HTHost_ActivateRequestCallback * cbf)
 {
     HTTRACE(CORE_TRACE, "HTHost...... Registering %p\n" _ cbf);
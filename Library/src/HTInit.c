@@ -168,7 +168,8 @@ PUBLIC void HTFormatInit (HTList * c)
 PUBLIC void HTTransferEncoderInit (HTList * c)
 {
 #ifdef HT_ZLIB
-    HTCoding_add(c, "deflate", NULL, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "deflate", HTZLib_deflate, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "gzip", HTZLib_deflate, HTZLib_inflate, 1.0);
 #endif
     HTCoding_add(c, "chunked", HTChunkedEncoder, HTChunkedDecoder, 1.0);
 }
@@ -180,7 +181,8 @@ PUBLIC void HTTransferEncoderInit (HTList * c)
 PUBLIC void HTContentEncoderInit (HTList * c)
 {
 #ifdef HT_ZLIB
-    HTCoding_add(c, "deflate", NULL, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "deflate", HTZLib_deflate, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "gzip", HTZLib_deflate, HTZLib_inflate, 1.0);
 #endif /* HT_ZLIB */
 }
 
@@ -190,6 +190,7 @@ PUBLIC BOOL HTLibTerminate (void)
     HT_FREE(HTAppVersion);
 
     HTAtom_deleteAll();					 /* Remove the atoms */
+    HTDNS_killAll();			      /* Stop outstanding DNS lookups */
     HTDNS_deleteAll();				/* Remove the DNS host cache */
     HTAnchor_deleteAll(NULL);		/* Delete anchors and drop hyperdocs */
 
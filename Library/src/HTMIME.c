@@ -290,6 +290,43 @@ PRIVATE int _stream2dispatchParsers (HTStream * me)
     return (_dispatchParsers (me->request, token, value));
 }
 
+/*
+**	Fast path for a complete header line of the form "token: value" at
+**	the beginning of the buffer. The line must be followed by the first
+**	character of a new header line in the same buffer so that we know it
+**	is neither folded nor the last line of the header. The line ends are
+**	found using memchr() which is much faster than looking at every byte
+**	and the token and value are copied in one go. Returns the number of
+**	bytes parsed or 0 if the state machine has to handle the line.
+*/
+PRIVATE int HTMIME_line (HTStream * me, const char * b, int l, int * pStatus)
+{
+    const char * eol = (const char *) memchr(b, LF, l);
+    const char * eov;
+    const char * colon;
+    const char * value;
+    const char * ptr;
+    if (!eol || eol+1 >= b+l) return 0;			/* Need next line */
+    if (eol[1]==CR || eol[1]==LF || isspace((int) eol[1])) return 0;
+    eov = (eol > b && *(eol-1) == CR) ? eol-1 : eol;
+    if (eov == b || memchr(b, CR, eov-b)) return 0;
+    if ((colon = (const char *) memchr(b, ':', eov-b)) == NULL || colon == b)
+	return 0;
+    for (ptr = b; ptr < colon; ptr++)
+	if (isspace((int) *ptr)) return 0;
+    for (value = colon; value < eov; value++)
+	if (*value != ':' && !isspace((int) *value)) break;
+    HTChunk_putb(me->token, b, colon-b);
+    HTChunk_putc(me->token, '\0');
+    HTChunk_putb(me->value, value, eov-value);
+    HTChunk_putc(me->value, '\0');
+    *pStatus = _stream2dispatchParsers(me);
+    HTChunk_truncate(me->token, 0);
+    HTChunk_truncate(me->value, 0);
+    HTNet_addBytesRead(me->net, eol+1-b);
+    return eol+1-b;
+}
+
 /*
 **	Header is terminated by CRCR, LFLF, CRLFLF, CRLFCRLF
 **	Folding is either of CF LWS, LF LWS, CRLF LWS
@@ -303,6 +340,17 @@ PRIVATE int HTMIME_put_block (HTStream * me, const char * b, int l)
     int status;
 
     while (!me->transparent) {
+	if (me->EOLstate == EOL_BEGIN && b == start && !me->haveToken &&
+	    !HTChunk_size(me->token) && !HTChunk_size(me->value)) {
+	    int ret = HT_OK;
+	    int used = HTMIME_line(me, b, l, &ret);
+	    if (used) {
+		b += used, l -= used;
+		start = end = b;
+		if (ret != HT_OK && ret != HT_LOADED) return ret;
+		continue;
+	    }
+	}
 	if (me->EOLstate == EOL_FCR) {
 	    if (*b == CR)				    /* End of header */
 	        me->EOLstate = EOL_END;
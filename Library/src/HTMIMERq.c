@@ -33,6 +33,7 @@ struct _HTStream {
     HTRequest *			request;
     BOOL			endHeader;
     BOOL			transparent;
+    HTEncoding			coding;	    /* Content coding we apply or NULL */
 };
 
 #define HT_MAX_WAIT		8      /* Max number of secs to wait for PUT */
@@ -54,8 +55,31 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
     HTParentAnchor * entity = HTRequest_entityAnchor(request);
     HTEnHd EntityMask = HTRequest_enHd(request);
     BOOL transfer_coding = NO;		/* We should get this from the Host object */
+    HTEncoding coding = HTRequest_entityCoding(request);
     *crlf = CR; *(crlf+1) = LF; *(crlf+2) = '\0';
 
+    /*
+    **  We only encode the entity ourselves if it isn't encoded already, if
+    **  we have an encoder for the coding that was asked for and if we can
+    **  send the headers telling how the entity is encoded and delimited
+    */
+    if (coding && (!(EntityMask & HT_E_CONTENT_ENCODING) ||
+		   !(EntityMask & HT_E_CONTENT_LENGTH) ||
+		   HTRequest_transfer(request)))
+	coding = NULL;
+    if (coding) {
+	HTList * cur = entity->content_encoding;
+	HTEncoding pres;
+	while ((pres = (HTEncoding) HTList_nextObject(cur))) {
+	    if (!HTFormat_isUnityContent(pres)) {
+		coding = NULL;
+		break;
+	    }
+	}
+	if (coding && !HTFormat_canEncode(coding, request)) coding = NULL;
+	me->coding = coding;
+    }
+
     if (EntityMask & HT_E_ALLOW) {
 	BOOL first = YES;
 	int cnt;
@@ -87,6 +111,11 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
 	}
 	if (!first) PUTBLOCK(crlf, 2);
     }
+    if (coding) {
+	PUTS("Content-Encoding: ");
+	PUTS(HTAtom_name(coding));
+	PUTBLOCK(crlf, 2);
+    }
     if (EntityMask & HT_E_CTE && entity->cte) {
 	HTEncoding cte = HTAnchor_contentTransferEncoding(entity);
 	if (!HTFormat_isUnityTransfer(cte)) {
@@ -110,10 +139,13 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
 	if (!first) PUTBLOCK(crlf, 2);
     }
 
-    /* Only send out Content-Length if we don't have a transfer coding */
+    /*
+    **  Only send out Content-Length if we don't have a transfer coding and
+    **  we don't encode the entity on the fly
+    */
     if (!HTRequest_transfer(request)) {
 	if (EntityMask & HT_E_CONTENT_LENGTH) {
-	    if (entity->content_length >= 0) {
+	    if (entity->content_length >= 0 && !coding) {
 		sprintf(linebuf, "Content-Length: %ld%c%c",
 			entity->content_length, CR, LF);
 		PUTBLOCK(linebuf, (int) strlen(linebuf));	
@@ -246,6 +278,12 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
 	    me->target = target;
     }
 
+    /* Encode the entity on the fly above the transfer coding */
+    if (coding) {
+	HTTRACE(STREAM_TRACE, "Building.... C-E stack for `%s\'\n" _ HTAtom_name(coding));
+	me->target = HTContentCodingStack(coding, me->target, request, NULL, YES);
+    }
+
 #if 0
     /*
     **  We expect the anchor object already to have the right encoding and
@@ -306,7 +344,11 @@ PRIVATE int MIMERequest_put_block (HTStream * me, const char * b, int l)
 	}
     }
     
-    /* Check if we have written it all */
+    /*
+    **  Check if we have written it all. If we encode the entity then the
+    **  bytes written don't match the length so the encoder must end it.
+    */
+    if (b && me->coding) return PUTBLOCK(b, l);
     if (b) {
 	HTParentAnchor * entity = HTRequest_entityAnchor(me->request);
 	long cl = HTAnchor_length(entity);
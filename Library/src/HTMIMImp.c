@@ -38,10 +38,39 @@ PUBLIC int HTMIME_acceptCharset (HTRequest * request, HTResponse * response,
     return HT_OK;
 }
 
+/*
+**	Pick the content coding with the highest quality that we can encode
+**	the entity with. The HTTP server module uses it when it sends the
+**	reply.
+*/
 PUBLIC int HTMIME_acceptEncoding (HTRequest * request, HTResponse * response,
 				  char * token, char * value)
 {
-
+    char * element;
+    HTEncoding best = NULL;
+    double best_quality = 0.0;
+    while ((element = HTNextElement(&value))) {
+	char * name = HTNextField(&element);
+	char * param_pair;
+	double quality = 1.0;
+	while ((param_pair = HTNextPair(&element))) {
+	    char * param = HTNextField(&param_pair);
+	    char * val = HTNextField(&param_pair);
+	    if (param && val && !strcasecomp(param, "q"))
+		quality = atof(val);
+	}
+	if (name && quality > best_quality) {
+	    HTEncoding coding = HTAtom_caseFor(name);
+	    if (HTFormat_canEncode(coding, request)) {
+		best = coding;
+		best_quality = quality;
+	    }
+	}
+    }
+    if (best) {
+	HTTRACE(STREAM_TRACE, "MIMEParser.. Client accepts `%s\'\n" _ HTAtom_name(best));
+	HTRequest_setEntityCoding(request, best);
+    }
     return HT_OK;
 }
 
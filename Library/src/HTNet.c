@@ -74,8 +74,8 @@ PRIVATE int MaxActive = HT_MAX_SOCKETS;  	      /* Max active requests */
 PRIVATE int Active = 0;				      /* Counts open sockets */
 PRIVATE int Persistent = 0;		        /* Counts persistent sockets */
 
-PRIVATE HTList ** NetTable = NULL;		      /* List of net objects */
-PRIVATE int HTNetCount = 0;		       /* Counting elements in table */
+PRIVATE HTDeque * NetList = NULL;		     /* Queue of net objects */
+PRIVATE int HTNetCount = 0;		       /* Counting elements in queue */
 
 /* ------------------------------------------------------------------------- */
 /*		   GENERIC BEFORE and AFTER filter Management		     */
@@ -543,13 +543,9 @@ PRIVATE HTNet * create_object (void)
         HT_OUTOFMEM("HTNet_new");
     me->hash = net_hash++ % HT_XL_HASH_SIZE;
 
-    /* Insert into hash table */
-    if (!NetTable) {
-	if ((NetTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE, sizeof(HTList *))) == NULL)
-	    HT_OUTOFMEM("create_object");
-    }
-    if (!NetTable[me->hash]) NetTable[me->hash] = HTList_new();
-    HTList_addObject(NetTable[me->hash], (void *) me);
+    /* Insert into list of net objects */
+    if (!NetList) NetList = HTDeque_new();
+    HTDeque_appendLink(NetList, &me->netLink, me);
     HTNetCount++;
     HTTRACE(CORE_TRACE, "Net Object.. %p created with hash %d\n" _ me _ me->hash);
     return me;
@@ -566,11 +562,16 @@ PUBLIC HTNet * HTNet_dup (HTNet * src)
     if (src) {
         HTNet * me;
 	int hash;
+	HTDequeLink netLink;
 	if ((me = create_object()) == NULL) return NULL;
 	hash = me->hash;
+	netLink = me->netLink;
 	HTTRACE(CORE_TRACE, "Net Object.. Duplicated %p\n" _ src);
         memcpy((void *) me, src, sizeof(HTNet));
 	me->hash = hash;			/* Carry over hash entry */
+	me->netLink = netLink;		      /* and our place in the list */
+	memset(&me->hostLink, 0, sizeof(HTDequeLink));
+	memset(&me->dnsLink, 0, sizeof(HTDequeLink));
 	return me;
     }
     return NULL;
@@ -838,6 +839,9 @@ PRIVATE BOOL free_net (HTNet * net)
     HTTRACE(CORE_TRACE, "Net Object.. Freeing object %p\n" _ net);
     if (net) {
         if (net == HTRequest_net(net->request)) HTRequest_setNet(net->request, NULL);
+	HTDeque_unlink(&net->hostLink);
+	HTDeque_unlink(&net->netLink);
+	HTDeque_unlink(&net->dnsLink);
         HT_FREE(net);
 	return YES;
     }
@@ -850,14 +854,11 @@ PRIVATE BOOL free_net (HTNet * net)
 */
 PRIVATE BOOL unregister_net (HTNet * net)
 {
-    if (net && NetTable) {
-	HTList * list = NetTable[net->hash];
-	if (list) {
-	    HTList_removeObject(list, (void *) net);
-	    check_pending(net);
-	    HTNetCount--;
-	    return YES;
-	}
+    if (net && NetList) {
+	HTDeque_unlink(&net->netLink);
+	check_pending(net);
+	HTNetCount--;
+	return YES;
     }
     return NO;
 }
@@ -945,20 +946,14 @@ PUBLIC BOOL HTNet_deleteDup (HTNet * dup)
 PUBLIC BOOL HTNet_deleteAll (void)
 {
     HTTRACE(CORE_TRACE, "Net Object.. Remove all Net objects, NO filters\n"); 
-    if (NetTable) {
-	HTList * cur = NULL;
+    if (NetList) {
         HTNet * pres = NULL;
-	int cnt;
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = NetTable[cnt])) { 
-		while ((pres = (HTNet *) HTList_nextObject(cur)) != NULL)  {
-		    check_pending(pres);
-                    free_net(pres);
-		}
-	    }
-	    HTList_delete(NetTable[cnt]);
+	while ((pres = (HTNet *) HTDeque_removeFirst(NetList)) != NULL) {
+	    check_pending(pres);
+	    free_net(pres);
 	}
-	HT_FREE(NetTable);
+	HTDeque_delete(NetList);
+	NetList = NULL;
 	HTNetCount = 0;
 	return YES;
     }
@@ -1008,18 +1003,10 @@ PUBLIC BOOL HTNet_kill (HTNet * net)
 PUBLIC BOOL HTNet_killAll (void)
 {
     HTTRACE(CORE_TRACE, "Net Object.. Kill ALL Net objects!!!\n"); 
-    if (NetTable) {
-	HTList * cur = NULL;
+    if (NetList) {
         HTNet * pres = NULL;
-	int cnt;
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = NetTable[cnt])) { 
-		while ((pres = (HTNet *) HTList_lastObject(cur)) != NULL) {
-		    HTNet_kill(pres);
-		    cur = NetTable[cnt];
-		}
-	    }
-	}
+	while ((pres = (HTNet *) HTDeque_last(NetList)) != NULL)
+	    HTNet_kill(pres);
 	return YES;
     }
     HTTRACE(CORE_TRACE, "Net Object.. No objects to kill\n");
@@ -43,6 +43,12 @@ PUBLIC void HTProfile_delete (void)
 	/* Remove bindings between suffixes, media types */
 	HTBind_deleteAll();
 
+	/* Remove the SGML parser lookup tables */
+	SGML_deleteAll();
+
+	/* Remove the serialized HTTP request headers */
+	HTTPRequest_deleteAll();
+
 	/* Terminate libwww */
 	HTLibTerminate();
     }
@@ -251,6 +257,9 @@ PUBLIC void HTProfile_newRobot (const char * AppName, const char * AppVersion)
 {    
   /* set up default event loop */
     HTEventInit();
+
+    /* A robot may have thousands of sockets so use epoll where we can */
+    HTEventList_setBackend(HT_EVENT_EPOLL);
     robot_profile(AppName, AppVersion);
 
     /* Register the default set of application protocol modules */
@@ -50,6 +50,7 @@
 #endif
 
 PRIVATE int HTMaxRetry = HT_MAX_RELOADS;
+PRIVATE BOOL DefaultArena = NO;		/* Use an arena for new requests */
 
 struct _HTStream {
 	HTStreamClass * isa;
@@ -152,6 +153,7 @@ PUBLIC HTRequest * HTRequest_dup (HTRequest * src)
     if ((me = (HTRequest  *) HT_MALLOC(sizeof(HTRequest))) == NULL)
         HT_OUTOFMEM("HTRequest_dup");
     memcpy(me, src, sizeof(HTRequest));
+    me->arena = NULL;
     HTTRACE(CORE_TRACE, "Request..... Duplicated %p to %p\n" _ src _ me);
     return me;
 }
@@ -171,6 +173,7 @@ PUBLIC HTRequest * HTRequest_dupInternal (HTRequest * src)
     if ((me = (HTRequest  *) HT_MALLOC(sizeof(HTRequest))) == NULL)
         HT_OUTOFMEM("HTRequest_dup");
     memcpy(me, src, sizeof(HTRequest));
+    me->arena = NULL;
     HTRequest_clear(me);
     return me;
 }
@@ -254,6 +257,9 @@ PUBLIC void HTRequest_delete (HTRequest * me)
         me->messageBodyFormat = NULL;
         me->messageBodyLength = -1;     
 #endif
+
+	/* Anything taken from the arena goes with it */
+	if (me->arena) HTArena_delete(me->arena);
         
 	HT_FREE(me);
     }
@@ -388,6 +394,30 @@ PUBLIC HTNet * HTRequest_net (HTRequest * me)
     return me ? me->net : NULL;
 }
 
+/*
+**	Memory Arena. The arena is created the first time it is asked for if
+**	arenas are turned on, and everything in it is freed when the request
+**	is deleted.
+*/
+PUBLIC void HTRequest_setDefaultArena (BOOL mode)
+{
+    DefaultArena = mode;
+}
+
+PUBLIC BOOL HTRequest_defaultArena (void)
+{
+    return DefaultArena;
+}
+
+PUBLIC HTArena * HTRequest_arena (HTRequest * me)
+{
+    if (me) {
+	if (!me->arena && DefaultArena) me->arena = HTArena_new(0);
+	return me->arena;
+    }
+    return NULL;
+}
+
 /*
 **	Response Object. If the object does not exist then create it at the
 **	same time it is asked for.
@@ -396,7 +426,7 @@ PUBLIC HTResponse * HTRequest_response (HTRequest * me)
 {
     if (me) {
 	if (!me->response)
-	    me->response = HTResponse_new();
+	    me->response = HTResponse_newFromArena(HTRequest_arena(me));
 	return me->response;
     }
     return NULL;
@@ -445,8 +475,9 @@ PUBLIC BOOL HTRequest_addError (HTRequest * 	me,
 {
     if (me) {
 	if (!me->error_stack) me->error_stack = HTList_new();
-	return HTError_add(me->error_stack, severity, ignore, element,
-			   par, length, where);
+	return HTError_addFromArena(HTRequest_arena(me), me->error_stack,
+				    severity, ignore, element,
+				    par, length, where);
     }
     return NO;
 }
@@ -459,8 +490,9 @@ PUBLIC BOOL HTRequest_addSystemError (HTRequest * 	me,
 {
     if (me) {
 	if (!me->error_stack) me->error_stack = HTList_new();
-	return HTError_addSystem(me->error_stack, severity, errornumber,
-				 ignore, syscall);
+	return HTError_addSystemFromArena(HTRequest_arena(me), me->error_stack,
+					  severity, errornumber,
+					  ignore, syscall);
     }
     return NO;
 }
@@ -1163,6 +1195,28 @@ PUBLIC HTFormat HTRequest_outputFormat (HTRequest * me)
     return me ? me->output_format : NULL;
 }
 
+/*
+**	Call back function for sending a local file directly to the output
+*/
+PUBLIC void HTRequest_setFileCallback (HTRequest * me, HTFileCallback * cbf,
+				       void * param)
+{
+    if (me) {
+	me->FileCallback = cbf;
+	me->file_param = param;
+    }
+}
+
+PUBLIC HTFileCallback * HTRequest_fileCallback (HTRequest * me)
+{
+    return me ? me->FileCallback : NULL;
+}
+
+PUBLIC void * HTRequest_fileParam (HTRequest * me)
+{
+    return me ? me->file_param : NULL;
+}
+
 /*
 **	Debug stream
 */
@@ -1446,6 +1500,23 @@ PUBLIC HTParentAnchor * HTRequest_entityAnchor (HTRequest * me)
 	me->anchor : NULL;
 }
 
+/*
+**	Content coding to apply to the entity when sending it
+*/
+PUBLIC BOOL HTRequest_setEntityCoding (HTRequest * me, HTEncoding coding)
+{
+    if (me) {
+	me->entity_coding = coding;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC HTEncoding HTRequest_entityCoding (HTRequest * me)
+{
+    return me ? me->entity_coding : NULL;
+}
+
 /* ------------------------------------------------------------------------- */
 /*				POST WEB METHODS	      	 	     */
 /* ------------------------------------------------------------------------- */
@@ -1709,6 +1780,9 @@ PUBLIC BOOL HTLoad (HTRequest * me, BOOL recursive)
 	me->response = NULL;
     }
 
+    /* Nothing is left in the arena when we start afresh */
+    if (!recursive && me->arena) HTArena_clear(me->arena);
+
     /*
     **  We set the start point of handling a request to here.
     **  This time will be used by the cache
@@ -1741,6 +1815,9 @@ PUBLIC BOOL HTServe (HTRequest * me, BOOL recursive)
 	me->response = NULL;
     }
 
+    /* Nothing is left in the arena when we start afresh */
+    if (!recursive && me->arena) HTArena_clear(me->arena);
+
     /* Now start the Net Manager */
     return HTNet_newServer(me);
 }
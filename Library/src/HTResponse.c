@@ -21,12 +21,8 @@
 /*			Create and delete the HTResponse Object		     */
 /* --------------------------------------------------------------------------*/
 
-PUBLIC HTResponse * HTResponse_new (void)
+PRIVATE void response_init (HTResponse * me)
 {
-    HTResponse * me;
-    if ((me = (HTResponse *) HT_CALLOC(1, sizeof(HTResponse))) == NULL)
-	HT_OUTOFMEM("HTResponse_new()");
-    
     /* Default content-* values */
     me->content_type = WWW_UNKNOWN;
     me->content_length = -1;
@@ -38,6 +34,24 @@ PUBLIC HTResponse * HTResponse_new (void)
     me->cachable = NO;
 
     HTTRACE(CORE_TRACE, "Response.... Created %p\n" _ me);
+}
+
+PUBLIC HTResponse * HTResponse_new (void)
+{
+    HTResponse * me;
+    if ((me = (HTResponse *) HT_CALLOC(1, sizeof(HTResponse))) == NULL)
+	HT_OUTOFMEM("HTResponse_new()");
+    response_init(me);
+    return me;
+}
+
+PUBLIC HTResponse * HTResponse_newFromArena (HTArena * arena)
+{
+    HTResponse * me;
+    if (!arena) return HTResponse_new();
+    me = (HTResponse *) HTArena_calloc(arena, 1, sizeof(HTResponse));
+    me->arena = arena;
+    response_init(me);
     return me;
 }
 
@@ -91,10 +105,11 @@ PUBLIC BOOL HTResponse_delete (HTResponse * me)
 	    if (me->headers) HTAssocList_delete(me->headers);
 	}
 
-	/* HTTP reason string */
-	if (me->reason)  HT_FREE (me->reason);
-
- 	HT_FREE(me);
+	/* HTTP reason string and the object itself unless in an arena */
+	if (!me->arena) {
+	    if (me->reason)  HT_FREE (me->reason);
+	    HT_FREE(me);
+	}
 	return YES;
     }
     return NO;
@@ -681,7 +696,10 @@ PUBLIC char * HTResponse_reason (HTResponse * me)
 PUBLIC BOOL HTResponse_setReason (HTResponse * me, char * reason)
 {
   if (me && reason && *reason) {
-      StrAllocCopy(me->reason, reason);
+      if (me->arena)
+	  me->reason = HTArena_strdup(me->arena, reason);
+      else
+	  StrAllocCopy(me->reason, reason);
       return YES;
     }
   return NO;
@@ -81,7 +81,8 @@ PRIVATE int HTSC_putBlock (HTStream * me, const char * b, int l)
     } else if (!me->ensure) {
 	HTParentAnchor * anchor = HTRequest_anchor(me->request);
 	int cl = HTAnchor_length(anchor);
-	if (cl > 0) HTChunk_ensure(me->chunk, cl);
+	if (cl > 0 && (me->max_size <= 0 || cl <= me->max_size))
+	    HTChunk_ensure(me->chunk, cl);
 	me->ensure = YES;
     }
     if (!me->give_up) {
@@ -90,6 +90,44 @@
 /*	       	      CONNECTION ESTABLISHMENT MANAGEMENT 		     */
 /* ------------------------------------------------------------------------- */
 
+/* set_nonblocking - change the socket status to non-blocking
+** I use fcntl() so that I can ask the status before I set it.
+** See W. Richard Stevens (Advan. Prog. in UNIX environment, p.364)
+** Be CAREFULL with the old `O_NDELAY' - it will not work as read()
+** returns 0 when blocking and NOT -1. FNDELAY is ONLY for BSD and
+** does NOT work on SVR4 systems. O_NONBLOCK is POSIX.
+** returns -1 if error
+*/
+PRIVATE int set_nonblocking (SOCKET sockfd)
+{
+    int status = -1;
+#ifdef _WINSOCKAPI_
+    {
+	u_long one = 1;
+	status = ioctlsocket(sockfd, FIONBIO, &one) == SOCKET_ERROR ? -1 : 0;
+    }
+#else /* _WINSOCKAPI_ */
+#if defined(VMS)
+    {
+	int enable = 1;
+	status = IOCTL(sockfd, FIONBIO, &enable);
+    }
+#else /* VMS */
+    if ((status = fcntl(sockfd, F_GETFL, 0)) != -1) {
+#ifdef O_NONBLOCK
+	status |= O_NONBLOCK;				    /* POSIX */
+#else /* O_NONBLOCK */
+#ifdef F_NDELAY
+	status |= F_NDELAY;				      /* BSD */
+#endif /* F_NDELAY */
+#endif /* !O_NONBLOCK */
+	status = fcntl(sockfd, F_SETFL, status);
+    }
+#endif /* !VMS */
+#endif /* !_WINSOCKAPI_ */
+    return status;
+}
+
 /* _makeSocket - create a socket, if !preemptive, set FIONBIO
 ** returns sockfd or INVSOC if error
 */
@@ -129,43 +167,9 @@ PRIVATE int _makeSocket (HTHost * host, HTRequest * request, int preemptive)
     }
 #endif
 
-    /* If non-blocking protocol then change socket status
-    ** I use fcntl() so that I can ask the status before I set it.
-    ** See W. Richard Stevens (Advan. Prog. in UNIX environment, p.364)
-    ** Be CAREFULL with the old `O_NDELAY' - it will not work as read()
-    ** returns 0 when blocking and NOT -1. FNDELAY is ONLY for BSD and
-    ** does NOT work on SVR4 systems. O_NONBLOCK is POSIX.
-    */
+    /* If non-blocking protocol then change socket status */
     if (!preemptive) {
-#ifdef _WINSOCKAPI_
-	{		/* begin windows scope  */
-	    long levents = FD_READ | FD_WRITE | FD_ACCEPT | 
-			   FD_CONNECT | FD_CLOSE ;
-	    int rv = 0 ;
-	    u_long one = 1;
-
-	    status = ioctlsocket(sockfd, FIONBIO, &one) == 
-		     SOCKET_ERROR ? -1 : 0;
-	} /* end scope */
-#else /* _WINSOCKAPI_ */
-#if defined(VMS)
-	{
-	    int enable = 1;
-	    status = IOCTL(sockfd, FIONBIO, &enable);
-	}
-#else /* VMS */
-	if((status = fcntl(sockfd, F_GETFL, 0)) != -1) {
-#ifdef O_NONBLOCK
-	    status |= O_NONBLOCK;			    /* POSIX */
-#else /* O_NONBLOCK */
-#ifdef F_NDELAY
-		    status |= F_NDELAY;				      /* BSD */
-#endif /* F_NDELAY */
-#endif /* !O_NONBLOCK */
-		    status = fcntl(sockfd, F_SETFL, status);
-	}
-#endif /* !VMS */
-#endif /* !_WINSOCKAPI_ */
+	status = set_nonblocking(sockfd);
 	HTTRACE(PROT_TRACE, "Socket...... %slocking socket\n" _ status == -1 ? "B" : "Non-b");
     } else
 	HTTRACE(PROT_TRACE, "Socket...... Blocking socket\n");
@@ -265,6 +269,10 @@ PUBLIC int HTDoConnect (HTNet * net)
 		HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_ERROR.\n" _ host);
 		break;
 	    }
+	    if (status == 0) {
+		HTTRACE(PROT_TRACE, "HTDoConnect. Waiting for `%s\' to resolve\n" _ hostname);
+		return HT_WOULD_BLOCK;
+	    }
 	    if (!HTHost_retry(host) && status > 1)		/* If multiple homes */
 		HTHost_setRetry(host, status);
 	    host->tcpstate = TCP_NEED_SOCKET;
@@ -494,7 +502,12 @@ PUBLIC int HTDoAccept (HTNet * listening, HTNet * accepting)
 
     HTTRACE(PROT_TRACE, "Accepted.... socket %d\n" _ status);
 
+    /* The new socket doesn't inherit the status of the listening socket */
+    if (!listening->preemptive && set_nonblocking(status) == -1)
+	HTTRACE(PROT_TRACE, "HTDoAccept.. Can't make socket %d non-blocking\n" _ status);
+
     /* Remember the new socket we got and close the old one */
+    HTEvent_unregister(HTNet_socket(accepting), HTEvent_ACCEPT);
     NETCLOSE(HTNet_socket(accepting));
     HTNet_setSocket(accepting, status);	
 
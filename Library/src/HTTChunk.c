@@ -24,6 +24,14 @@
 #define PUTBLOCK(b, l)	(*me->target->isa->put_block)(me->target, b, l)
 #define PUTC(c)		(*me->target->isa->put_character)(me->target, c)
 
+typedef enum _HTChunkState {
+    CHUNK_SIZE = 0,			       /* Reading the chunk size */
+    CHUNK_EXT,			 /* Skipping extensions up to end of line */
+    CHUNK_DATA,				       /* Passing on chunk payload */
+    CHUNK_DATA_END,			   /* Reading CRLF after the payload */
+    CHUNK_TRAILER			  /* Reading trailer after last chunk */
+} HTChunkState;
+
 struct _HTStream {
     const HTStreamClass *	isa;
     HTEncoding			coding;
@@ -33,9 +41,9 @@ struct _HTStream {
     long			left;	    /* Remaining bytes in this chunk */
     long			total;			      /* Full length */
     BOOL			lastchunk;	  /* Is this the last chunk? */
-    BOOL			trailer;	    /* Do we have a trailer? */
-    HTEOLState			state;    
-    HTChunk *			buf;
+    HTChunkState		state;
+    int				digits;	   /* Hex digits seen in chunk size */
+    HTChunk *			buf;		     /* Current trailer line */
     int				status;	     /* return code from down stream */
 };
 
@@ -44,90 +52,139 @@ struct _HTStream {
 /*
 **	Chunked Decoder stream
 */
-PRIVATE BOOL HTChunkDecode_header (HTStream * me) 
+PRIVATE int hexval (char c)
 {
-    char * line = HTChunk_data(me->buf);
-    if (line) {
-	char *errstr = NULL;
-	me->left = strtol(line, &errstr, 16);    /* hex! */
-	HTTRACE(STREAM_TRACE, "Chunked..... `%s\' chunk size: %X\n" _ line _ me->left);
-	if (errstr == line)
-	    HTDEBUGBREAK("Chunk decoder received illigal chunk size: `%s\'\n" _ line);
-	if (me->left > 0) {
-	    me->total += me->left;
-
-	    /* Look for arguments */
-	
-	    HTChunk_clear(me->buf);
-	} else if (me->left == 0)	       		      /* Last chunk */
-	    me->lastchunk = YES;
-	else if (me->left < 0)
-	    return NO;
-	return YES;
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+**	Add the complete trailer line in our buffer to the response. Lines
+**	that are not of the form "name: value" are ignored.
+*/
+PRIVATE void HTChunkDecode_trailer (HTStream * me)
+{
+    char * name = HTChunk_data(me->buf);
+    char * value;
+    if ((value = strchr(name, ':')) != NULL) {
+	*value++ = '\0';
+	value = HTStrip(value);
+	HTTRACE(STREAM_TRACE, "Chunked..... trailer `%s\': `%s\'\n" _ name _ value);
+	HTResponse_addTrailer(HTRequest_response(me->request), name, value);
     }
-    return NO;
 }
 
+/*
+**	Chunk headers are parsed in place as they arrive. The payload of a
+**	chunk is passed on with a single put_block for each contiguous
+**	region in the block we get. Trailer lines are the only thing we
+**	copy, as they have to be added to the response.
+*/
 PRIVATE int HTChunkDecode_block (HTStream * me, const char * b, int l)
 {
+    HTHost * host = HTNet_host(HTRequest_net(me->request));
+    const char * start = b;
     while (l > 0) {
-	int length = l;
-	if (me->left <= 0 && !me->trailer) {
+	switch (me->state) {
+	case CHUNK_SIZE:
+	    if (!me->digits && (*b == ' ' || *b == '\t')) {
+		b++, l--;
+		break;
+	    }
 	    while (l > 0) {
-		if (me->state == EOL_FLF) {
-		    if (HTChunkDecode_header(me) == NO) return HT_ERROR;
-		    if (me->lastchunk) if (*b != CR && *b != LF) me->trailer = YES;
-		    me->state = EOL_DOT;
-		    break;
-		} else if (me->state == EOL_SLF) {
-		    if (me->lastchunk) break;
-		    me->state = EOL_BEGIN;
-		    HTChunk_putc(me->buf, *b);
-		} else if (*b == CR) {
-		    me->state = me->state == EOL_DOT ? EOL_SCR : EOL_FCR;
-		} else if (*b == LF) {
-		    me->state = me->state == EOL_SCR ? EOL_SLF : EOL_FLF;
-		} else
-		    HTChunk_putc(me->buf, *b);
+		int val = hexval(*b);
+		if (val < 0) break;
+		if (me->left >> (sizeof(long) * 8 - 5)) {
+		    HTTRACE(STREAM_TRACE, "Chunked..... chunk size overflow\n");
+		    return HT_ERROR;
+		}
+		me->left = (me->left << 4) + val;
+		me->digits++;
 		b++, l--;
 	    }
+	    if (l > 0) {
+		if (!me->digits) {
+		    HTDEBUGBREAK("Chunk decoder received illegal chunk size\n");
+		    return HT_ERROR;
+		}
+		me->state = CHUNK_EXT;
+	    }
+	    break;
+
+	case CHUNK_EXT:
+	{
+	    const char * eol = (const char *) memchr(b, LF, l);
+	    if (!eol) {
+		b += l, l = 0;
+		break;
+	    }
+	    l -= eol + 1 - b, b = eol + 1;
+	    HTTRACE(STREAM_TRACE, "Chunked..... chunk size: %lX\n" _ me->left);
+	    me->digits = 0;
+	    if (me->left > 0) {
+		me->total += me->left;
+		me->state = CHUNK_DATA;
+	    } else {
+		me->lastchunk = YES;
+		me->state = CHUNK_TRAILER;
+	    }
+	    break;
 	}
 
-	/*
-	** Account for the parts we read in the chunk header +
-	** the chunk that we are reading.
-	*/
-	if (length != l)
-	    HTHost_setConsumed(HTNet_host(HTRequest_net(me->request)), length - l);
-
-	/*
-	** If we have to read trailers. Otherwise we are done.
-	*/
-	if (me->trailer) {
-	    me->target = HTStreamStack(WWW_MIME_FOOT, WWW_SOURCE,
-				       me->target, me->request, NO);
-	} else if (me->state == EOL_SLF) {
-            if (me->lastchunk) {
-                HTAlertCallback * cbf = HTAlert_find(HT_PROG_DONE);
-                if (cbf) (*cbf)(me->request, HT_PROG_DONE, HT_MSG_NULL,
-                                NULL, NULL, NULL);
-                return HT_LOADED;
-            }
-	    me->state = EOL_BEGIN;
+	case CHUNK_DATA:
+	{
+	    int bytes = (int) HTMIN(l, me->left);
+	    int status;
+	    if (b > start) {
+		HTHost_setConsumed(host, b - start);
+		start = b;
+	    }
+	    if ((status = PUTBLOCK(b, bytes)) != HT_OK) return status;
+	    me->left -= bytes;
+	    b += bytes, l -= bytes;
+	    if (!me->left) me->state = CHUNK_DATA_END;
+	    break;
 	}
 
-	/*
-	**  Handle the rest of the data including trailers
-	*/
-	if (l > 0 && me->left) {
-	    int bytes = HTMIN(l, me->left);
-	    int status = (*me->target->isa->put_block)(me->target, b, bytes);
-	    if (status != HT_OK) return status;
-	    HTHost_setConsumed(HTNet_host(HTRequest_net(me->request)), bytes);
-	    me->left -= bytes;
-	    l -= bytes, b+= bytes;
+	case CHUNK_DATA_END:
+	    if (*b == LF)
+		me->state = CHUNK_SIZE;
+	    else if (*b != CR) {
+		HTTRACE(STREAM_TRACE, "Chunked..... no CRLF after chunk data\n");
+		return HT_ERROR;
+	    }
+	    b++, l--;
+	    break;
+
+	case CHUNK_TRAILER:
+	{
+	    const char * eol = (const char *) memchr(b, LF, l);
+	    int len = eol ? eol - b : l;
+	    HTChunk_putb(me->buf, b, len);
+	    b += len, l -= len;
+	    if (!eol) break;
+	    b++, l--;
+	    len = HTChunk_size(me->buf);
+	    if (len && HTChunk_data(me->buf)[len-1] == CR) len--;
+	    HTChunk_truncate(me->buf, len);
+	    if (len) {
+		HTChunk_putc(me->buf, '\0');
+		HTChunkDecode_trailer(me);
+		HTChunk_truncate(me->buf, 0);
+	    } else {
+		HTAlertCallback * cbf = HTAlert_find(HT_PROG_DONE);
+		HTHost_setConsumed(host, b - start);
+		if (cbf) (*cbf)(me->request, HT_PROG_DONE, HT_MSG_NULL,
+				NULL, NULL, NULL);
+		return HT_LOADED;
+	    }
+	    break;
+	}
 	}
     }
+    if (b > start) HTHost_setConsumed(host, b - start);
     return HT_OK;
 }
 
@@ -200,7 +257,7 @@ PUBLIC HTStream * HTChunkedDecoder   (HTRequest *	request,
     me->coding = coding;
     me->target = target;
     me->request = request;
-    me->state = EOL_BEGIN;
+    me->state = CHUNK_SIZE;
     me->buf = HTChunk_new(64);
     me->status = HT_ERROR;
     
@@ -258,21 +315,19 @@ PRIVATE int HTChunkEncode_flush (HTStream * me)
     return (*me->target->isa->flush)(me->target);
 }
 
+/*
+**	If the last chunk hasn't been written when we are freed, for example
+**	because an encoder above us ended the entity in its free method,
+**	then we write it now so that the message is properly delimited.
+*/
 PRIVATE int HTChunkEncode_free (HTStream * me)
 {
-#if 0
-    int status = HTChunkEncode_block(me, NULL, 0);
-    if (status != HT_WOULD_BLOCK) {
-	if ((status = (*me->target->isa->_free)(me->target)) == HT_WOULD_BLOCK)
-	    return HT_WOULD_BLOCK;
-	HT_FREE(me);
-    }
-    return status;
-#else
-    int status = me->target ? (*me->target->isa->_free)(me->target) : HT_OK;
+    int status;
+    if (!me->lastchunk && me->target) HTChunkEncode_block(me, NULL, 0);
+    status = me->target ? (*me->target->isa->_free)(me->target) : HT_OK;
+    HTChunk_delete(me->buf);
     HT_FREE(me);
     return status;
-#endif
 }
 
 PRIVATE int HTChunkEncode_abort (HTStream * me, HTList * e)
@@ -280,6 +335,7 @@ PRIVATE int HTChunkEncode_abort (HTStream * me, HTList * e)
     int status = HT_ERROR;
     if (me->target) status = (*me->target->isa->_free)(me->target);
     HTTRACE(PROT_TRACE, "Chunked..... ABORTING...\n");
+    HTChunk_delete(me->buf);
     HT_FREE(me);
     return status;
 }
@@ -308,7 +364,6 @@ PUBLIC HTStream * HTChunkedEncoder   (HTRequest *	request,
     me->target = target;
     me->request = request;
     me->param = (char *) param;
-    me->state = EOL_BEGIN;
     me->status = HT_ERROR;
     {
 	int length = me->param ? strlen(me->param)+20 : 20;
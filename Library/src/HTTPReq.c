@@ -37,6 +37,25 @@ struct _HTStream {
     BOOL			transparent;
 };
 
+/*
+**  The Accept headers and the User-Agent header generated from the global
+**  preferences are the same for all requests so we keep the serialized
+**  lines until the global lists or the application name change.
+*/
+typedef struct _HTTPHeaders {
+    int		generation;
+    char *	accept;
+    char *	charset;
+    char *	encoding;
+    char *	te;
+    char *	language;
+    char *	agent;
+    char *	app_name;
+    char *	app_version;
+} HTTPHeaders;
+
+PRIVATE HTTPHeaders Headers = {-1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
 /* ------------------------------------------------------------------------- */
 /* 			    HTTP Output Request Stream			     */
 /* ------------------------------------------------------------------------- */
@@ -66,6 +85,124 @@ PRIVATE int HTTP09Request (HTStream * me, HTRequest * request)
     return HT_OK;
 }
 
+/*	Serialized Global Headers
+**	-------------------------
+**	Each line is a complete header line including CRLF or NULL if the
+**	global list is empty.
+*/
+PRIVATE void add_item (HTChunk * ch, const char * name, const char * item,
+		       double quality)
+{
+    if (!HTChunk_size(ch))
+	HTChunk_puts(ch, name);
+    else
+	HTChunk_putc(ch, ',');
+    HTChunk_puts(ch, item);
+    if (quality < 1.0 && quality >= 0.0) {
+	char qstr[10];
+	sprintf(qstr, ";q=%1.1f", quality);
+	HTChunk_puts(ch, qstr);
+    }
+}
+
+PRIVATE char * make_line (HTChunk * ch)
+{
+    char * line = NULL;
+    if (HTChunk_size(ch)) {
+	HTChunk_putc(ch, CR);
+	HTChunk_putc(ch, LF);
+	StrAllocCopy(line, HTChunk_data(ch));
+    }
+    HTChunk_clear(ch);
+    return line;
+}
+
+PRIVATE void make_accept_lines (void)
+{
+    HTChunk * ch = HTChunk_new(128);
+    HTList * cur;
+    HTTRACE(PROT_TRACE, "HTTP........ Serializing Accept headers\n");
+
+    {
+	HTPresentation * pres;
+	cur = HTFormat_conversion();
+	while ((pres = (HTPresentation *) HTList_nextObject(cur)))
+	    if (pres->rep_out==WWW_PRESENT && pres->quality<=1.0)
+		add_item(ch, "Accept: ", HTAtom_name(pres->rep), pres->quality);
+	HT_FREE(Headers.accept);
+	Headers.accept = make_line(ch);
+    }
+    {
+	HTAcceptNode * pres;
+	cur = HTFormat_charset();
+	while ((pres = (HTAcceptNode *) HTList_nextObject(cur)))
+	    add_item(ch, "Accept-Charset: ", HTAtom_name(pres->atom), pres->quality);
+	HT_FREE(Headers.charset);
+	Headers.charset = make_line(ch);
+
+	cur = HTFormat_language();
+	while ((pres = (HTAcceptNode *) HTList_nextObject(cur)))
+	    add_item(ch, "Accept-Language: ", HTAtom_name(pres->atom), pres->quality);
+	HT_FREE(Headers.language);
+	Headers.language = make_line(ch);
+    }
+    {
+	HTCoding * pres;
+	cur = HTFormat_contentCoding();
+	while ((pres = (HTCoding *) HTList_nextObject(cur)))
+	    add_item(ch, "Accept-Encoding: ", HTCoding_name(pres),
+		     HTCoding_quality(pres));
+	HT_FREE(Headers.encoding);
+	Headers.encoding = make_line(ch);
+
+	/* Special check for "chunked" which is translated to "trailers" */
+	cur = HTFormat_transferCoding();
+	while ((pres = (HTCoding *) HTList_nextObject(cur))) {
+	    const char * coding = HTCoding_name(pres);
+	    add_item(ch, "TE: ", strcasecomp(coding, "chunked") ? coding : "trailers",
+		     HTCoding_quality(pres));
+	}
+	HT_FREE(Headers.te);
+	Headers.te = make_line(ch);
+    }
+    HTChunk_delete(ch);
+    Headers.generation = HTFormat_generation();
+}
+
+PRIVATE void make_agent_line (void)
+{
+    const char * name = HTLib_appName();
+    const char * version = HTLib_appVersion();
+    HTChunk * ch = HTChunk_new(64);
+    HTChunk_puts(ch, "User-Agent: ");
+    HTChunk_puts(ch, name);
+    HTChunk_putc(ch, '/');
+    HTChunk_puts(ch, version);
+    HTChunk_putc(ch, ' ');
+    HTChunk_puts(ch, HTLib_name());
+    HTChunk_putc(ch, '/');
+    HTChunk_puts(ch, HTLib_version());
+    HT_FREE(Headers.agent);
+    Headers.agent = make_line(ch);
+    StrAllocCopy(Headers.app_name, name);
+    StrAllocCopy(Headers.app_version, version);
+    HTChunk_delete(ch);
+}
+
+/*
+**	Put a serialized line. If more items are to be added to the same
+**	header then the line isn't terminated and we return YES.
+*/
+PRIVATE BOOL put_line (HTStream * me, const char * line, BOOL more)
+{
+    if (line) {
+	int len = (int) strlen(line);
+	PUTBLOCK(line, more ? len-2 : len);
+	return more;
+    }
+    return NO;
+}
+
 /*	HTTPMakeRequest
 **	---------------
 **	Makes a HTTP/1.0-1.1 request header.
@@ -200,6 +337,7 @@ PRIVATE int HTTPMakeRequest (HTStream * me, HTRequest * request)
     PUTBLOCK(crlf, 2);
 
     /* Request Headers */
+    if (Headers.generation != HTFormat_generation()) make_accept_lines();
     if (request_mask & HT_C_ACCEPT_TYPE) {
 	HTFormat format = HTRequest_outputFormat(request);
 	
@@ -209,26 +347,20 @@ PRIVATE int HTTPMakeRequest (HTStream * me, HTRequest * request)
 	** accept header
 	*/
 	if (format == WWW_PRESENT) {
-	    int list;
-	    HTList *cur;
-	    BOOL first=YES;
-	    for (list=0; list<2; list++) {
-		if ((!list && ((cur = HTFormat_conversion()) != NULL)) ||
-		    (list && ((cur = HTRequest_conversion(request))!=NULL))) {
-		    HTPresentation * pres;
-		    while ((pres=(HTPresentation *) HTList_nextObject(cur))) {
-			if (pres->rep_out==WWW_PRESENT && pres->quality<=1.0) {
-			    if (first) {
-				PUTS("Accept: ");
-				first=NO;
-			    } else
-				PUTC(',');
-			    PUTS(HTAtom_name(pres->rep));
-			    if (pres->quality < 1.0 && pres->quality >= 0.0) {
-				sprintf(qstr, ";q=%1.1f", pres->quality);
-				PUTS(qstr);
-			    }
-			}
+	    HTList * cur = HTRequest_conversion(request);
+	    BOOL first = !put_line(me, Headers.accept, !HTList_isEmpty(cur));
+	    HTPresentation * pres;
+	    while ((pres=(HTPresentation *) HTList_nextObject(cur))) {
+		if (pres->rep_out==WWW_PRESENT && pres->quality<=1.0) {
+		    if (first) {
+			PUTS("Accept: ");
+			first=NO;
+		    } else
+			PUTC(',');
+		    PUTS(HTAtom_name(pres->rep));
+		    if (pres->quality < 1.0 && pres->quality >= 0.0) {
+			sprintf(qstr, ";q=%1.1f", pres->quality);
+			PUTS(qstr);
 		    }
 		}
 	    }
@@ -248,105 +380,81 @@ PRIVATE int HTTPMakeRequest (HTStream * me, HTRequest * request)
 	}	
     }
     if (request_mask & HT_C_ACCEPT_CHAR) {
-	int list;
-	HTList *cur;
-	BOOL first=YES;
-	for (list=0; list<2; list++) {
-	    if ((!list && ((cur = HTFormat_charset()) != NULL)) ||
-		(list && ((cur = HTRequest_charset(request)) != NULL))) {
-		HTAcceptNode *pres;
-		while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
-		    if (first) {
-			PUTS("Accept-Charset: ");
-			first=NO;
-		    } else
-			PUTC(',');
-		    PUTS(HTAtom_name(pres->atom));
-		    if (pres->quality < 1.0 && pres->quality >= 0.0) {
-			sprintf(qstr, ";q=%1.1f", pres->quality);
-			PUTS(qstr);
-		    }
-		}
+	HTList * cur = HTRequest_charset(request);
+	BOOL first = !put_line(me, Headers.charset, !HTList_isEmpty(cur));
+	HTAcceptNode *pres;
+	while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
+	    if (first) {
+		PUTS("Accept-Charset: ");
+		first=NO;
+	    } else
+		PUTC(',');
+	    PUTS(HTAtom_name(pres->atom));
+	    if (pres->quality < 1.0 && pres->quality >= 0.0) {
+		sprintf(qstr, ";q=%1.1f", pres->quality);
+		PUTS(qstr);
 	    }
 	}
 	if (!first) PUTBLOCK(crlf, 2);
     }
     if (request_mask & HT_C_ACCEPT_ENC) {
-	int list;
-	HTList *cur;
-	BOOL first=YES;
-	for (list=0; list<2; list++) {
-	    if ((!list && ((cur = HTFormat_contentCoding()) != NULL)) ||
-		(list && ((cur = HTRequest_encoding(request)) != NULL))) {
-		HTCoding * pres;
-		while ((pres = (HTCoding *) HTList_nextObject(cur))) {
-		    double quality = HTCoding_quality(pres);
-		    if (first) {
-			PUTS("Accept-Encoding: ");
-			first = NO;
-		    } else
-			PUTC(',');
-		    PUTS(HTCoding_name(pres));
-		    if (quality < 1.0 && quality >= 0.0) {
-			sprintf(qstr, ";q=%1.1f", quality);
-			PUTS(qstr);
-		    }
-		}
+	HTList * cur = HTRequest_encoding(request);
+	BOOL first = !put_line(me, Headers.encoding, !HTList_isEmpty(cur));
+	HTCoding * pres;
+	while ((pres = (HTCoding *) HTList_nextObject(cur))) {
+	    double quality = HTCoding_quality(pres);
+	    if (first) {
+		PUTS("Accept-Encoding: ");
+		first = NO;
+	    } else
+		PUTC(',');
+	    PUTS(HTCoding_name(pres));
+	    if (quality < 1.0 && quality >= 0.0) {
+		sprintf(qstr, ";q=%1.1f", quality);
+		PUTS(qstr);
 	    }
 	}
 	if (!first) PUTBLOCK(crlf, 2);
     }
     if (request_mask & HT_C_ACCEPT_TE) {
-	int list;
-	HTList *cur;
-	BOOL first=YES;
-	for (list=0; list<2; list++) {
-	    if ((!list && ((cur = HTFormat_transferCoding()) != NULL)) ||
-		(list && ((cur = HTRequest_transfer(request)) != NULL))) {
-		HTCoding * pres;
-		while ((pres = (HTCoding *) HTList_nextObject(cur))) {
-		    double quality = HTCoding_quality(pres);
-		    const char * coding = HTCoding_name(pres);
-		    if (first) {
-			PUTS("TE: ");
-			first = NO;
-		    } else
-			PUTC(',');
-
-		    /* Special check for "chunked" which is translated to "trailers" */
-		    if (!strcasecomp(coding, "chunked"))
-			PUTS("trailers");
-		    else
-			PUTS(coding);
-		    if (quality < 1.0 && quality >= 0.0) {
-			sprintf(qstr, ";q=%1.1f", quality);
-			PUTS(qstr);
-		    }
-		}
+	HTList * cur = HTRequest_transfer(request);
+	BOOL first = !put_line(me, Headers.te, !HTList_isEmpty(cur));
+	HTCoding * pres;
+	while ((pres = (HTCoding *) HTList_nextObject(cur))) {
+	    double quality = HTCoding_quality(pres);
+	    const char * coding = HTCoding_name(pres);
+	    if (first) {
+		PUTS("TE: ");
+		first = NO;
+	    } else
+		PUTC(',');
+
+	    /* Special check for "chunked" which is translated to "trailers" */
+	    if (!strcasecomp(coding, "chunked"))
+		PUTS("trailers");
+	    else
+		PUTS(coding);
+	    if (quality < 1.0 && quality >= 0.0) {
+		sprintf(qstr, ";q=%1.1f", quality);
+		PUTS(qstr);
 	    }
 	}
 	if (!first) PUTBLOCK(crlf, 2);
     }
     if (request_mask & HT_C_ACCEPT_LAN) {
-	int list;
-	HTList *cur;
-	BOOL first=YES;
-	for (list=0; list<2; list++) {
-	    if ((!list && ((cur = HTFormat_language()) != NULL)) ||
-		(list && ((cur = HTRequest_language(request)) != NULL))) {
-		HTAcceptNode *pres;
-		while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
-		    if (first) {
-			PUTS("Accept-Language: ");
-			first=NO;
-		    } else
-			PUTC(',');
-		    PUTS(HTAtom_name(pres->atom));
-		    if (pres->quality < 1.0 && pres->quality >= 0.0) {
-			sprintf(qstr, ";q=%1.1f", pres->quality);
-			PUTS(qstr);
-		    }
-		}
+	HTList * cur = HTRequest_language(request);
+	BOOL first = !put_line(me, Headers.language, !HTList_isEmpty(cur));
+	HTAcceptNode *pres;
+	while ((pres = (HTAcceptNode *) HTList_nextObject(cur))) {
+	    if (first) {
+		PUTS("Accept-Language: ");
+		first=NO;
+	    } else
+		PUTC(',');
+	    PUTS(HTAtom_name(pres->atom));
+	    if (pres->quality < 1.0 && pres->quality >= 0.0) {
+		sprintf(qstr, ";q=%1.1f", pres->quality);
+		PUTS(qstr);
 	    }
 	}
 	if (!first) PUTBLOCK(crlf, 2);
@@ -533,15 +641,11 @@ PRIVATE int HTTPMakeRequest (HTStream * me, HTRequest * request)
 	}
     }
     if (request_mask & HT_C_USER_AGENT) {
-	PUTS("User-Agent: ");
-	PUTS(HTLib_appName());
-	PUTC('/');
-	PUTS(HTLib_appVersion());
-	PUTC(' ');
-	PUTS(HTLib_name());
-	PUTC('/');
-	PUTS(HTLib_version());
-	PUTBLOCK(crlf, 2);
+	if (!Headers.agent ||
+	    strcmp(Headers.app_name, HTLib_appName()) ||
+	    strcmp(Headers.app_version, HTLib_appVersion()))
+	    make_agent_line();
+	put_line(me, Headers.agent, NO);
     }
     HTTRACE(PROT_TRACE, "HTTP........ Generating HTTP/1.x Request Headers\n");
     return HT_OK;
@@ -652,3 +756,20 @@ PUBLIC HTStream * HTTPRequest_new (HTRequest * request, HTStream * target,
     /* Return general HTTP header stream */
     return HTTPGen_new(request, me, endHeader, version);
 }
+
+/*	HTTPRequest_deleteAll
+**	---------------------
+**	Free the serialized global header lines
+*/
+PUBLIC void HTTPRequest_deleteAll (void)
+{
+    HT_FREE(Headers.accept);
+    HT_FREE(Headers.charset);
+    HT_FREE(Headers.encoding);
+    HT_FREE(Headers.te);
+    HT_FREE(Headers.language);
+    HT_FREE(Headers.agent);
+    HT_FREE(Headers.app_name);
+    HT_FREE(Headers.app_version);
+    Headers.generation = -1;
+}
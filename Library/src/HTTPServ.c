@@ -19,6 +19,8 @@
 #include "HTHeader.h"
 #include "HTMIMERq.h"
 #include "HTNetMan.h"
+#include "HTTimer.h"
+#include "HTBufWrt.h"
 #include "HTTPUtil.h"
 #include "HTTPRes.h"
 #include "HTTPServ.h"					       /* Implements */
@@ -32,7 +34,8 @@
 typedef enum _HTTPState {
     HTTPS_ERROR		= -2,
     HTTPS_OK		= -1,
-    HTTPS_BEGIN		= 0,
+    HTTPS_ACCEPT	= 0,
+    HTTPS_BEGIN,
     HTTPS_NEED_REQUEST,
     HTTPS_LOAD_CLIENT
 } HTTPState;
@@ -43,6 +46,7 @@ typedef struct _https_info {
     HTList *	clients;		          /* List of client requests */
     HTTPState	state;			  /* Current State of the connection */
     HTNet *	net;
+    BOOL	chunked;		/* Client can take chunked replies */
 } https_info;
 
 /* The HTTP Receive Stream */
@@ -60,6 +64,13 @@ struct _HTInputStream {
     const HTInputStreamClass *	isa;
 };
 
+struct _HTOutputStream {
+    const HTOutputStreamClass *	isa;
+};
+
+PRIVATE BOOL SendFile = YES;	    /* Send local files directly to socket */
+PRIVATE BOOL Compress = YES;	   /* Honour Accept-Encoding for text replies */
+
 /* ------------------------------------------------------------------------- */
 
 /*	ServerCleanup
@@ -96,9 +107,8 @@ PRIVATE int ServerCleanup (HTRequest * req, HTNet * net, int status)
     **	Also unregister all pending requests and close the connection
     */
     HTChannel_setSemaphore(channel, 0);
-    HTNet_delete(net, HT_IGNORE);
-
     HT_FREE(http);
+    HTNet_delete(net, status);
     return YES;
 }
 
@@ -106,6 +116,25 @@ PRIVATE int ServerCleanup (HTRequest * req, HTNet * net, int status)
 /*				REPLY STREAM				     */
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Find out whether the reply to the client request is compressed. The
+**	content coding is set by the MIME parser if the client accepts one
+**	we can encode and we take it away again if the reply isn't text.
+*/
+PRIVATE HTEncoding ReplyCoding (HTRequest * client)
+{
+    HTEncoding coding = HTRequest_entityCoding(client);
+    if (coding) {
+	HTFormat format = HTAnchor_format(HTRequest_anchor(client));
+	if (!Compress || HTRequest_method(client) == METHOD_HEAD ||
+	    !HTMIMEMatch(HTAtom_for("text/*"), format)) {
+	    HTRequest_setEntityCoding(client, NULL);
+	    coding = NULL;
+	}
+    }
+    return coding;
+}
+
 /*
 **	This is our handle to the server reply stream when data is coming
 **	back from our "client" request. It is responsible for setting up the
@@ -146,6 +175,7 @@ PRIVATE int MakeReplyPipe (HTStream * me, HTRequest * client)
     {
 	HTParentAnchor * anchor = HTRequest_anchor(client);
 	HTFormat format = HTAnchor_format(anchor);
+	ReplyCoding(client);
 	me->target = (format == WWW_UNKNOWN) ?
 	    HTTPResponse_new(client, me->target, YES, HTTP_11) :
 	    HTMIMERequest_new(client,
@@ -185,7 +215,9 @@ PRIVATE int HTTPReply_free (HTStream * me)
 {
     int status = HTTPReply_put_block(me, NULL, 0);
     HTTRACE(STREAM_TRACE, "HTTPReply... Freeing server stream\n");
-    return status==HT_OK ? (*me->target->isa->_free)(me->target) : status;
+    if (status == HT_OK) status = (*me->target->isa->_free)(me->target);
+    HT_FREE(me);
+    return status;
 }
 
 PRIVATE int HTTPReply_abort (HTStream * me, HTList * e)
@@ -224,6 +256,55 @@ PRIVATE HTStream * HTTPReply_new (HTRequest * request, https_info * http,
     return me;
 }
 
+/*
+**	When the client request is served from a local file which doesn't
+**	need any conversion, the response header is put into the output
+**	buffer and the file is queued after it. The buffered writer then
+**	sends it directly to the socket. A reply that is compressed goes
+**	through the stream stack instead.
+*/
+PRIVATE void ReplyFileDone (void * context)
+{
+    close((int) (long) context);
+}
+
+PRIVATE int ReplyFile (HTRequest * request, void * param, int fd, long length)
+{
+    HTStream * me = (HTStream *) param;
+    if (ReplyCoding(request)) return HT_ERROR;
+
+    /* Once the header has gone out we can't let the file module start over */
+    if (HTTPReply_put_block(me, NULL, 0) != HT_OK ||
+	PUTBLOCK(NULL, 0) != HT_OK ||
+	HTBufferWriter_putFile(HTNet_getOutput(me->http->net, NULL, 0),
+			       fd, 0, length, ReplyFileDone,
+			       (void *) (long) fd) != HT_OK) {
+	close(fd);
+	return HT_CLOSED;
+    }
+    return HT_OK;
+}
+
+/*
+**	The reply stream isn't freed by the stream stack but when the client
+**	request is deleted. That flushes the response to the network. The
+**	client request is deleted from the event loop as the remaining AFTER
+**	filters still need it.
+*/
+PRIVATE int DeleteClient (HTTimer * timer, void * param, HTEventType type)
+{
+    HTTimer_delete(timer);
+    HTRequest_delete((HTRequest *) param);
+    return HT_OK;
+}
+
+PRIVATE int ReplyDone (HTRequest * request, HTResponse * response,
+		       void * param, int status)
+{
+    HTTimer_defer(DeleteClient, request);
+    return HT_OK;
+}
+
 /* ------------------------------------------------------------------------- */
 /*				RECEIVE STREAM				     */
 /* ------------------------------------------------------------------------- */
@@ -264,6 +345,8 @@ PRIVATE int ParseRequest (HTStream * me)
 
     /* Get ready to get the rest of the request */
     if (version_str) {
+	me->http->chunked = strcasecomp(version_str, "HTTP/1.0") &&
+	    !strncasecomp(version_str, "HTTP/1.", 7);
 	me->target = HTStreamStack(WWW_MIME_HEAD,
 				   HTRequest_debugFormat(client),
 				   HTRequest_debugStream(client),
@@ -281,6 +364,7 @@ PRIVATE int ParseRequest (HTStream * me)
 */
 PRIVATE int HTTPReceive_put_block (HTStream * me, const char * b, int l)
 {
+    int length = l;
     if (!me->transparent) {
 	const char *p=b;
 	while (l>0 && *p!=CR && *p!=LF) l--, p++;
@@ -295,7 +379,15 @@ PRIVATE int HTTPReceive_put_block (HTStream * me, const char * b, int l)
     }
     if (l > 0) {
 	int status = PUTBLOCK(b, l);
-	if (status == HT_LOADED) me->transparent = NO;
+	if (status == HT_LOADED) {
+	    /*
+	    **  The header parser belongs to the client request so it can't
+	    **  tell our reader how much it has consumed. As we don't handle
+	    **  pipelined requests, the whole block is consumed.
+	    */
+	    HTHost_setConsumed(HTNet_host(me->http->net), length);
+	    me->transparent = NO;
+	}
 	return status;
     }
     return HT_OK;
@@ -367,6 +459,32 @@ PRIVATE HTStream * HTTPReceive_new (HTRequest * request, https_info * http)
 
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Whether local files are sent directly to the socket
+*/
+PUBLIC void HTTPServ_setSendFile (BOOL mode)
+{
+    SendFile = mode;
+}
+
+PUBLIC BOOL HTTPServ_sendFile (void)
+{
+    return SendFile;
+}
+
+/*
+**	Whether text replies are compressed if the client accepts it
+*/
+PUBLIC void HTTPServ_setCompress (BOOL mode)
+{
+    Compress = mode;
+}
+
+PUBLIC BOOL HTTPServ_compress (void)
+{
+    return Compress;
+}
+
 /*	HTServHTTP
 **	----------
 **	Serv Document using HTTP.
@@ -388,8 +506,8 @@ PUBLIC int HTServHTTP (SOCKET soc, HTRequest * request)
     if ((http = (https_info *) HT_CALLOC(1, sizeof(https_info))) == NULL)
 	HT_OUTOFMEM("HTServHTTP");
     http->server = request;
-    http->state = HTTPS_BEGIN;
     http->clients = HTList_new();
+    http->net = net;
     HTNet_setContext(net, http);
 
     /* 
@@ -397,11 +515,15 @@ PUBLIC int HTServHTTP (SOCKET soc, HTRequest * request)
     */
     net->readStream = HTTPReceive_new(request, http);
     HTRequest_setOutputConnected(request, YES);
-    http->state = HTTPS_BEGIN;
+    http->state = HTTPS_ACCEPT;
 
     HTNet_setEventCallback(net, ServEvent);
     HTNet_setEventParam(net, http);  /* callbacks get http* */
 
+    /* Start listening on a socket */
+    if (HTHost_listen(NULL, net, HTAnchor_physical(HTRequest_anchor(request))) == HT_ERROR)
+	return ServEvent(soc, http, HTEvent_CLOSE);
+
     return ServEvent(soc, http, HTEvent_BEGIN);		/* get it started - ops is ignored */
 }
 
@@ -420,12 +542,34 @@ PRIVATE int ServEvent (SOCKET soc, void * pVoid, HTEventType type)
     if (type == HTEvent_CLOSE) {			      /* Interrupted */
 	ServerCleanup(request, net, HT_INTERRUPTED);
 	return HT_OK;
+    } else if (type == HTEvent_WRITE || type == HTEvent_FLUSH) {
+	/*
+	**  The reply didn't fit in the socket so we get called when we
+	**  can write the rest
+	*/
+	HTOutputStream * output = HTNet_getOutput(net, NULL, 0);
+	status = (*output->isa->flush)(output);
+	if (status == HT_WOULD_BLOCK) return HT_OK;
+	HTHost_unregister(HTNet_host(net), net, HTEvent_WRITE);
+	if (status != HT_OK) ServerCleanup(request, net, HT_ERROR);
+	return HT_OK;
     } else
 	http = (https_info *) HTNet_context(net);	/* Get existing copy */
  
     /* Now jump into the machine. We know the state from the previous run */
     while (1) {
 	switch (http->state) {
+	case HTTPS_ACCEPT:
+	    status = HTHost_accept(HTNet_host(net), net, NULL);
+	    if (status == HT_OK) {
+		http->state = HTTPS_BEGIN;
+		type = HTEvent_BEGIN;
+	    } else if (status == HT_WOULD_BLOCK || status == HT_PENDING)
+		return HT_OK;
+	    else
+		http->state = HTTPS_ERROR;
+	    break;
+
 	case HTTPS_BEGIN:
 	{
 	    /*
@@ -450,6 +594,9 @@ PRIVATE int ServEvent (SOCKET soc, void * pVoid, HTEventType type)
 		HTStream * app = HTTPReply_new(client, http,(HTStream*)output);
 		HTRequest_setOutputStream(client, app);
 		HTRequest_setOutputFormat(client, WWW_SOURCE);
+		HTRequest_addAfter(client, ReplyDone, NULL, NULL, HT_ALL,
+				   HT_FILTER_LAST, NO);
+		if (SendFile) HTRequest_setFileCallback(client, ReplyFile, app);
 	    }
 	    http->state = HTTPS_NEED_REQUEST;
 	}
@@ -473,13 +620,14 @@ PRIVATE int ServEvent (SOCKET soc, void * pVoid, HTEventType type)
 	case HTTPS_LOAD_CLIENT:
 	{
 	    HTRequest * client = HTList_removeFirstObject(http->clients);
+	    if (!http->chunked) HTRequest_setEntityCoding(client, NULL);
 	    HTLoad(client, NO);
 	    http->state = HTTPS_BEGIN;
 	    break;
 	}
 
 	case HTTPS_OK:
-	    ServerCleanup(request, net, HT_IGNORE);
+	    ServerCleanup(request, net, HT_LOADED);
 	    return HT_OK;
 
 	case HTTPS_ERROR:
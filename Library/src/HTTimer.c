@@ -28,9 +28,22 @@ struct _HTTimer {
     BOOL	repetitive;
     void *	param;		/* Client supplied context */
     HTTimerCallback * cbf;
+    int		index;		/* Position in heap or -1 if not active */
+    unsigned long seq;		/* Keeps timers with same expiry in order */
 };
 
-PRIVATE HTList * Timers = NULL;			   /* List of timers */
+/*
+**  Active timers are kept in a binary min-heap ordered by expiration
+**  time. Each timer knows its own position in the heap so that deleting
+**  or refreshing a timer is O(log n) and finding the next timer to
+**  expire is O(1).
+*/
+#define TIMER_HEAP_GROW	64
+
+PRIVATE HTTimer ** Timers = NULL;		  /* Heap of active timers */
+PRIVATE int TimerCount = 0;
+PRIVATE int TimerAllocated = 0;
+PRIVATE unsigned long TimerSeq = 0;
 
 PRIVATE HTTimerSetCallback * SetPlatformTimer = NULL;
 PRIVATE HTTimerSetCallback * DeletePlatformTimer = NULL;
@@ -50,32 +63,120 @@ PRIVATE HTTimer * InTimer = NULL;
 
 #endif /* !WATCH_RECURSION */
 
+/* ------------------------------------------------------------------------- */
+/*				TIMER HEAP				     */
+/* ------------------------------------------------------------------------- */
+
+#define TIMER_BEFORE(a, b) \
+	((a)->expires < (b)->expires || \
+	 ((a)->expires == (b)->expires && (a)->seq < (b)->seq))
+
+PRIVATE void TimerHeap_set (int index, HTTimer * timer)
+{
+    Timers[index] = timer;
+    timer->index = index;
+}
+
+PRIVATE void TimerHeap_up (int index)
+{
+    HTTimer * timer = Timers[index];
+    while (index > 0) {
+	int parent = (index-1) / 2;
+	if (!TIMER_BEFORE(timer, Timers[parent])) break;
+	TimerHeap_set(index, Timers[parent]);
+	index = parent;
+    }
+    TimerHeap_set(index, timer);
+}
+
+PRIVATE void TimerHeap_down (int index)
+{
+    HTTimer * timer = Timers[index];
+    for (;;) {
+	int child = 2*index + 1;
+	if (child >= TimerCount) break;
+	if (child+1 < TimerCount && TIMER_BEFORE(Timers[child+1], Timers[child]))
+	    child++;
+	if (!TIMER_BEFORE(Timers[child], timer)) break;
+	TimerHeap_set(index, Timers[child]);
+	index = child;
+    }
+    TimerHeap_set(index, timer);
+}
+
+PRIVATE void TimerHeap_add (HTTimer * timer)
+{
+    if (TimerCount >= TimerAllocated) {
+	TimerAllocated += TIMER_HEAP_GROW + TimerAllocated/2;
+	if ((Timers = (HTTimer **) HT_REALLOC(Timers, TimerAllocated * sizeof(HTTimer *))) == NULL)
+	    HT_OUTOFMEM("TimerHeap_add");
+    }
+    TimerHeap_set(TimerCount++, timer);
+    TimerHeap_up(timer->index);
+}
+
+/*
+**  Reposition a timer that is already in the heap after its expiration
+**  time has changed
+*/
+PRIVATE void TimerHeap_update (HTTimer * timer)
+{
+    int index = timer->index;
+    if (index > 0 && TIMER_BEFORE(timer, Timers[(index-1) / 2]))
+	TimerHeap_up(index);
+    else
+	TimerHeap_down(index);
+}
+
+/*
+**  A timer is active if the heap slot it points to points back at it.
+**  One shot timers that have been dispatched have an index of -1.
+*/
+PRIVATE BOOL TimerHeap_contains (HTTimer * timer)
+{
+    return (timer && timer->index >= 0 && timer->index < TimerCount &&
+	    Timers[timer->index] == timer);
+}
+
+PRIVATE BOOL TimerHeap_remove (HTTimer * timer)
+{
+    int index = timer->index;
+    if (!TimerHeap_contains(timer)) return NO;
+    timer->index = -1;
+    if (index != --TimerCount) {
+	TimerHeap_set(index, Timers[TimerCount]);
+	TimerHeap_update(Timers[index]);
+    }
+    return YES;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE int Timer_dispatch (HTTimer * timer);
+
 /* JK: used by Amaya */
 PUBLIC BOOL HTTimer_expireAll (void)
 {
-  HTList * cur;
+  int cnt;
   HTTimer * timer;
-  if (Timers) {
+  if (TimerCount > 0) {
     /*
     **  first delete all plattform specific timers to
     **  avoid having a concurrent callback
     */
-    cur = Timers;
-    while ((timer = (HTTimer *) HTList_nextObject(cur))) {
-      if (DeletePlatformTimer) DeletePlatformTimer(timer);
+    for (cnt = 0; cnt < TimerCount; cnt++) {
+      if (DeletePlatformTimer) DeletePlatformTimer(Timers[cnt]);
     }
  
     /*
     ** simulate a timer timeout thru timer_dispatch
     ** to kill its context
     */
-    cur = Timers;
-    while ((timer = (HTTimer *) HTList_nextObject(cur))) {
+    while (TimerCount > 0) {
+      timer = Timers[0];
           /* avoid having it being refreshed */
       timer->repetitive = NO;
-      HTTimer_dispatch (timer);
-      /* as the timer is erased, we start again from the top of the list */
-      cur = Timers;
+      Timer_dispatch (timer);
     }
     return YES;
   }
@@ -89,12 +190,10 @@ PUBLIC BOOL HTTimer_expireAll (void)
 **  timer with the next expiration time if repetitive. Otherwise we just leave
 **  it
 */
-PRIVATE int Timer_dispatch (HTList * cur, HTList * last)
+PRIVATE int Timer_dispatch (HTTimer * timer)
 {
-    HTTimer * timer;
     int ret = HT_ERROR;
 
-    timer = (HTTimer *)HTList_objectOf(cur);
     if (timer == NULL) {
 #if 0
         HTDEBUGBREAK("Timer dispatch couldn't find a timer\n");
@@ -112,7 +211,7 @@ PRIVATE int Timer_dispatch (HTList * cur, HTList * last)
     if (timer->repetitive)
 	HTTimer_new(timer, timer->cbf, timer->param, timer->millis, YES, YES);
     else
-	HTList_quickRemoveElement(cur, last);
+	TimerHeap_remove(timer);
     HTTRACE(THD_TRACE, "Timer....... Dispatch timer %p\n" _ timer);
     ret = (*timer->cbf) (timer, timer->param, HTEvent_TIMEOUT);
     return ret;
@@ -160,11 +259,9 @@ PUBLIC BOOL HTTimer_isRelative (HTTimer * timer)
 
 PUBLIC BOOL HTTimer_delete (HTTimer * timer)
 {
-    HTList * last;
-    HTList * cur;
+    if (!timer) return NO;
     CHECKME(timer);
-    if ((cur = HTList_elementOf(Timers, (void *)timer, &last)) == NULL) CLEARME(timer);
-    if (HTList_quickRemoveElement(cur, last)) {
+    if (TimerHeap_remove(timer)) {
 	HTTRACE(THD_TRACE, "Timer....... Deleted active timer %p\n" _ timer);
     } else { 
 	HTTRACE(THD_TRACE, "Timer....... Deleted expired timer %p\n" _ timer);
@@ -184,11 +281,9 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
 			      void * param, ms_t millis, BOOL relative,
 			      BOOL repetitive)
 {
-    HTList * last;
-    HTList * cur;
     ms_t now = HTGetTimeInMillis();
     ms_t expires;
-    HTTimer * pres;
+    BOOL active = NO;
 
     CHECKME(timer);
     expires = millis;
@@ -197,42 +292,31 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     else
 	millis = expires-now;
 
-    if (Timers == NULL)
-	Timers = HTList_new();
-
     if (timer) {
 
 	/*	if a timer is specified, it should already exist
 	 */
-	if ((cur = HTList_elementOf(Timers, (void *)timer, &last)) == NULL) {
+	if (timer->index < 0) {
 	    HTDEBUGBREAK("Timer %p not found\n" _ timer);
 	    CLEARME(timer);
 	    return NULL;
 	}
-	HTList_quickRemoveElement(cur, last);
+	active = YES;
 	HTTRACE(THD_TRACE, "Timer....... Found timer %p with callback %p, context %p, and %s timeout %d\n" _ 
 		    timer _ cbf _ param _ relative ? "relative" : "absolute" _ millis);
-	/* could optimize by sorting from last when ((HTList *)(last->object))->expires < expires (most common case) */
     } else {
 
 	/*	create a new timer
 	 */
 	if ((timer = (HTTimer *) HT_CALLOC(1, sizeof(HTTimer))) == NULL)
 	    HT_OUTOFMEM("HTTimer_new");
-	last = Timers;
+	timer->index = -1;
 	HTTRACE(THD_TRACE, "Timer....... Created %s timer %p with callback %p, context %p, and %s timeout %d\n" _ 
 		    repetitive ? "repetitive" : "one shot" _ 
 		    timer _ cbf _ param _ 
 		    relative ? "relative" : "absolute" _ millis);
     }
 
-    /*
-    **  Sort new element into list
-    */
-    for (cur = last; 
-	 (pres = (HTTimer *) HTList_nextObject(cur)) != NULL && pres->expires < expires; 
-	 last = cur);
-
     /*
     **  If the expiration is 0 then we still register it but dispatch it immediately.
     */
@@ -244,12 +328,16 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     timer->millis = millis;
     timer->relative = relative;
     timer->repetitive = repetitive;
+    timer->seq = TimerSeq++;
     SETME(timer);
 
     /*
-    **	add to list if timer is new
+    **	Put the timer into the heap or move it to its new position
     */
-    cur = HTList_addList(last, (void *)timer);
+    if (active)
+	TimerHeap_update(timer);
+    else
+	TimerHeap_add(timer);
 
     /*
     **  Call any platform specific timer handler
@@ -257,13 +345,38 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     if (SetPlatformTimer) SetPlatformTimer(timer);
 
     /* Check if the timer object has already expired. If so then dispatch */
-    if (timer->expires <= now) Timer_dispatch(cur, last);
+    if (timer->expires <= now) Timer_dispatch(timer);
 
     CLEARME(timer);
     return timer;
 }
 
 
+/*
+**  Like a one shot timer with a relative timeout of 0 but it isn't
+**  dispatched until the next time we go through HTTimer_next.
+*/
+PUBLIC HTTimer * HTTimer_defer (HTTimerCallback * cbf, void * param)
+{
+    HTTimer * timer;
+    CHECKME(NULL);
+    if ((timer = (HTTimer *) HT_CALLOC(1, sizeof(HTTimer))) == NULL)
+	HT_OUTOFMEM("HTTimer_defer");
+    timer->index = -1;
+    timer->expires = HTGetTimeInMillis();
+    timer->cbf = cbf;
+    timer->param = param;
+    timer->relative = YES;
+    timer->seq = TimerSeq++;
+    SETME(timer);
+    TimerHeap_add(timer);
+    if (SetPlatformTimer) SetPlatformTimer(timer);
+    HTTRACE(THD_TRACE, "Timer....... Created deferred timer %p with callback %p, context %p\n" _
+	    timer _ cbf _ param);
+    CLEARME(timer);
+    return timer;
+}
+
 PUBLIC BOOL HTTimer_refresh (HTTimer * timer, ms_t now)
 {
     if (timer == NULL || timer->repetitive == NO)
@@ -275,10 +388,10 @@ PUBLIC BOOL HTTimer_refresh (HTTimer * timer, ms_t now)
 
 PUBLIC BOOL HTTimer_deleteAll (void)
 {
-    HTList * cur = Timers;
-    HTTimer * pres;
     if (Timers) {
-	while ((pres = (HTTimer *) HTList_nextObject(cur))) {
+	int cnt;
+	for (cnt = 0; cnt < TimerCount; cnt++) {
+	    HTTimer * pres = Timers[cnt];
 
 	    /*
 	    **  Call any platform specific timer handler
@@ -286,8 +399,8 @@ PUBLIC BOOL HTTimer_deleteAll (void)
 	    if (DeletePlatformTimer) DeletePlatformTimer(pres);
 	    HT_FREE(pres);
 	}
-	HTList_delete(Timers);
-	Timers = NULL;
+	HT_FREE(Timers);
+	TimerCount = TimerAllocated = 0;
 	return YES;
     }
     return NO;
@@ -295,10 +408,7 @@ PUBLIC BOOL HTTimer_deleteAll (void)
 
 PUBLIC int HTTimer_dispatch (HTTimer * timer)
 {
-    HTList * cur;
-    HTList * last = Timers;
-    cur = HTList_elementOf(Timers, (void *)timer, &last);
-    return Timer_dispatch(cur, last);
+    return Timer_dispatch(TimerHeap_contains(timer) ? timer : NULL);
 }
 
 /*
@@ -311,8 +421,6 @@ PUBLIC BOOL HTTimer_hasTimerExpired (HTTimer * timer)
 
 PUBLIC int HTTimer_next (ms_t * pSoonest)
 {
-    HTList * cur = Timers;
-    HTList * last = Timers;
     HTTimer * pres;
     ms_t now = HTGetTimeInMillis();
     int ret = HT_OK;
@@ -320,21 +428,15 @@ PUBLIC int HTTimer_next (ms_t * pSoonest)
     /*
     **  Dispatch all timers that have expired
     */
-    while (Timers && (pres = (HTTimer *) HTList_nextObject(cur))) {
-	if (pres->expires <= now) {
-	    if ((ret = Timer_dispatch(cur, last)) != HT_OK) break;
-	    cur = last = Timers;
-	} else {
-	    last = cur;
-	}	
+    while (TimerCount > 0 && (pres = Timers[0])->expires <= now) {
+	if ((ret = Timer_dispatch(pres)) != HT_OK) break;
     }
 
     if (pSoonest) {
 	/*
-	**	First element in Timers is the next to expire.
+	**	Top of the heap is the next to expire.
 	*/
-	HTList * cur = Timers;	/* for now */
-	pres = (HTTimer *) HTList_nextObject(cur);
+	pres = TimerCount > 0 ? Timers[0] : NULL;
 	*pSoonest = pres ? pres->expires - now : 0;
     }
     return ret;
@@ -344,9 +446,9 @@ PUBLIC int HTTimer_next (ms_t * pSoonest)
 extern void CheckSockEvent(HTTimer * timer, HTTimerCallback * cbf, void * param);
 PRIVATE void CheckTimers(void)
 {
-    HTList * cur = Timers;
-    HTTimer * pres;
-    while ((pres = (HTTimer *) HTList_nextObject(cur))) {
+    int cnt;
+    for (cnt = 0; cnt < TimerCount; cnt++) {
+	HTTimer * pres = Timers[cnt];
 	CheckSockEvent(pres, pres->cbf, pres->param);
     }
 }
@@ -36,6 +36,9 @@ struct _HTOutputStream {
 #endif
 };
 
+#define HT_IOV_MAX	16		      /* Max segments per system call */
+#define HT_SENDFILE_MAX	0x40000000L	       /* Max bytes per system call */
+
 /* ------------------------------------------------------------------------- */
 
 PRIVATE int HTWriter_flush (HTOutputStream * me)
@@ -53,6 +56,68 @@ PRIVATE int HTWriter_abort (HTOutputStream * me, HTList * e)
     return HT_ERROR;
 }
 
+/*
+**  Handle a failed write. Returns HT_CONTINUE if the call was interrupted
+**  and should be tried again. If the socket would block then we register
+**  for a write event so that we get called again when we can write.
+*/
+PRIVATE int write_error (HTHost * host, HTNet * net)
+{
+#ifdef EAGAIN
+    if (socerrno == EAGAIN || socerrno == EWOULDBLOCK)	      /* POSIX, SVR4 */
+#else
+    if (socerrno == EWOULDBLOCK)				      /* BSD */
+#endif
+    {
+	HTHost_register(host, net, HTEvent_WRITE);
+	return HT_WOULD_BLOCK;
+#ifdef EINTR
+    } else if (socerrno == EINTR) {
+	/*
+	**	EINTR	A signal was caught during the  write  opera-
+	**		tion and no data was transferred.
+	*/
+	HTTRACE(STREAM_TRACE, "Write Socket call interrupted - try again\n");
+	return HT_CONTINUE;
+#endif
+    } else {
+	host->broken_pipe = YES;
+#ifdef EPIPE
+	if (socerrno == EPIPE) {
+	    /* JK: an experimental bug solution proposed by
+	       Olga and Mikhael */
+	    HTTRACE(STREAM_TRACE, "Write Socket got EPIPE\n");
+	    HTHost_unregister(host, net, HTEvent_WRITE);
+	    HTHost_register(host, net, HTEvent_CLOSE);
+	    /* @@ JK: seems that some functions check the errors 
+	       as part of the flow control */
+	    HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
+				     "NETWRITE");
+	    return HT_CLOSED;		    
+	}
+#endif /* EPIPE */
+	/* all errors that aren't EPIPE */
+	HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
+				 "NETWRITE");
+	return HT_ERROR;
+    }
+}
+
+/*
+**  Account for data written and tell the application
+*/
+PRIVATE void written (HTNet * net, SOCKET soc, int b_write)
+{
+    HTAlertCallback *cbf = HTAlert_find(HT_PROG_WRITE);
+    HTNet_addBytesWritten(net, b_write);
+    HTTRACE(STREAM_TRACE, "Write Socket %d bytes written to %d\n" _ b_write _ soc);
+    if (cbf) {
+	int tw = HTNet_bytesWritten(net);
+	(*cbf)(net->request, HT_PROG_WRITE,
+	       HT_MSG_NULL, NULL, &tw, NULL);
+    }
+}
+
 /*	Write to the socket
 **
 ** According to Solaris 2.3 man on write:
@@ -126,67 +191,169 @@ PRIVATE int HTWriter_write (HTOutputStream * me, const char * buf, int len)
     /* Write data to the network */
     while (wrtp < limit) {
 	if ((b_write = NETWRITE(soc, wrtp, len)) < 0) {
-#ifdef EAGAIN
-	    if (socerrno == EAGAIN || socerrno == EWOULDBLOCK)/* POSIX, SVR4 */
-#else
-	    if (socerrno == EWOULDBLOCK)			      /* BSD */
-#endif
-	    {
-		HTHost_register(host, net, HTEvent_WRITE);
+	    int status = write_error(host, net);
+	    if (status == HT_CONTINUE) continue;
+	    if (status == HT_WOULD_BLOCK) {
 		me->offset = wrtp - buf;
 		HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (offset %d)\n" _ soc _ me->offset);
-		return HT_WOULD_BLOCK;
-#ifdef EINTR
-	    } else if (socerrno == EINTR) {
-		/*
-		**	EINTR	A signal was caught during the  write  opera-
-		**		tion and no data was transferred.
-		*/
-		HTTRACE(STREAM_TRACE, "Write Socket call interrupted - try again\n");
-		continue;
-#endif
-	    } else {
-		host->broken_pipe = YES;
-#ifdef EPIPE
-	        if (socerrno == EPIPE) {
-		    /* JK: an experimental bug solution proposed by
-                       Olga and Mikhael */
-		    HTTRACE(STREAM_TRACE, "Write Socket got EPIPE\n");
-		    HTHost_unregister(host, net, HTEvent_WRITE);
-		    HTHost_register(host, net, HTEvent_CLOSE);
-		    /* @@ JK: seems that some functions check the errors 
-		       as part of the flow control */
-                    HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
-					     "NETWRITE");
-		    return HT_CLOSED;		    
-		}
-#endif /* EPIPE */
-		/* all errors that aren't EPIPE */
-		HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
-					 "NETWRITE");
-		return HT_ERROR;
 	    }
+	    return status;
 	}
 
 	/* We do this unconditionally, should we check to see if we ever blocked? */
 	HTTRACEDATA(wrtp, b_write, "Writing to socket %d" _ soc);
-	HTNet_addBytesWritten(net, b_write);
 	wrtp += b_write;
 	len -= b_write;
-	HTTRACE(STREAM_TRACE, "Write Socket %d bytes written to %d\n" _ b_write _ soc);
+	written(net, soc, b_write);
+    }
+#ifdef NOT_ASCII
+    HT_FREE(me->ascbuf);
+#endif
+    return HT_OK;
+}
+
+/*	Write a vector of segments to the socket
+**	----------------------------------------
+**	Writes as many segments as possible in each system call. Unlike
+**	HTWriter_write, we don't remember how far we got if the socket would
+**	block - instead we return the number of bytes written in `done' and
+**	the caller passes what is left the next time.
+*/
+PUBLIC int HTWriter_writev (HTOutputStream * me, const HTIOVec * vec, int count,
+			    int * done)
+{
+    HTHost * host = me->host;
+    SOCKET soc = HTChannel_socket(HTHost_channel(host));
+    HTNet * net = HTHost_getWriteNet(host);
+    int skip = 0;			  /* Bytes written of the first segment */
+    *done = 0;
+
+    /* If we don't have a Net object then return right away */
+    if (!net) {
+	HTTRACE(STREAM_TRACE, "Write Socket No Net object %d\n" _ soc);
+	return HT_ERROR;
+    }
+
+    while (count > 0) {
+	int b_write;
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H) && !defined(NOT_ASCII)
+	struct iovec iov[HT_IOV_MAX];
+	int cnt;
+	for (cnt = 0; cnt < count && cnt < HT_IOV_MAX; cnt++) {
+	    iov[cnt].iov_base = (void *) vec[cnt].base;
+	    iov[cnt].iov_len = vec[cnt].len;
+	}
+	iov[0].iov_base = (char *) iov[0].iov_base + skip;
+	iov[0].iov_len -= skip;
+	b_write = NETWRITEV(soc, iov, cnt);
+#else
+	/* One segment at a time through the normal write method */
 	{
-	    HTAlertCallback *cbf = HTAlert_find(HT_PROG_WRITE);
-	    if (cbf) {
-		int tw = HTNet_bytesWritten(net);
-		(*cbf)(net->request, HT_PROG_WRITE,
-		       HT_MSG_NULL, NULL, &tw, NULL);
+	    int status = HTWriter_write(me, vec->base + skip, vec->len - skip);
+	    b_write = me->offset ? me->offset : vec->len - skip;
+	    if (status != HT_OK) {
+		if (status == HT_WOULD_BLOCK) *done += me->offset;
+		me->offset = 0;
+		return status;
 	    }
 	}
+#endif
+	if (b_write < 0) {
+	    int status = write_error(host, net);
+	    if (status == HT_CONTINUE) continue;
+	    HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (%d bytes written)\n" _ soc _ *done);
+	    return status;
+	}
+#if defined(HAVE_WRITEV) && defined(HAVE_SYS_UIO_H) && !defined(NOT_ASCII)
+	written(net, soc, b_write);
+#endif
+	*done += b_write;
+
+	/* Move past the segments that are done */
+	while (count > 0 && b_write >= vec->len - skip) {
+	    b_write -= vec->len - skip;
+	    skip = 0;
+	    vec++;
+	    count--;
+	}
+	skip += b_write;
     }
-#ifdef NOT_ASCII
-    HT_FREE(me->ascbuf);
+    return HT_OK;
+}
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H) && !defined(NOT_ASCII)
+/*
+**  Some file systems and kernels can't send a file to a socket. That is
+**  not an error on the connection and nothing has been written.
+*/
+PRIVATE BOOL sendfile_unsupported (void)
+{
+#ifdef EINVAL
+    if (socerrno == EINVAL) return YES;
+#endif
+#ifdef ENOSYS
+    if (socerrno == ENOSYS) return YES;
 #endif
+#ifdef EOVERFLOW
+    if (socerrno == EOVERFLOW) return YES;
+#endif
+#ifdef EOPNOTSUPP
+    if (socerrno == EOPNOTSUPP) return YES;
+#endif
+    return NO;
+}
+#endif
+
+/*	Write part of a file to the socket
+**	----------------------------------
+**	The data goes straight from the file to the socket without being
+**	copied through user space. As with HTWriter_writev, `done' is set to
+**	the number of bytes written and the caller passes what is left the
+**	next time. Returns HT_UNSUPPORTED if the platform or the file system
+**	can't do this so that the caller can read the rest of the file instead.
+*/
+PUBLIC int HTWriter_sendfile (HTOutputStream * me, int fd, long offset,
+			      long length, long * done)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H) && !defined(NOT_ASCII)
+    HTHost * host = me->host;
+    SOCKET soc = HTChannel_socket(HTHost_channel(host));
+    HTNet * net = HTHost_getWriteNet(host);
+    *done = 0;
+
+    /* If we don't have a Net object then return right away */
+    if (!net) {
+	HTTRACE(STREAM_TRACE, "Write Socket No Net object %d\n" _ soc);
+	return HT_ERROR;
+    }
+
+    while (length > 0) {
+	off_t pos = offset;
+	size_t size = length > HT_SENDFILE_MAX ? HT_SENDFILE_MAX : length;
+	int b_write = sendfile(soc, fd, &pos, size);
+	if (b_write < 0) {
+	    int status;
+	    if (sendfile_unsupported()) {
+		HTTRACE(STREAM_TRACE, "Write Socket can't send file %d (%ld bytes sent)\n" _ fd _ *done);
+		return HT_UNSUPPORTED;
+	    }
+	    if ((status = write_error(host, net)) == HT_CONTINUE) continue;
+	    HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (%ld bytes sent)\n" _ soc _ *done);
+	    return status;
+	} else if (b_write == 0) {
+	    HTTRACE(STREAM_TRACE, "Write Socket file %d is shorter than expected\n" _ fd);
+	    return HT_ERROR;
+	}
+	written(net, soc, b_write);
+	*done += b_write;
+	offset += b_write;
+	length -= b_write;
+    }
     return HT_OK;
+#else
+    *done = 0;
+    return HT_UNSUPPORTED;
+#endif
 }
 
 /*	Character handling
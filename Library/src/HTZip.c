@@ -28,13 +28,23 @@ struct _HTStream {
     HTRequest *			request;
     HTStream *			target;			/* Our output target */
     z_stream *			zstream;		      /* Zlib stream */
-    char 			outbuf [OUTBUF_SIZE]; 	    /* Inflated data */
+    BOOL			pending;     /* Deflated input not yet flushed */
+    BOOL			finished;	   /* Deflate stream is complete */
+    char 			outbuf [OUTBUF_SIZE];  /* Inflated or deflated data */
 };
 
 PRIVATE int CompressionLevel = Z_DEFAULT_COMPRESSION;
 
 /* ------------------------------------------------------------------------- */
 
+/*
+**	The inflater detects a zlib or a gzip header by itself. The deflater
+**	writes a gzip header for "gzip" and a zlib header for "deflate".
+*/
+#define ZLIB_WINDOW		15
+#define ZLIB_GZIP		16
+#define ZLIB_AUTO		32
+
 PRIVATE BOOL Zlib_init (HTStream * me, int level)
 {
     if (me && me->zstream &&
@@ -42,7 +52,7 @@ PRIVATE BOOL Zlib_init (HTStream * me, int level)
 	 (level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION))) {
 	int status;
 	HTTRACE(STREAM_TRACE, "Zlib Inflate Init stream %p with compression level %d\n" _ me _ level);
-	if ((status = inflateInit(me->zstream)) != Z_OK) {
+	if ((status = inflateInit2(me->zstream, ZLIB_WINDOW+ZLIB_AUTO)) != Z_OK) {
 	    HTTRACE(STREAM_TRACE, "Zlib........ Failed with status %d\n" _ status);
 	    return NO;
 	}
@@ -184,11 +194,168 @@ PRIVATE const HTStreamClass HTInflate =
     HTZLibInflate_write
 }; 
 
+/* ------------------------------------------------------------------------- */
+/*				DEFLATE STREAM				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE BOOL ZlibDeflate_init (HTStream * me, int level, BOOL gzip)
+{
+    int status;
+    HTTRACE(STREAM_TRACE, "Zlib Deflate Init stream %p with compression level %d\n" _ me _ level);
+    if ((status = deflateInit2(me->zstream, level, Z_DEFLATED,
+			       gzip ? ZLIB_WINDOW+ZLIB_GZIP : ZLIB_WINDOW,
+			       8, Z_DEFAULT_STRATEGY)) != Z_OK) {
+	HTTRACE(STREAM_TRACE, "Zlib........ Failed with status %d\n" _ status);
+	return NO;
+    }
+    return YES;
+}
+
+PRIVATE void ZlibDeflate_terminate (HTStream * me)
+{
+    HTTRACE(STREAM_TRACE, "Results..... Deflated outgoing data: inflated %lu, deflated %lu, factor %.2f\n" _ 
+		me->zstream->total_in _ me->zstream->total_out _ 
+		me->zstream->total_out == 0 ? 0.0 :
+		(double) me->zstream->total_in / me->zstream->total_out);
+    deflateEnd(me->zstream);
+}
+
+/*
+**	Run the deflater over the input in the zstream and pass every full
+**	output buffer on to the target. Any output left when the input is
+**	used up is passed on as well unless the mode is Z_NO_FLUSH where we
+**	wait for more input to fill the buffer. A target that would block
+**	has still taken the data so we go on until the input is used up.
+*/
+PRIVATE int ZlibDeflate_run (HTStream * me, int mode)
+{
+    me->state = HT_OK;
+    for (;;) {
+	int status = deflate(me->zstream, mode);
+	int bytes = OUTBUF_SIZE - me->zstream->avail_out;
+	BOOL full = me->zstream->avail_out == 0;
+	if (status == Z_STREAM_ERROR) {
+	    HTTRACE(STREAM_TRACE, "Zlib Deflate Deflate returned %d\n" _ status);
+	    return HT_ERROR;
+	}
+	if (bytes > 0 && (full || mode != Z_NO_FLUSH)) {
+	    int ret = (*me->target->isa->put_block)(me->target,
+						     me->outbuf, bytes);
+	    me->zstream->next_out = (unsigned char *) me->outbuf;
+	    me->zstream->avail_out = OUTBUF_SIZE;
+	    if (ret == HT_WOULD_BLOCK)
+		me->state = ret;
+	    else if (ret != HT_OK)
+		return ret;
+	}
+	if (status == Z_STREAM_END) {
+	    HTTRACE(STREAM_TRACE, "Zlib Deflate End of Stream\n");
+	    return me->state;
+	}
+	if (me->zstream->avail_in == 0 && !full)
+	    return me->state;
+    }
+}
+
+/*
+**	Finish the deflate stream and write out the rest of the data
+*/
+PRIVATE int ZlibDeflate_finish (HTStream * me)
+{
+    int status;
+    if (me->finished) return HT_OK;
+    me->zstream->next_in = NULL;
+    me->zstream->avail_in = 0;
+    status = ZlibDeflate_run(me, Z_FINISH);
+    if (status == HT_OK || status == HT_WOULD_BLOCK) me->finished = YES;
+    return status;
+}
+
+PRIVATE int HTZLibDeflate_flush (HTStream * me)
+{
+    if (me->pending && !me->finished) {
+	int status;
+	me->zstream->next_in = NULL;
+	me->zstream->avail_in = 0;
+	status = ZlibDeflate_run(me, Z_SYNC_FLUSH);
+	if (status != HT_OK && status != HT_WOULD_BLOCK) return status;
+	me->pending = NO;
+    }
+    return (*me->target->isa->flush)(me->target);
+}
+
+PRIVATE int HTZLibDeflate_free (HTStream * me)
+{
+    int status;
+    ZlibDeflate_finish(me);
+    ZlibDeflate_terminate(me);
+    if ((status = (*me->target->isa->_free)(me->target)) == HT_WOULD_BLOCK)
+	return HT_WOULD_BLOCK;
+    HTTRACE(STREAM_TRACE, "Zlib Deflate FREEING...\n");
+    HT_FREE(me->zstream);
+    HT_FREE(me);
+    return status;
+}
+
+PRIVATE int HTZLibDeflate_abort (HTStream * me, HTList * e)
+{
+    HTTRACE(STREAM_TRACE, "Zlib Deflate ABORTING...\n");
+    ZlibDeflate_terminate(me);
+    (*me->target->isa->abort)(me->target, NULL);
+    HT_FREE(me->zstream);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+/*
+**	An empty block marks the end of the entity like it does for the
+**	chunked encoder. We finish the deflate stream and pass the empty
+**	block on so that the encoders below us can end as well.
+*/
+PRIVATE int HTZLibDeflate_write (HTStream * me, const char * buf, int len)
+{
+    int status;
+    if (me->finished) return HT_LOADED;
+    if (len <= 0) {
+	status = ZlibDeflate_finish(me);
+	if (status != HT_OK && status != HT_WOULD_BLOCK) return status;
+	return (*me->target->isa->put_block)(me->target, "", 0);
+    }
+    me->zstream->next_in = (unsigned char *) buf;
+    me->zstream->avail_in = len;
+    me->pending = YES;
+    return ZlibDeflate_run(me, Z_NO_FLUSH);
+}
+
+PRIVATE int HTZLibDeflate_put_character (HTStream * me, char c)
+{
+    return HTZLibDeflate_write(me, &c, 1);
+}
+
+PRIVATE int HTZLibDeflate_put_string (HTStream * me, const char * s)
+{
+    return HTZLibDeflate_write(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass HTDeflate =
+{		
+    "ZlibDeflate",
+    HTZLibDeflate_flush,
+    HTZLibDeflate_free,
+    HTZLibDeflate_abort,
+    HTZLibDeflate_put_character,
+    HTZLibDeflate_put_string,
+    HTZLibDeflate_write
+}; 
+
+/* ------------------------------------------------------------------------- */
+
 PUBLIC BOOL HTZLib_setCompressionLevel (int level)
 {
     if (level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION) {
 	CompressionLevel = level;
 	HTTRACE(STREAM_TRACE, "Zlib........ Compression level set to %d\n" _ level);
+	return YES;
     }
     return NO;
 }
@@ -218,3 +385,28 @@ PUBLIC HTStream * HTZLib_inflate (HTRequest *	request,
     HTTRACE(STREAM_TRACE, "Zlib Inflate Stream created\n");
     return me;
 }
+
+PUBLIC HTStream * HTZLib_deflate (HTRequest *	request,
+				  void *	param,
+				  HTEncoding	coding,
+				  HTStream *	target)
+{
+    HTStream * me = NULL;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL ||
+	(me->zstream = (z_stream *) HT_CALLOC(1, sizeof(z_stream))) == NULL)
+	HT_OUTOFMEM("HTZLib_deflate");
+    me->isa = &HTDeflate;
+    me->state = HT_OK;
+    me->request = request;
+    me->target = target ? target : HTErrorStream();
+    if (ZlibDeflate_init(me, CompressionLevel,
+			 coding == WWW_CODING_GZIP) != YES) {
+	HT_FREE(me->zstream);
+	HT_FREE(me);
+	return HTErrorStream();
+    }
+    me->zstream->next_out = (unsigned char *) me->outbuf;
+    me->zstream->avail_out = OUTBUF_SIZE;
+    HTTRACE(STREAM_TRACE, "Zlib Deflate Stream created\n");
+    return me;
+}
@@ -24,6 +24,7 @@
 #include "HTUtils.h"
 #include "HTString.h"
 #include "HTChunk.h"
+#include "HTList.h"
 #include "SGML.h"
 
 #define INVALID (-1)
@@ -46,6 +47,28 @@ typedef enum _sgml_state
 	S_md, S_md_sqs, S_md_dqs, S_com_1, S_com, S_com_2, S_com_2a
     } sgml_state;
 
+/*	Lookup Tables for a DTD
+**	-----------------------
+**	A perfect hash table for the tag names and one for each distinct
+**	attribute list. Tags sharing an attribute list share the table.
+*/
+typedef struct _SGMLHash
+    {
+	unsigned long	mask;		/* Number of slots - 1 */
+	unsigned long	buckets;	/* Number of buckets - 1 */
+	unsigned short *disp;		/* Displacement for each bucket */
+	short *		slot;		/* Key number or -1 if free */
+    } SGMLHash;
+
+typedef struct _SGMLLookup
+    {
+	const SGML_dtd *dtd;
+	SGMLHash *	tags;
+	SGMLHash **	attributes;	/* One per tag */
+    } SGMLLookup;
+
+PRIVATE HTList * Lookups = NULL;	/* One lookup per DTD in use */
+
 
 /*	Internal Context Data Structure
 **	-------------------------------
@@ -54,6 +77,7 @@ struct _HTStream
     {
 	const HTStreamClass *isa;	/* inherited from HTStream */
 	const SGML_dtd *dtd;
+	SGMLLookup *lookup;		/* Hash tables for the DTD */
 	HTStructuredClass *actions;	/* target class  */
 	HTStructured *target;		/* target object */
 
@@ -71,10 +95,263 @@ struct _HTStream
 #define PUTC(ch) ((*context->actions->put_character)(context->target, ch))
 #define PUTB(b,l) ((*context->actions->put_block)(context->target, b, l))
 
+/*
+**  Test a machine word for a given byte. HAS_ZERO is non-zero if any
+**  byte in the word is zero.
+*/
+#define ONES		((unsigned long) -1 / 0xFF)
+#define HIGHS		(ONES * 0x80)
+#define HAS_ZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+#define HAS_BYTE(w,c)	HAS_ZERO((w) ^ (ONES * (unsigned char) (c)))
+
+#ifdef ISO_2022_JP
+#define TEXT_STOP(c)	((c) == '<' || (c) == '&' || (c) == '\n' || (c) == '\033')
+#else
+#define TEXT_STOP(c)	((c) == '<' || (c) == '&' || (c) == '\n')
+#endif
+
+/*	Find a Run of Text
+**	------------------
+**	Returns the number of characters of plain text at the start of the
+**	buffer, that is before the first '<', '&' or newline. The text
+**	state doesn't have to look at these one by one so we test a machine
+**	word at a time.
+*/
+PRIVATE int text_span (const char * b, int l)
+    {
+	const char * start = b;
+	while (l >= (int) sizeof(unsigned long))
+	    {
+		unsigned long w;
+		memcpy(&w, b, sizeof(unsigned long));
+		if (HAS_BYTE(w, '<') || HAS_BYTE(w, '&') || HAS_BYTE(w, '\n')
+#ifdef ISO_2022_JP
+		    || HAS_BYTE(w, '\033')
+#endif
+		    )
+			break;
+		b += sizeof(unsigned long);
+		l -= sizeof(unsigned long);
+	    }
+	while (l > 0 && !TEXT_STOP(*b))
+	    {
+		b++;
+		l--;
+	    }
+	return b - start;
+    }
+
+/*	Collect a Quoted Attribute Value
+**	--------------------------------
+**	Copies the value up to the closing quote (or the end of the buffer)
+**	in as few blocks as possible. Line breaks and NUL characters are
+**	dropped. Returns the number of characters consumed.
+*/
+PRIVATE int value_span (HTChunk * string, const char * b, int l, char quote)
+    {
+	const char * start = b;
+	const char * stop = (const char *) memchr(b, quote, l);
+	if (!stop) stop = b + l;
+	while (b < stop)
+	    {
+		const char * p = b;
+		while (p < stop && *p && *p != '\n' && *p != '\r')
+			p++;
+		if (p > b)
+			HTChunk_putb(string, b, p - b);
+		b = (p < stop) ? p + 1 : p;
+	    }
+	return stop - start;
+    }
+
+/*	Perfect Hashing of Names
+**	------------------------
+**	The keys are spread over a small number of buckets and each bucket
+**	gets a displacement which puts all of its keys in free slots, so a
+**	name is found with one hash and one string comparison. The hash is
+**	case insensitive like the comparison. If no displacement works for
+**	a bucket (only if two names are equal or have the same hash) then
+**	hash_new returns NULL and the caller falls back to binary search.
+*/
+#define HASH_TRIES		0x10000
+#define HASH_BUCKET(h,b)	((((h) * 0x9E3779B1UL) & 0xFFFFFFFFUL) >> 16 & (b))
+#define HASH_NAME(base,size,i)	(*(char * const *) ((const char *) (base) + (i) * (size)))
+
+PRIVATE unsigned long name_hash (const char * s)
+    {
+	unsigned long h = 2166136261UL;
+	for ( ; *s; s++)
+	    {
+		h ^= (unsigned char) TOLOWER(*s);
+		h = (h * 16777619UL) & 0xFFFFFFFFUL;
+	    }
+	return h;
+    }
+
+/*
+**  Mix the hash of a name with a displacement to get its slot
+*/
+PRIVATE unsigned long hash_slot (unsigned long h, unsigned long d,
+				 unsigned long mask)
+    {
+	h = (h + d * 0x9E3779B1UL) & 0xFFFFFFFFUL;
+	h ^= h >> 15;
+	h = (h * 0x2C1B3C6DUL) & 0xFFFFFFFFUL;
+	h ^= h >> 12;
+	return h & mask;
+    }
+
+/*
+**  Build a table for n names. The names are the first member of
+**  structures of the given size, as in HTTag and HTAttr.
+*/
+PRIVATE SGMLHash * hash_new (const void * base, size_t size, int n)
+    {
+	SGMLHash * me = NULL;
+	unsigned long * hashes = NULL;
+	int * order = NULL;
+	int * count = NULL;
+	unsigned long slots = 2, buckets = 1;
+	int i, j, k;
+	if (n <= 0 || n > 0x4000) return NULL;
+	while (slots < 2 * (unsigned long) n) slots <<= 1;
+	while (buckets < (unsigned long) (n+1) / 2) buckets <<= 1;
+	if ((me = (SGMLHash *) HT_CALLOC(1, sizeof(SGMLHash) +
+					  buckets * sizeof(unsigned short) +
+					  slots * sizeof(short))) == NULL ||
+	    (hashes = (unsigned long *) HT_MALLOC(n * sizeof(unsigned long))) == NULL ||
+	    (order = (int *) HT_MALLOC(buckets * sizeof(int))) == NULL ||
+	    (count = (int *) HT_CALLOC(buckets, sizeof(int))) == NULL)
+		HT_OUTOFMEM("hash_new");
+	me->mask = slots - 1;
+	me->buckets = buckets - 1;
+	me->disp = (unsigned short *) (me + 1);
+	me->slot = (short *) (me->disp + buckets);
+	for (i = 0; i < (int) slots; i++) me->slot[i] = -1;
+	for (i = 0; i < n; i++)
+	    {
+		hashes[i] = name_hash(HASH_NAME(base, size, i));
+		count[HASH_BUCKET(hashes[i], me->buckets)]++;
+	    }
+
+	/* Place the largest buckets first while there is most room */
+	for (i = 0; i < (int) buckets; i++)
+	    {
+		for (j = i; j > 0 && count[order[j-1]] < count[i]; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	    }
+	for (k = 0; k < (int) buckets && count[order[k]] > 0; k++)
+	    {
+		unsigned long b = order[k];
+		unsigned long d;
+		for (d = 0; d < HASH_TRIES; d++)
+		    {
+			for (i = 0; i < n; i++)
+			    {
+				unsigned long s;
+				if (HASH_BUCKET(hashes[i], me->buckets) != b) continue;
+				s = hash_slot(hashes[i], d, me->mask);
+				if (me->slot[s] >= 0) break;
+				me->slot[s] = i;
+			    }
+			if (i == n) break;
+
+			/* Undo what we placed from this bucket and try again */
+			for (j = 0; j < i; j++)
+				if (HASH_BUCKET(hashes[j], me->buckets) == b)
+					me->slot[hash_slot(hashes[j], d, me->mask)] = -1;
+		    }
+		if (d == HASH_TRIES)
+		    {
+			HTTRACE(SGML_TRACE, "SGML Hash... No perfect hash for %d names\n" _ n);
+			HT_FREE(me);
+			break;
+		    }
+		me->disp[b] = (unsigned short) d;
+	    }
+	HT_FREE(hashes);
+	HT_FREE(order);
+	HT_FREE(count);
+	return me;
+    }
+
+/*
+**  Returns the number of the only name which can match or -1
+*/
+PRIVATE int hash_find (SGMLHash * me, const char * s)
+    {
+	unsigned long h = name_hash(s);
+	return me->slot[hash_slot(h, me->disp[HASH_BUCKET(h, me->buckets)], me->mask)];
+    }
+
+PRIVATE SGMLHash * attributes_hash (SGMLLookup * me, int i)
+    {
+	const HTTag * tags = me->dtd->tags;
+	int j;
+	for (j = 0; j < i; j++)
+		if (tags[j].attributes == tags[i].attributes &&
+		    tags[j].number_of_attributes == tags[i].number_of_attributes)
+			return me->attributes[j];
+	return NULL;
+    }
+
+PRIVATE SGMLLookup * lookup_new (const SGML_dtd * dtd)
+    {
+	SGMLLookup * me;
+	int i;
+	if ((me = (SGMLLookup *) HT_CALLOC(1, sizeof(SGMLLookup))) == NULL ||
+	    (me->attributes = (SGMLHash **)
+	     HT_CALLOC(dtd->number_of_tags > 0 ? dtd->number_of_tags : 1,
+		       sizeof(SGMLHash *))) == NULL)
+		HT_OUTOFMEM("lookup_new");
+	me->dtd = dtd;
+	me->tags = hash_new(dtd->tags, sizeof(HTTag), dtd->number_of_tags);
+	for (i = 0; i < dtd->number_of_tags; i++)
+	    {
+		HTTag * tag = &dtd->tags[i];
+		if ((me->attributes[i] = attributes_hash(me, i)) == NULL)
+			me->attributes[i] = hash_new(tag->attributes, sizeof(HTAttr),
+						     tag->number_of_attributes);
+	    }
+	HTTRACE(SGML_TRACE, "SGML Hash... Built lookup tables for DTD %p\n" _ dtd);
+	return me;
+    }
+
+PRIVATE void lookup_delete (SGMLLookup * me)
+    {
+	int i;
+
+	/* Backwards so that the tables we compare with are still there */
+	for (i = me->dtd->number_of_tags-1; i >= 0; i--)
+		if (me->attributes[i] && me->attributes[i] != attributes_hash(me, i))
+			HT_FREE(me->attributes[i]);
+	HT_FREE(me->attributes);
+	HT_FREE(me->tags);
+	HT_FREE(me);
+    }
+
+/*
+**  Find the lookup tables for a DTD and build them the first time the
+**  DTD is used.
+*/
+PRIVATE SGMLLookup * SGMLLookup_find (const SGML_dtd * dtd)
+    {
+	HTList * cur = Lookups;
+	SGMLLookup * pres;
+	if (!dtd) return NULL;
+	while ((pres = (SGMLLookup *) HTList_nextObject(cur)))
+		if (pres->dtd == dtd) return pres;
+	if (!Lookups) Lookups = HTList_new();
+	pres = lookup_new(dtd);
+	HTList_addObject(Lookups, pres);
+	return pres;
+    }
+
 /*	Find Attribute Number
 **	---------------------
 */
-PRIVATE int SGMLFindAttribute  (HTTag* tag, const char * s)
+PRIVATE int SGMLFindAttribute  (HTStream * context, HTTag* tag, const char * s)
     {
 	HTAttr* attributes = tag->attributes;
 
@@ -82,6 +359,16 @@ PRIVATE int SGMLFindAttribute  (HTTag* tag, const char * s)
 
 	assert(tag->number_of_attributes <= MAX_ATTRIBUTES);
 
+	if (context->lookup)
+	    {
+		SGMLHash * hash = context->lookup->attributes[tag - context->dtd->tags];
+		if (hash)
+		    {
+			i = hash_find(hash, s);
+			return (i >= 0 && !strcasecomp(attributes[i].name, s)) ? i : -1;
+		    }
+	    }
+
 	for(low=0, high=tag->number_of_attributes;
 	    high > low ;
 	    diff < 0 ? (low = i+1) : (high = i) )
@@ -107,7 +394,7 @@ PRIVATE void handle_attribute_name (HTStream * context, const char * s)
 	/* Note: if tag==NULL, we are skipping unknown tag... */
 	if (tag)
 	    {
-		int i = SGMLFindAttribute(tag, s);
+		int i = SGMLFindAttribute(context, tag, s);
 		if (i >= 0)
 		    {
 			context->current_attribute_number = i;
@@ -225,9 +512,16 @@ PRIVATE void start_element (HTStream * context)
 **		NULL		tag not found
 **		else		address of tag structure in dtd
 */
-PRIVATE HTTag * SGMLFindTag (const SGML_dtd* dtd, const char * string)
+PRIVATE HTTag * SGMLFindTag (const SGML_dtd* dtd, SGMLLookup * lookup,
+			     const char * string)
     {
 	int high, low, i, diff;
+	if (lookup && lookup->tags)
+	    {
+		i = hash_find(lookup->tags, string);
+		return (i >= 0 && !strcasecomp(dtd->tags[i].name, string)) ?
+			&dtd->tags[i] : NULL;
+	    }
 	for(low=0, high=dtd->number_of_tags;
 	    high > low ;
 	    diff < 0 ? (low = i+1) : (high = i))
@@ -348,7 +642,13 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 			    	/* Newline - ignore if before end tag! */
 				context->state = S_nl;
 			else
-				++count;
+			    {
+				/* Take the rest of the run in one go */
+				int span = text_span(b, l);
+				count += span + 1;
+				b += span;
+				l -= span;
+			    }
 			break;
 
 		    case S_nl:
@@ -525,7 +825,7 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				break;
 			    }
 			    HTChunk_terminate(string);
-			    context->current_tag  = SGMLFindTag(dtd, HTChunk_data(string));
+			    context->current_tag  = SGMLFindTag(dtd, context->lookup, HTChunk_data(string));
 			    if (context->current_tag == NULL) {
 				HTTRACE(SGML_TRACE, "*** Unknown element %s\n" _ HTChunk_data(string));
 				(*context->actions->unparsed_begin_element)
@@ -631,8 +931,15 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				context->token = HTChunk_size(string);
 				context->state = S_tag_gap;
 			    }
-			else if (c && c != '\n' && c != '\r')
-				HTChunk_putc(string, c);
+			else
+			    {
+				int span;
+				if (c && c != '\n' && c != '\r')
+					HTChunk_putc(string, c);
+				span = value_span(string, b, l, '\'');
+				b += span;
+				l -= span;
+			    }
 			break;
 	
 		    case S_dquoted:	/* Quoted attribute value */
@@ -643,8 +950,15 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				context->token = HTChunk_size(string);
 				context->state = S_tag_gap;
 			    }
-			else if (c && c != '\n' && c != '\r')
-				HTChunk_putc(string, c);
+			else
+			    {
+				int span;
+				if (c && c != '\n' && c != '\r')
+					HTChunk_putc(string, c);
+				span = value_span(string, b, l, '"');
+				b += span;
+				l -= span;
+			    }
 			break;
 
 		    case S_end:	/* </ */
@@ -656,7 +970,7 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				char * first;
 				HTChunk_terminate(string);
 				if ((first=HTChunk_data(string))!=NULL && *first != '\0')
-				        t = SGMLFindTag(dtd, HTChunk_data(string));
+				        t = SGMLFindTag(dtd, context->lookup, HTChunk_data(string));
 				else
 				    	/* Empty end tag */
 					/* Original code popped here one
@@ -751,6 +1065,14 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 		    case S_com: /* ..within comment */
 			if (c == '-')
 				context->state = S_com_2;
+			else
+			    {
+				/* Skip to the next '-' */
+				const char * dash = (const char *) memchr(b, '-', l);
+				int span = dash ? dash - b : l;
+				b += span;
+				l -= span;
+			    }
 			break;
 
 		    case S_com_2: /* Ending a comment ? */
@@ -821,6 +1143,7 @@ PUBLIC HTStream *SGML_new(const SGML_dtd * dtd, HTStructured * target)
     context->isa = &SGMLParser;
     context->string = HTChunk_new(128);	/* Grow by this much */
     context->dtd = dtd;
+    context->lookup = SGMLLookup_find(dtd);
     context->target = target;
     context->actions = (HTStructuredClass*)(((HTStream*)target)->isa);
     /* Ugh: no OO */
@@ -830,6 +1153,20 @@ PUBLIC HTStream *SGML_new(const SGML_dtd * dtd, HTStructured * target)
     return context;
 }
 
+PUBLIC BOOL SGML_deleteAll (void)
+{
+    if (Lookups) {
+	HTList * cur = Lookups;
+	SGMLLookup * pres;
+	while ((pres = (SGMLLookup *) HTList_nextObject(cur)))
+	    lookup_delete(pres);
+	HTList_delete(Lookups);
+	Lookups = NULL;
+	return YES;
+    }
+    return NO;
+}
+
 PUBLIC HTTag * SGML_findTag (SGML_dtd * dtd, int element_number)
 {
     return (dtd && element_number>=0 && element_number<dtd->number_of_tags) ?
@@ -853,6 +1190,11 @@ PUBLIC int SGML_findElementNumber (SGML_dtd * dtd, char * name_element)
     if (dtd && name_element) {
 	int i;
 	HTTag *ct;
+	SGMLLookup * lookup = SGMLLookup_find(dtd);
+	if (lookup && lookup->tags) {
+	    i = hash_find(lookup->tags, name_element);
+	    return (i >= 0 && !strcasecomp(dtd->tags[i].name, name_element)) ? i : -1;
+	}
 	for (i = 0; i< dtd->number_of_tags; i++) {
 	    ct = &(dtd->tags[i]);
 	    if (!strcasecomp(ct->name,name_element))
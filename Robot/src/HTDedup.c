@@ -0,0 +1,288 @@
+/*
+**	@(#) $Id$
+**
+**	W3C Webbot can be found at "http://www.w3.org/Robot/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	The words of the text are hashed as they come and the last four are
+**	kept so that each new word makes a shingle. Every shingle hash adds
+**	one to the counter of each of its 64 bits that is set and takes one
+**	away from the others. The SimHash has the bits whose counter ends up
+**	above zero.
+**
+**	The set keeps the fingerprints in an array and has four tables, one
+**	for each 16 bit quarter of the SimHash, with a chain through the array
+**	for each value. A document with too little text goes in the tables
+**	with its exact hash instead so that these don't all end up in the
+**	same chain.
+*/
+
+#include "HTDedup.h"
+
+#define SHINGLE_WORDS	4			/* Words in each shingle */
+#define MIN_SHINGLES	8	    /* Fewer than this only for exact copies */
+#define DEDUP_SIZE	1024
+#define DEDUP_BLOCKS	4
+#define DEDUP_BUCKETS	0x10000
+
+struct _HTFingerprint {
+    unsigned int	hash;			   /* Exact hash of all bytes */
+    unsigned int	check;
+    unsigned int	word;			     /* Word being read */
+    int			wordlen;
+    unsigned int	words[SHINGLE_WORDS];	     /* The last words read */
+    long		nwords;
+    BOOL		tag;			       /* Inside markup */
+    int			counts[64];
+};
+
+typedef struct _DedupPrint {
+    unsigned int	hash;
+    unsigned int	check;
+    unsigned int	key[2];		   /* SimHash or else the exact hash */
+    BOOL		near;		/* Enough text to compare the SimHash */
+    int			next[DEDUP_BLOCKS];	   /* Chains, index + 1 */
+} DedupPrint;
+
+struct _HTDedup {
+    int			distance;
+    DedupPrint *	prints;
+    int			count;
+    int			size;
+    int *		heads[DEDUP_BLOCKS];	     /* Index + 1 or 0 */
+};
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE unsigned int dedup_mix (unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+PRIVATE int dedup_bits (unsigned int x)
+{
+    int bits = 0;
+    while (x) {
+	x &= x - 1;
+	bits++;
+    }
+    return bits;
+}
+
+/*
+**	The shingle is the last SHINGLE_WORDS words, oldest first, hashed
+**	twice with different mixes for the two halves of the 64 bits
+*/
+PRIVATE void add_shingle (HTFingerprint * me, int words)
+{
+    unsigned int lo = 0x9e3779b9U;
+    unsigned int hi = 0x7f4a7c15U;
+    int i;
+    for (i = 0; i < words; i++) {
+	unsigned int w = me->words[(me->nwords - words + i) % SHINGLE_WORDS];
+	lo = dedup_mix(lo ^ w);
+	hi = dedup_mix(hi ^ (w * 0x9e3779b1U));
+    }
+    for (i = 0; i < 32; i++) {
+	me->counts[i] += (lo >> i) & 1 ? 1 : -1;
+	me->counts[32+i] += (hi >> i) & 1 ? 1 : -1;
+    }
+}
+
+PRIVATE void end_word (HTFingerprint * me)
+{
+    if (me->wordlen) {
+	me->words[me->nwords++ % SHINGLE_WORDS] = dedup_mix(me->word);
+	if (me->nwords >= SHINGLE_WORDS) add_shingle(me, SHINGLE_WORDS);
+	me->word = 2166136261U;
+	me->wordlen = 0;
+    }
+}
+
+PUBLIC HTFingerprint * HTFingerprint_new (void)
+{
+    HTFingerprint * me;
+    if ((me = (HTFingerprint *) HT_CALLOC(1, sizeof(HTFingerprint))) == NULL)
+	HT_OUTOFMEM("HTFingerprint_new");
+    me->hash = 2166136261U;
+    me->check = 5381;
+    me->word = 2166136261U;
+    return me;
+}
+
+PUBLIC BOOL HTFingerprint_delete (HTFingerprint * me)
+{
+    if (me) {
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	Words are runs of letters and digits, not counting case. Bytes above
+**	127 count as letters so that words in other character sets are words
+**	too. Markup ends a word and isn't part of the text.
+*/
+PUBLIC void HTFingerprint_put (HTFingerprint * me, const char * buf, int len)
+{
+    if (me && buf) {
+	const unsigned char * ptr = (const unsigned char *) buf;
+	const unsigned char * end = ptr + len;
+	for (; ptr < end; ptr++) {
+	    unsigned char c = *ptr;
+	    me->hash = (me->hash ^ c) * 16777619U;
+	    me->check = me->check * 33 + c;
+	    if (me->tag) {
+		if (c == '>') me->tag = NO;
+	    } else if (c == '<') {
+		end_word(me);
+		me->tag = YES;
+	    } else if (c >= 0x80 || isalnum((int) c)) {
+		me->word = (me->word ^ (unsigned char) tolower((int) c)) * 16777619U;
+		me->wordlen++;
+	    } else
+		end_word(me);
+	}
+    }
+}
+
+/*
+**	Finish the last word and turn the counters into the SimHash. A text
+**	shorter than a shingle makes a single shingle of what there is.
+*/
+PRIVATE void fingerprint_done (HTFingerprint * me, DedupPrint * print)
+{
+    int i;
+    end_word(me);
+    if (me->nwords > 0 && me->nwords < SHINGLE_WORDS)
+	add_shingle(me, (int) me->nwords);
+    print->hash = me->hash;
+    print->check = me->check;
+    print->near = (me->nwords - SHINGLE_WORDS + 1 >= MIN_SHINGLES);
+    if (print->near) {
+	print->key[0] = print->key[1] = 0;
+	for (i = 0; i < 32; i++) {
+	    if (me->counts[i] > 0) print->key[0] |= 1U << i;
+	    if (me->counts[32+i] > 0) print->key[1] |= 1U << i;
+	}
+    } else {
+	print->key[0] = me->hash;
+	print->key[1] = me->check;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE unsigned int dedup_block (unsigned int * key, int block)
+{
+    return (key[block / 2] >> (block % 2 ? 16 : 0)) & 0xFFFF;
+}
+
+PUBLIC HTDedup * HTDedup_new (int distance)
+{
+    HTDedup * me;
+    if ((me = (HTDedup *) HT_CALLOC(1, sizeof(HTDedup))) == NULL)
+	HT_OUTOFMEM("HTDedup_new");
+    me->distance = HTMIN(HTMAX(distance, 0), HT_DEDUP_MAX_DISTANCE);
+    return me;
+}
+
+PUBLIC BOOL HTDedup_delete (HTDedup * me)
+{
+    if (me) {
+	int block;
+	for (block = 0; block < DEDUP_BLOCKS; block++)
+	    HT_FREE(me->heads[block]);
+	HT_FREE(me->prints);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	An exact copy has the same key so it is in the chain of the first
+**	quarter. A near duplicate differs in at most three bits so one of the
+**	four quarters is the same and we look in all of the chains.
+*/
+PRIVATE HTDedupMatch dedup_find (HTDedup * me, DedupPrint * print)
+{
+    int blocks = print->near ? DEDUP_BLOCKS : 1;
+    int block;
+    if (!me->count) return HT_DEDUP_NEW;
+    for (block = 0; block < blocks; block++) {
+	int pos = me->heads[block][dedup_block(print->key, block)];
+	while (pos) {
+	    DedupPrint * pres = me->prints + pos - 1;
+	    if (pres->hash == print->hash && pres->check == print->check)
+		return HT_DEDUP_SAME;
+	    if (print->near && pres->near &&
+		dedup_bits(pres->key[0] ^ print->key[0]) +
+		dedup_bits(pres->key[1] ^ print->key[1]) <= me->distance)
+		return HT_DEDUP_NEAR;
+	    pos = pres->next[block];
+	}
+    }
+    return HT_DEDUP_NEW;
+}
+
+PUBLIC HTDedupMatch HTDedup_add (HTDedup * me, HTFingerprint * fingerprint)
+{
+    if (me && fingerprint) {
+	DedupPrint print;
+	HTDedupMatch match;
+	int block;
+	memset(&print, 0, sizeof(DedupPrint));
+	fingerprint_done(fingerprint, &print);
+	if ((match = dedup_find(me, &print)) != HT_DEDUP_NEW) return match;
+
+	/* A new document goes in the array and at the front of its chains */
+	if (me->count >= me->size) {
+	    me->size = me->size ? me->size * 2 : DEDUP_SIZE;
+	    if ((me->prints = (DedupPrint *) HT_REALLOC(me->prints,
+				me->size * sizeof(DedupPrint))) == NULL)
+		HT_OUTOFMEM("HTDedup_add");
+	}
+	for (block = 0; block < DEDUP_BLOCKS; block++) {
+	    unsigned int bucket = dedup_block(print.key, block);
+	    if (!me->heads[block] &&
+		(me->heads[block] = (int *) HT_CALLOC(DEDUP_BUCKETS, sizeof(int))) == NULL)
+		HT_OUTOFMEM("HTDedup_add");
+	    print.next[block] = me->heads[block][bucket];
+	    me->heads[block][bucket] = me->count + 1;
+	}
+	me->prints[me->count++] = print;
+	return HT_DEDUP_NEW;
+    }
+    return HT_DEDUP_NEW;
+}
+
+PUBLIC long HTDedup_count (HTDedup * me)
+{
+    return me ? me->count : 0;
+}
+
+PUBLIC long HTDedup_bytes (HTDedup * me)
+{
+    if (me) {
+	long bytes = sizeof(HTDedup) + (long) me->size * sizeof(DedupPrint);
+	if (me->heads[0]) bytes += DEDUP_BLOCKS * DEDUP_BUCKETS * sizeof(int);
+	return bytes;
+    }
+    return 0;
+}
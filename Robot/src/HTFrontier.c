@@ -0,0 +1,339 @@
+/*
+**	@(#) $Id$
+**
+**	W3C Webbot can be found at "http://www.w3.org/Robot/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	The frontier keeps a queue of documents for each host and a heap of
+**	the hosts that can be given a request, ordered by the time when they
+**	are next allowed one. A host is in the heap when it has something
+**	queued and has fewer requests in flight than the per host limit,
+**	unless it is held.
+*/
+
+#include "HTFrontier.h"
+#include "HTHash.h"
+
+#define FRONTIER_HASH_SIZE	1021
+#define HEAP_SIZE		64
+
+struct _HTFrontierHost {
+    char *		name;
+    HTDeque *		queue;
+    ms_t		ready;		    /* Next time we can send a request */
+    ms_t		delay;			/* Time between requests */
+    int			inflight;
+    int			index;			  /* Place in heap or -1 */
+    BOOL		held;
+    void *		context;
+};
+
+struct _HTFrontier {
+    HTFrontierCallback *	cbf;
+    void *			context;
+    HTHashtable *		hosts;
+    HTFrontierHost **		heap;		     /* Hosts that are ready */
+    int				heap_count;
+    int				heap_size;
+    int				max_inflight;
+    int				host_inflight;
+    ms_t			delay;
+    int				inflight;
+    int				count;			  /* Objects queued */
+    BOOL			dispatching;
+};
+
+/* ------------------------------------------------------------------------- */
+/*				   HOST HEAP				     */
+/* ------------------------------------------------------------------------- */
+
+#define HOST_BEFORE(a,b)	((a)->ready < (b)->ready)
+
+PRIVATE void heap_place (HTFrontier * me, HTFrontierHost * host, int i)
+{
+    me->heap[i] = host;
+    host->index = i;
+}
+
+PRIVATE void heap_up (HTFrontier * me, int i)
+{
+    HTFrontierHost * host = me->heap[i];
+    while (i > 0) {
+	int parent = (i - 1) / 2;
+	if (!HOST_BEFORE(host, me->heap[parent])) break;
+	heap_place(me, me->heap[parent], i);
+	i = parent;
+    }
+    heap_place(me, host, i);
+}
+
+PRIVATE void heap_down (HTFrontier * me, int i)
+{
+    HTFrontierHost * host = me->heap[i];
+    for (;;) {
+	int child = 2 * i + 1;
+	if (child >= me->heap_count) break;
+	if (child + 1 < me->heap_count &&
+	    HOST_BEFORE(me->heap[child + 1], me->heap[child]))
+	    child++;
+	if (!HOST_BEFORE(me->heap[child], host)) break;
+	heap_place(me, me->heap[child], i);
+	i = child;
+    }
+    heap_place(me, host, i);
+}
+
+PRIVATE void heap_add (HTFrontier * me, HTFrontierHost * host)
+{
+    if (host->index >= 0) return;
+    if (me->heap_count >= me->heap_size) {
+	me->heap_size = me->heap_size ? me->heap_size * 2 : HEAP_SIZE;
+	if ((me->heap = (HTFrontierHost **)
+	     HT_REALLOC(me->heap, me->heap_size * sizeof(HTFrontierHost *))) == NULL)
+	    HT_OUTOFMEM("heap_add");
+    }
+    me->heap[me->heap_count] = host;
+    heap_up(me, me->heap_count++);
+}
+
+PRIVATE void heap_remove (HTFrontier * me, HTFrontierHost * host)
+{
+    int i = host->index;
+    if (i < 0) return;
+    host->index = -1;
+    if (i < --me->heap_count) {
+	HTFrontierHost * last = me->heap[me->heap_count];
+	heap_place(me, last, i);
+	heap_down(me, i);
+	heap_up(me, last->index);
+    }
+}
+
+/*
+**  Put the host in the heap or take it out depending on whether it can
+**  be given another request.
+*/
+PRIVATE void host_update (HTFrontier * me, HTFrontierHost * host)
+{
+    if (!host->held && !HTDeque_isEmpty(host->queue) &&
+	host->inflight < me->host_inflight) {
+	if (host->index < 0)
+	    heap_add(me, host);
+	else {
+	    heap_down(me, host->index);
+	    heap_up(me, host->index);
+	}
+    } else
+	heap_remove(me, host);
+}
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTFrontier * HTFrontier_new (HTFrontierCallback * cbf, void * context,
+				    int max_inflight, int host_inflight,
+				    ms_t delay)
+{
+    HTFrontier * me;
+    if ((me = (HTFrontier *) HT_CALLOC(1, sizeof(HTFrontier))) == NULL)
+	HT_OUTOFMEM("HTFrontier_new");
+    me->cbf = cbf;
+    me->context = context;
+    me->hosts = HTHashtable_new(FRONTIER_HASH_SIZE);
+    me->max_inflight = max_inflight > 0 ? max_inflight : 1;
+    me->host_inflight = host_inflight > 0 ? host_inflight : 1;
+    me->delay = delay;
+    return me;
+}
+
+PRIVATE int host_delete (HTHashtable * table, char * key, void * object)
+{
+    HTFrontierHost * host = (HTFrontierHost *) object;
+    HTDeque_delete(host->queue);
+    HT_FREE(host->name);
+    HT_FREE(host);
+    return 1;
+}
+
+PUBLIC BOOL HTFrontier_delete (HTFrontier * me)
+{
+    if (me) {
+	HTHashtable_walk(me->hosts, host_delete);
+	HTHashtable_delete(me->hosts);
+	HT_FREE(me->heap);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC HTFrontierHost * HTFrontier_host (HTFrontier * me, const char * name)
+{
+    HTFrontierHost * host = NULL;
+    if (me) {
+	if (!name) name = "";
+	if ((host = (HTFrontierHost *) HTHashtable_object(me->hosts, name)) == NULL) {
+	    if ((host = (HTFrontierHost *) HT_CALLOC(1, sizeof(HTFrontierHost))) == NULL)
+		HT_OUTOFMEM("HTFrontier_host");
+	    StrAllocCopy(host->name, name);
+	    host->queue = HTDeque_new();
+	    host->delay = me->delay;
+	    host->index = -1;
+	    HTHashtable_addObject(me->hosts, name, host);
+	}
+    }
+    return host;
+}
+
+PUBLIC const char * HTFrontierHost_name (HTFrontierHost * host)
+{
+    return host ? host->name : NULL;
+}
+
+PUBLIC BOOL HTFrontierHost_setDelay (HTFrontierHost * host, ms_t delay)
+{
+    if (host) {
+	host->delay = delay;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC void * HTFrontierHost_context (HTFrontierHost * host)
+{
+    return host ? host->context : NULL;
+}
+
+PUBLIC BOOL HTFrontierHost_setContext (HTFrontierHost * host, void * context)
+{
+    if (host) {
+	host->context = context;
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  A held host keeps its queue but isn't given any requests
+*/
+PUBLIC BOOL HTFrontier_hold (HTFrontier * me, HTFrontierHost * host, BOOL hold)
+{
+    if (me && host) {
+	host->held = hold;
+	host_update(me, host);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTFrontier_add (HTFrontier * me, HTFrontierHost * host,
+			    void * object, BOOL first)
+{
+    if (me && host && object) {
+	if (first)
+	    HTDeque_prepend(host->queue, object);
+	else
+	    HTDeque_append(host->queue, object);
+	me->count++;
+	if (host->index < 0) host_update(me, host);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  Hand out requests to the hosts at the top of the heap as long as they
+**  are ready and we haven't got too many requests in flight.
+*/
+PUBLIC long HTFrontier_dispatch (HTFrontier * me)
+{
+    long wait = -1;
+    if (!me || me->dispatching) return -1;
+    me->dispatching = YES;
+    while (me->heap_count > 0) {
+	HTFrontierHost * host = me->heap[0];
+	ms_t now = HTGetTimeInMillis();
+	ms_t ready = host->ready;
+	void * object;
+	if (host->ready > now) {
+	    wait = (long) (host->ready - now);
+	    break;
+	}
+	if (me->inflight >= me->max_inflight) {
+	    wait = 0;
+	    break;
+	}
+	object = HTDeque_removeFirst(host->queue);
+	me->count--;
+	me->inflight++;
+	host->inflight++;
+	host->ready = now + host->delay;
+	host_update(me, host);
+	if (!(*me->cbf)(me, host, object, me->context)) {
+	    me->inflight--;
+	    host->inflight--;
+	    host->ready = ready;
+	    host_update(me, host);
+	}
+    }
+    if (me->heap_count == 0 && me->count > 0) wait = 0;
+    me->dispatching = NO;
+    return wait;
+}
+
+PUBLIC BOOL HTFrontier_start (HTFrontier * me, HTFrontierHost * host)
+{
+    if (me && host) {
+	me->inflight++;
+	host->inflight++;
+	host->ready = HTGetTimeInMillis() + host->delay;
+	host_update(me, host);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  A request is done. The next one to this host can go when the delay
+**  has passed counting from now.
+*/
+PUBLIC BOOL HTFrontier_done (HTFrontier * me, HTFrontierHost * host)
+{
+    if (me && host && host->inflight > 0) {
+	ms_t ready = HTGetTimeInMillis() + host->delay;
+	host->inflight--;
+	me->inflight--;
+	if (host->ready < ready) host->ready = ready;
+	host_update(me, host);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTFrontier_isEmpty (HTFrontier * me)
+{
+    return me ? (me->count == 0 && !me->dispatching) : YES;
+}
+
+PUBLIC int HTFrontier_count (HTFrontier * me)
+{
+    return me ? me->count : 0;
+}
+
+PUBLIC int HTFrontier_inflight (HTFrontier * me)
+{
+    return me ? me->inflight : 0;
+}
+
+PUBLIC int HTFrontier_hosts (HTFrontier * me)
+{
+    return me ? HTHashtable_count(me->hosts) : 0;
+}
@@ -0,0 +1,272 @@
+/*
+**	@(#) $Id$
+**
+**	W3C Webbot can be found at "http://www.w3.org/Robot/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	A journal starts with a magic string. Each record is the type byte,
+**	the length of the fields and then the fields. Numbers are in base 128
+**	with the low digits first and the top bit set on all but the last
+**	byte. Negative numbers are folded into the positive ones so that small
+**	ones of either sign stay small. Knowing the length up front means that
+**	a record cut short by a crash is found before it is handed out.
+*/
+
+#include "HTJournal.h"
+
+#define JOURNAL_MAGIC		"W3CJNL1\n"
+#define JOURNAL_MAGIC_LEN	8
+#define JOURNAL_MAX_RECORD	0x100000L    /* Anything bigger is damage */
+
+struct _HTJournal {
+    FILE *		fp;
+    HTChunk *		record;			   /* Fields being written */
+    long		size;
+};
+
+struct _HTJournalRecord {
+    char *		data;
+    long		length;
+    long		pos;
+};
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE int encode_number (char * buf, unsigned long n)
+{
+    int len = 0;
+    while (n >= 0x80) {
+	buf[len++] = (char) ((n & 0x7F) | 0x80);
+	n >>= 7;
+    }
+    buf[len++] = (char) n;
+    return len;
+}
+
+PRIVATE void put_number (HTChunk * chunk, unsigned long n)
+{
+    char buf[16];
+    HTChunk_putb(chunk, buf, encode_number(buf, n));
+}
+
+PRIVATE BOOL get_number (HTJournalRecord * record, unsigned long * n)
+{
+    unsigned long value = 0;
+    int shift = 0;
+    while (record->pos < record->length) {
+	unsigned char c = (unsigned char) record->data[record->pos++];
+	if (shift < (int) sizeof(unsigned long) * 8)
+	    value |= (unsigned long) (c & 0x7F) << shift;
+	shift += 7;
+	if (!(c & 0x80)) {
+	    *n = value;
+	    return YES;
+	}
+    }
+    return NO;
+}
+
+PRIVATE BOOL read_number (FILE * fp, unsigned long * n)
+{
+    unsigned long value = 0;
+    int shift = 0;
+    int c;
+    while ((c = getc(fp)) != EOF) {
+	if (shift < (int) sizeof(unsigned long) * 8)
+	    value |= (unsigned long) (c & 0x7F) << shift;
+	shift += 7;
+	if (!(c & 0x80)) {
+	    *n = value;
+	    return YES;
+	}
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				    WRITING				     */
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTJournal * HTJournal_open (const char * filename, BOOL append)
+{
+    HTJournal * me;
+    FILE * fp;
+    if (!filename || (fp = fopen(filename, append ? "ab" : "wb")) == NULL) {
+	HTTRACE(APP_TRACE, "Journal..... Can't open `%s\'\n" _ filename);
+	return NULL;
+    }
+    if ((me = (HTJournal *) HT_CALLOC(1, sizeof(HTJournal))) == NULL)
+	HT_OUTOFMEM("HTJournal_open");
+    me->fp = fp;
+    me->record = HTChunk_new(256);
+    fseek(fp, 0L, SEEK_END);
+    if ((me->size = ftell(fp)) <= 0) {
+	fwrite(JOURNAL_MAGIC, 1, JOURNAL_MAGIC_LEN, fp);
+	me->size = JOURNAL_MAGIC_LEN;
+    }
+    HTTRACE(APP_TRACE, "Journal..... Writing `%s\', %ld bytes so far\n" _
+	    filename _ me->size);
+    return me;
+}
+
+PUBLIC BOOL HTJournal_flush (HTJournal * me)
+{
+    return (me && fflush(me->fp) == 0);
+}
+
+PUBLIC BOOL HTJournal_close (HTJournal * me)
+{
+    if (me) {
+	BOOL status = (fclose(me->fp) == 0);
+	HTChunk_delete(me->record);
+	HT_FREE(me);
+	return status;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTJournal_add (HTJournal * me, int type, const char * fields, ...)
+{
+    if (me && fields) {
+	HTChunk * chunk = me->record;
+	char head[16];
+	int len;
+	va_list pArgs;
+	va_start(pArgs, fields);
+	HTChunk_truncate(chunk, 0);
+	for (; *fields; fields++) {
+	    switch (*fields) {
+	    case 'n':
+		put_number(chunk, va_arg(pArgs, unsigned long));
+		break;
+	    case 'i':
+		{
+		    long value = va_arg(pArgs, long);
+		    put_number(chunk, value < 0 ? ((unsigned long) ~value << 1) | 1 :
+			       (unsigned long) value << 1);
+		}
+		break;
+	    case 's':
+		{
+		    const char * str = va_arg(pArgs, const char *);
+		    if (str) HTChunk_puts(chunk, str);
+		    HTChunk_putb(chunk, "", 1);
+		}
+		break;
+	    default:
+		HTTRACE(APP_TRACE, "Journal..... Bad field `%c\'\n" _ *fields);
+		va_end(pArgs);
+		return NO;
+	    }
+	}
+	va_end(pArgs);
+
+	*head = (char) type;
+	len = 1 + encode_number(head + 1, (unsigned long) HTChunk_size(chunk));
+	if (fwrite(head, 1, len, me->fp) != (size_t) len ||
+	    fwrite(HTChunk_data(chunk), 1, HTChunk_size(chunk), me->fp) != (size_t) HTChunk_size(chunk))
+	    return NO;
+	me->size += len + HTChunk_size(chunk);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC long HTJournal_size (HTJournal * me)
+{
+    return me ? me->size : 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				    READING				     */
+/* ------------------------------------------------------------------------- */
+
+PUBLIC long HTJournal_read (const char * filename, HTJournalCallback * cbf,
+			    void * context)
+{
+    FILE * fp;
+    char magic[JOURNAL_MAGIC_LEN];
+    long count = 0;
+    if (!filename || !cbf || (fp = fopen(filename, "rb")) == NULL) return -1;
+    if (fread(magic, 1, JOURNAL_MAGIC_LEN, fp) != JOURNAL_MAGIC_LEN ||
+	memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN)) {
+	HTTRACE(APP_TRACE, "Journal..... `%s\' is not a journal\n" _ filename);
+	fclose(fp);
+	return -1;
+    } else {
+	HTJournalRecord record;
+	long allocated = 0;
+	int type;
+	memset(&record, 0, sizeof(HTJournalRecord));
+	while ((type = getc(fp)) != EOF) {
+	    unsigned long length;
+	    if (!read_number(fp, &length) || length > JOURNAL_MAX_RECORD) break;
+	    if ((long) length > allocated) {
+		allocated = (long) length;
+		if ((record.data = (char *) HT_REALLOC(record.data, allocated)) == NULL)
+		    HT_OUTOFMEM("HTJournal_read");
+	    }
+	    if (fread(record.data, 1, length, fp) != length) break;
+	    record.length = (long) length;
+	    record.pos = 0;
+	    count++;
+	    if (!(*cbf)(type, &record, context)) break;
+	}
+	if (!feof(fp))
+	    HTTRACE(APP_TRACE, "Journal..... Stopped after %ld records\n" _ count);
+	HT_FREE(record.data);
+    }
+    fclose(fp);
+    return count;
+}
+
+PUBLIC BOOL HTJournal_get (HTJournalRecord * record, const char * fields, ...)
+{
+    BOOL status = YES;
+    if (record && fields) {
+	va_list pArgs;
+	va_start(pArgs, fields);
+	for (; *fields && status; fields++) {
+	    unsigned long value = 0;
+	    switch (*fields) {
+	    case 'n':
+		status = get_number(record, &value);
+		*va_arg(pArgs, unsigned long *) = value;
+		break;
+	    case 'i':
+		status = get_number(record, &value);
+		*va_arg(pArgs, long *) = (value & 1) ? (long) ~(value >> 1) :
+		    (long) (value >> 1);
+		break;
+	    case 's':
+		{
+		    char * str = record->data + record->pos;
+		    char * end = memchr(str, '\0', record->length - record->pos);
+		    if (end) {
+			*va_arg(pArgs, char **) = *str ? str : NULL;
+			record->pos += end - str + 1;
+		    } else {
+			*va_arg(pArgs, char **) = NULL;
+			status = NO;
+		    }
+		}
+		break;
+	    default:
+		status = NO;
+		break;
+	    }
+	}
+	va_end(pArgs);
+	return status;
+    }
+    return NO;
+}
@@ -22,42 +22,42 @@
 
 #include "HTQueue.h"
 
-HTList * HTQueue_new(void)
+HTDeque * HTQueue_new(void)
 {
-  return HTList_new();
+  return HTDeque_new();
 }
 
-BOOL HTQueue_delete(HTList *me)
+BOOL HTQueue_delete(HTDeque *me)
 {
-  return HTList_delete(me);
+  return HTDeque_delete(me);
 }
 
-BOOL HTQueue_enqueue(HTList *me,void *newObject)
+BOOL HTQueue_enqueue(HTDeque *me,void *newObject)
 {
-  return  HTList_addObject(me,newObject);
+  return  HTDeque_append(me,newObject);
 }
-BOOL HTQueue_append(HTList *me,void *newObject)
+BOOL HTQueue_append(HTDeque *me,void *newObject)
 {
-  return  HTList_appendObject(me,newObject);
+  return  HTDeque_prepend(me,newObject);
 }
 
-BOOL HTQueue_dequeue(HTList *me)
+BOOL HTQueue_dequeue(HTDeque *me)
 {
-  return HTList_removeFirstObject(me) ? YES : NO;
+  return HTDeque_removeFirst(me) ? YES : NO;
 }
 
-BOOL HTQueue_isEmpty(HTList *me)
+BOOL HTQueue_isEmpty(HTDeque *me)
 {
-  return HTList_isEmpty(me);
+  return HTDeque_isEmpty(me);
 }
 
-void * HTQueue_headOfQueue(HTList *me)
+void * HTQueue_headOfQueue(HTDeque *me)
 {
-  return HTList_firstObject(me);
+  return HTDeque_first(me);
 }
 
-int HTQueue_count(HTList *me)
+int HTQueue_count(HTDeque *me)
 {
-  return HTList_count(me);
+  return HTDeque_count(me);
 }
 
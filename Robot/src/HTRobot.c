@@ -24,7 +24,6 @@
 */
 
 #include "HTRobMan.h"
-#include "HTQueue.h"
 #include "HTAncMan.h"
 
 #define SHOW_QUIET(mr)		((mr) && !((mr)->flags & MR_QUIET))
@@ -44,6 +43,20 @@ PRIVATE HText_new	RHText_new;
 PRIVATE HText_delete	RHText_delete;
 PRIVATE HText_foundLink	RHText_foundLink;
 
+/*
+**  The robots.txt file of each host
+*/
+PRIVATE RobotSite * RobotSite_new (Robot * mr, HTFrontierHost * host);
+PRIVATE BOOL RobotSite_delete (RobotSite * site);
+PRIVATE void RobotSite_hold (Robot * mr, RobotSite * site);
+
+/*
+**  The checkpoint journal
+*/
+PRIVATE BOOL journal_queued (Robot * mr, HyperDoc * hd);
+PRIVATE BOOL journal_done (Robot * mr, HyperDoc * hd, HTMethod method,
+			   int status, HTParentAnchor * anchor);
+
 /* ------------------------------------------------------------------------- */
 
 /*	Create a "HyperDoc" object
@@ -66,9 +79,22 @@ PUBLIC HyperDoc * HyperDoc_new (Robot * mr,HTParentAnchor * anchor, int depth)
     hd->anchor = anchor;
     HTAnchor_setDocument(anchor, (void *) hd);
 
-    /* Add this HyperDoc object to our list */
-    if (!mr->hyperdoc) mr->hyperdoc = HTList_new();
-    HTList_addObject(mr->hyperdoc, (void *) hd);
+    /* Remember the URL even after the HyperDoc is gone */
+    {
+	char * uri = HTAnchor_address((HTAnchor *) anchor);
+	HTSeen_add(mr->seen, uri);
+	HT_FREE(uri);
+    }
+    if (++mr->docs > mr->max_docs) mr->max_docs = mr->docs;
+
+    /*
+    **  Add this HyperDoc object to our list. In release mode the HyperDocs
+    **  are deleted one by one as we go so we don't keep a list of them.
+    */
+    if (!(mr->flags & MR_RELEASE)) {
+	if (!mr->hyperdoc) mr->hyperdoc = HTList_new();
+	HTList_addObject(mr->hyperdoc, (void *) hd);
+    }
     return hd;
 }
 
@@ -78,12 +104,75 @@ PUBLIC HyperDoc * HyperDoc_new (Robot * mr,HTParentAnchor * anchor, int depth)
 PUBLIC BOOL HyperDoc_delete (HyperDoc * hd)
 {
     if (hd) {
+	HT_FREE(hd->title);
 	HT_FREE (hd);
 	return YES;
     }
     return NO;
 }
 
+/*	Release a "HyperDoc" object
+**	---------------------------
+**	In release mode we forget about a document as soon as we are done
+**	with it, that is when it is neither queued nor being loaded and the
+**	requests that use it as referer have finished. The anchor goes
+**	together with the links to and from it. The URL stays in the seen
+**	set so that we don't come back to it.
+*/
+PRIVATE BOOL HyperDoc_release (Robot * mr, HyperDoc * hd)
+{
+    if ((mr->flags & MR_RELEASE) && hd &&
+	!hd->queued && !hd->loading && hd->pending <= 0) {
+	HTAnchor_setDocument(hd->anchor, NULL);
+	HTAnchor_release(hd->anchor);
+	HyperDoc_delete(hd);
+	mr->docs--;
+	mr->released++;
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  A document is done when the last request for it has finished and it
+**  isn't queued again (BFS does a HEAD first and then a GET). Then it no
+**  longer needs its referer. A document that still has an entry in the
+**  finished list is loading so it can't be released under our feet.
+*/
+PRIVATE void HyperDoc_done (Robot * mr, HyperDoc * hd)
+{
+    if (hd && !hd->queued && !hd->loading) {
+	HyperDoc * referer = hd->referer;
+	if (referer) {
+	    hd->referer = NULL;
+	    referer->pending--;
+	    HyperDoc_release(mr, referer);
+	}
+	HyperDoc_release(mr, hd);
+    }
+}
+
+/*
+**  Go through the documents whose requests have finished
+*/
+PRIVATE void Robot_reap (Robot * mr)
+{
+    HyperDoc * hd;
+    while ((hd = (HyperDoc *) HTList_removeLastObject(mr->finished))) {
+	hd->loading--;
+	HyperDoc_done(mr, hd);
+    }
+}
+
+PRIVATE int Robot_reaper (HTTimer * timer, void * param, HTEventType type)
+{
+    Robot * mr = (Robot *) param;
+    if (timer == mr->reaper) mr->reaper = NULL;
+    HTTimer_delete(timer);
+    Robot_reap(mr);
+    return HT_OK;
+}
+
 /*
 **  Sort the anchor array and log reference count
 */
@@ -465,6 +554,39 @@ PRIVATE BOOL calculate_statistics (Robot * mr)
 	    if (SHOW_REAL_QUIET(mr))
 		HTPrint("\tDid a HEAD on %ld document(s) with a total of %s bytes\n",
 			mr->head_docs, bytes);
+	    if (SHOW_REAL_QUIET(mr))
+		HTPrint("\tFound %d host(s), with at most %d request(s) in flight and %d per host\n",
+			HTFrontier_hosts(mr->frontier), mr->inflight,
+			mr->host_inflight);
+	    if (SHOW_REAL_QUIET(mr) && HTSeen_count(mr->seen) > 0) {
+		HTNumToStr(HTSeen_bytes(mr->seen), bytes, 50);
+		HTPrint("\tSaw %ld URL(s) using %s bytes (%.1f bytes per URL), kept at most %ld and released %ld document(s)\n",
+			HTSeen_count(mr->seen), bytes,
+			(double) HTSeen_bytes(mr->seen) / HTSeen_count(mr->seen),
+			mr->max_docs, mr->released);
+	    }
+	    if (SHOW_REAL_QUIET(mr) && !(mr->flags & MR_NOROBOTSTXT)) {
+		HTList * cur = mr->sites;
+		RobotSite * pres;
+		int loaded = 0;
+		while ((pres = (RobotSite *) HTList_nextObject(cur)))
+		    if (pres->rules) loaded++;
+		HTPrint("\tLoaded robots.txt from %d host(s) which disallowed %ld document(s)\n",
+			loaded, mr->disallowed);
+	    }
+	    if (SHOW_REAL_QUIET(mr) && mr->journal) {
+		HTNumToStr(HTJournal_size(mr->journal), bytes, 50);
+		HTPrint("\tCheckpointed %ld document(s) in `%s\' using %s bytes, %ld of them resumed\n",
+			mr->entries, mr->journalfile, bytes, mr->resumed);
+	    }
+	    if (SHOW_REAL_QUIET(mr) && mr->dedup) {
+		char skipped[50];
+		HTNumToStr(HTDedup_bytes(mr->dedup), bytes, 50);
+		HTNumToStr(mr->dup_bytes, skipped, 50);
+		HTPrint("\tFingerprinted %ld distinct document(s) using %s bytes and skipped %ld exact and %ld near duplicate(s) without parsing %s bytes\n",
+			HTDedup_count(mr->dedup), bytes, mr->dup_same,
+			mr->dup_near, skipped);
+	    }
 	}
     }
 
@@ -687,6 +809,10 @@ PUBLIC Robot * Robot_new (void)
     if ((me = (Robot *) HT_CALLOC(1, sizeof(Robot))) == NULL)
 	HT_OUTOFMEM("Robot_new");
     me->hyperdoc = HTList_new();
+    me->seen = HTSeen_new(0);
+    me->finished = HTList_new();
+    me->sites = HTList_new();
+    me->robots = HTList_new();
     me->htext = HTList_new();
     me->timer = DEFAULT_TIMEOUT*MILLIES;
     me->waits = 0;
@@ -695,10 +821,9 @@ PUBLIC Robot * Robot_new (void)
     me->cnt = 0;
     me->ndoc = -1;
     me->fingers = HTList_new();
- 
-   /* This is new */
-    me->queue = HTQueue_new();
-    me->cq = 0;
+    me->inflight = DEFAULT_INFLIGHT;
+    me->host_inflight = DEFAULT_HOST_INFLIGHT;
+    me->checkpoint = DEFAULT_CHECKPOINT;
     me->furl = NULL;
 
     return me;
@@ -715,6 +840,8 @@ PRIVATE BOOL Robot_delete (Robot * mr)
        	/* Calculate statistics */
 	calculate_statistics(mr);
 
+	/* In release mode we find what is left of the HyperDocs on the anchors */
+	if (mr->flags & MR_RELEASE) HTAnchor_clearAll(mr->hyperdoc);
         if (mr->hyperdoc) {
 	    HTList * cur = mr->hyperdoc;
 	    HyperDoc * pres;
@@ -722,6 +849,7 @@ PRIVATE BOOL Robot_delete (Robot * mr)
 		HyperDoc_delete(pres);
 	    HTList_delete(mr->hyperdoc);
 	}
+	HTSeen_delete(mr->seen);
 	if (mr->htext) {
 	    HTList * cur = mr->htext;
 	    HText * pres;
@@ -773,6 +901,9 @@ PRIVATE BOOL Robot_delete (Robot * mr)
 	}
 
 	if (mr->output && mr->output != STDOUT) fclose(mr->output);
+	if (mr->journal) HTJournal_close(mr->journal);
+	if (mr->conversions) HTConversion_deleteAll(mr->conversions);
+	HTDedup_delete(mr->dedup);
 
 	if (mr->flags & MR_TIME) {
 	    time_t local = time(NULL);
@@ -793,10 +924,6 @@ PRIVATE BOOL Robot_delete (Robot * mr)
 	    regfree(mr->exclude);
 	    HT_FREE(mr->exclude);
 	}
-	if (mr->exc_robot) {
-	    regfree(mr->exc_robot);
-	    HT_FREE(mr->exc_robot);
-	}
 	if (mr->check) {
 	    regfree(mr->check);
 	    HT_FREE(mr->check);
@@ -810,7 +937,24 @@ PRIVATE BOOL Robot_delete (Robot * mr)
 	}
 #endif
 
-	if (mr->queue) HTQueue_delete(mr->queue);
+	/* A site whose robots.txt is still loading goes when the request ends */
+	if (mr->sites) {
+	    HTList * cur = mr->sites;
+	    RobotSite * pres;
+	    while ((pres = (RobotSite *) HTList_nextObject(cur))) {
+		if (pres->request)
+		    pres->robot = NULL;
+		else
+		    RobotSite_delete(pres);
+	    }
+	    HTList_delete(mr->sites);
+	}
+	HTList_delete(mr->robots);
+
+	if (mr->wakeup) HTTimer_delete(mr->wakeup);
+	if (mr->reaper) HTTimer_delete(mr->reaper);
+	HTList_delete(mr->finished);
+	if (mr->frontier) HTFrontier_delete(mr->frontier);
 	HT_FREE(mr->cwd);
 	HT_FREE(mr->prefix);
 	HT_FREE(mr->img_prefix);
@@ -832,6 +976,7 @@ PUBLIC Finger * Finger_new (Robot * robot, HTParentAnchor * dest, HTMethod metho
     me->robot = robot;
     me->request = request;
     me->dest = dest;
+    if ((me->hd = HTAnchor_document(dest)) != NULL) me->hd->loading++;
     HTList_addObject(robot->fingers, (void *)me);
 
     /* Set the context for this request */
@@ -848,18 +993,43 @@ PUBLIC Finger * Finger_new (Robot * robot, HTParentAnchor * dest, HTMethod metho
     /* We wanna make sure that we are sending a Host header (default) */
     HTRequest_addRqHd(request, HT_C_HOST);
 
+    /* The HTML goes through the duplicate check before it is parsed */
+    if (robot->conversions)
+	HTRequest_setConversion(request, robot->conversions, NO);
+
+    /* A document we got in an earlier run is only sent if it has changed */
+    if (me->hd && me->hd->validate) {
+	HTRequest_addRqHd(request, HT_C_IMS | HT_C_IF_NONE_MATCH);
+	me->hd->validate = NO;
+    }
+
     /* Set the method for this request */
     HTRequest_setMethod(request, method);
     robot->cnt++;
     return me;
 }
 
+/*
+**  A request for a document is over and gives up its loading count
+*/
+PRIVATE void Robot_finish (Robot * mr, HyperDoc * hd)
+{
+    if (mr->flags & MR_RELEASE) {
+	HTList_addObject(mr->finished, hd);
+	if (!(mr->flags & MR_PREEMPTIVE) && !mr->reaper)
+	    mr->reaper = HTTimer_defer(Robot_reaper, mr);
+    } else
+	hd->loading--;
+}
+
 PRIVATE int Finger_delete (Finger * me)
 {
+    HyperDoc * redirected = NULL;
     HTList_removeObject(me->robot->fingers, (void *)me);
 
     /* Done with one more */
     me->robot->cnt--;
+    if (me->host) HTFrontier_done(me->robot->frontier, me->host);
 
     /* See if we don't need to keep all the metadata around in the anchors */
     if (!(me->robot->flags & MR_KEEP_META))
@@ -869,11 +1039,25 @@ PRIVATE int Finger_delete (Finger * me)
     **  If we are down at one request then flush the output buffer
     */
     if (me->request) {
+	HTParentAnchor * anchor = HTRequest_anchor(me->request);
+	if (anchor != me->dest) redirected = HTAnchor_document(anchor);
 	if (me->robot->cnt == 1) HTRequest_forceFlush(me->request);
 	HTRequest_delete(me->request);
 	me->request = NULL;
     }
 
+    /*
+    **  Now the request is gone we may be done with the documents. In
+    **  release mode libwww still looks at the anchor when we return from
+    **  the terminate handler so we hand them on to Robot_reap which is
+    **  called when no request is terminating. They stay loading till then.
+    */
+    if (me->hd) Robot_finish(me->robot, me->hd);
+    if (redirected && redirected != me->hd) {
+	redirected->loading++;
+	Robot_finish(me->robot, redirected);
+    }
+
     /*
     **  Delete the request and free myself
     */
@@ -894,14 +1078,14 @@ PRIVATE BOOL check_constraints(Robot * mr, char *prefix, char *uri)
     if (match && mr->include) {
 	match = regexec(mr->include, uri, 0, NULL, 0) ? NO : YES;
     }
-    if (match && mr->exc_robot) {
-	match = regexec(mr->exc_robot, uri, 0, NULL, 0) ? YES : NO;
-    }
     if (match && mr->exclude) {
 	match = regexec(mr->exclude, uri, 0, NULL, 0) ? YES : NO;
     }
   
 #endif
+
+    /* Check what robots.txt says */
+    if (match) match = Robot_allowed(mr, uri);
     return match;
 }
 
@@ -1027,9 +1211,10 @@ PUBLIC int redirection_handler (HTRequest * request, HTResponse * response,
     ** then update it
     */
     if (match) {
-	if ((redirection_hd = HTAnchor_document(redirection_parent)) != NULL) {
+	if ((redirection_hd = HTAnchor_document(redirection_parent)) != NULL ||
+	    HTSeen_find(mr->seen, redirection_parent_addr)) {
 	    if (SHOW_QUIET(mr)) HTPrint("............ Already checked\n");
-	    redirection_hd->hits++;
+	    if (redirection_hd) redirection_hd->hits++;
 	    HT_FREE(redirection_parent_addr);
 	    HT_FREE(uri);
 	    return HT_OK;
@@ -1042,8 +1227,7 @@ PUBLIC int redirection_handler (HTRequest * request, HTResponse * response,
 
 	    if(mr->flags & MR_BFS) {
 		nhd->method = METHOD_HEAD;
-		HTQueue_append(mr->queue, (void *) nhd);
-		(mr->cq)++;
+		Robot_enqueue(mr, nhd, YES);
 	    }
 
 	    if (check) {
@@ -1135,6 +1319,10 @@ PUBLIC int terminate_handler (HTRequest * request, HTResponse * response,
 	mr->other_docs++;
     }
 
+    /* Write down how it went before the metadata goes */
+    journal_done(mr, finger->hd, HTRequest_method(request), status,
+		 HTRequest_anchor(request) == finger->dest ? finger->dest : NULL);
+
     if (!(mr->flags & MR_BFS)) {
 
 #if 0
@@ -1145,11 +1333,11 @@ PUBLIC int terminate_handler (HTRequest * request, HTResponse * response,
 	/* Delete this thread */
 	Finger_delete(finger);
 
-	/* Should we stop? */
-	if (mr->cnt <= 0) {
-	    if (SHOW_QUIET(mr)) HTPrint("             Everything is finished...\n");
-	    Cleanup(mr, 0);			/* No way back from here */
-	}
+	/*
+	**  Send what we can from the frontier and see if we should stop.
+	**  In single threaded mode main does this when the request returns.
+	*/
+	if (!(mr->flags & MR_PREEMPTIVE)) Serving_queue(mr);
     }
 
     if (SHOW_QUIET(mr)) HTPrint("             %d outstanding request%s\n", mr->cnt, mr->cnt == 1 ? "" : "s");
@@ -1172,74 +1360,682 @@ PUBLIC int bfs_terminate_handler (HTRequest * request, HTResponse * response,
        (depth < mr->depth))
       {
 	hd->method = METHOD_GET;
-	HTQueue_append(mr->queue, (void *)hd); (mr->cq)++;
+	Robot_enqueue(mr, hd, YES);
       }
 
     Finger_delete(finger);
+    if (!(mr->flags & MR_PREEMPTIVE)) Serving_queue(mr);
+    return HT_OK;
+}
+
+/*
+**  Find the frontier host for an anchor. The host is the scheme, name and
+**  port of the URI so that all requests to the same origin share the same
+**  queue.
+*/
+PRIVATE HTFrontierHost * robot_host (Robot * mr, const char * uri)
+{
+    char * name = HTParse(uri, "", PARSE_ACCESS | PARSE_HOST | PARSE_PUNCTUATION);
+    HTFrontierHost * host = HTFrontier_host(mr->frontier, name);
+
+    /* The first time we see an HTTP host, and when its rules expire */
+    if (!(mr->flags & MR_NOROBOTSTXT) && !strncasecomp(name, "http", 4)) {
+	RobotSite * site = (RobotSite *) HTFrontierHost_context(host);
+	if (!site) site = RobotSite_new(mr, host);
+	if (!site->held && site->expires <= time(NULL))
+	    RobotSite_hold(mr, site);
+    }
+    HT_FREE(name);
+    return host;
+}
+
+PUBLIC HTFrontierHost * Robot_host (Robot * mr, HTParentAnchor * anchor)
+{
+    HTFrontierHost * host = NULL;
+    if (mr && anchor) {
+	char * uri = HTAnchor_address((HTAnchor *) anchor);
+	host = robot_host(mr, uri);
+	HT_FREE(uri);
+    }
+    return host;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				  ROBOTS.TXT				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE RobotSite * RobotSite_new (Robot * mr, HTFrontierHost * host)
+{
+    RobotSite * site;
+    if ((site = (RobotSite *) HT_CALLOC(1, sizeof(RobotSite))) == NULL)
+	HT_OUTOFMEM("RobotSite_new");
+    site->robot = mr;
+    site->host = host;
+    HTFrontierHost_setContext(host, site);
+    HTList_addObject(mr->sites, site);
+    return site;
+}
+
+PRIVATE BOOL RobotSite_delete (RobotSite * site)
+{
+    if (site) {
+	RobotTxt_delete(site->rules);
+	HTChunk_delete(site->chunk);
+	HT_FREE(site);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  Hold the host till we have its robots.txt. We don't start the request
+**  here as we may be in the middle of parsing a document, which in single
+**  threaded mode means in the middle of another request. Serving_queue
+**  starts it instead.
+*/
+PRIVATE void RobotSite_hold (Robot * mr, RobotSite * site)
+{
+    site->held = YES;
+    HTFrontier_hold(mr->frontier, site->host, YES);
+    HTList_addObject(mr->robots, site);
+}
+
+PRIVATE BOOL RobotSite_allowed (Robot * mr, RobotSite * site, const char * uri)
+{
+    if (site && site->rules) {
+	char * path = HTParse(uri, "", PARSE_PATH | PARSE_PUNCTUATION);
+	BOOL allowed = RobotTxt_allowed(site->rules, path);
+	if (!allowed) {
+	    mr->disallowed++;
+	    if (SHOW_QUIET(mr))
+		HTPrint("Robot....... `%s\' is disallowed by robots.txt\n", uri);
+	}
+	HT_FREE(path);
+	return allowed;
+    }
+    return YES;
+}
+
+/*
+**  If we haven't got the rules for the host yet then the answer is yes,
+**  and we ask again when the document is taken out of the frontier.
+*/
+PUBLIC BOOL Robot_allowed (Robot * mr, const char * uri)
+{
+    if (mr && uri && !(mr->flags & MR_NOROBOTSTXT)) {
+	HTFrontierHost * host = robot_host(mr, uri);
+	return RobotSite_allowed(mr, (RobotSite *) HTFrontierHost_context(host), uri);
+    }
+    return YES;
+}
+
+/*
+**  The request for robots.txt has ended. Whatever happened the host is let
+**  go. If we didn't get the file then everything is allowed, and if the
+**  server is in trouble we try again sooner than if it just hasn't got one.
+*/
+PRIVATE int robots_handler (HTRequest * request, HTResponse * response,
+			    void * param, int status)
+{
+    RobotSite * site = (RobotSite *) param;
+    Robot * mr = site->robot;
+    time_t now = time(NULL);
+    time_t expires = now + ROBOTS_TXT_EXPIRES;
+    HTChunk * chunk = site->chunk;
+
+    site->request = NULL;
+    site->chunk = NULL;
+
+    /* The robot has already gone away */
+    if (!mr) {
+	HTChunk_delete(chunk);
+	RobotSite_delete(site);
+	HTRequest_delete(request);
+	return HT_ERROR;
+    }
+
+    RobotTxt_delete(site->rules);
+    if (status == HT_LOADED && chunk) {
+	char * str = HTChunk_toCString(chunk);
+	time_t date = HTAnchor_expires(HTRequest_anchor(request));
+	site->rules = RobotTxt_parse(str, APP_NAME);
+	if (date != (time_t) -1 && date < expires) expires = date;
+	HT_FREE(str);
+    } else {
+	site->rules = RobotTxt_new();
+	if (status > -400 || status <= -500) expires = now + ROBOTS_TXT_RETRY;
+	HTChunk_delete(chunk);
+    }
+    if (expires < now + ROBOTS_TXT_RETRY) expires = now + ROBOTS_TXT_RETRY;
+    site->expires = expires;
+
+    /* A crawl delay can make us wait longer but not shorter */
+    if (RobotTxt_delay(site->rules) > (ms_t) mr->waits * MILLIES)
+	HTFrontierHost_setDelay(site->host, RobotTxt_delay(site->rules));
+
+    if (SHOW_QUIET(mr))
+	HTPrint("Robots.txt.. %s has %d rule(s) for us (status %d)\n",
+		HTFrontierHost_name(site->host), RobotTxt_rules(site->rules),
+		status);
+
+    site->held = NO;
+    HTFrontier_hold(mr->frontier, site->host, NO);
+    HTFrontier_done(mr->frontier, site->host);
+    mr->cnt--;
+    HTRequest_delete(request);
+    if (!(mr->flags & MR_PREEMPTIVE)) Serving_queue(mr);
+
+    /* The filters of the request are gone so libwww must stop here */
+    return HT_ERROR;
+}
+
+/*
+**  Start loading robots.txt for the hosts that are waiting for it. We
+**  override the global after filters so that the request isn't taken for
+**  a document, which means that we have to ask for redirections ourselves.
+*/
+PUBLIC void Robot_loadRobotsTxt (Robot * mr)
+{
+    RobotSite * site;
+    while ((site = (RobotSite *) HTList_removeFirstObject(mr->robots))) {
+	char * uri = HTParse(ROBOTS_TXT, HTFrontierHost_name(site->host), PARSE_ALL);
+	HTRequest * request = HTRequest_new();
+	HTStream * target = HTStreamToChunk(request, &site->chunk, 0);
+	if (SHOW_QUIET(mr)) HTPrint("Robots.txt.. Loading `%s\'\n", uri);
+	site->request = request;
+	HTRequest_setOutputFormat(request, WWW_SOURCE);
+	HTRequest_setOutputStream(request, target);
+	HTRequest_addRqHd(request, HT_C_HOST);
+	if (mr->flags & MR_PREEMPTIVE) HTRequest_setPreemptive(request, YES);
+	HTRequest_addAfter(request, HTRedirectFilter, NULL, NULL,
+			   HT_PERM_REDIRECT, HT_FILTER_MIDDLE, YES);
+	HTRequest_addAfter(request, HTRedirectFilter, NULL, NULL,
+			   HT_TEMP_REDIRECT, HT_FILTER_MIDDLE, YES);
+	HTRequest_addAfter(request, HTRedirectFilter, NULL, NULL,
+			   HT_FOUND, HT_FILTER_MIDDLE, YES);
+	HTRequest_addAfter(request, HTRedirectFilter, NULL, NULL,
+			   HT_SEE_OTHER, HT_FILTER_MIDDLE, YES);
+	HTRequest_addAfter(request, robots_handler, NULL, site,
+			   HT_ALL, HT_FILTER_LAST, YES);
+	HTFrontier_start(mr->frontier, site->host);
+	mr->cnt++;
+	if (HTLoadAnchor(HTAnchor_findAddress(uri), request) != YES &&
+	    site->request == request)
+	    robots_handler(request, NULL, site, HT_ERROR);
+	HT_FREE(uri);
+    }
+}
+
+/*
+**  Put a document in the queue of its host
+*/
+PUBLIC BOOL Robot_enqueue (Robot * mr, HyperDoc * hd, BOOL first)
+{
+    if (mr && hd && HTFrontier_add(mr->frontier, Robot_host(mr, hd->anchor),
+				   (void *) hd, first)) {
+	hd->queued = YES;
+	journal_queued(mr, hd);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**  Called by the frontier when a host is ready for another request
+*/
+PUBLIC BOOL Robot_load (HTFrontier * frontier, HTFrontierHost * host,
+			void * object, void * context)
+{
+    Robot * mr = (Robot *) context;
+    HyperDoc * hd = (HyperDoc *) object;
+    Finger * finger;
+    HTRequest * request;
+
+    /* In single threaded mode no request is terminating when we get here */
+    if (mr->flags & MR_PREEMPTIVE) Robot_reap(mr);
+
+    /* We may have got the rules for the host after it was queued */
+    hd->queued = NO;
+    if (HTFrontierHost_context(host)) {
+	char * uri = HTAnchor_address((HTAnchor *) hd->anchor);
+	BOOL allowed = RobotSite_allowed(mr, (RobotSite *) HTFrontierHost_context(host), uri);
+	if (!allowed && mr->reject)
+	    HTLog_addText(mr->reject, "robots.txt --> %s\n", uri);
+	HT_FREE(uri);
+	if (!allowed) {
+	    hd->loading++;
+	    Robot_finish(mr, hd);
+	    return NO;
+	}
+    }
 
-    if(!(mr->flags & MR_PREEMPTIVE))
-      Serving_queue(mr);
+    finger = Finger_new(mr, hd->anchor, hd->method);
+    request = finger->request;
+    finger->host = host;
+    HTRequest_setParent(request, hd->referer ? hd->referer->anchor :
+			get_last_parent(hd->anchor));
+    if (SHOW_QUIET(mr)) {
+	char * uri = HTAnchor_address((HTAnchor *) hd->anchor);
+	HTPrint("Request from QUEUE  %s\n", uri);
+	HTPrint("%d elements in queue \n", HTFrontier_count(frontier));
+	HT_FREE(uri);
+    }
+    if (HTLoadAnchor((HTAnchor *) hd->anchor, request) != YES) {
+	if (SHOW_QUIET(mr)) HTPrint("not tested!\n");
+	finger->host = NULL;
+	Finger_delete(finger);
+	return NO;
+    }
+    return YES;
+}
 
+PRIVATE int Robot_wakeup (HTTimer * timer, void * param, HTEventType type)
+{
+    Robot * mr = (Robot *) param;
+    if (timer == mr->wakeup) mr->wakeup = NULL;
+    HTTimer_delete(timer);
+    Serving_queue(mr);
     return HT_OK;
 }
 
+/*
+**  Send requests to the hosts that are ready. If the next host isn't
+**  ready yet then we set a timer for when it is, or sleep in single
+**  threaded mode. When no requests are left then we are done.
+*/
 PUBLIC void Serving_queue(Robot *mr)
 {
-  BOOL abort = NO;
-  Finger *nfinger;
-  
-  while(!abort)
-    {
-      if(!HTQueue_isEmpty(mr->queue))
-	{
-	  HTRequest *newreq;
-	  
-	  HyperDoc *nhd = (HyperDoc *)HTQueue_headOfQueue(mr->queue);
-	  
-	  if(nhd)
-	    {
-	      char *uri = HTAnchor_address((HTAnchor *)nhd->anchor);
-	      HTQueue_dequeue(mr->queue); (mr->cq)--;
-
-	      nfinger = Finger_new(mr, nhd->anchor, nhd->method); 
-	      
-	      newreq = nfinger->request;
-
-	      if(SHOW_QUIET(mr))  HTPrint("Request from QUEUE  %s\n",uri);
-	      HT_FREE(uri);
-	      if(SHOW_QUIET(mr)) HTPrint("%d elements in queue \n", mr->cq);
-
-	      HTRequest_setParent(newreq,get_last_parent(nhd->anchor));
-
-	      /* @@@ Should be done using a timer and not sleep! @@@ */
-#if 0
-	      if(mr->waits)
-		  sleep(mr->waits);
-#endif
-	      
-	      if (HTLoadAnchor((HTAnchor *)nhd->anchor , newreq) != YES) 
-		{
-		  if (SHOW_QUIET(mr)) HTPrint("not tested!\n");
-		  Finger_delete(nfinger);
-		}
-	    }
-	  else
-	    abort = YES;
-	}
-      else
-	abort = YES;
+    long wait;
+    for (;;) {
+	Robot_loadRobotsTxt(mr);
+	wait = HTFrontier_dispatch(mr->frontier);
+	if (!(mr->flags & MR_PREEMPTIVE)) break;
+	if (!HTList_isEmpty(mr->robots)) continue;
+	if (wait <= 0) break;
+	SLEEP((wait + MILLIES - 1) / MILLIES);
     }
 
-  if(SHOW_QUIET(mr)) HTPrint("Queue size: %d \n", mr->cq);
+    if (wait > 0 && !(mr->flags & MR_PREEMPTIVE))
+	mr->wakeup = HTTimer_new(mr->wakeup, Robot_wakeup, mr, wait, YES, NO);
 
-    if (mr->cnt <= 0 || (abort && (mr->flags & MR_PREEMPTIVE)))
-      {
-	if(mr->cnt > 0)
-	  if(SHOW_QUIET(mr)) HTPrint("%d requests were not served\n", mr->cnt);
+    if (SHOW_QUIET(mr)) HTPrint("Queue size: %d \n", HTFrontier_count(mr->frontier));
+
+    if (HTFrontier_isEmpty(mr->frontier) &&
+	(mr->cnt <= 0 || (mr->flags & MR_PREEMPTIVE))) {
+	if (mr->cnt > 0)
+	    if (SHOW_QUIET(mr)) HTPrint("%d requests were not served\n", mr->cnt);
 
 	if (SHOW_QUIET(mr)) HTPrint("             Everything is finished...\n");
 	Cleanup(mr, 0);			/* No way back from here */
-      }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*				CHECKPOINT JOURNAL			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  The journal has a record when a document is first queued and one each
+**  time a request for it has finished. The documents are numbered in the
+**  order in which they were queued, starting at 1. The last record for a
+**  document is the one that counts.
+*/
+#define JOURNAL_QUEUED		'Q'		      /* URI, depth, method */
+#define JOURNAL_DONE		'D'   /* Number, method, status, LM, etag */
+
+typedef struct _JournalEntry {
+    char *		uri;
+    int			depth;
+    HTMethod		method;
+    BOOL		done;
+    int			status;
+    time_t		lm;
+    char *		etag;
+    HyperDoc *		hd;
+} JournalEntry;
+
+PRIVATE BOOL journal_queued (Robot * mr, HyperDoc * hd)
+{
+    if (mr->journal && hd && !hd->entry) {
+	char * uri = HTAnchor_address((HTAnchor *) hd->anchor);
+	BOOL status = HTJournal_add(mr->journal, JOURNAL_QUEUED, "snn", uri,
+				    (unsigned long) hd->depth,
+				    (unsigned long) hd->method);
+	HT_FREE(uri);
+	hd->entry = ++mr->entries;
+	return status;
+    }
+    return NO;
+}
+
+/*
+**  The validators are only those of the document itself and not of where
+**  it may have been redirected to. They are flushed to disk now and then.
+*/
+PRIVATE BOOL journal_done (Robot * mr, HyperDoc * hd, HTMethod method,
+			   int status, HTParentAnchor * anchor)
+{
+    if (mr->journal && hd && hd->entry) {
+	time_t lm = anchor ? HTAnchor_lastModified(anchor) : -1;
+	char * etag = anchor ? HTAnchor_etag(anchor) : NULL;
+	ms_t now = HTGetTimeInMillis();
+	BOOL added = HTJournal_add(mr->journal, JOURNAL_DONE, "nnins",
+				   (unsigned long) hd->entry,
+				   (unsigned long) method, (long) status,
+				   (unsigned long) (lm > 0 ? lm : 0), etag);
+	if (now - mr->flushed >= (ms_t) mr->checkpoint * MILLIES) {
+	    HTJournal_flush(mr->journal);
+	    mr->flushed = now;
+	}
+	return added;
+    }
+    return NO;
+}
+
+PRIVATE BOOL journal_entry (int type, HTJournalRecord * record, void * context)
+{
+    HTArray * entries = (HTArray *) context;
+    char * uri = NULL;
+    char * etag = NULL;
+    unsigned long number = 0;
+    unsigned long depth = 0;
+    unsigned long method = 0;
+    unsigned long lm = 0;
+    long status = 0;
+    if (type == JOURNAL_QUEUED) {
+	JournalEntry * entry;
+	if (!HTJournal_get(record, "snn", &uri, &depth, &method) || !uri)
+	    return NO;
+	if ((entry = (JournalEntry *) HT_CALLOC(1, sizeof(JournalEntry))) == NULL)
+	    HT_OUTOFMEM("journal_entry");
+	StrAllocCopy(entry->uri, uri);
+	entry->depth = (int) depth;
+	entry->method = (HTMethod) method;
+	HTArray_addObject(entries, entry);
+    } else if (type == JOURNAL_DONE) {
+	JournalEntry * entry;
+	if (!HTJournal_get(record, "nnins", &number, &method, &status, &lm, &etag) ||
+	    number < 1 || number > (unsigned long) HTArray_size(entries))
+	    return NO;
+	entry = (JournalEntry *) HTArray_data(entries)[number-1];
+	entry->done = YES;
+	entry->method = (HTMethod) method;
+	entry->status = (int) status;
+	entry->lm = (time_t) lm;
+	if (etag)
+	    StrAllocCopy(entry->etag, etag);
+	else
+	    HT_FREE(entry->etag);
+    }
+    return YES;
+}
+
+/*
+**  Find or make the HyperDoc for a document in the journal we resume and
+**  write it down again in the new one. A document that we got before is
+**  loaded with a conditional request if we know its validators.
+*/
+PRIVATE HyperDoc * resume_entry (Robot * mr, JournalEntry * entry)
+{
+    HTParentAnchor * anchor = HTAnchor_parent(HTAnchor_findAddress(entry->uri));
+    HyperDoc * hd = HTAnchor_document(anchor);
+    if (hd && hd->entry) return NULL;
+    if (!hd) hd = HyperDoc_new(mr, anchor, entry->depth);
+
+    /* In BFS the HEAD is only the first half and we still need the links */
+    if ((mr->flags & MR_BFS) && entry->done && entry->method == METHOD_HEAD &&
+	entry->depth < mr->depth) {
+	entry->done = NO;
+	entry->method = METHOD_GET;
+    }
+    hd->method = entry->method;
+    journal_queued(mr, hd);
+    if (entry->done) {
+	if (entry->lm > 0) HTAnchor_setLastModified(anchor, entry->lm);
+	if (entry->etag) HTAnchor_setEtag(anchor, entry->etag);
+	hd->validate = (entry->lm > 0 || entry->etag);
+	journal_done(mr, hd, entry->method, entry->status,
+		     hd->validate ? anchor : NULL);
+    }
+    mr->resumed++;
+    return hd;
+}
+
+/*
+**  Open the journal. If we resume then we first read the old one and queue
+**  the documents in it, those that we didn't get before first. What is
+**  left of the old journal is written to a new one which then takes its
+**  place, so the journal doesn't grow from one run to the next with
+**  records that no longer count.
+*/
+PUBLIC BOOL Robot_openJournal (Robot * mr, HyperDoc * start)
+{
+    HTArray * entries = HTArray_new(1024);
+    char * tmpfile = NULL;
+    BOOL status = NO;
+    if (!mr || !mr->journalfile) return NO;
+    if ((mr->flags & MR_RESUME) &&
+	HTJournal_read(mr->journalfile, journal_entry, entries) < 0) {
+	if (SHOW_REAL_QUIET(mr))
+	    HTPrint("Can't resume from journal `%s\'\n", mr->journalfile);
+    }
+    StrAllocCopy(tmpfile, mr->journalfile);
+    StrAllocCat(tmpfile, ".new");
+    if ((mr->journal = HTJournal_open(tmpfile, NO)) != NULL) {
+	int size = HTArray_size(entries);
+	JournalEntry ** data = (JournalEntry **) HTArray_data(entries);
+	long revalidate = 0;
+	int i;
+	for (i = 0; i < size; i++)
+	    data[i]->hd = resume_entry(mr, data[i]);
+	journal_queued(mr, start);
+	HTJournal_close(mr->journal);
+	if (rename(tmpfile, mr->journalfile) == 0 &&
+	    (mr->journal = HTJournal_open(mr->journalfile, YES)) != NULL) {
+	    mr->flushed = HTGetTimeInMillis();
+	    status = YES;
+	} else {
+	    mr->journal = NULL;
+	    if (SHOW_REAL_QUIET(mr))
+		HTPrint("Can't write journal `%s\'\n", mr->journalfile);
+	}
+
+	/* The start document is loaded by main */
+	for (i = 0; i < size; i++) {
+	    HyperDoc * hd = data[i]->hd;
+	    if (hd && hd != start && !data[i]->done) Robot_enqueue(mr, hd, NO);
+	}
+	for (i = 0; i < size; i++) {
+	    HyperDoc * hd = data[i]->hd;
+	    if (hd && hd != start && data[i]->done) {
+		if (hd->validate) {
+		    Robot_enqueue(mr, hd, NO);
+		    revalidate++;
+		} else
+		    HyperDoc_done(mr, hd);
+	    }
+	}
+	if (size > 0 && SHOW_REAL_QUIET(mr))
+	    HTPrint("Resumed %ld document(s) from `%s\', %ld of them to revalidate\n",
+		    mr->resumed, mr->journalfile, revalidate);
+    } else if (SHOW_REAL_QUIET(mr))
+	HTPrint("Can't write journal `%s\'\n", tmpfile);
+
+    {
+	int size = HTArray_size(entries);
+	JournalEntry ** data = (JournalEntry **) HTArray_data(entries);
+	int i;
+	for (i = 0; i < size; i++) {
+	    HT_FREE(data[i]->uri);
+	    HT_FREE(data[i]->etag);
+	    HT_FREE(data[i]);
+	}
+	HTArray_delete(entries);
+    }
+    HT_FREE(tmpfile);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				DUPLICATE DOCUMENTS			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  The HTML of our requests goes through this stream on its way to the
+**  parser. It keeps the document and makes a fingerprint of it as it
+**  comes, and at the end the document is only parsed if we haven't seen
+**  it before. A document which is too big to keep goes straight on to the
+**  parser.
+*/
+struct _HTStream {
+    const HTStreamClass *	isa;
+    HTRequest *			request;
+    HTFormat			input_format;
+    HTFormat			output_format;
+    HTStream *			output_stream;	     /* For the parser */
+    HTStream *			target;		    /* The parser if any */
+    HTChunk *			buffer;
+    HTFingerprint *		print;
+};
+
+PRIVATE int RobotDedup_parse (HTStream * me)
+{
+    int status = HT_OK;
+    me->target = HTMLPresent(me->request, NULL, me->input_format,
+			     me->output_format, me->output_stream);
+    if (me->target && HTChunk_size(me->buffer) > 0)
+	status = (*me->target->isa->put_block)(me->target,
+					       HTChunk_data(me->buffer),
+					       HTChunk_size(me->buffer));
+    HTFingerprint_delete(me->print);
+    me->print = NULL;
+    HTChunk_delete(me->buffer);
+    me->buffer = NULL;
+    return status;
+}
+
+PRIVATE int RobotDedup_put_block (HTStream * me, const char * b, int l)
+{
+    if (me->target) return (*me->target->isa->put_block)(me->target, b, l);
+    HTFingerprint_put(me->print, b, l);
+    HTChunk_putb(me->buffer, b, l);
+    if (HTChunk_size(me->buffer) > DEDUP_MAX_BUFFER) {
+	HTTRACE(APP_TRACE, "Dedup....... Too big to keep, parsing as it comes\n");
+	return RobotDedup_parse(me);
+    }
+    return HT_OK;
+}
+
+PRIVATE int RobotDedup_put_character (HTStream * me, char c)
+{
+    return RobotDedup_put_block(me, &c, 1);
+}
+
+PRIVATE int RobotDedup_put_string (HTStream * me, const char * s)
+{
+    return RobotDedup_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE int RobotDedup_flush (HTStream * me)
+{
+    return me->target ? (*me->target->isa->flush)(me->target) : HT_OK;
+}
+
+PRIVATE int RobotDedup_free (HTStream * me)
+{
+    int status = HT_OK;
+    if (!me->target) {
+	Finger * finger = (Finger *) HTRequest_context(me->request);
+	Robot * mr = finger ? finger->robot : NULL;
+	HTDedupMatch match = mr ? HTDedup_add(mr->dedup, me->print) : HT_DEDUP_NEW;
+	if (match == HT_DEDUP_NEW)
+	    RobotDedup_parse(me);
+	else {
+	    char * uri = HTAnchor_address((HTAnchor *) HTRequest_anchor(me->request));
+	    if (match == HT_DEDUP_SAME)
+		mr->dup_same++;
+	    else
+		mr->dup_near++;
+	    mr->dup_bytes += HTChunk_size(me->buffer);
+	    HTTRACE(APP_TRACE, "Dedup....... `%s\' is a%s copy, not parsed\n" _
+		    uri _ match == HT_DEDUP_SAME ? "n exact" : " near");
+	    if (mr->reject)
+		HTLog_addText(mr->reject, "%s --> %s\n",
+			      match == HT_DEDUP_SAME ? "duplicate" : "near duplicate",
+			      uri);
+	    HT_FREE(uri);
+	    if (me->output_stream)
+		(*me->output_stream->isa->_free)(me->output_stream);
+	}
+    }
+    if (me->target) status = (*me->target->isa->_free)(me->target);
+    HTFingerprint_delete(me->print);
+    HTChunk_delete(me->buffer);
+    HT_FREE(me);
+    return status;
+}
+
+PRIVATE int RobotDedup_abort (HTStream * me, HTList * e)
+{
+    if (me->target)
+	(*me->target->isa->abort)(me->target, e);
+    else if (me->output_stream)
+	(*me->output_stream->isa->abort)(me->output_stream, e);
+    HTFingerprint_delete(me->print);
+    HTChunk_delete(me->buffer);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+PRIVATE const HTStreamClass RobotDedupClass =
+{
+    "RobotDedup",
+    RobotDedup_flush,
+    RobotDedup_free,
+    RobotDedup_abort,
+    RobotDedup_put_character,
+    RobotDedup_put_string,
+    RobotDedup_put_block
+};
+
+PRIVATE HTStream * RobotDedup_new (HTRequest *	request,
+				   void *	param,
+				   HTFormat	input_format,
+				   HTFormat	output_format,
+				   HTStream *	output_stream)
+{
+    HTStream * me;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+	HT_OUTOFMEM("RobotDedup_new");
+    me->isa = &RobotDedupClass;
+    me->request = request;
+    me->input_format = input_format;
+    me->output_format = output_format;
+    me->output_stream = output_stream;
+    me->buffer = HTChunk_new(1024);
+    {
+	long length = HTAnchor_length(HTRequest_anchor(request));
+	if (length > 0 && length <= DEDUP_MAX_BUFFER)
+	    HTChunk_ensure(me->buffer, (int) length);
+    }
+    me->print = HTFingerprint_new();
+    return me;
+}
+
+/*
+**  Our requests get their own conversion from HTML which is tried before
+**  the global one that goes straight to the parser
+*/
+PUBLIC BOOL Robot_registerDedup (Robot * mr, int distance)
+{
+    if (mr && !mr->dedup) {
+	mr->dedup = HTDedup_new(distance);
+	mr->conversions = HTList_new();
+	HTConversion_add(mr->conversions, "text/html", "www/present",
+			 RobotDedup_new, 1.0, 0.0, 0.0);
+	return YES;
+    }
+    return NO;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1324,9 +2120,10 @@ PRIVATE void RHText_foundAnchor (HText * text, HTChildAnchor * anchor)
 	if (!uri) return;
 	if (SHOW_QUIET(mr)) HTPrint("Robot....... Found `%s\' - \n", uri ? uri : "NULL\n");
 
-        if (hd) {
+	/* The HyperDoc may be gone already but the URL is still seen */
+        if (hd || HTSeen_find(mr->seen, uri)) {
 	    if (SHOW_QUIET(mr)) HTPrint("............ Already checked\n");
-            hd->hits++;
+            if (hd) hd->hits++;
 #ifdef HT_MYSQL
 	    if (mr->sqllog) {
 		char * ref_addr = HTAnchor_address((HTAnchor *) referer);
@@ -1360,37 +2157,42 @@ PRIVATE void RHText_foundAnchor (HText * text, HTChildAnchor * anchor)
 	if (mr->ndoc == 0) /* Number of Documents is reached */
 	  follow = NO;
 
-	/* Test whether we already have a hyperdoc for this document */
-	if (!hd && dest_parent) {
-	    nhd = HyperDoc_new(mr, dest_parent, depth);
+	/*
+	**  Create a hyperdoc for this document. In release mode we only do
+	**  that for the documents that we are going to load and just
+	**  remember the URL of the others.
+	*/
+	follow = (mr->flags & MR_LINK) && match && dest_parent && follow;
+	if (dest_parent) {
+	    if (follow || !(mr->flags & MR_RELEASE))
+		nhd = HyperDoc_new(mr, dest_parent, depth);
+	    else
+		HTSeen_add(mr->seen, uri);
 	    mr->cdepth[depth]++;
 	}
 
-	/* Test whether we already have a hyperdoc for this document */
-        if (mr->flags & MR_LINK && match && dest_parent && follow && !hd) {
+        if (follow) {
+	    /* The request for it uses this document as referer */
+	    if (last_doc) {
+		nhd->referer = last_doc;
+		last_doc->pending++;
+	    }
+
 	    if (mr->flags & MR_BFS) {
 		nhd->method = METHOD_HEAD;
-		HTQueue_enqueue(mr->queue, (void *) nhd);
-		(mr->cq)++;
+		Robot_enqueue(mr, nhd, NO);
 		if(mr->ndoc > 0) mr->ndoc--;
 	    } else {
-		Finger * newfinger = Finger_new(mr, dest_parent, METHOD_GET);
-		HTRequest * newreq = newfinger->request;
-		HTRequest_setParent(newreq, referer);		
 		nhd->method = METHOD_GET;
-
 		if (check || depth >= mr->depth) {
 		    if (SHOW_QUIET(mr)) HTPrint("loading at depth %d using HEAD\n", depth);
-		    HTRequest_setMethod(newreq, METHOD_HEAD);
 		    nhd->method = METHOD_HEAD;    
-
 		} else {
 		    if (SHOW_QUIET(mr)) HTPrint("loading at depth %d\n", depth);
 		}
-		if (HTLoadAnchor((HTAnchor *) dest_parent, newreq) != YES) {
-		    if (SHOW_QUIET(mr)) HTPrint("not tested!\n");
-		    Finger_delete(newfinger);
-		}
+
+		/* Depth first means that the newest goes first */
+		Robot_enqueue(mr, nhd, YES);
 	    }
 
 	} else {
@@ -1435,9 +2237,9 @@ PRIVATE void RHText_foundImage (HText * text, HTChildAnchor * anchor,
 	    BOOL match = YES;
 
 	    if (!uri) return;
-	    if (hd) {
+	    if (hd || HTSeen_find(mr->seen, uri)) {
 		if (SHOW_QUIET(mr)) HTPrint("............ Already checked\n");
-		hd->hits++;
+		if (hd) hd->hits++;
 #ifdef HT_MYSQL
 		if (mr->sqllog) {
 		    char * ref_addr = HTAnchor_address((HTAnchor *) referer);
@@ -1458,12 +2260,13 @@ PRIVATE void RHText_foundImage (HText * text, HTChildAnchor * anchor,
 
 	    /* Test whether we already have a hyperdoc for this document */
 	    if (match && dest) {
-		Finger * newfinger = Finger_new(mr, dest_parent,
-						mr->flags & MR_SAVE ?
-						METHOD_GET : METHOD_HEAD);
-		HTRequest * newreq = newfinger->request;
-		HyperDoc_new(mr, dest_parent, 1);
-		HTRequest_setParent(newreq, referer);
+		HyperDoc * nhd = HyperDoc_new(mr, dest_parent, 1);
+		HyperDoc * last_doc = HTAnchor_document(referer);
+		nhd->method = mr->flags & MR_SAVE ? METHOD_GET : METHOD_HEAD;
+		if (last_doc) {
+		    nhd->referer = last_doc;
+		    last_doc->pending++;
+		}
 
 		/* Check whether we should report missing ALT tags */
 		if (mr->noalttag && (alt==NULL || *alt=='\0')) {
@@ -1475,10 +2278,7 @@ PRIVATE void RHText_foundImage (HText * text, HTChildAnchor * anchor,
 		}
 		
 		if (SHOW_QUIET(mr)) HTPrint("Robot....... Checking Image `%s\'\n", uri);
-		if (HTLoadAnchor((HTAnchor *) dest, newreq) != YES) {
-		    if (SHOW_QUIET(mr)) HTPrint("Robot....... Image not tested!\n");
-		    Finger_delete(newfinger);
-		}
+		Robot_enqueue(mr, nhd, NO);
 	    } else {
 		if (SHOW_QUIET(mr)) HTPrint("............ does not fulfill constraints\n");
 #ifdef HT_MYSQL
@@ -1526,19 +2326,4 @@ PRIVATE void RHText_foundLink (HText * text,
     }
 }
 
-PUBLIC char * get_robots_txt(char * uri)
-{
-    char *str = NULL;
-    HTChunk * chunk;
-    HTParentAnchor *anchor = HTAnchor_parent(HTAnchor_findAddress(uri));
-    HTRequest *request = HTRequest_new();
-    HTRequest_setOutputFormat(request, WWW_SOURCE);
-    HTRequest_setPreemptive(request, YES);
-    HTRequest_setMethod(request, METHOD_GET);
-    chunk = HTLoadAnchorToChunk ((HTAnchor *)anchor, request);
-    str = HTChunk_toCString(chunk);
-    HTRequest_delete(request);
-    return str;
-}
-
 
@@ -0,0 +1,155 @@
+/*
+**	@(#) $Id$
+**
+**	W3C Webbot can be found at "http://www.w3.org/Robot/"
+**
+**	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	The seen set keeps a 64 bit fingerprint for each URL in an open
+**	addressed table with linear probing. The fingerprint is made of two
+**	independent 32 bit hashes of which the first also gives the place in
+**	the table. An empty slot is all zeros.
+*/
+
+#include "HTSeen.h"
+
+#define SEEN_SIZE	1024			  /* Must be a power of two */
+
+typedef struct _HTSeenSlot {
+    unsigned int	hash;
+    unsigned int	check;
+} HTSeenSlot;
+
+struct _HTSeen {
+    HTSeenSlot *	slots;
+    unsigned int	size;
+    long		count;
+};
+
+/* ------------------------------------------------------------------------- */
+
+/*
+**	FNV-1a with a final mix, like the anchor hash
+*/
+PRIVATE unsigned int seen_hash (const char * uri)
+{
+    unsigned int hash = 2166136261U;
+    while (*uri) {
+	hash ^= *(unsigned char *) uri++;
+	hash *= 16777619U;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+/*
+**	A second hash which doesn't depend on the first. It is never zero so
+**	that a used slot can't look empty.
+*/
+PRIVATE unsigned int seen_check (const char * uri)
+{
+    unsigned int check = 5381;
+    while (*uri)
+	check = check * 33 + *(unsigned char *) uri++;
+    check ^= check >> 15;
+    check *= 0x2c1b3c6dU;
+    check ^= check >> 12;
+    return check ? check : 1;
+}
+
+PRIVATE HTSeenSlot * seen_find (HTSeen * me, unsigned int hash,
+				unsigned int check)
+{
+    unsigned int mask = me->size - 1;
+    unsigned int pos = hash & mask;
+    HTSeenSlot * slot;
+    while ((slot = me->slots + pos)->check) {
+	if (slot->hash == hash && slot->check == check) break;
+	pos = (pos + 1) & mask;
+    }
+    return slot;
+}
+
+PRIVATE void seen_grow (HTSeen * me)
+{
+    HTSeenSlot * old = me->slots;
+    unsigned int old_size = me->size;
+    unsigned int pos;
+    me->size *= 2;
+    if ((me->slots = (HTSeenSlot *) HT_CALLOC(me->size, sizeof(HTSeenSlot))) == NULL)
+	HT_OUTOFMEM("seen_grow");
+    for (pos = 0; pos < old_size; pos++) {
+	if (old[pos].check)
+	    *seen_find(me, old[pos].hash, old[pos].check) = old[pos];
+    }
+    HT_FREE(old);
+    HTTRACE(APP_TRACE, "Seen........ Grown to %u slots for %ld URLs\n" _
+	    me->size _ me->count);
+}
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTSeen * HTSeen_new (int size)
+{
+    HTSeen * me;
+    if ((me = (HTSeen *) HT_CALLOC(1, sizeof(HTSeen))) == NULL)
+	HT_OUTOFMEM("HTSeen_new");
+    me->size = SEEN_SIZE;
+    while (size > 0 && me->size < (unsigned int) size / 3 * 4)
+	me->size *= 2;
+    if ((me->slots = (HTSeenSlot *) HT_CALLOC(me->size, sizeof(HTSeenSlot))) == NULL)
+	HT_OUTOFMEM("HTSeen_new");
+    return me;
+}
+
+PUBLIC BOOL HTSeen_delete (HTSeen * me)
+{
+    if (me) {
+	HT_FREE(me->slots);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTSeen_add (HTSeen * me, const char * uri)
+{
+    if (me && uri) {
+	unsigned int hash = seen_hash(uri);
+	unsigned int check = seen_check(uri);
+	HTSeenSlot * slot = seen_find(me, hash, check);
+	if (slot->check) return NO;
+	slot->hash = hash;
+	slot->check = check;
+	if (++me->count > (long) (me->size / 4 * 3)) seen_grow(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTSeen_find (HTSeen * me, const char * uri)
+{
+    if (me && uri)
+	return seen_find(me, seen_hash(uri), seen_check(uri))->check ? YES : NO;
+    return NO;
+}
+
+PUBLIC long HTSeen_count (HTSeen * me)
+{
+    return me ? me->count : 0;
+}
+
+PUBLIC long HTSeen_bytes (HTSeen * me)
+{
+    return me ? (long) (me->size * sizeof(HTSeenSlot) + sizeof(HTSeen)) : 0;
+}
@@ -24,7 +24,6 @@
 */
 
 #include "HTRobMan.h"
-#include "RobotTxt.h"
 
 #define SHOW_QUIET(mr)		((mr) && !((mr)->flags & MR_QUIET))
 #define SHOW_REAL_QUIET(mr)	((mr) && !((mr)->flags & MR_REAL_QUIET))
@@ -216,6 +215,18 @@ int main (int argc, char ** argv)
 		    atoi(argv[++arg]) : 0;
 		if (waits > 0) mr->waits = waits;
 
+	    /* Max number of requests in flight */
+	    } else if (!strcmp(argv[arg], "-inflight")) {
+		int inflight = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : DEFAULT_INFLIGHT;
+		if (inflight > 0) mr->inflight = inflight;
+
+	    /* Max number of requests in flight to the same host */
+	    } else if (!strcmp(argv[arg], "-hostinflight")) {
+		int inflight = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : DEFAULT_HOST_INFLIGHT;
+		if (inflight > 0) mr->host_inflight = inflight;
+
 	    /* Force no pipelined requests */
 	    } else if (!strcmp(argv[arg], "-nopipe")) {
 		HTTP_setConnectionMode(HTTP_11_NO_PIPELINING);
@@ -297,6 +308,34 @@ int main (int argc, char ** argv)
 	    } else if (!strcmp(argv[arg], "-bfs")) { 
 		mr->flags |= MR_BFS;
 
+	    /* forget about documents when we are done with them */
+	    } else if (!strcmp(argv[arg], "-release")) { 
+		mr->flags |= MR_RELEASE;
+
+	    /* checkpoint the crawl in a journal */
+	    } else if (!strcmp(argv[arg], "-journal")) {
+		mr->journalfile = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    argv[++arg] : DEFAULT_JOURNAL_FILE;
+
+	    /* secs between flushing the journal to disk */
+	    } else if (!strcmp(argv[arg], "-checkpoint")) {
+		int checkpoint = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : DEFAULT_CHECKPOINT;
+		if (checkpoint >= 0) mr->checkpoint = checkpoint;
+
+	    /* pick up the crawl where the journal left it */
+	    } else if (!strcmp(argv[arg], "-resume")) {
+		mr->flags |= MR_RESUME;
+
+	    /* don't parse documents we have seen before */
+	    } else if (!strcmp(argv[arg], "-dedup")) {
+		Robot_registerDedup(mr, (arg+1 < argc && isdigit((int) *argv[arg+1])) ?
+				    atoi(argv[++arg]) : DEFAULT_DEDUP_DISTANCE);
+
+	    /* don't look at robots.txt */
+	    } else if (!strcmp(argv[arg], "-norobotstxt")) {
+		mr->flags |= MR_NOROBOTSTXT;
+
 	    /* run in quiet mode */
 	    } else if (!strcmp(argv[arg], "-q")) { 
 		mr->flags |= MR_QUIET;
@@ -326,8 +365,6 @@ int main (int argc, char ** argv)
 		if (arg+1 < argc && *argv[arg+1] != '-') {
 		    mr->check = get_regtype(mr, argv[++arg], W3C_DEFAULT_REGEX_FLAGS);
 		}
-	    } else if (!strcmp(argv[arg], "-norobotstxt")) {
-	      mr->flags |= MR_NOROBOTSTXT;
 #endif
 
 #ifdef HT_MYSQL
@@ -428,6 +465,22 @@ int main (int argc, char ** argv)
 	VersionInfo();
 	Cleanup(mr, 0);
     }
+
+    /*
+    ** The distributions and the redirection log need all the anchors so
+    ** we can't release them. Otherwise the HyperDocs are found on the
+    ** anchors in the end and not in the list.
+    */
+    if (mr->flags & MR_RELEASE) {
+	if (mr->flags & (MR_DISTRIBUTIONS | MR_REDIR)) {
+	    if (SHOW_REAL_QUIET(mr))
+		HTPrint("Can't use -release with distributions or -redir\n");
+	    mr->flags &= ~MR_RELEASE;
+	} else {
+	    HTList_delete(mr->hyperdoc);
+	    mr->hyperdoc = HTList_new();
+	}
+    }
 #ifdef HT_SSL
     /* Set the SSL protocol method. By default, it is the highest
        available protocol. Setting it up to SSL_V23 allows the client
@@ -494,6 +547,10 @@ int main (int argc, char ** argv)
     if ((mr->cdepth = (int *) HT_CALLOC(mr->depth+2, sizeof(int)))==NULL)
 	HT_OUTOFMEM("main");
 
+    /* The documents we find are queued per host */
+    mr->frontier = HTFrontier_new(Robot_load, mr, mr->inflight,
+				  mr->host_inflight, mr->waits * MILLIES);
+
     /* Should we use persistent cache? */
     if (cache) {
 	HTCacheInit(cache_root, cache_size);
@@ -571,24 +628,10 @@ int main (int argc, char ** argv)
     /* Reject Log file specified? */
     if (mr->rejectfile) mr->reject = HTLog_open(mr->rejectfile, YES, YES);
 
-#ifdef HT_POSIX_REGEX
-    if(!(mr->flags & MR_NOROBOTSTXT))
-      {
-      char *ruri = HTParse(ROBOTS_TXT, mr->furl, PARSE_ALL);
-      char *robot_str = get_robots_txt(ruri);
-      char *reg_exp_robot = robot_str ? 
-	scan_robots_txt(robot_str,APP_NAME) : NULL;
-      if (SHOW_REAL_QUIET(mr)) HTPrint("robots.txt uri is `%s'\n", ruri);
-      if(robot_str)
-	  HT_FREE(robot_str);
-      if(reg_exp_robot)
-	{
-	  mr->exc_robot = get_regtype(mr, reg_exp_robot, W3C_DEFAULT_REGEX_FLAGS);
-	  HT_FREE(reg_exp_robot);
-	}
-      HT_FREE(ruri);
-    }
-#endif
+    /* Journal specified? Then queue what is left from the last run */
+    if ((mr->flags & MR_RESUME) && !mr->journalfile)
+	mr->journalfile = DEFAULT_JOURNAL_FILE;
+    if (mr->journalfile) Robot_openJournal(mr, HTAnchor_document(startAnchor));
 
     /* Add our own HTML HText functions */
     Robot_registerHTMLParser();
@@ -605,8 +648,10 @@ int main (int argc, char ** argv)
 
     mr->time = HTGetTimeInMillis();
 
-    /* Start the request */
+    /* Start the request and let the frontier know that the host is busy */
     finger = Finger_new(mr, startAnchor, METHOD_GET);
+    finger->host = Robot_host(mr, startAnchor);
+    HTFrontier_start(mr->frontier, finger->host);
 
     /*
     ** Make sure that the first request is flushed immediately and not
@@ -642,10 +687,12 @@ int main (int argc, char ** argv)
 
     /* Go into the event loop... */
 
-    if((mr->flags & MR_PREEMPTIVE) && (mr->flags & MR_BFS))
+    if (mr->flags & MR_PREEMPTIVE)
       Serving_queue(mr);
-    else
+    else {
+      Robot_loadRobotsTxt(mr);
       HTEventList_loop(finger->request);
+    }
 
 
     /* Only gets here if event loop fails */
@@ -1,8 +1,8 @@
 /*
 **	@(#) $Id$
-**	
+**
 **	W3C Webbot can be found at "http://www.w3.org/Robot/"
-**	
+**
 **	Copyright  1995-1998 World Wide Web Consortium, (Massachusetts
 **	Institute of Technology, Institut National de Recherche en
 **	Informatique et en Automatique, Keio University). All Rights
@@ -18,324 +18,379 @@
 **
 **  History:
 **	Oct 1998	Written
+**
+**	The rules are kept in a trie of path prefixes where each node has
+**	the children sorted by character so that a path is looked up in one
+**	walk down the trie. The deepest node on the way with a rule is the
+**	longest match. Rules with a wildcard inside them can't go in the
+**	trie so they are kept in a list and tried one by one.
 */
 
 #include "HTRobMan.h"
 #include "RobotTxt.h"
 
-PUBLIC UserAgent * new_user_agent (void)
-{
-    UserAgent * ua;
-    if ((ua = (UserAgent *) HT_CALLOC(1, sizeof(UserAgent))) == NULL)
-        HT_OUTOFMEM("new_user_agent");
-    ua->disallow = HTList_new();
-    return ua;
-}
-
-PUBLIC char * get_name_user_agent (UserAgent * ua)
+#define RULE_NONE	0
+#define RULE_ALLOW	1
+#define RULE_DISALLOW	2
+
+typedef struct _RuleNode {
+    unsigned char	ch;
+    unsigned char	rule;		/* Rule for paths starting here */
+    unsigned char	end;		/* Rule for paths ending here ($) */
+    unsigned short	count;			      /* Number of children */
+    struct _RuleNode *	children;		       /* Sorted by ch */
+} RuleNode;
+
+typedef struct _RuleWild {
+    char *		pattern;
+    int			length;
+    int			rule;
+} RuleWild;
+
+struct _RobotTxt {
+    RuleNode		root;
+    HTList *		wild;			  /* Rules with wildcards */
+    int			rules;
+    ms_t		delay;				     /* Crawl-delay */
+};
+
+/* ------------------------------------------------------------------------- */
+/*				  RULE TRIE				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE RuleNode * node_child (RuleNode * node, unsigned char ch)
 {
-    return ua ? ua->name : NULL;
+    int low = 0;
+    int high = node->count - 1;
+    while (low <= high) {
+	int mid = (low + high) / 2;
+	RuleNode * child = node->children + mid;
+	if (child->ch == ch) return child;
+	if (child->ch < ch)
+	    low = mid + 1;
+	else
+	    high = mid - 1;
+    }
+    return NULL;
 }
 
-PUBLIC HTList * get_disallow_user_agent (UserAgent * ua)
+PRIVATE RuleNode * node_add (RuleNode * node, unsigned char ch)
 {
-    return ua ? ua->disallow : NULL;
+    RuleNode * child;
+    int pos = 0;
+    if ((child = node_child(node, ch)) != NULL) return child;
+    while (pos < node->count && node->children[pos].ch < ch) pos++;
+    if ((node->children = (RuleNode *) HT_REALLOC(node->children,
+			   (node->count + 1) * sizeof(RuleNode))) == NULL)
+	HT_OUTOFMEM("node_add");
+    memmove(node->children + pos + 1, node->children + pos,
+	    (node->count - pos) * sizeof(RuleNode));
+    node->count++;
+    child = node->children + pos;
+    memset(child, 0, sizeof(RuleNode));
+    child->ch = ch;
+    return child;
 }
 
-PUBLIC BOOL set_name_user_agent (UserAgent * ua, char * name)
+PRIVATE void node_delete (RuleNode * node)
 {
-    if (ua && name) {
-	StrAllocCopy(ua->name, name);
-	return YES;
-    }
-    return NO;
+    int i;
+    for (i = 0; i < node->count; i++)
+	node_delete(node->children + i);
+    HT_FREE(node->children);
 }
 
-PUBLIC BOOL add_disallow_user_agent (UserAgent * ua, char * disallow)
+/*
+**  Allow wins over Disallow when both have the same path
+*/
+PRIVATE void set_rule (unsigned char * where, int rule)
 {
-    if (ua && disallow) {
-	char * da = NULL;
-	StrAllocCopy(da, disallow);
-
-	/* @@@ Should be an association list (HTAssocList) @@@ */
-	return HTList_addObject(ua->disallow, da);
-    }
-    return NO;
+    if (*where != RULE_ALLOW) *where = (unsigned char) rule;
 }
 
-PUBLIC BOOL delete_user_agent (UserAgent * ua)
+/*
+**  Match a pattern with '*' and a trailing '$' against the start of a path.
+**  When a character doesn't match we only go back to the last '*' and let
+**  it take one more character. The earlier stars never have to take more
+**  so this is at most the length of the pattern times that of the path -
+**  the robots.txt comes from the server and may well be written to make
+**  us spin.
+*/
+PRIVATE BOOL wild_match (const char * pattern, const char * path)
 {
-    if (ua) {
-	HT_FREE(ua->name);
-	if (ua->disallow) {
-	    HTList *cur = ua->disallow;
-	    char *pres;
-	    while ((pres = (char *) HTList_nextObject(cur)))
-		HT_FREE(pres);
-	    HTList_delete(ua->disallow);
+    const char * star = NULL;		      /* Pattern after the last '*' */
+    const char * retry = NULL;		   /* Where that '*' stopped taking */
+    while (1) {
+	if (*pattern == '*') {
+	    while (*pattern == '*') pattern++;
+	    if (!*pattern) return YES;
+	    star = pattern;
+	    retry = path;
+	    continue;
 	}
-	return YES;
+	if (!*pattern) return YES;
+	if (*pattern == '$' && !pattern[1]) {
+	    if (!*path) return YES;
+	} else if (*path && *pattern == *path) {
+	    pattern++;
+	    path++;
+	    continue;
+	}
+	if (!star || !*retry) return NO;
+	pattern = star;
+	path = ++retry;
     }
-    return NO;
 }
 
-PUBLIC BOOL delete_all_user_agents(HTList *user_agents)
+PRIVATE BOOL add_rule (RobotTxt * me, const char * path, int rule)
 {
-    if (user_agents) {
-	HTList *cur = user_agents;
-	UserAgent *pres;
-	while ((pres = (UserAgent *) HTList_nextObject(cur)))
-	    delete_user_agent(pres);
-	return HTList_delete(user_agents);
+    const char * star = strchr(path, '*');
+    int length = (int) strlen(path);
+    BOOL end = NO;
+
+    /* Trailing stars don't change anything */
+    while (length > 0 && path[length-1] == '*') length--;
+    if (length > 0 && path[length-1] == '$' && (!star || star >= path+length)) {
+	end = YES;
+	length--;
     }
-    return NO;
-}
-
-PUBLIC char * get_regular_expression (HTList * user_agents, char * name_robot)
-{
-    if (user_agents && name_robot) {
-	HTChunk *ch = HTChunk_new (1024);
-	HTList *cur = user_agents;
-	UserAgent *pres;
-	UserAgent *ua_gen=NULL;
-	int found=0;
-
-	while ((pres = (UserAgent *) HTList_nextObject(cur))) {
-	    char *name = get_name_user_agent(pres);
-
-	    if(!strcmp(name,"*"))
-		ua_gen = pres;
-
-	    if(!strcmp(name,name_robot)) {
-		put_string_disallow(ch,pres);
-		found = 1;
-	    }
-	}
-	if(!found && ua_gen) put_string_disallow(ch,ua_gen);
-
-	return (HTChunk_toCString (ch));
+    if (length == 0 && !end) return NO;
+
+    if (star && star < path + length) {
+	RuleWild * wild;
+	if ((wild = (RuleWild *) HT_CALLOC(1, sizeof(RuleWild))) == NULL)
+	    HT_OUTOFMEM("add_rule");
+	StrAllocCopy(wild->pattern, path);
+	wild->length = (int) strlen(path);
+	wild->rule = rule;
+	if (!me->wild) me->wild = HTList_new();
+	HTList_addObject(me->wild, wild);
+    } else {
+	RuleNode * node = &me->root;
+	int i;
+	for (i = 0; i < length; i++)
+	    node = node_add(node, (unsigned char) path[i]);
+	set_rule(end ? &node->end : &node->rule, rule);
     }
-    return NULL;
+    me->rules++;
+    return YES;
 }
 
-PUBLIC BOOL put_string_disallow (HTChunk * ch, UserAgent * ua)
+/* ------------------------------------------------------------------------- */
+/*				    PARSER				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  Find the next line, cut off comments and white space and split it into
+**  field and value. Returns the start of the line after or NULL at the end.
+*/
+PRIVATE char * next_line (char * ptr, char ** field, char ** value)
 {
-    if (ch && ua) {
-	HTList *cur = get_disallow_user_agent(ua);
-	char *pres;
-	int first = 1;
-  
-	while ((pres = (char *) HTList_nextObject(cur))) {
-	    if(!first)
-		HTChunk_puts (ch,"|");
-	    else
-		first = 0;
-	    HTChunk_puts (ch,pres);
-	}
-	return YES;
+    char * end;
+    char * colon;
+    *field = *value = NULL;
+    if (!ptr || !*ptr) return NULL;
+    end = ptr;
+    while (*end && *end != '\n' && *end != '\r') end++;
+    if (*end) *end++ = '\0';
+    if ((colon = strchr(ptr, '#')) != NULL) *colon = '\0';
+    if ((colon = strchr(ptr, ':')) != NULL) {
+	*colon++ = '\0';
+	*field = HTStrip(ptr);
+	*value = HTStrip(colon);
     }
-    return NO;
+    return end;
 }
 
-PUBLIC void print_user_agent(UserAgent *ua)
+/*
+**  The name in a User-agent line matches ours if it is the same, not
+**  counting case and a version number like "W3CRobot/5.4"
+*/
+PRIVATE BOOL agent_match (char * name, const char * agent)
 {
-  HTList *cur = ua->disallow;
-  char *pres;
-  HTTRACE(APP_TRACE, "User Agent : %s \n" _ ua->name);
-  while ((pres = (char*) HTList_nextObject(cur)))
-      HTTRACE(APP_TRACE, "Disallow : %s \n" _ pres);
+    char * ptr = name;
+    while (*ptr && *ptr != '/' && !isspace((int) *ptr)) ptr++;
+    *ptr = '\0';
+    return (agent && *name && !strcasecomp(name, agent));
 }
 
-PUBLIC void print_all_user_agents(HTList * user_agents)
+PUBLIC RobotTxt * RobotTxt_new (void)
 {
-    HTList *cur = user_agents;
-    UserAgent *pres;
-    while ((pres = (UserAgent *) HTList_nextObject(cur)))
-    {
-	HTTRACE(APP_TRACE, "\nNew User Agent\n");
-	print_user_agent(pres);
-    }
+    RobotTxt * me;
+    if ((me = (RobotTxt *) HT_CALLOC(1, sizeof(RobotTxt))) == NULL)
+	HT_OUTOFMEM("RobotTxt_new");
+    return me;
 }
 
-PUBLIC HTList * get_all_user_agents(char * rob_str)
+PUBLIC BOOL RobotTxt_delete (RobotTxt * me)
 {
-    if (rob_str) {
-	char * ptr = rob_str;
-	HTList * user_agents = HTList_new();
-
-	/* skip blank spaces */
-	while(isspace((int)*ptr))
-	    ptr++;
-
-	/* skip comments */
-	ptr = skip_comments(ptr);
-
-	if(!get_user_agents(ptr,user_agents))
-	    HTTRACE(APP_TRACE, "Something is wrong in robots.txt\n");
-
-	return user_agents;
+    if (me) {
+	if (me->wild) {
+	    HTList * cur = me->wild;
+	    RuleWild * pres;
+	    while ((pres = (RuleWild *) HTList_nextObject(cur))) {
+		HT_FREE(pres->pattern);
+		HT_FREE(pres);
+	    }
+	    HTList_delete(me->wild);
+	}
+	node_delete(&me->root);
+	HT_FREE(me);
+	return YES;
     }
-    return NULL;
+    return NO;
 }
 
-PUBLIC char * skip_comments(char *ptr)
+/*
+**  A group is one or more User-agent lines followed by the rules for
+**  them. We compile the groups for our own name and those for "*" at the
+**  same time and keep the first unless there aren't any.
+*/
+PUBLIC RobotTxt * RobotTxt_parse (const char * str, const char * agent)
 {
-    if (ptr && *ptr == '#') {
-	do {
-	    while(*ptr != '\n')
-		ptr++;
-	    while(isspace((int)*ptr))
-		ptr++;
-	} while (*ptr == '#');
+    RobotTxt * mine = NULL;
+    RobotTxt * any = NULL;
+    if (str) {
+	char * text = NULL;
+	char * ptr;
+	char * field;
+	char * value;
+	BOOL in_agents = NO;
+	BOOL for_mine = NO;
+	BOOL for_any = NO;
+	any = RobotTxt_new();
+	StrAllocCopy(text, str);
+	ptr = text;
+	while ((ptr = next_line(ptr, &field, &value)) != NULL) {
+	    if (!field) continue;
+	    if (!strcasecomp(field, "user-agent")) {
+		if (!in_agents) for_mine = for_any = NO;
+		in_agents = YES;
+		if (!strcmp(value, "*"))
+		    for_any = YES;
+		else if (agent_match(value, agent)) {
+		    for_mine = YES;
+		    if (!mine) mine = RobotTxt_new();
+		}
+		continue;
+	    }
+	    in_agents = NO;
+	    if (!strcasecomp(field, "allow") || !strcasecomp(field, "disallow")) {
+		int rule = tolower((int) *field) == 'a' ? RULE_ALLOW : RULE_DISALLOW;
+		if (for_mine) add_rule(mine, value, rule);
+		if (for_any) add_rule(any, value, rule);
+	    } else if (!strcasecomp(field, "crawl-delay")) {
+		double secs = atof(value);
+		ms_t delay = secs > 0 ? (ms_t) (secs * MILLIES) : 0;
+		if (for_mine) mine->delay = delay;
+		if (for_any) any->delay = delay;
+	    }
+	}
+	HT_FREE(text);
     }
-    return ptr;
-}
-
-PUBLIC void scan_name_until_eoline(char *robot_str, char *name)
-{
-  char *ptr = robot_str;
-  char *ntr = name;
-  while(*ptr != '\n' && *ptr != '#')
-    {
-      *ntr = *ptr;
-      ntr++; ptr++;
-      if(*ptr == '\0')
-	break;
+    if (mine) {
+	RobotTxt_delete(any);
+	any = mine;
     }
-  *ntr = '\0';
+    HTTRACE(APP_TRACE, "Robots.txt.. %d rule(s) for %s, crawl delay %lu ms\n" _
+	    any ? any->rules : 0 _ mine ? agent : "*" _ any ? any->delay : 0);
+    return any;
 }
 
-PUBLIC void scan_name_until_space(char *robot_str, char *name)
+/*
+**  Walk down the trie as far as the path goes. The deepest rule wins, and
+**  a wildcard rule wins if its pattern is longer than that.
+*/
+PUBLIC BOOL RobotTxt_allowed (RobotTxt * me, const char * path)
 {
-  char *ptr = robot_str;
-  char *ntr = name;
-  while(!isspace((int)*ptr) && *ptr != '#')
-    {
-      *ntr = *ptr;
-      ntr++; ptr++;
-      if(*ptr == '\0')
-	break;
+    if (me && path && me->rules > 0) {
+	RuleNode * node = &me->root;
+	const char * ptr = path;
+	int rule = RULE_NONE;
+	int length = 0;
+	for (; *ptr; ptr++) {
+	    if ((node = node_child(node, (unsigned char) *ptr)) == NULL) break;
+	    if (node->rule) {
+		rule = node->rule;
+		length = (int) (ptr - path) + 1;
+	    }
+	}
+	if (node && !*ptr && node->end) {
+	    rule = node->end;
+	    length = (int) (ptr - path) + 1;
+	}
+	if (me->wild) {
+	    HTList * cur = me->wild;
+	    RuleWild * pres;
+	    while ((pres = (RuleWild *) HTList_nextObject(cur))) {
+		if ((pres->length > length ||
+		     (pres->length == length && pres->rule == RULE_ALLOW)) &&
+		    wild_match(pres->pattern, path)) {
+		    rule = pres->rule;
+		    length = pres->length;
+		}
+	    }
+	}
+	return (rule != RULE_DISALLOW);
     }
-  *ntr = '\0';
+    return YES;
 }
 
-PUBLIC BOOL get_user_agents(char * ptr, HTList *user_agents)
+PUBLIC ms_t RobotTxt_delay (RobotTxt * me)
 {
-  char *uastr = "user-agent:";
-  char *disstr = "disallow:";
-  int luastr = 10;
-  int ldisstr = 9;
-  char name[2000];
-  int indices[200];
-  int i = 0;
-  if (ptr && !strncasecomp(ptr,uastr,luastr)) {
-      UserAgent *ua = NULL;
-      do {
-	i=0;
-	do {
-	  ua = new_user_agent();
-	  HTList_appendObject(user_agents,(void *)ua);
-	  indices[i++] = HTList_indexOf(user_agents, (void *)ua);
-	  ptr += luastr + 1;
-	  while(isspace((int)*ptr))
-	    ptr++;
-	  scan_name_until_eoline(ptr,name); 
-	  ptr += strlen(name) + 1;
-	  while(isspace((int)*ptr))
-	    ptr++;
-	  ptr = skip_comments(ptr);
-	  set_name_user_agent(ua,name);
-	} while(!strncasecomp(ptr,uastr,luastr));
-
-	if(!strncasecomp(ptr, disstr,ldisstr))
-	  {
-	    do {
-	      ptr += ldisstr + 1;
-	      scan_name_until_space(ptr,name); 
-	      ptr += strlen(name) + 1;
-	      while(isspace((int)*ptr))
-		ptr++;
-	      ptr = skip_comments(ptr);
-	      if(i==1)
-		add_disallow_user_agent(ua,name);
-	      else
-		{
-		  int j;
-		  for(j = 0 ; j < i ; j++)
-		    {
-		      ua = HTList_objectAt(user_agents, indices[j]);
-		      add_disallow_user_agent(ua,name);
-		    }
-		}
-	    } while(!strncasecomp(ptr,disstr,ldisstr));
-	  }
-	else
-	  return NO;
-
-      } while(!strncasecomp(ptr,uastr,luastr));
-      return YES;
-    }
-  else
-    return NO;
+    return me ? me->delay : 0;
 }
 
-PUBLIC char * scan_robots_txt(char *rob_str, char *name_robot)
+PUBLIC int RobotTxt_rules (RobotTxt * me)
 {
-  char *reg_exp_exclude = NULL;
-  HTList * user_agents = get_all_user_agents(rob_str);
-  /*print_all_user_agents(user_agents);*/
-
-  reg_exp_exclude = get_regular_expression(user_agents, name_robot);
-  delete_all_user_agents(user_agents);
-
-  return reg_exp_exclude;
+    return me ? me->rules : 0;
 }
 
 #ifdef ROBOTS_TXT_STANDALONE
 
-int 
+/*
+**  robottxt robots.txt agent path ...
+*/
+int
 main(int argc, char *argv[])
 {
   char *text;
-  char *reg_exp;
   char *filename= argc > 1 ? argv[1] : "robots.txt";
   FILE *fp;
   struct stat statb;
+  RobotTxt *rules;
+  int arg;
   /* make sure the file is a regular text file and open it */
   if(stat(filename, &statb) == -1 ||
      (statb.st_mode & S_IFMT ) != S_IFREG ||
-     !(fp = fopen(filename, "r"))) 
+     !(fp = fopen(filename, "r")))
     {
       if((statb.st_mode & S_IFMT) == S_IFREG)
 	perror(filename);
       else
-	HTTRACE(ALL_TRACE, "%s : not a regular file \n" _ filename);
+	HTPrint("%s : not a regular file \n", filename);
       return 1;
     }
 
   if(!(text = malloc((unsigned)(statb.st_size +1))))
     {
-      HTTRACE(ALL_TRACE, "Can't alloc enough space for %s" _ filename);
+      HTPrint("Can't alloc enough space for %s", filename);
       fclose(fp);
-      return;
+      return 1;
     }
-  if(!fread(text,sizeof(char), statb.st_size + 1, fp))
-    HTTRACE(APP_TRACE, "Warning: may not have read entire file!\n");
+  if(!fread(text,sizeof(char), statb.st_size, fp))
+    HTPrint("Warning: may not have read entire file!\n");
   text[statb.st_size] = 0; /* be sure to NULL-terminate */
   fclose(fp);
-  if(argc > 2)
-    {
-      reg_exp = scan_robots_txt(text,argv[2]);
-      if(reg_exp)
-	{
-	  HTTRACE(ALL_TRACE, "REG EXP : %s \n" _ reg_exp);
-	  free(reg_exp);
-	}
-    }
+  rules = RobotTxt_parse(text, argc > 2 ? argv[2] : APP_NAME);
+  HTPrint("%d rule(s), crawl delay %lu ms\n", RobotTxt_rules(rules),
+	  RobotTxt_delay(rules));
+  for (arg = 3; arg < argc; arg++)
+    HTPrint("%s %s\n", RobotTxt_allowed(rules, argv[arg]) ? "allow   " : "disallow", argv[arg]);
+  RobotTxt_delete(rules);
   free(text);
 
   return 0;
 }
 
-
 #endif